@@ -1,12 +1,212 @@
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include <WebServer.h>
 #include <DNSServer.h>
+#include <Wire.h>
+#include <Preferences.h>
 #include <vector>
+#include <queue>
+#include <deque>
 #include <FS.h>
 #include <SPIFFS.h>
 #include <ArduinoJson.h>
-#include <time.h> // Für struct tm, mktime, localtime
+#include <time.h> // time_t
 #include <esp_task_wdt.h>
+#include <driver/pcnt.h>
+#include <driver/adc.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <atomic>
+#include <stdarg.h>
+
+/* --------------------------------------------------------------------------
+   Protokoll
+   --------------------------------------------------------------------------
+   LOG_E/LOG_W/LOG_I/LOG_D("Format %d", x) schreiben printf-artig in einen
+   festen Ringpuffer, ohne Heap und ohne zu warten: ein Platz wird per
+   compare-and-swap reserviert, der Text mit logFormat() direkt
+   hineingeschrieben (auch aus anderen Tasks). loop() gibt die Einträge
+   nur so weit auf die serielle Schnittstelle aus, wie der UART-Puffer
+   ohne Blockieren aufnimmt; /api/log liefert die letzten Einträge. Ist
+   der Puffer voll, weil die Ausgabe nicht nachkommt, wird die neue
+   Meldung verworfen und gezählt. Stufen oberhalb von LOG_LEVEL werden
+   schon beim Übersetzen entfernt (z.B. -DLOG_LEVEL=3 für LOG_D).
+   -------------------------------------------------------------------------- */
+#define LOG_LVL_ERROR 0
+#define LOG_LVL_WARN  1
+#define LOG_LVL_INFO  2
+#define LOG_LVL_DEBUG 3
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LVL_INFO
+#endif
+
+const int LOG_ENTRIES  = 64;  // Zweierpotenz
+const int LOG_TEXT_MAX = 100;
+
+struct LogEntry {
+  std::atomic<uint32_t> seq; // Nummer + 1, 0 = wird geschrieben
+  uint32_t ms;
+  uint8_t level;
+  char text[LOG_TEXT_MAX];
+};
+LogEntry logRing[LOG_ENTRIES];
+std::atomic<uint32_t> logHead(0);     // nächste Nummer
+std::atomic<uint32_t> logUartPos(0);  // nächste auf UART auszugebende Nummer
+std::atomic<uint32_t> logDropped(0);  // verworfen, Puffer voll
+std::atomic<uint32_t> logTruncated(0);// gekürzt, Text zu lang
+static const char LOG_LEVEL_CHARS[] = "EWID";
+
+// Minimales vsnprintf ohne Heap: %d %i %u %x %X %c %s %f %% mit Flags
+// '-' '0', Breite, Genauigkeit und 'l'. Liefert false, wenn gekürzt wurde.
+bool logFormat(char *out, size_t cap, const char *fmt, va_list ap) {
+  size_t n = 0;
+  bool fits = true;
+  auto put = [&](char c){
+    if(n+1<cap) out[n++] = c;
+    else fits = false;
+  };
+  while(*fmt){
+    char c = *fmt++;
+    if(c!='%'){ put(c); continue; }
+    bool left = false, zero = false;
+    while(*fmt=='-' || *fmt=='0'){
+      if(*fmt=='-') left = true; else zero = true;
+      fmt++;
+    }
+    int width = 0, prec = -1;
+    while(isdigit((unsigned char)*fmt)) width = width*10 + (*fmt++ - '0');
+    if(*fmt=='.'){
+      fmt++;
+      prec = 0;
+      while(isdigit((unsigned char)*fmt)) prec = prec*10 + (*fmt++ - '0');
+    }
+    bool isLong = false;
+    while(*fmt=='l'){ isLong = true; fmt++; }
+
+    char num[24];
+    const char *s = num;
+    int len = 0;
+    bool neg = false;
+    char conv = *fmt ? *fmt++ : 0;
+    switch(conv){
+      case 'd': case 'i': {
+        long v = isLong ? va_arg(ap, long) : va_arg(ap, int);
+        unsigned long u = v<0 ? 0UL-(unsigned long)v : (unsigned long)v;
+        neg = v<0;
+        do { num[sizeof(num)-1-len++] = '0' + u%10; u /= 10; } while(u);
+        s = num + sizeof(num) - len;
+        break;
+      }
+      case 'u': case 'x': case 'X': {
+        unsigned long u = isLong ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+        unsigned base = conv=='u' ? 10 : 16;
+        const char *digits = conv=='X' ? "0123456789ABCDEF" : "0123456789abcdef";
+        do { num[sizeof(num)-1-len++] = digits[u%base]; u /= base; } while(u);
+        s = num + sizeof(num) - len;
+        break;
+      }
+      case 'f': {
+        double v = va_arg(ap, double);
+        if(prec<0 || prec>6) prec = 6;
+        neg = v<0;
+        if(neg) v = -v;
+        double scale = 1;
+        for(int i=0; i<prec; i++) scale *= 10;
+        if(v*scale>4e18){ s = "ovf"; len = 3; break; }
+        uint64_t fixed = (uint64_t)(v*scale + 0.5);
+        for(int digits=0; fixed || digits<=prec; digits++){
+          if(digits==prec && prec>0) num[sizeof(num)-1-len++] = '.';
+          num[sizeof(num)-1-len++] = '0' + fixed%10;
+          fixed /= 10;
+        }
+        s = num + sizeof(num) - len;
+        break;
+      }
+      case 'c':
+        num[0] = (char)va_arg(ap, int);
+        len = 1;
+        break;
+      case 's':
+        s = va_arg(ap, const char*);
+        if(!s) s = "(null)";
+        len = strlen(s);
+        if(prec>=0 && len>prec) len = prec;
+        break;
+      case '%':
+        num[0] = '%';
+        len = 1;
+        break;
+      default:
+        continue;
+    }
+    int pad = width - len - (neg ? 1 : 0);
+    if(!left && !zero) while(pad-->0) put(' ');
+    if(neg) put('-');
+    if(!left && zero) while(pad-->0) put('0');
+    for(int i=0; i<len; i++) put(s[i]);
+    if(left) while(pad-->0) put(' ');
+  }
+  out[n] = 0;
+  return fits;
+}
+
+void logWrite(uint8_t level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void logWrite(uint8_t level, const char *fmt, ...) {
+  uint32_t head = logHead.load(std::memory_order_relaxed);
+  do {
+    if(head - logUartPos.load(std::memory_order_acquire) >= (uint32_t)LOG_ENTRIES){
+      logDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  } while(!logHead.compare_exchange_weak(head, head+1, std::memory_order_acq_rel));
+
+  LogEntry &e = logRing[head % LOG_ENTRIES];
+  e.seq.store(0, std::memory_order_relaxed);
+  e.ms = millis();
+  e.level = level;
+  va_list ap;
+  va_start(ap, fmt);
+  if(!logFormat(e.text, sizeof(e.text), fmt, ap)) logTruncated.fetch_add(1, std::memory_order_relaxed);
+  va_end(ap);
+  e.seq.store(head+1, std::memory_order_release);
+}
+
+#define LOG_E(...) logWrite(LOG_LVL_ERROR, __VA_ARGS__)
+#if LOG_LEVEL >= LOG_LVL_WARN
+#define LOG_W(...) logWrite(LOG_LVL_WARN, __VA_ARGS__)
+#else
+#define LOG_W(...) do{}while(0)
+#endif
+#if LOG_LEVEL >= LOG_LVL_INFO
+#define LOG_I(...) logWrite(LOG_LVL_INFO, __VA_ARGS__)
+#else
+#define LOG_I(...) do{}while(0)
+#endif
+#if LOG_LEVEL >= LOG_LVL_DEBUG
+#define LOG_D(...) logWrite(LOG_LVL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_D(...) do{}while(0)
+#endif
+
+// Fertige Einträge ausgeben, solange der UART-Puffer sie ohne Warten nimmt
+// (aus loop())
+void logDrain() {
+  uint32_t pos = logUartPos.load(std::memory_order_relaxed);
+  for(int budget=8; budget>0 && pos!=logHead.load(std::memory_order_acquire); budget--){
+    LogEntry &e = logRing[pos % LOG_ENTRIES];
+    if(e.seq.load(std::memory_order_acquire)!=pos+1) break; // wird noch geschrieben
+    char prefix[16];
+    int plen = snprintf(prefix, sizeof(prefix), "%lu %c ", (unsigned long)e.ms,
+                        LOG_LEVEL_CHARS[e.level & 3]);
+    size_t tlen = strlen(e.text);
+    if((size_t)Serial.availableForWrite() < plen + tlen + 2) break;
+    Serial.write((const uint8_t*)prefix, plen);
+    Serial.write((const uint8_t*)e.text, tlen);
+    Serial.write((const uint8_t*)"\r\n", 2);
+    pos++;
+    logUartPos.store(pos, std::memory_order_release);
+  }
+}
 
 /* --------------------------------------------------------------------------
    Wi-Fi Einstellungen
@@ -31,10 +231,33 @@ const int pump3  = 17;
 const int pump4  = 5;
 
 /* --------------------------------------------------------------------------
-   Tank-Pins
+   Vorratsbehälter
+   --------------------------------------------------------------------------
+   Jede Pumpe fördert aus einem Behälter (pumpReservoir). Jede Dosierung
+   zieht ihre Menge vom Stand dieses Behälters ab. Ein Programm, das einen
+   Behälter unter seine Reserve ziehen würde, wird nicht gestartet.
    -------------------------------------------------------------------------- */
-// Neuer globaler Wert für deinen Tank (ml)
-float currentTankLevel = 0.0f;
+#define MAX_RESERVOIRS 8
+
+struct Reservoir {
+  String name;
+  float capacity; // ml, 0 = unbekannt
+  float level;    // ml
+  float reserve;  // ml, Mindestinhalt (0 = keine Sperre)
+};
+std::vector<Reservoir> reservoirs = {{"Tank", 0.0f, 0.0f, 0.0f}};
+int pumpReservoir[4] = {0, 0, 0, 0};
+
+// Füllstandssensor mit Analogausgang an ADC1 (-1 = keiner, Stand manuell)
+int tankSensorPin = -1; // z.B. 34
+int tankSensorReservoir = 0; // Behälter, in dem der Sensor sitzt
+
+// Geometrietabelle: Sensor-Rohwert -> Inhalt in ml, aufsteigend nach Rohwert
+struct TankGeometryPoint {
+  uint16_t raw;
+  float ml;
+};
+std::vector<TankGeometryPoint> tankGeometry;
 
 
 /* --------------------------------------------------------------------------
@@ -42,65 +265,742 @@ float currentTankLevel = 0.0f;
    -------------------------------------------------------------------------- */
 bool pumpStatus[4]    = {false, false, false, false};
 float pumpFlowRate[4] = {0,0,0,0}; // ml/s
-unsigned long calibrationStartTime[4] = {0,0,0,0};
-bool calibrationRunning[4] = {false, false, false, false};
+volatile bool calibrationRunning[4] = {false, false, false, false};
+// Taster für Start/Stopp der Kalibrierung ohne WLAN (-1 = keiner, gegen GND)
+int calButtonPin = -1;
+volatile int calButtonPump = 0;
+uint32_t calibrationStartPulses[4] = {0,0,0,0};
+
+// Optionale Durchflusssensoren (Pin -1 = keiner)
+int   flowSensorPin[4]   = {-1,-1,-1,-1}; // z.B. 18, 19, 21, 22
+float flowPulsesPerMl[4] = {0,0,0,0};
+bool  flowSensorFault[4] = {false,false,false,false};
+
+bool flowSensorUsable(int i) {
+  return flowSensorPin[i]>=0 && flowPulsesPerMl[i]>0 && !flowSensorFault[i];
+}
+
+// Optionale Stromsensoren an ADC1 (Pin -1 = keiner) und die gelernte
+// Stromsignatur eines gesunden Laufs, siehe "Motorstrom-Überwachung"
+int currentSensePin[4] = {-1,-1,-1,-1}; // z.B. 32, 33, 35, 39
+struct CurrentBaseline {
+  float mean;      // Dauerstrom (ADC-Rohwert)
+  float sd;        // Streuung der Blockmittel
+  float inrush;    // Anlaufspitze
+  uint16_t runs;   // gelernte Läufe
+};
+CurrentBaseline currentBase[4] = {};
+
+// Wartungsgrenzen je Pumpe seit der letzten Wartung (0 = keine), siehe
+// "Pumpenzähler"
+struct PumpMaintenance {
+  float hours;     // Laufzeit
+  float ml;        // kalibrierte Menge
+};
+PumpMaintenance pumpMaint[4] = {};
+
+// Laufende Dosierung je Pumpe
+struct PumpRun {
+  bool active;
+  bool closedLoop;        // Abschaltung nach gezählter Menge
+  float targetMl;
+  uint32_t startPulses;
+  uint32_t targetPulses;
+  unsigned long startMs;
+  unsigned long durationMs; // Zeitmodus: Laufzeit, sonst Sicherheitsgrenze
+  unsigned long journalMs;  // letzter Fortschrittseintrag im Dosierjournal
+};
+
+PumpRun pumpRun[4] = {};
+bool doseResume = false; // nach Stromausfall offene Dosierung fortsetzen
+bool traceEnabled = false; // Eingabemitschnitt (siehe dort)
 
 /* --------------------------------------------------------------------------
    Programmdatenstruktur
    --------------------------------------------------------------------------
-   Jeder Eintrag kann mehrere Pumpen gleichzeitig steuern.
+   Jeder Eintrag kann mehrere Pumpen steuern, jede mit eigener Menge,
+   gleichzeitig oder nacheinander.
    -------------------------------------------------------------------------- */
+enum ProgramMode : uint8_t {
+  PROG_PARALLEL   = 0, // alle Pumpen zugleich (kürzeste Gesamtdauer)
+  PROG_SEQUENTIAL = 1  // eine Pumpe nach der anderen, mit Pause dazwischen
+};
+
+// Vorberechneter Zeitplan (siehe compileSchedule)
+struct ProgramSchedule {
+  uint64_t minutes;  // Bit 0..59
+  uint32_t hours;    // Bit 0..23
+  uint32_t mdays;    // Bit 1..31
+  uint16_t months;   // Bit 1..12
+  uint8_t  wdays;    // Bit 0 = So ... Bit 6 = Sa
+  bool domOrDow;     // Tag und Wochentag beide eingeschränkt: einer genügt
+  bool valid;
+};
+
 struct Program {
   String days;       
   int interval;      
   String time;       
-  int amount;        
+  String cron;       // Cron-Ausdruck; leer = days/time/interval
+  time_t anchor;     // Bezugswoche für interval bei Cron-Ausdrücken
+  int amounts[4];    // Menge je Pumpe in ml
+  uint8_t mode;      // ProgramMode
+  uint16_t gapSec;   // Pause zwischen zwei Pumpen (nacheinander)
   bool active;
   bool pumps[4];     // beibehalten
   time_t lastRun;
+
+  // Replikation: stabile ID und Lamport-Stempel der letzten Änderung
+  uint32_t id;
+  uint32_t version;
+  uint32_t origin;   // Knoten-ID, die die letzte Änderung vorgenommen hat
+
+  ProgramSchedule sched;
+};
+
+
+/* ---- Programmspeicher ----
+   Die Programme liegen nicht im Heap, sondern als Einträge fester Größe
+   in der Flash-Partition "programs" (siehe partitions.csv), die über den
+   Flash-Cache eingeblendet ist. Im RAM bleiben je Programm nur Slot,
+   Minutenschlüssel sowie Pumpen- und Wochentagsmaske für die gefilterte
+   Liste (6 Bytes) und wenige zuletzt gelesene Programme.
+   Umsetzung im Abschnitt "Programmspeicher". */
+struct ProgramRecord {
+  uint32_t state;      // PSTORE_FREE, PSTORE_LIVE oder PSTORE_DEAD
+  uint32_t crc;        // über alles ab seq
+  uint32_t seq;        // Schreibfolge: von zwei gültigen Kopien gilt die neuere
+  uint32_t order;      // Listenposition (aufsteigend)
+  uint32_t id, version, origin;
+  int32_t  lastRun, anchor;
+  int32_t  amounts[4];
+  uint16_t gapSec;
+  uint8_t  mode, interval, active, pumps; // pumps als Bitmaske
+  uint8_t  wdays;      // days als Bitmaske (Bit 0 = So)
+  uint8_t  hour, minute; // time; hour 0xFF = keine
+  char     cron[65];
+  uint8_t  reserved[2];
+};
+static_assert(sizeof(ProgramRecord)==128, "ProgramRecord muss 128 Bytes groß sein");
+
+class ProgramStore {
+public:
+  bool begin();
+  size_t size() const { return entries.size(); }
+  size_t capacity() const;
+  // Dekodiertes Programm (über den Zwischenspeicher)
+  Program get(size_t i);
+  // Rohdaten direkt aus dem Flash, ohne Kopie
+  const ProgramRecord &record(size_t i) const { return base[entries[i].slot]; }
+  // Alle Programme der Reihe nach, mit einem wiederverwendeten Objekt
+  template<typename F> void forEach(F fn) {
+    Program p;
+    for(size_t i=0; i<entries.size(); i++){
+      decode(base[entries[i].slot], p);
+      fn(i, (const Program&)p);
+    }
+  }
+  // Kann Programm i zur lokalen Minute (0..1439) fällig sein?
+  bool mayFireAt(size_t i, int minuteOfDay) const {
+    uint16_t k = entries[i].minute;
+    return k==minuteOfDay || k==KEY_ANY;
+  }
+  // Filter der Programmliste nur über den Index (-1 = egal)
+  bool indexMatches(size_t i, int pump, int wday, int active) const {
+    const Entry &e = entries[i];
+    if(pump>=0 && !((e.pumps>>pump) & 1)) return false;
+    if(wday>=0 && !((e.wdays>>wday) & 1)) return false;
+    return active<0 || ((e.pumps & ENTRY_ACTIVE)!=0)==(active!=0);
+  }
+  bool append(const Program &p);
+  bool update(size_t i, const Program &p);
+  bool setLastRun(size_t i, time_t t);
+  void erase(size_t i);
+  void eraseFirst(size_t n);
+  void clear();
+
+  size_t freeSlots() const { return freeCount; }
+  size_t indexBytes() const;
+  // Zählt jede Änderung (Schreiben, Löschen, Öffnen), für abgeleitete Caches
+  uint32_t changes() const { return changeCount; }
+  uint32_t openMs = 0;
+
+private:
+  static const uint16_t KEY_ANY   = 0xFFFF; // mehrere Zeitpunkte am Tag
+  static const uint16_t KEY_NEVER = 0xFFFE; // inaktiv oder ohne Zeitplan
+  static const int CACHE_LINES = 8;
+  static const uint8_t ENTRY_ACTIVE = 0x80;
+
+  struct Entry {
+    uint16_t slot;
+    uint16_t minute;   // Lokalminute des Tages, KEY_ANY oder KEY_NEVER
+    uint8_t  pumps;    // Bit 0..3 Pumpen, ENTRY_ACTIVE
+    uint8_t  wdays;    // Bit 0 = So; bei Cron aus dem Wochentagsfeld
+  };
+  struct CacheLine {
+    uint16_t slot;     // 0xFFFF = leer
+    uint32_t used;
+    Program prog;
+  };
+
+  const esp_partition_t *part = nullptr;
+  const ProgramRecord *base = nullptr;
+  uint16_t slots = 0;
+  int spare = -1;      // gelöschter Reservesektor für das Aufräumen
+  uint16_t head = 0;   // nächster zu prüfender Slot
+  size_t freeCount = 0;
+  uint32_t maxSeq = 0, maxOrder = 0;
+  uint32_t changeCount = 0;
+  std::vector<Entry> entries;
+  CacheLine cache[CACHE_LINES];
+  uint32_t cacheClock = 0;
+
+  static uint32_t recordCrc(const ProgramRecord &r);
+  static void encode(const Program &p, ProgramRecord &r);
+  static void decode(const ProgramRecord &r, Program &p);
+  static Entry makeEntry(uint16_t slot, const ProgramRecord &r);
+  bool writeRecord(uint16_t slot, ProgramRecord &r);
+  void kill(uint16_t slot);
+  void forget(uint16_t slot);
+  void countFree();
+  int allocSlot();
+  bool collect();
+};
+
+ProgramStore programs;
+
+// Rezept: feste Schrittfolge (siehe compileRecipe), von Hand oder per
+// Cron-Ausdruck gestartet
+#define MAX_RECIPES 12
+#define RECIPE_MAX_TEXT 200
+
+struct Recipe {
+  uint16_t id;       // stabil, auch im Dosierjournal
+  String name;
+  String steps;      // Quelltext der Schritte
+  String cron;       // leer = nur von Hand
+  bool active;
+  time_t lastRun;
+  ProgramSchedule sched;
+};
+
+std::vector<Recipe> recipes;
+
+// Sensoreingänge und Auslöser, die ein Programm bei einem Schwellwert statt
+// zu einer Uhrzeit starten (siehe "Sensor-Auslöser")
+#define MAX_SENSORS  4
+#define MAX_TRIGGERS 32
+
+enum SensorKind : uint8_t {
+  SENSOR_ADC = 0, // Analogausgang an ADC1, pin = GPIO
+  SENSOR_I2C = 1, // 16-Bit-Register, pin = Adresse, reg = Register
+  SENSOR_SIM = 2  // Wert wird über die API gesetzt (Test, Host)
+};
+
+struct SensorInput {
+  String name;
+  uint8_t kind;   // SensorKind
+  int pin;
+  uint8_t reg;
+  float scale;    // Wert = Rohwert*scale + offset
+  float offset;
+};
+std::vector<SensorInput> sensors;
+
+struct SensorTrigger {
+  uint16_t id;
+  uint8_t sensor;
+  bool below;          // auslösen beim Unterschreiten, sonst beim Überschreiten
+  float threshold;
+  float hysteresis;    // wieder scharf erst jenseits threshold +/- hysteresis
+  uint32_t minGapSec;  // Mindestabstand zweier Auslösungen
+  uint16_t dailyCapMl; // Höchstmenge je Tag, 0 = unbegrenzt
+  uint32_t programId;
+  bool active;
+  time_t lastFire;
+  int32_t day;         // lokaler Tag, zu dem dayMl gehört
+  uint16_t dayMl;
+};
+std::vector<SensorTrigger> triggers;
+
+// Gesamtmenge eines Programmlaufs
+int programVolume(const Program &prog) {
+  int sum = 0;
+  for(int i=0; i<4; i++){
+    if(prog.pumps[i]) sum += prog.amounts[i];
+  }
+  return sum;
+}
+
+// Erwartete Gesamtdauer eines Programmlaufs in Sekunden (mit kalibrierten
+// Raten; unkalibrierte Pumpen zählen nicht)
+float programDurationSec(const Program &prog) {
+  float total = 0;
+  int steps = 0;
+  for(int i=0; i<4; i++){
+    if(!prog.pumps[i] || prog.amounts[i]<=0 || pumpFlowRate[i]<=0) continue;
+    float sec = prog.amounts[i] / pumpFlowRate[i];
+    if(prog.mode==PROG_SEQUENTIAL){
+      total += sec;
+      steps++;
+    } else if(sec>total){
+      total = sec;
+    }
+  }
+  if(steps>1) total += (steps-1)*prog.gapSec;
+  return total;
+}
+
+/* --------------------------------------------------------------------------
+   Replikationszustand
+   --------------------------------------------------------------------------
+   Jede Änderung trägt einen Stempel (Lamport-Uhr, Knoten-ID). Bei Konflikten
+   gewinnt der größere Stempel ("last writer wins").
+   -------------------------------------------------------------------------- */
+struct ReplStamp {
+  uint32_t version;
+  uint32_t origin;
+};
+
+// Gelöschte Programme merken, damit sie bei der Synchronisation nicht
+// von einem Knoten mit altem Stand wieder eingespielt werden.
+struct ReplTombstone {
+  uint32_t id;
+  ReplStamp stamp;
+  ReplStamp prog;   // Stand des Programms beim Löschen ({0,0} = unbekannt)
 };
 
+const size_t REPL_MAX_TOMBSTONES  = 64;  // darüber fallen bestätigte weg
+const size_t REPL_HARD_TOMBSTONES = 256; // darüber auch unbestätigte
+
+bool     replEnabled  = false;
+String   replSsid     = "";
+String   replPassword = "";
+uint16_t replPort     = 4210;
 
-std::vector<Program> programs;
+uint32_t replNodeId = 0;
+uint32_t replClock  = 0;
+ReplStamp replTankStamp    = {0,0};
+ReplStamp replFlowStamp[4] = {{0,0},{0,0},{0,0},{0,0}};
+std::vector<ReplTombstone> replTombstones;
+// Je Ursprungsknoten der höchste Programmstand, dessen Tombstone schon
+// entfernt wurde (version, origin), siehe replTrimTombstones()
+const size_t REPL_MAX_PURGED = 32;
+std::vector<ReplStamp> replPurged;
 
 /* --------------------------------------------------------------------------
    Zeitverwaltung
    -------------------------------------------------------------------------- */
-time_t currentUnixTime = 0;
+time_t currentUnixTime = 0; // UTC
 unsigned long lastUpdateMillis = 0;
+time_t lastProgramCheck = 0;  // zuletzt geprüfte Minute (currentUnixTime/60)
 
 // Wochentage-Kürzel (0=So, 1=Mo, ...)
 const char* wdays[7] = {"So","Mo","Di","Mi","Do","Fr","Sa"};
 
-// String -> Unixzeit (Format "YYYY-MM-DD HH:MM:SS")
-time_t stringToUnixTime(const String &dt) {
+const time_t SECONDS_PER_DAY  = 24*3600;
+const time_t SECONDS_PER_WEEK = 7*SECONDS_PER_DAY;
+
+/* ---- Zeitzone ----
+   Die Zone wird als POSIX-TZ-Regel eingestellt (z.B. "CET-1CEST,M3.5.0,
+   M10.5.0/3") und beim Setzen einmal in eine Tabelle der Offset-Wechsel
+   für TZ_FIRST_YEAR..TZ_LAST_YEAR umgerechnet. Umrechnungen sind danach
+   eine binäre Suche statt localtime(). Lokalzeiten, die es nicht gibt
+   (Sprung vor), werden auf das Ende der Lücke gelegt; doppelte Lokalzeiten
+   (Sprung zurück) gelten beim ersten Auftreten. */
+#define TZ_FIRST_YEAR 2020
+#define TZ_LAST_YEAR  2070
+
+struct TzTransition {
+  uint32_t utc;    // ab diesem Zeitpunkt gilt offset
+  int32_t offset;  // Lokalzeit - UTC in s
+};
+
+String tzRule = "CET-1CEST,M3.5.0,M10.5.0/3";
+int32_t tzBaseOffset = 3600;              // vor dem ersten Wechsel
+std::vector<TzTransition> tzTransitions;
+
+// Tage seit 1.1.1970 für ein Datum (proleptisch gregorianisch)
+long daysFromCivil(int y, int m, int d) {
+  y -= m<=2;
+  long era = (y>=0 ? y : y-399) / 400;
+  long yoe = y - era*400;
+  long doy = (153*(m + (m>2 ? -3 : 9)) + 2)/5 + d-1;
+  long doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  return era*146097 + doe - 719468;
+}
+
+void civilFromDays(long z, int &y, int &m, int &d) {
+  z += 719468;
+  long era = (z>=0 ? z : z-146096) / 146097;
+  long doe = z - era*146097;
+  long yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  long doy = doe - (365*yoe + yoe/4 - yoe/100);
+  long mp  = (5*doy + 2)/153;
+  d = doy - (153*mp+2)/5 + 1;
+  m = mp<10 ? mp+3 : mp-9;
+  y = yoe + era*400 + (m<=2);
+}
+
+struct LocalTime {
   int year, month, day, hour, minute, second;
-  sscanf(dt.c_str(), "%d-%d-%d %d:%d:%d",
-         &year, &month, &day, &hour, &minute, &second);
-  struct tm t = {0};
-  t.tm_year = year - 1900;
-  t.tm_mon  = month - 1;
-  t.tm_mday = day;
-  t.tm_hour = hour;
-  t.tm_min  = minute;
-  t.tm_sec  = second;
-  return mktime(&t);
-}
-
-// Unixzeit -> formatierter String mit Wochentag
-String unixTimeToDayString(time_t ut) {
-  struct tm* tmStruct = localtime(&ut);
-  int wday   = tmStruct->tm_wday;        
-  int day    = tmStruct->tm_mday;        
-  int month  = tmStruct->tm_mon + 1;   
-  int year   = tmStruct->tm_year + 1900;
-  int hour   = tmStruct->tm_hour;
-  int minute = tmStruct->tm_min;
+  int wday; // 0=So
+};
+
+// Lokalzeit in Sekunden seit 1970 (ohne Zone) zerlegen
+LocalTime splitLocal(time_t local) {
+  LocalTime lt;
+  long days = (long)(local>=0 ? local/SECONDS_PER_DAY : (local-SECONDS_PER_DAY+1)/SECONDS_PER_DAY);
+  long sec  = (long)(local - days*SECONDS_PER_DAY);
+  civilFromDays(days, lt.year, lt.month, lt.day);
+  lt.hour   = sec/3600;
+  lt.minute = (sec/60)%60;
+  lt.second = sec%60;
+  lt.wday   = (int)((days%7+11)%7); // 1.1.1970 war ein Donnerstag
+  return lt;
+}
+
+int32_t tzOffsetAt(time_t utc) {
+  // Erster Wechsel nach utc, davor gilt der gesuchte
+  size_t lo = 0, hi = tzTransitions.size();
+  while(lo<hi){
+    size_t mid = (lo+hi)/2;
+    if((time_t)tzTransitions[mid].utc<=utc) lo = mid+1; else hi = mid;
+  }
+  return lo==0 ? tzBaseOffset : tzTransitions[lo-1].offset;
+}
+
+time_t tzLocal(time_t utc) {
+  return utc + tzOffsetAt(utc);
+}
+
+// Lokalzeit -> UTC; Lücke => Ende der Lücke, doppelt => erstes Auftreten
+time_t tzToUtc(time_t local) {
+  // Wechsel liegen Monate auseinander: die Offsets einen Tag vorher und
+  // nachher decken beide Seiten eines Wechsels ab
+  int32_t before = tzOffsetAt(local - SECONDS_PER_DAY);
+  int32_t after  = tzOffsetAt(local + SECONDS_PER_DAY);
+  time_t u1 = local - before;
+  time_t u2 = local - after;
+  bool ok1 = tzOffsetAt(u1)==before;
+  bool ok2 = tzOffsetAt(u2)==after;
+  if(ok1 && ok2) return u1<u2 ? u1 : u2;
+  if(ok1) return u1;
+  if(ok2) return u2;
+  // In der Lücke: u1 liegt schon hinter dem Wechsel, gesucht ist der Wechsel
+  size_t lo = 0, hi = tzTransitions.size();
+  while(lo<hi){
+    size_t mid = (lo+hi)/2;
+    if((time_t)tzTransitions[mid].utc<=u1) lo = mid+1; else hi = mid;
+  }
+  return lo==0 ? u1 : (time_t)tzTransitions[lo-1].utc;
+}
+
+/* POSIX-Regel lesen. Unterstützt werden Namen (auch <+03>), Offsets
+   [+-]hh[:mm[:ss]] und Wechselregeln der Form Mm.w.d[/zeit]. */
+static bool tzParseName(const char *&p) {
+  if(*p=='<'){
+    p++;
+    while(isalnum((unsigned char)*p) || *p=='+' || *p=='-') p++;
+    if(*p!='>') return false;
+    p++;
+    return true;
+  }
+  const char *start = p;
+  while(isalpha((unsigned char)*p)) p++;
+  return p-start>=3;
+}
+
+static bool tzParseTime(const char *&p, long &sec) {
+  int sign = 1;
+  if(*p=='+' || *p=='-'){
+    if(*p=='-') sign = -1;
+    p++;
+  }
+  if(!isdigit((unsigned char)*p)) return false;
+  long parts[3] = {0,0,0};
+  for(int i=0; i<3; i++){
+    parts[i] = strtol(p, (char**)&p, 10);
+    if(*p!=':' || i==2) break;
+    p++;
+  }
+  sec = sign*(parts[0]*3600 + parts[1]*60 + parts[2]);
+  return true;
+}
+
+struct TzRulePoint {
+  int month, week, wday;
+  long time; // Sekunden nach Mitternacht (Lokalzeit vor dem Wechsel)
+};
+
+static bool tzParseRulePoint(const char *&p, TzRulePoint &r) {
+  if(*p!='M') return false;
+  p++;
+  r.month = strtol(p, (char**)&p, 10);
+  if(*p++!='.') return false;
+  r.week = strtol(p, (char**)&p, 10);
+  if(*p++!='.') return false;
+  r.wday = strtol(p, (char**)&p, 10);
+  r.time = 2*3600;
+  if(*p=='/' && !tzParseTime(++p, r.time)) return false;
+  return r.month>=1 && r.month<=12 && r.week>=1 && r.week<=5
+      && r.wday>=0 && r.wday<=6;
+}
+
+// Lokalzeit (Sekunden seit 1970) des Wechsels in einem Jahr
+static time_t tzRuleLocal(const TzRulePoint &r, int year) {
+  static const int mdays[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+  long first = daysFromCivil(year, r.month, 1);
+  int firstWday = (int)((first%7+11)%7);
+  int day = 1 + (r.wday - firstWday + 7)%7 + (r.week-1)*7;
+  int len = mdays[r.month-1]
+          + (r.month==2 && (year%4==0 && (year%100!=0 || year%400==0)));
+  while(day>len) day -= 7;
+  return (first + day-1)*SECONDS_PER_DAY + r.time;
+}
+
+// Regel übernehmen und Tabelle neu aufbauen; false bei ungültiger Regel
+bool tzSetRule(const String &rule) {
+  const char *p = rule.c_str();
+  long stdPosix, dstPosix;
+  if(!tzParseName(p) || !tzParseTime(p, stdPosix)) return false;
+  int32_t stdOff = -stdPosix; // POSIX zählt westlich von Greenwich positiv
+
+  std::vector<TzTransition> table;
+  int32_t base = stdOff;
+  if(*p){
+    if(!tzParseName(p)) return false;
+    dstPosix = stdPosix - 3600;
+    if(*p && *p!=',' && !tzParseTime(p, dstPosix)) return false;
+    int32_t dstOff = -dstPosix;
+    TzRulePoint start, end;
+    if(*p++!=',' || !tzParseRulePoint(p, start)
+       || *p++!=',' || !tzParseRulePoint(p, end) || *p) return false;
+
+    table.reserve(2*(TZ_LAST_YEAR-TZ_FIRST_YEAR+1));
+    for(int y=TZ_FIRST_YEAR; y<=TZ_LAST_YEAR; y++){
+      TzTransition a = {(uint32_t)(tzRuleLocal(start, y) - stdOff), dstOff};
+      TzTransition b = {(uint32_t)(tzRuleLocal(end, y) - dstOff), stdOff};
+      // Südhalbkugel: Sommerzeit beginnt nach ihrem Ende im selben Jahr
+      if(a.utc<b.utc){ table.push_back(a); table.push_back(b); }
+      else           { table.push_back(b); table.push_back(a); }
+    }
+    // Vor dem ersten Wechsel gilt der Offset, den der letzte des Jahres setzt
+    base = table[1].offset;
+  }
+
+  tzRule = rule;
+  tzBaseOffset = base;
+  tzTransitions.swap(table);
+  return true;
+}
+
+/* ---- Zeitplan ----
+   Jedes Programm wird beim Speichern in Bitmasken für Minute, Stunde, Tag
+   des Monats, Monat und Wochentag übersetzt. Quelle ist entweder ein
+   Cron-Ausdruck ("Min Std Tag Monat Wochentag", z.B. "0 8,12,18 * * *"
+   oder "30 7 1,15 * *"; Listen, Bereiche, Schrittweiten mit "/" und
+   Wochentage als 0-7 oder Mo..So) oder die
+   bisherigen Felder days/time. Ein Zeitpunkt passt, wenn alle Bits gesetzt
+   sind; sind Tag des Monats und Wochentag beide eingeschränkt, genügt wie
+   bei cron einer der beiden. */
+static bool cronNumber(const char *&p, int lo, int hi, bool dow, int &v) {
+  if(dow && isalpha((unsigned char)*p)){
+    for(int i=0; i<7; i++){
+      if(strncmp(p, wdays[i], 2)==0){
+        v = i;
+        p += 2;
+        return true;
+      }
+    }
+    return false;
+  }
+  if(!isdigit((unsigned char)*p)) return false;
+  v = strtol(p, (char**)&p, 10);
+  return v>=lo && v<=hi; // Wochentag 7 = Sonntag, siehe cronField()
+}
+
+// Ein Feld ("*", "1-5", "*/15", "8,12,18", ...) als Bitmaske
+static bool cronField(const char *&p, int lo, int hi, bool dow,
+                      uint64_t &bits, bool &restricted) {
+  bits = 0;
+  restricted = *p!='*';
+  while(true){
+    int a, b, step = 1;
+    if(*p=='*'){
+      a = lo; b = hi;
+      p++;
+    } else {
+      if(!cronNumber(p, lo, dow ? 7 : hi, dow, a)) return false;
+      b = a;
+      if(*p=='-'){
+        p++;
+        if(!cronNumber(p, lo, dow ? 7 : hi, dow, b)) return false;
+        if(dow && b==0 && a>0) b = 7; // "Mo-So"
+      }
+    }
+    if(*p=='/'){
+      p++;
+      if(!isdigit((unsigned char)*p)) return false;
+      step = strtol(p, (char**)&p, 10);
+      if(step<1) return false;
+      if(a==b) b = hi; // "5/15" = ab 5 alle 15
+    }
+    if(a>b) return false;
+    for(int v=a; v<=b; v+=step) bits |= 1ULL<<v;
+    if(*p!=',') break;
+    p++;
+  }
+  // Wochentag 7 ist der Sonntag (Bit 0)
+  if(dow && (bits & 0x80)) bits = (bits | 1) & 0x7F;
+  return *p==0 || *p==' ';
+}
+
+// Cron-Ausdruck übersetzen; liefert Fehlertext oder ""
+String compileCron(const String &expr, ProgramSchedule &s) {
+  String e = expr;
+  e.trim();
+  if(e=="@hourly")  e = "0 * * * *";
+  if(e=="@daily")   e = "0 0 * * *";
+  if(e=="@weekly")  e = "0 0 * * 0";
+  if(e=="@monthly") e = "0 0 1 * *";
+
+  const char *p = e.c_str();
+  uint64_t bits[5];
+  bool restricted[5];
+  static const int lo[5] = {0, 0, 1, 1, 0};
+  static const int hi[5] = {59, 23, 31, 12, 6};
+  for(int f=0; f<5; f++){
+    while(*p==' ') p++;
+    if(!*p) return "Cron-Ausdruck braucht 5 Felder";
+    if(!cronField(p, lo[f], hi[f], f==4, bits[f], restricted[f])){
+      return "ungültiges Cron-Feld "+String(f+1);
+    }
+  }
+  while(*p==' ') p++;
+  if(*p) return "Cron-Ausdruck hat mehr als 5 Felder";
+
+  // Nur Tage des Monats eingeschränkt: mindestens einer muss in einem der
+  // Monate vorkommen ("0 0 31 2 *" trifft nie zu)
+  if(restricted[2] && !restricted[4]){
+    static const int monthDays[13] = {0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool possible = false;
+    for(int m=1; m<=12 && !possible; m++){
+      uint64_t days = (2ULL << monthDays[m]) - 2; // Bit 1..monthDays
+      possible = ((bits[3]>>m) & 1) && (bits[2] & days);
+    }
+    if(!possible) return "Cron-Ausdruck trifft nie zu";
+  }
+
+  s.minutes  = bits[0];
+  s.hours    = (uint32_t)bits[1];
+  s.mdays    = (uint32_t)bits[2];
+  s.months   = (uint16_t)bits[3];
+  s.wdays    = (uint8_t)bits[4];
+  s.domOrDow = restricted[2] && restricted[4];
+  s.valid    = true;
+  return "";
+}
+
+// Zeitplan vorberechnen (Cron-Ausdruck oder days/time)
+// Wochentagsmaske (Bit 0 = So) -> "Mo,Mi,Fr" in der Reihenfolge Mo..So
+String daysFromMask(uint8_t mask) {
+  String days;
+  for(int k=1; k<=7; k++){
+    int d = k%7;
+    if(!(mask & (1<<d))) continue;
+    if(!days.isEmpty()) days += ',';
+    days += wdays[d];
+  }
+  return days;
+}
+
+void compileSchedule(Program &prog) {
+  ProgramSchedule &s = prog.sched;
+  s.valid = false;
+  if(!prog.cron.isEmpty()){
+    compileCron(prog.cron, s);
+    return;
+  }
+  s.wdays = 0;
+  for(int i=0; i<7; i++){
+    String look = String(wdays[i]) + ",";
+    if((prog.days + ",").indexOf(look)>=0) s.wdays |= (1<<i);
+  }
+  int hh, mm;
+  if(sscanf(prog.time.c_str(), "%d:%d", &hh, &mm)==2
+     && hh>=0 && hh<24 && mm>=0 && mm<60){
+    s.minutes  = 1ULL<<mm;
+    s.hours    = 1UL<<hh;
+    s.mdays    = 0xFFFFFFFEUL; // 1..31
+    s.months   = 0x1FFE;       // 1..12
+    s.domOrDow = false;
+    s.valid    = s.wdays!=0;
+  }
+}
+
+bool scheduleDayMatches(const ProgramSchedule &s, const LocalTime &lt) {
+  if(!(s.months & (1<<lt.month))) return false;
+  bool dom = (s.mdays >> lt.day) & 1;
+  bool dow = (s.wdays >> lt.wday) & 1;
+  return s.domOrDow ? (dom || dow) : (dom && dow);
+}
+
+bool scheduleMatches(const ProgramSchedule &s, const LocalTime &lt) {
+  return ((s.minutes >> lt.minute) & 1) && ((s.hours >> lt.hour) & 1)
+      && scheduleDayMatches(s, lt);
+}
+
+// Cron-Programme mit Intervall > 1 Woche laufen nur in jeder n-ten Woche,
+// gezählt ab der Woche (Mo-So) von anchor
+bool programWeekMatches(const Program &prog, time_t localDay) {
+  if(prog.cron.isEmpty() || prog.interval<=1) return true;
+  time_t anchorDay = tzLocal(prog.anchor)/SECONDS_PER_DAY;
+  time_t monday = anchorDay - (anchorDay+3)%7;
+  time_t weeks = (localDay - monday)/7;
+  return localDay>=monday && weeks%prog.interval==0;
+}
 
+// Erwartete Läufe pro Woche eines Cron-Programms (für die Tankprognose)
+float programRunsPerWeek(const Program &prog) {
+  const ProgramSchedule &s = prog.sched;
+  if(!s.valid) return 0;
+  float perDay = __builtin_popcountll(s.minutes) * __builtin_popcount(s.hours);
+  float fm = __builtin_popcount(s.mdays)/31.0f;
+  float fw = __builtin_popcount(s.wdays)/7.0f;
+  float days = 7.0f * (s.domOrDow ? fm+fw-fm*fw : fm*fw)
+             * __builtin_popcount(s.months)/12.0f;
+  return perDay*days/(prog.interval>1 ? prog.interval : 1);
+}
+
+// Frühester erneuter Lauf nach lastRun (0 = sofort). Eine Stunde Spielraum,
+// damit ein Wochentermin nach der Zeitumstellung nicht eine Woche später fällt.
+// Cron-Programme zählen das Intervall stattdessen über programWeekMatches().
+time_t rerunAllowedAt(const Program &prog, time_t lastRun) {
+  return lastRun==0 || !prog.cron.isEmpty() ? 0 : lastRun + prog.interval*SECONDS_PER_WEEK - 3600;
+}
+
+// Lokalzeit-String (Format "YYYY-MM-DD HH:MM:SS") -> Unixzeit, 0 bei Fehler
+time_t stringToUnixTime(const String &dt) {
+  int year=0, month=0, day=0, hour=0, minute=0, second=0;
+  if(sscanf(dt.c_str(), "%d-%d-%d %d:%d:%d",
+            &year, &month, &day, &hour, &minute, &second)<5) return 0;
+  time_t local = daysFromCivil(year, month, day)*SECONDS_PER_DAY
+               + hour*3600 + minute*60 + second;
+  return tzToUtc(local);
+}
+
+// Unixzeit -> formatierter Text mit Wochentag (Lokalzeit) in buf
+const char *formatDayString(char *buf, size_t size, time_t ut) {
+  LocalTime lt = splitLocal(tzLocal(ut));
+  snprintf(buf, size, "%s %d.%d.%d %02d:%02d",
+           wdays[lt.wday], lt.day, lt.month, lt.year, lt.hour, lt.minute);
+  return buf;
+}
+
+String unixTimeToDayString(time_t ut) {
   char buf[40];
-  snprintf(buf, sizeof(buf), "%s %d.%d.%d %02d:%02d",
-           wdays[wday], day, month, year, hour, minute);
-  return String(buf);
+  return String(formatDayString(buf, sizeof(buf), ut));
 }
 
 String getCurrentDateTime() {
@@ -108,8 +1008,60 @@ String getCurrentDateTime() {
 }
 
 
-// Check, ob time in HH:MM format gültig ist
-String calculateTankEmptyDate() {
+// Behälter, aus dem Pumpe i fördert (ungültige Zuordnung => Behälter 1)
+int pumpTankIndex(int i) {
+  int r = pumpReservoir[i];
+  return r>=0 && r<(int)reservoirs.size() ? r : 0;
+}
+
+Reservoir &pumpTank(int i) {
+  return reservoirs[pumpTankIndex(i)];
+}
+
+// Menge vom Behälter der Pumpe abziehen (negativ = gutschreiben). Den Stand
+// eines Behälters mit Füllstandssensor schreibt allein tankSensorLoop().
+void pumpCounterDraw(int p, float ml);
+bool reservoirMeasured(int r);
+
+void reservoirDraw(int i, float ml) {
+  pumpCounterDraw(i, ml);
+  if(reservoirMeasured(pumpTankIndex(i))) return;
+  Reservoir &r = pumpTank(i);
+  r.level -= ml;
+  if(r.level<0) r.level = 0;
+}
+
+// Menge, die ein Lauf des Programms aus Behälter r zieht
+float programDraw(const Program &prog, int r) {
+  float ml = 0;
+  for(int i=0; i<4; i++){
+    if(prog.pumps[i] && pumpTankIndex(i)==r) ml += prog.amounts[i];
+  }
+  return ml;
+}
+
+// Behälter, den das Programm unter die Reserve ziehen würde, sonst -1
+int programBlockingReservoir(const Program &prog) {
+  for(size_t r=0; r<reservoirs.size(); r++){
+    if(reservoirs[r].reserve<=0) continue;
+    float draw = programDraw(prog, r);
+    if(draw>0 && reservoirs[r].level-draw<reservoirs[r].reserve) return r;
+  }
+  return -1;
+}
+
+// Namen stehen unverändert im JSON der API
+bool reservoirNameValid(const String &name) {
+  if(name.isEmpty() || name.length()>32) return false;
+  for(unsigned int i=0; i<name.length(); i++){
+    char c = name[i];
+    if(c=='"' || c=='\\' || (unsigned char)c<0x20) return false;
+  }
+  return true;
+}
+
+// Voraussichtliches Leerdatum von Behälter r ("" = kein Verbrauch)
+String calculateTankEmptyDate(int r) {
   float usagePerWeek = 0.0f;
 
   // Hilfsfunktion: Tage zählen in "Mo,Di,Fr"
@@ -126,1134 +1078,8377 @@ String calculateTankEmptyDate() {
   };
 
   // Programme durchgehen
-  for(auto &pr : programs){
-    if(!pr.active) continue;
-    int dayCount = countDays(pr.days); 
-    float weeklyAmount = dayCount * pr.amount;
+  programs.forEach([&](size_t, const Program &pr){
+    if(!pr.active) return;
+    float runs = pr.cron.isEmpty() ? countDays(pr.days) : programRunsPerWeek(pr);
+    float weeklyAmount = runs * programDraw(pr, r);
     usagePerWeek += weeklyAmount;
-  }
+  });
 
   if(usagePerWeek<=0.0f) {
     // Kein Verbrauch => kein LeerDatum
     return "";
   }
 
-  // Wieviel Wochen reicht currentTankLevel?
-  float weeks = currentTankLevel / usagePerWeek;
+  // Wieviel Wochen reicht der Inhalt?
+  float weeks = reservoirs[r].level / usagePerWeek;
   time_t nowSec   = currentUnixTime;
   time_t deltaSec = (time_t)(weeks * 7 * 24 * 3600);
   time_t emptySec = nowSec + deltaSec;
 
-  struct tm *tmStruct = localtime(&emptySec);
-  int d  = tmStruct->tm_mday;
-  int mo = tmStruct->tm_mon +1;
-  int y  = tmStruct->tm_year+1900;
-  int hh = tmStruct->tm_hour;
-  int mm = tmStruct->tm_min;
+  LocalTime lt = splitLocal(tzLocal(emptySec));
   char buf[40];
-  snprintf(buf,sizeof(buf),"%02d.%02d.%04d %02d:%02d", d, mo, y, hh, mm);
+  snprintf(buf,sizeof(buf),"%02d.%02d.%04d %02d:%02d",
+           lt.day, lt.month, lt.year, lt.hour, lt.minute);
   return String(buf);
 }
 
 /* --------------------------------------------------------------------------
-   Speichern/Laden der Konfiguration in SPIFFS
+   Programmspeicher
+   --------------------------------------------------------------------------
+   Die Partition ist in Slots zu 128 Bytes geteilt, 32 je 4-KB-Sektor. Eine
+   Änderung schreibt das Programm in einen freien Slot und setzt danach
+   das Statuswort des alten auf 0 (Bits lassen sich im Flash ohne Löschen
+   nur von 1 auf 0 setzen). Beim Start werden alle Slots einmal gelesen:
+   gültige Einträge nach order sortiert, doppelte (Stromausfall zwischen
+   Schreiben und Entwerten) über seq aufgelöst. Gehen die freien Slots aus,
+   kopiert collect() die gültigen Einträge des Sektors mit den meisten
+   entwerteten in den Reservesektor und löscht ihn; er wird die neue Reserve.
+   esp_partition_write() leert den Cache für den geschriebenen Bereich, die
+   Einblendung zeigt danach den neuen Inhalt.
    -------------------------------------------------------------------------- */
-void saveConfig() {
-  DynamicJsonDocument doc(4096);
-
-  // Beispiel: doc["currentDateTime"] = ...
-  doc["currentDateTime"] = getCurrentDateTime();
-
-  // Neuer Tanklevel
-  doc["tankLevel"] = currentTankLevel;
+#define PSTORE_SUBTYPE 0x40
+#define PSTORE_FREE    0xFFFFFFFFUL
+#define PSTORE_LIVE    0x50524731UL // "PRG1"
+#define PSTORE_DEAD    0x00000000UL
+#define PSTORE_SECTOR_SLOTS (SPI_FLASH_SEC_SIZE/sizeof(ProgramRecord))
+
+uint32_t ProgramStore::recordCrc(const ProgramRecord &r) {
+  const uint8_t *b = (const uint8_t*)&r + offsetof(ProgramRecord, seq);
+  const uint8_t *e = (const uint8_t*)&r + sizeof(r);
+  uint32_t h = 2166136261UL; // FNV-1a
+  while(b<e) h = (h ^ *b++) * 16777619UL;
+  return h;
+}
 
-  // Pumpenstatus in ein Array
-  {
-    // statt createNestedArray("pumpStatus"):
-    JsonArray arr = doc["pumpStatus"].to<JsonArray>();
-    arr.clear();  // sicherheitshalber leeren, bevor wir einfügen
-    for (int i = 0; i < 4; i++) {
-      arr.add(pumpStatus[i]);
-    }
+void ProgramStore::encode(const Program &p, ProgramRecord &r) {
+  memset(&r, 0, sizeof(r));
+  r.id       = p.id;
+  r.version  = p.version;
+  r.origin   = p.origin;
+  r.lastRun  = (int32_t)p.lastRun;
+  r.anchor   = (int32_t)p.anchor;
+  for(int i=0; i<4; i++){
+    r.amounts[i] = p.amounts[i];
+    if(p.pumps[i]) r.pumps |= 1<<i;
   }
-
-  // PumpFlowRate in ein Array
-  {
-    JsonArray arr = doc["pumpFlowRate"].to<JsonArray>();
-    arr.clear();
-    for (int i = 0; i < 4; i++) {
-      arr.add(pumpFlowRate[i]);
+  r.gapSec   = p.gapSec;
+  r.mode     = p.mode;
+  r.interval = (uint8_t)constrain(p.interval, 1, 255);
+  r.active   = p.active;
+  r.hour     = 0xFF;
+  if(p.cron.isEmpty()){
+    Program tmp;
+    tmp.days = p.days;
+    tmp.time = p.time;
+    compileSchedule(tmp);
+    int hh, mm;
+    r.wdays = tmp.sched.wdays;
+    if(sscanf(p.time.c_str(), "%d:%d", &hh, &mm)==2 && hh>=0 && hh<24 && mm>=0 && mm<60){
+      r.hour   = hh;
+      r.minute = mm;
     }
+  } else {
+    strncpy(r.cron, p.cron.c_str(), sizeof(r.cron)-1);
   }
+}
 
-  // Programme
-  {
-    // statt createNestedArray("programs"):
-    JsonArray arr = doc["programs"].to<JsonArray>();
-    arr.clear();
-    for (auto &prog : programs) {
-      // statt createNestedObject():
-      JsonObject p = arr.createNestedObject();
-
-      p["days"]     = prog.days;
-      p["interval"] = prog.interval;
-      p["time"]     = prog.time;
-      p["amount"]   = prog.amount;
-      p["active"]   = prog.active;
-      p["lastRun"]  = (long)prog.lastRun;
-
-      // pumps
-      JsonArray pa = p["pumps"].to<JsonArray>();
-      pa.clear();
-      for (int i = 0; i < 4; i++) {
-        pa.add(prog.pumps[i]);
-      }
-    }
+void ProgramStore::decode(const ProgramRecord &r, Program &p) {
+  p.days = daysFromMask(r.wdays);
+  char t[6] = "";
+  if(r.hour!=0xFF) snprintf(t, sizeof(t), "%02d:%02d", r.hour, r.minute);
+  p.time     = t;
+  p.cron     = r.cron;
+  p.interval = r.interval;
+  p.anchor   = r.anchor;
+  for(int i=0; i<4; i++){
+    p.amounts[i] = r.amounts[i];
+    p.pumps[i]   = (r.pumps>>i) & 1;
   }
+  p.mode     = r.mode;
+  p.gapSec   = r.gapSec;
+  p.active   = r.active;
+  p.lastRun  = r.lastRun;
+  p.id       = r.id;
+  p.version  = r.version;
+  p.origin   = r.origin;
+  compileSchedule(p);
+}
 
-  File file = SPIFFS.open("/config.json", FILE_WRITE);
-  if(!file) {
-    Serial.println("Fehler beim Öffnen /config.json zum Schreiben!");
-    return;
+// Indexeintrag: Programme mit genau einem Zeitpunkt am Tag prüft
+// checkPrograms() nur in dieser Minute, die übrigen Cron-Programme jede
+// Minute; dazu die Masken für die Filter der Programmliste
+ProgramStore::Entry ProgramStore::makeEntry(uint16_t slot, const ProgramRecord &r) {
+  Entry e = {slot, KEY_NEVER, (uint8_t)(r.pumps | (r.active ? ENTRY_ACTIVE : 0)), r.wdays};
+  if(!r.cron[0]){
+    if(r.active && r.hour!=0xFF && r.wdays) e.minute = r.hour*60 + r.minute;
+    return e;
   }
-  serializeJson(doc, file);
-  file.close();
-  Serial.println("Konfiguration gespeichert.");
+  ProgramSchedule s;
+  s.valid = false;
+  compileCron(String(r.cron), s);
+  if(!s.valid) return e;
+  e.wdays = s.wdays;
+  if(!r.active) return e;
+  bool once = __builtin_popcountll(s.minutes)==1 && __builtin_popcount(s.hours)==1;
+  e.minute = once ? __builtin_ctz(s.hours)*60 + __builtin_ctzll(s.minutes) : KEY_ANY;
+  return e;
 }
 
-void loadConfig() {
-  if(!SPIFFS.exists("/config.json")){
-    Serial.println("Keine config.json, Standardwerte");
-    return;
-  }
-  File file = SPIFFS.open("/config.json", FILE_READ);
-  if(!file){
-    Serial.println("Fehler beim Öffnen /config.json zum Lesen!");
-    return;
-  }
+bool ProgramStore::writeRecord(uint16_t slot, ProgramRecord &r) {
+  r.state = PSTORE_LIVE;
+  r.crc   = recordCrc(r);
+  changeCount++;
+  return esp_partition_write(part, (size_t)slot*sizeof(r), &r, sizeof(r))==ESP_OK;
+}
 
-  DynamicJsonDocument doc(4096);
-  DeserializationError err = deserializeJson(doc, file);
-  file.close();
-  if(err) {
-    Serial.println("Fehler beim Parsen der config.json!");
-    return;
+void ProgramStore::kill(uint16_t slot) {
+  uint32_t dead = PSTORE_DEAD;
+  esp_partition_write(part, (size_t)slot*sizeof(ProgramRecord), &dead, sizeof(dead));
+  forget(slot);
+  changeCount++;
+}
+
+// Zwischengespeicherte Kopie eines Slots verwerfen
+void ProgramStore::forget(uint16_t slot) {
+  for(auto &line : cache){
+    if(line.slot==slot) line.slot = 0xFFFF;
   }
+}
 
-  // TankLevel
-  // Keine Notwendigkeit für containsKey("tankLevel"), 
-  // man kann direkt checken ob doc["tankLevel"].is<float>()
-  if (doc["tankLevel"].is<float>()) {
-    currentTankLevel = doc["tankLevel"].as<float>();
-  } else {
-    currentTankLevel = 0.0f;
+void ProgramStore::countFree() {
+  freeCount = 0;
+  for(uint16_t s=0; s<slots; s++){
+    if((int)(s/PSTORE_SECTOR_SLOTS)!=spare && base[s].state==PSTORE_FREE) freeCount++;
   }
+}
 
-  // currentDateTime
-  if (doc["currentDateTime"].is<const char*>()) {
-    String dtStr = doc["currentDateTime"].as<const char*>();
-    currentUnixTime = stringToUnixTime(dtStr);
+bool ProgramStore::begin() {
+  unsigned long t0 = millis();
+  for(auto &line : cache) line.slot = 0xFFFF;
+  changeCount++;
+  if(!part){
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+             (esp_partition_subtype_t)PSTORE_SUBTYPE, "programs");
+    spi_flash_mmap_handle_t handle;
+    const void *ptr = nullptr;
+    if(!part || esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &ptr, &handle)!=ESP_OK){
+      LOG_E("Partition \"programs\" fehlt, Programme können nicht gespeichert werden!");
+      part = nullptr;
+      return false;
+    }
+    base  = (const ProgramRecord*)ptr;
+    slots = part->size/sizeof(ProgramRecord) > 0xFFF0 ? 0xFFF0 : part->size/sizeof(ProgramRecord);
   }
 
-  // pumpStatus
-  {
-    JsonArray arr = doc["pumpStatus"].as<JsonArray>();
-    if(!arr.isNull()) {
-      for(int i=0; i<4 && i<(int)arr.size(); i++){
-        pumpStatus[i] = arr[i].as<bool>();
-      }
+  // Gültige Einträge einsammeln, beschädigte entwerten
+  entries.clear();
+  maxSeq = maxOrder = 0;
+  for(uint16_t s=0; s<slots; s++){
+    const ProgramRecord &r = base[s];
+    if(r.state!=PSTORE_LIVE) continue;
+    if(r.crc!=recordCrc(r)){
+      kill(s);
+      continue;
+    }
+    entries.push_back({s, 0, 0, 0});
+    if(r.seq>maxSeq) maxSeq = r.seq;
+    if(r.order>maxOrder) maxOrder = r.order;
+  }
+  std::sort(entries.begin(), entries.end(), [this](const Entry &a, const Entry &b){
+    const ProgramRecord &ra = base[a.slot], &rb = base[b.slot];
+    return ra.order!=rb.order ? ra.order<rb.order : ra.seq<rb.seq;
+  });
+  size_t out = 0;
+  for(size_t i=0; i<entries.size(); i++){
+    // Gleiche Position zweimal: die ältere Kopie ist überholt
+    if(i+1<entries.size() && base[entries[i+1].slot].order==base[entries[i].slot].order){
+      kill(entries[i].slot);
+      continue;
+    }
+    entries[out] = makeEntry(entries[i].slot, base[entries[i].slot]);
+    out++;
+  }
+  entries.resize(out);
+  entries.shrink_to_fit();
+
+  // Reservesektor: einer ohne gültige Einträge, wenn nötig gelöscht
+  size_t sectors = slots/PSTORE_SECTOR_SLOTS;
+  spare = -1;
+  for(size_t sec=0; sec<sectors && spare<0; sec++){
+    bool empty = true, erased = true;
+    for(size_t k=0; k<PSTORE_SECTOR_SLOTS; k++){
+      uint32_t st = base[sec*PSTORE_SECTOR_SLOTS+k].state;
+      if(st==PSTORE_LIVE) empty = false;
+      if(st!=PSTORE_FREE) erased = false;
     }
+    if(!empty) continue;
+    if(!erased) esp_partition_erase_range(part, sec*SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+    spare = sec;
   }
+  if(spare<0) LOG_W("Programmspeicher ohne Reservesektor, Aufräumen nicht möglich");
+  countFree();
+  head = 0;
+  openMs = millis() - t0;
+  LOG_I("Programmspeicher: %u Programme, %u Slots frei, %lu ms",
+    (unsigned)entries.size(), (unsigned)freeCount, (unsigned long)openMs);
+  return true;
+}
 
-  // pumpFlowRate
-  {
-    JsonArray arr = doc["pumpFlowRate"].as<JsonArray>();
-    if(!arr.isNull()) {
-      for(int i=0; i<4 && i<(int)arr.size(); i++){
-        pumpFlowRate[i] = arr[i].as<float>();
-      }
+// Reservesektor und etwas Luft zum Aufräumen bleiben frei
+size_t ProgramStore::capacity() const {
+  return slots>2*PSTORE_SECTOR_SLOTS ? slots - 2*PSTORE_SECTOR_SLOTS : 0;
+}
+
+size_t ProgramStore::indexBytes() const {
+  return entries.capacity()*sizeof(Entry) + sizeof(cache);
+}
+
+// Sektor mit den meisten entwerteten Einträgen in den Reservesektor umziehen
+bool ProgramStore::collect() {
+  if(spare<0) return false;
+  size_t sectors = slots/PSTORE_SECTOR_SLOTS;
+  int victim = -1;
+  size_t best = 0;
+  for(size_t sec=0; sec<sectors; sec++){
+    if((int)sec==spare) continue;
+    size_t dead = 0;
+    for(size_t k=0; k<PSTORE_SECTOR_SLOTS; k++){
+      if(base[sec*PSTORE_SECTOR_SLOTS+k].state==PSTORE_DEAD) dead++;
+    }
+    if(dead>best){ best = dead; victim = sec; }
+  }
+  if(victim<0) return false;
+
+  uint16_t dst = spare*PSTORE_SECTOR_SLOTS;
+  for(size_t k=0; k<PSTORE_SECTOR_SLOTS; k++){
+    uint16_t src = victim*PSTORE_SECTOR_SLOTS + k;
+    if(base[src].state!=PSTORE_LIVE) continue;
+    // Über RAM kopieren: während des Schreibens ist der Flash-Cache aus
+    ProgramRecord r = base[src];
+    if(esp_partition_write(part, (size_t)dst*sizeof(r), &r, sizeof(r))!=ESP_OK) return false;
+    for(auto &e : entries){
+      if(e.slot==src){ e.slot = dst; break; }
     }
+    forget(src);
+    dst++;
   }
+  esp_partition_erase_range(part, (size_t)victim*SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+  spare = victim;
+  countFree();
+  return true;
+}
 
-  // programmes
-  {
-    JsonArray parr = doc["programs"].as<JsonArray>();
-    if(!parr.isNull()) {
-      programs.clear();
-      for (JsonObject p : parr) {
-        Program prog;
-        prog.days     = p["days"]    .as<String>();
-        prog.interval = p["interval"].as<int>();
-        prog.time     = p["time"]    .as<String>();
-        prog.amount   = p["amount"]  .as<int>();
-        prog.active   = p["active"]  .as<bool>();
-        prog.lastRun  = p["lastRun"] | 0L;
-
-        // pumps
-        JsonArray pa = p["pumps"].as<JsonArray>();
-        if(!pa.isNull()) {
-          for(int i=0; i<4 && i<(int)pa.size(); i++){
-            prog.pumps[i] = pa[i].as<bool>();
-          }
-        }
-        programs.push_back(prog);
+int ProgramStore::allocSlot() {
+  if(!part) return -1;
+  for(int pass=0; pass<2; pass++){
+    if(freeCount>0){
+      for(uint16_t k=0; k<slots; k++){
+        uint16_t s = (head+k)%slots;
+        if((int)(s/PSTORE_SECTOR_SLOTS)==spare || base[s].state!=PSTORE_FREE) continue;
+        head = s+1;
+        freeCount--;
+        return s;
       }
     }
+    if(!collect()) break;
   }
+  LOG_E("Programmspeicher voll");
+  return -1;
+}
 
-  Serial.println("Konfiguration geladen.");
+Program ProgramStore::get(size_t i) {
+  uint16_t slot = entries[i].slot;
+  CacheLine *line = &cache[0];
+  for(auto &c : cache){
+    if(c.slot==slot){ line = &c; break; }
+    if(c.used<line->used) line = &c;
+  }
+  if(line->slot!=slot){
+    decode(base[slot], line->prog);
+    line->slot = slot;
+  }
+  line->used = ++cacheClock;
+  return line->prog;
 }
 
+bool ProgramStore::append(const Program &p) {
+  if(entries.size()>=capacity()) return false;
+  int slot = allocSlot();
+  if(slot<0) return false;
+  ProgramRecord r;
+  encode(p, r);
+  r.seq   = ++maxSeq;
+  r.order = ++maxOrder;
+  if(!writeRecord(slot, r)) return false;
+  entries.push_back(makeEntry(slot, r));
+  return true;
+}
 
-/* --------------------------------------------------------------------------
-   Setter-Funktionen mit automatischer Sicherung
-   -------------------------------------------------------------------------- */
-void setCurrentDateTime(const String &dt) {
-  currentUnixTime = stringToUnixTime(dt);
-  lastUpdateMillis = millis();
-  saveConfig();
+bool ProgramStore::update(size_t i, const Program &p) {
+  int slot = allocSlot(); // kann Einträge verschieben, erst danach lesen
+  if(slot<0) return false;
+  ProgramRecord r;
+  encode(p, r);
+  r.seq   = ++maxSeq;
+  r.order = base[entries[i].slot].order;
+  if(!writeRecord(slot, r)) return false;
+  kill(entries[i].slot);
+  entries[i] = makeEntry(slot, r);
+  return true;
 }
 
-void togglePumpStatus(int idx) {
+bool ProgramStore::setLastRun(size_t i, time_t t) {
+  Program p = get(i);
+  p.lastRun = t;
+  return update(i, p);
+}
+
+void ProgramStore::erase(size_t i) {
+  kill(entries[i].slot);
+  entries.erase(entries.begin()+i);
+}
+
+// Die ersten n Programme entfernen (z.B. den alten Stand nach einem Import)
+void ProgramStore::eraseFirst(size_t n) {
+  if(n>entries.size()) n = entries.size();
+  for(size_t i=0; i<n; i++) kill(entries[i].slot);
+  entries.erase(entries.begin(), entries.begin()+n);
+}
+
+void ProgramStore::clear() {
+  for(auto &e : entries) kill(e.slot);
+  entries.clear();
+  entries.shrink_to_fit();
+}
+
+
+/* --------------------------------------------------------------------------
+   Speichern/Laden der Konfiguration in SPIFFS
+   --------------------------------------------------------------------------
+   Geschrieben wird direkt aus den Datenstrukturen in einen Print (Datei
+   oder HTTP-Antwort), gelesen mit einem inkrementellen Parser, der nur ein
+   Programm bzw. einen Wert auf einmal im Speicher hält. Die Programme
+   selbst liegen im Programmspeicher; config.json enthält sie nicht mehr,
+   nur der Export. Eine ältere config.json mit Programmen wird beim ersten
+   Start in den leeren Programmspeicher übernommen.
+   -------------------------------------------------------------------------- */
+
+// JSON-String mit Escaping ausgeben
+void writeJsonString(Print &out, const String &s) {
+  out.print('"');
+  for(unsigned int i=0; i<s.length(); i++){
+    char c = s[i];
+    switch(c){
+      case '"':  out.print("\\\""); break;
+      case '\\': out.print("\\\\"); break;
+      case '\n': out.print("\\n");  break;
+      case '\r': out.print("\\r");  break;
+      case '\t': out.print("\\t");  break;
+      default:
+        if((uint8_t)c<0x20){
+          char esc[7];
+          snprintf(esc, sizeof(esc), "\\u%04x", c);
+          out.print(esc);
+        } else {
+          out.print(c);
+        }
+    }
+  }
+  out.print('"');
+}
+
+void writeProgramJson(Print &out, const Program &prog) {
+  out.print("{\"days\":");
+  writeJsonString(out, prog.days);
+  out.print(",\"interval\":");  out.print(prog.interval);
+  out.print(",\"time\":");
+  writeJsonString(out, prog.time);
+  if(!prog.cron.isEmpty()){
+    out.print(",\"cron\":");
+    writeJsonString(out, prog.cron);
+    out.print(",\"anchor\":");  out.print((long)prog.anchor);
+  }
+  out.print(",\"amounts\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print(prog.amounts[i]);
+  }
+  out.print("],\"mode\":");     out.print(prog.mode);
+  out.print(",\"gap\":");       out.print(prog.gapSec);
+  out.print(",\"active\":");    out.print(prog.active ? "true" : "false");
+  out.print(",\"lastRun\":");   out.print((long)prog.lastRun);
+  out.print(",\"id\":");        out.print((unsigned long)prog.id);
+  out.print(",\"version\":");   out.print((unsigned long)prog.version);
+  out.print(",\"origin\":");    out.print((unsigned long)prog.origin);
+  out.print(",\"pumps\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print(prog.pumps[i] ? "true" : "false");
+  }
+  out.print("]}");
+}
+
+// Gesamte Konfiguration als JSON ausgeben
+void writeConfigJson(Print &out, bool withPrograms) {
+  // Zone zuerst, damit die folgenden Lokalzeiten richtig gelesen werden
+  out.print("{\"tz\":");
+  writeJsonString(out, tzRule);
+  out.print(",\"currentDateTime\":");
+  writeJsonString(out, getCurrentDateTime());
+  out.print(",\"utc\":");
+  out.print((long)currentUnixTime);
+
+  out.print(",\"reservoirs\":[");
+  for(size_t i=0; i<reservoirs.size(); i++){
+    const Reservoir &r = reservoirs[i];
+    if(i>0) out.print(',');
+    out.print("{\"name\":");      writeJsonString(out, r.name);
+    out.print(",\"capacity\":");  out.print(r.capacity, 1);
+    out.print(",\"level\":");     out.print(r.level, 1);
+    out.print(",\"reserve\":");   out.print(r.reserve, 1);
+    out.print('}');
+  }
+  out.print("],\"pumpReservoir\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print(pumpReservoir[i]);
+  }
+  out.print(']');
+
+  out.print(",\"pumpStatus\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print(pumpStatus[i] ? "true" : "false");
+  }
+  out.print("],\"pumpFlowRate\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print(pumpFlowRate[i], 4);
+  }
+  out.print("],\"flowSensors\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print("{\"pin\":");  out.print(flowSensorPin[i]);
+    out.print(",\"ppm\":");  out.print(flowPulsesPerMl[i], 3);
+    out.print('}');
+  }
+  out.print(']');
+
+  out.print(",\"currentSense\":[");
+  for(int i=0; i<4; i++){
+    const CurrentBaseline &b = currentBase[i];
+    if(i>0) out.print(',');
+    out.print("{\"pin\":");     out.print(currentSensePin[i]);
+    out.print(",\"mean\":");    out.print(b.mean, 1);
+    out.print(",\"sd\":");      out.print(b.sd, 2);
+    out.print(",\"inrush\":");  out.print(b.inrush, 1);
+    out.print(",\"runs\":");    out.print((unsigned)b.runs);
+    out.print('}');
+  }
+  out.print(']');
+
+  out.print(",\"maintenance\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print("{\"hours\":");  out.print(pumpMaint[i].hours, 1);
+    out.print(",\"ml\":");     out.print(pumpMaint[i].ml, 0);
+    out.print('}');
+  }
+  out.print(']');
+
+  out.print(",\"doseResume\":");
+  out.print(doseResume ? "true" : "false");
+
+  out.print(",\"trace\":");
+  out.print(traceEnabled ? "true" : "false");
+
+  out.print(",\"calButton\":{\"pin\":");
+  out.print(calButtonPin);
+  out.print(",\"pump\":");
+  out.print(calButtonPump);
+  out.print('}');
+
+  out.print(",\"tankSensor\":{\"pin\":");
+  out.print(tankSensorPin);
+  out.print(",\"reservoir\":");
+  out.print(tankSensorReservoir);
+  out.print(",\"table\":[");
+  for(size_t i=0; i<tankGeometry.size(); i++){
+    if(i>0) out.print(',');
+    out.print('[');
+    out.print(tankGeometry[i].raw); out.print(',');
+    out.print(tankGeometry[i].ml, 1);
+    out.print(']');
+  }
+  out.print("]}");
+
+  out.print(",\"sensors\":[");
+  for(size_t i=0; i<sensors.size(); i++){
+    const SensorInput &e = sensors[i];
+    if(i>0) out.print(',');
+    out.print("{\"name\":");     writeJsonString(out, e.name);
+    out.print(",\"kind\":");     out.print(e.kind);
+    out.print(",\"pin\":");      out.print(e.pin);
+    out.print(",\"reg\":");      out.print(e.reg);
+    out.print(",\"scale\":");    out.print(e.scale, 6);
+    out.print(",\"offset\":");   out.print(e.offset, 3);
+    out.print('}');
+  }
+  out.print("],\"triggers\":[");
+  for(size_t i=0; i<triggers.size(); i++){
+    const SensorTrigger &t = triggers[i];
+    if(i>0) out.print(',');
+    out.print("{\"id\":");         out.print(t.id);
+    out.print(",\"sensor\":");     out.print(t.sensor);
+    out.print(",\"below\":");      out.print(t.below ? "true" : "false");
+    out.print(",\"threshold\":");  out.print(t.threshold, 3);
+    out.print(",\"hysteresis\":"); out.print(t.hysteresis, 3);
+    out.print(",\"gap\":");        out.print((unsigned long)t.minGapSec);
+    out.print(",\"cap\":");        out.print(t.dailyCapMl);
+    out.print(",\"program\":");    out.print((unsigned long)t.programId);
+    out.print(",\"active\":");     out.print(t.active ? "true" : "false");
+    out.print(",\"lastFire\":");   out.print((long)t.lastFire);
+    out.print(",\"day\":");        out.print((long)t.day);
+    out.print(",\"dayMl\":");      out.print(t.dayMl);
+    out.print('}');
+  }
+  out.print(']');
+
+  out.print(",\"recipes\":[");
+  for(size_t i=0; i<recipes.size(); i++){
+    const Recipe &r = recipes[i];
+    if(i>0) out.print(',');
+    out.print("{\"id\":");       out.print(r.id);
+    out.print(",\"name\":");     writeJsonString(out, r.name);
+    out.print(",\"steps\":");    writeJsonString(out, r.steps);
+    out.print(",\"cron\":");     writeJsonString(out, r.cron);
+    out.print(",\"active\":");   out.print(r.active ? "true" : "false");
+    out.print(",\"lastRun\":");  out.print((long)r.lastRun);
+    out.print('}');
+  }
+  out.print(']');
+
+  if(withPrograms){
+    out.print(",\"programCount\":");
+    out.print((unsigned long)programs.size());
+    out.print(",\"programs\":[");
+    programs.forEach([&](size_t i, const Program &p){
+      if(i>0) out.print(',');
+      writeProgramJson(out, p);
+    });
+    out.print(']');
+  }
+
+  // Replikation
+  out.print(",\"repl\":{\"enabled\":");
+  out.print(replEnabled ? "true" : "false");
+  out.print(",\"ssid\":");
+  writeJsonString(out, replSsid);
+  // Der Export ist ohne Anmeldung abrufbar: WLAN-Passwort nur in config.json
+  if(!withPrograms){
+    out.print(",\"password\":");
+    writeJsonString(out, replPassword);
+  }
+  out.print(",\"port\":");      out.print(replPort);
+  out.print(",\"clock\":");     out.print((unsigned long)replClock);
+  out.print(",\"tankStamp\":[");
+  out.print((unsigned long)replTankStamp.version); out.print(',');
+  out.print((unsigned long)replTankStamp.origin);
+  out.print("],\"flowStamps\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print('[');
+    out.print((unsigned long)replFlowStamp[i].version); out.print(',');
+    out.print((unsigned long)replFlowStamp[i].origin);
+    out.print(']');
+  }
+  out.print("],\"tombstones\":[");
+  for(size_t i=0; i<replTombstones.size(); i++){
+    ReplTombstone &t = replTombstones[i];
+    if(i>0) out.print(',');
+    out.print('[');
+    out.print((unsigned long)t.id);            out.print(',');
+    out.print((unsigned long)t.stamp.version); out.print(',');
+    out.print((unsigned long)t.stamp.origin);  out.print(',');
+    out.print((unsigned long)t.prog.version);  out.print(',');
+    out.print((unsigned long)t.prog.origin);
+    out.print(']');
+  }
+  out.print("],\"purged\":[");
+  for(size_t i=0; i<replPurged.size(); i++){
+    if(i>0) out.print(',');
+    out.print('[');
+    out.print((unsigned long)replPurged[i].version); out.print(',');
+    out.print((unsigned long)replPurged[i].origin);
+    out.print(']');
+  }
+  out.print("]}}");
+}
+
+// Gepuffertes Schreiben, damit SPIFFS nicht Byte für Byte arbeitet
+class BufferedPrint : public Print {
+public:
+  explicit BufferedPrint(Print &target) : out(target), len(0) {}
+  ~BufferedPrint() { flush(); }
+  size_t write(uint8_t c) override {
+    buf[len++] = c;
+    if(len==sizeof(buf)) flush();
+    return 1;
+  }
+  void flush() override {
+    if(len>0) out.write(buf, len);
+    len = 0;
+  }
+private:
+  Print &out;
+  uint8_t buf[512];
+  size_t len;
+};
+
+bool configDirty = false;
+unsigned long configDirtySince = 0;
+
+bool writeConfigFile(const char *path) {
+  File file = SPIFFS.open(path, FILE_WRITE);
+  if(!file) {
+    LOG_E("Fehler beim Öffnen %s zum Schreiben!", path);
+    return false;
+  }
+  {
+    BufferedPrint out(file);
+    writeConfigJson(out, false);
+  }
+  file.close();
+  return true;
+}
+
+void saveConfig() {
+  configDirty = false;
+
+  // Erst in eine Zwischendatei schreiben und dann umbenennen, damit ein
+  // Stromausfall nie eine halbe config.json hinterlässt. SPIFFS benennt
+  // nicht über eine vorhandene Datei um; fällt der Strom zwischen Löschen
+  // und Umbenennen aus, übernimmt loadConfig() die vollständige
+  // Zwischendatei.
+  if(!writeConfigFile("/config.tmp")) return;
+
+  SPIFFS.remove("/config.json");
+  if(!SPIFFS.rename("/config.tmp", "/config.json")){
+    LOG_E("Fehler beim Umbenennen nach /config.json!");
+    return;
+  }
+  LOG_I("Konfiguration gespeichert.");
+}
+
+// Gesammeltes Speichern für Änderungen, die in schneller Folge eintreffen
+// (Replikation, automatische Nachkalibrierung)
+void markConfigDirty() {
+  configDirty = true;
+  configDirtySince = millis();
+}
+
+void saveConfigIfDirty() {
+  if(configDirty && millis()-configDirtySince>=2000){
+    configDirty = false;
+    saveConfig();
+  }
+}
+
+/* ---- Inkrementeller Parser ---- */
+Program programFromJson(JsonObject p) {
+  Program prog;
+  prog.days     = p["days"]    .as<String>();
+  prog.interval = p["interval"].as<int>();
+  prog.time     = p["time"]    .as<String>();
+  prog.cron     = p["cron"]    | "";
+  prog.anchor   = p["anchor"]  | 0L;
+  prog.mode     = p["mode"]    | 0;
+  prog.gapSec   = p["gap"]     | 0;
+  prog.active   = p["active"]  .as<bool>();
+  prog.lastRun  = p["lastRun"] | 0L;
+  prog.id       = p["id"]      | 0UL;
+  prog.version  = p["version"] | 0UL;
+  prog.origin   = p["origin"]  | 0UL;
+
+  for(int i=0; i<4; i++) prog.pumps[i] = false;
+  JsonArray pa = p["pumps"].as<JsonArray>();
+  if(!pa.isNull()) {
+    for(int i=0; i<4 && i<(int)pa.size(); i++){
+      prog.pumps[i] = pa[i].as<bool>();
+    }
+  }
+  // Ältere Konfigurationen: eine Menge für alle gewählten Pumpen
+  JsonArray am = p["amounts"].as<JsonArray>();
+  int legacy = p["amount"] | 0;
+  for(int i=0; i<4; i++){
+    prog.amounts[i] = am.isNull() ? (prog.pumps[i] ? legacy : 0)
+                                  : (i<(int)am.size() ? am[i].as<int>() : 0);
+  }
+  // Ältere Konfigurationen: /add_program prüfte weder Tage noch Intervall.
+  // Ein Intervall unter 1 lief wöchentlich; unbekannte Tage oder
+  // Leerzeichen ("Mo, Di") fielen beim Abgleich ohnehin weg
+  prog.interval = constrain(prog.interval, 1, 52);
+  compileSchedule(prog);
+  if(prog.cron.isEmpty()) prog.days = daysFromMask(prog.sched.wdays);
+  return prog;
+}
+
+// Prüft ein Programm auf gültige Werte, liefert Fehlertext oder ""
+String validateProgram(const Program &prog) {
+  if(!prog.cron.isEmpty()){
+    if(prog.cron.length()>64) return "Cron-Ausdruck zu lang";
+    ProgramSchedule sched;
+    String err = compileCron(prog.cron, sched);
+    if(!err.isEmpty()) return err;
+  } else {
+    // Check, ob time in HH:MM format gültig ist
+    int hh, mm;
+    if(prog.time.length()!=5 || sscanf(prog.time.c_str(), "%d:%d", &hh, &mm)!=2
+       || hh<0 || hh>23 || mm<0 || mm>59) {
+      return "ungültige Uhrzeit";
+    }
+    // Leere Tage: das Programm läuft nie (wie bei älteren Konfigurationen)
+    String rest = prog.days + ",";
+    int start = prog.days.isEmpty() ? rest.length() : 0;
+    while(start<(int)rest.length()){
+      int idx = rest.indexOf(',', start);
+      String d = rest.substring(start, idx);
+      bool known = false;
+      for(int i=0; i<7; i++){
+        if(d==wdays[i]) { known=true; break; }
+      }
+      if(!known) return "ungültiger Wochentag";
+      start = idx+1;
+    }
+  }
+  if(prog.interval<1 || prog.interval>52) return "ungültiges Intervall";
+  bool anyPump = false;
+  for(int i=0; i<4; i++){
+    if(!prog.pumps[i]) continue;
+    anyPump = true;
+    if(prog.amounts[i]<=0 || prog.amounts[i]>100000) return "ungültige Menge";
+  }
+  if(!anyPump) return "keine Pumpe ausgewählt";
+  if(prog.mode>PROG_SEQUENTIAL) return "ungültiger Modus";
+  if(prog.gapSec>3600) return "ungültige Pause";
+  return "";
+}
+
+// Zerlegt das Konfigurations-JSON Zeichen für Zeichen. Werte der obersten
+// Ebene und einzelne Programme werden gepuffert und dann mit ArduinoJson
+// ausgewertet. Im Modus CFG_VALIDATE wird nur geprüft und gezählt, in
+// CFG_LOAD und CFG_IMPORT werden die Werte direkt übernommen. Beim Import
+// bleiben Laufzeitzustände (Uhrzeit, Pumpenstatus) unangetastet.
+enum ConfigParseMode { CFG_VALIDATE, CFG_LOAD, CFG_IMPORT };
+
+uint32_t replNewProgramId();
+void replStampProgram(Program &prog);
+
+class ConfigStreamParser {
+public:
+  explicit ConfigStreamParser(ConfigParseMode m)
+    : mode(m), state(S_START), keyLen(0), valLen(0), depth(0),
+      inString(false), escape(false), programCount(0), failed(false),
+      takePrograms(m!=CFG_LOAD || ::programs.size()==0), sawTimeZone(false) {}
+
+  bool feed(const uint8_t *data, size_t len) {
+    for(size_t i=0; i<len && !failed; i++) step((char)data[i]);
+    return !failed;
+  }
+
+  bool finish() {
+    if(!failed && state!=S_DONE) fail("unvollständiges JSON");
+    return !failed;
+  }
+
+  size_t programs() const { return programCount; }
+  const String& error() const { return errorText; }
+  // Ohne "tz" stammt die Datei aus der Zeit, als die Uhr Lokalzeit zählte
+  bool hasTimeZone() const { return sawTimeZone; }
+
+private:
+  enum State { S_START, S_KEY_OR_END, S_KEY, S_COLON, S_VALUE_START, S_VALUE,
+               S_AFTER_VALUE, S_LIST_OPEN, S_LIST, S_PROGRAM, S_DONE };
+
+  static const size_t MAX_VALUE = 4096;
+  static const size_t MAX_PROGRAM = 512;
+
+  ConfigParseMode mode;
+  State state;
+  char key[32];
+  size_t keyLen;
+  char val[MAX_VALUE+1];
+  size_t valLen;
+  int depth;
+  bool inString, escape;
+  size_t programCount;
+  bool failed;
+  bool takePrograms; // beim Laden nur zur Übernahme in einen leeren Speicher
+  bool sawTimeZone;
+  String errorText;
+
+  static bool isSpace(char c) {
+    return c==' ' || c=='\n' || c=='\r' || c=='\t';
+  }
+
+  void fail(const String &msg) {
+    if(failed) return;
+    failed = true;
+    errorText = msg;
+  }
+
+  bool capture(char c, size_t limit) {
+    if(valLen>=limit){
+      fail(String("Wert zu groß bei \"")+key+"\"");
+      return false;
+    }
+    val[valLen++] = c;
+    return true;
+  }
+
+  // Verfolgt Strings und Klammertiefe; true, wenn der Wert abgeschlossen ist
+  bool track(char c) {
+    if(inString){
+      if(escape) escape=false;
+      else if(c=='\\') escape=true;
+      else if(c=='"'){ inString=false; return depth==0; }
+      return false;
+    }
+    if(c=='"'){ inString=true; return false; }
+    if(c=='{' || c=='['){ depth++; return false; }
+    if(c=='}' || c==']'){ depth--; return depth==0; }
+    return false;
+  }
+
+  void step(char c) {
+    switch(state){
+      case S_START:
+        if(isSpace(c)) return;
+        if(c=='{') state = S_KEY_OR_END;
+        else fail("Objekt erwartet");
+        return;
+
+      case S_KEY_OR_END:
+        if(isSpace(c) || c==',') return;
+        if(c=='"'){ keyLen=0; state=S_KEY; }
+        else if(c=='}') state = S_DONE;
+        else fail("Schlüssel erwartet");
+        return;
+
+      case S_KEY:
+        if(c=='"'){ key[keyLen]=0; state=S_COLON; }
+        else if(keyLen<sizeof(key)-1) key[keyLen++] = c;
+        return;
+
+      case S_COLON:
+        if(isSpace(c)) return;
+        if(c!=':'){ fail("':' erwartet"); return; }
+        if(strcmp(key, "tz")==0) sawTimeZone = true;
+        state = strcmp(key, "programs")==0 ? S_LIST_OPEN : S_VALUE_START;
+        return;
+
+      case S_VALUE_START:
+        if(isSpace(c)) return;
+        valLen = 0; depth = 0; inString = false; escape = false;
+        state = S_VALUE;
+        // fällt durch, das erste Zeichen gehört zum Wert
+      case S_VALUE:
+        // Einfache Werte enden am nächsten Trenner
+        if(depth==0 && !inString && (c==',' || c=='}' || isSpace(c))){
+          endValue();
+          if(c=='}') state = S_DONE;
+          else if(c==',') state = S_KEY_OR_END;
+          else state = S_AFTER_VALUE;
+          return;
+        }
+        if(!capture(c, MAX_VALUE)) return;
+        if(track(c)){
+          endValue();
+          state = S_AFTER_VALUE;
+        }
+        return;
+
+      case S_AFTER_VALUE:
+        if(isSpace(c)) return;
+        if(c==',') state = S_KEY_OR_END;
+        else if(c=='}') state = S_DONE;
+        else fail("',' oder '}' erwartet");
+        return;
+
+      case S_LIST_OPEN:
+        if(isSpace(c)) return;
+        if(c=='[') state = S_LIST;
+        else fail("Programmliste erwartet");
+        return;
+
+      case S_LIST:
+        if(isSpace(c) || c==',') return;
+        if(c==']'){ state = S_AFTER_VALUE; return; }
+        if(c!='{'){ fail("Programmobjekt erwartet"); return; }
+        valLen = 0; depth = 0; inString = false; escape = false;
+        state = S_PROGRAM;
+        // fällt durch
+      case S_PROGRAM:
+        if(!capture(c, MAX_PROGRAM)) return;
+        if(track(c)){
+          endProgram();
+          state = S_LIST;
+        }
+        return;
+
+      case S_DONE:
+        if(!isSpace(c)) fail("Daten nach Ende des JSON");
+        return;
+    }
+  }
+
+  void endValue() {
+    JsonDocument doc;
+    if(deserializeJson(doc, val, valLen)){
+      fail(String("Ungültiger Wert bei \"")+key+"\"");
+      return;
+    }
+    if(mode!=CFG_VALIDATE) applyConfigValue(key, doc.as<JsonVariant>(), mode);
+  }
+
+  void endProgram() {
+    JsonDocument doc;
+    if(deserializeJson(doc, val, valLen)){
+      fail("Ungültiges Programm Nr. "+String(programCount+1));
+      return;
+    }
+    Program prog = programFromJson(doc.as<JsonObject>());
+    programCount++;
+    if(mode==CFG_VALIDATE){
+      String err = validateProgram(prog);
+      if(!err.isEmpty()) fail("Programm "+String(programCount)+": "+err);
+    } else if(takePrograms){
+      if(mode==CFG_IMPORT){
+        // Neu stempeln, damit sich der Import bei den Peers durchsetzt
+        if(prog.id==0) prog.id = replNewProgramId();
+        replStampProgram(prog);
+      }
+      if(!::programs.append(prog)) fail("Programmspeicher voll");
+    }
+  }
+
+  static void applyConfigValue(const char *key, JsonVariant v, ConfigParseMode mode);
+};
+
+void ConfigStreamParser::applyConfigValue(const char *key, JsonVariant v,
+                                          ConfigParseMode mode) {
+  bool runtime = (mode==CFG_LOAD);
+  if(strcmp(key, "tankLevel")==0){
+    // Ältere Konfigurationen: ein Tank
+    reservoirs[0].level = v.is<float>() ? v.as<float>() : 0.0f;
+  }
+  else if(strcmp(key, "reservoirs")==0){
+    JsonArray arr = v.as<JsonArray>();
+    if(arr.size()>0) reservoirs.clear();
+    for(JsonObject o : arr){
+      if(reservoirs.size()>=MAX_RESERVOIRS) break;
+      Reservoir r;
+      r.name     = o["name"]     | "";
+      r.capacity = o["capacity"] | 0.0f;
+      r.level    = o["level"]    | 0.0f;
+      r.reserve  = o["reserve"]  | 0.0f;
+      if(!reservoirNameValid(r.name)) r.name = "Tank "+String(reservoirs.size()+1);
+      reservoirs.push_back(r);
+    }
+  }
+  else if(strcmp(key, "pumpReservoir")==0){
+    JsonArray arr = v.as<JsonArray>();
+    for(int i=0; i<4 && i<(int)arr.size(); i++){
+      pumpReservoir[i] = arr[i].as<int>();
+    }
+  }
+  else if(strcmp(key, "tz")==0){
+    if(!tzSetRule(v.as<String>())) LOG_W("Ungültige Zeitzone: %s", v.as<const char*>());
+  }
+  else if(strcmp(key, "currentDateTime")==0){
+    if(runtime && v.is<const char*>()){
+      time_t t = stringToUnixTime(v.as<String>());
+      if(t>0) currentUnixTime = t;
+    }
+  }
+  else if(strcmp(key, "utc")==0){
+    if(runtime) currentUnixTime = v.as<long>();
+  }
+  else if(runtime && strcmp(key, "pumpStatus")==0){
+    JsonArray arr = v.as<JsonArray>();
+    for(int i=0; i<4 && i<(int)arr.size(); i++){
+      pumpStatus[i] = arr[i].as<bool>();
+    }
+  }
+  else if(strcmp(key, "pumpFlowRate")==0){
+    JsonArray arr = v.as<JsonArray>();
+    for(int i=0; i<4 && i<(int)arr.size(); i++){
+      pumpFlowRate[i] = arr[i].as<float>();
+    }
+  }
+  else if(strcmp(key, "flowSensors")==0){
+    JsonArray arr = v.as<JsonArray>();
+    for(int i=0; i<4 && i<(int)arr.size(); i++){
+      flowSensorPin[i]   = arr[i]["pin"] | -1;
+      flowPulsesPerMl[i] = arr[i]["ppm"] | 0.0f;
+    }
+  }
+  else if(strcmp(key, "currentSense")==0){
+    JsonArray arr = v.as<JsonArray>();
+    for(int i=0; i<4 && i<(int)arr.size(); i++){
+      currentSensePin[i]     = arr[i]["pin"]    | -1;
+      currentBase[i].mean    = arr[i]["mean"]   | 0.0f;
+      currentBase[i].sd      = arr[i]["sd"]     | 0.0f;
+      currentBase[i].inrush  = arr[i]["inrush"] | 0.0f;
+      currentBase[i].runs    = arr[i]["runs"]   | 0;
+    }
+  }
+  else if(strcmp(key, "maintenance")==0){
+    JsonArray arr = v.as<JsonArray>();
+    for(int i=0; i<4 && i<(int)arr.size(); i++){
+      pumpMaint[i].hours = arr[i]["hours"] | 0.0f;
+      pumpMaint[i].ml    = arr[i]["ml"]    | 0.0f;
+    }
+  }
+  else if(strcmp(key, "doseResume")==0){
+    doseResume = v.as<bool>();
+  }
+  else if(strcmp(key, "trace")==0){
+    if(runtime) traceEnabled = v.as<bool>(); // Ringdatei gehört zum Gerät
+  }
+  else if(strcmp(key, "calButton")==0){
+    int pump = v["pump"] | 0;
+    calButtonPin  = v["pin"] | -1;
+    calButtonPump = pump>=0 && pump<4 ? pump : 0;
+  }
+  else if(strcmp(key, "tankSensor")==0){
+    tankSensorPin = v["pin"] | -1;
+    tankSensorReservoir = v["reservoir"] | 0;
+    tankGeometry.clear();
+    for (JsonVariant e : v["table"].as<JsonArray>()) {
+      TankGeometryPoint p = {e[0].as<uint16_t>(), e[1].as<float>()};
+      tankGeometry.push_back(p);
+    }
+    std::sort(tankGeometry.begin(), tankGeometry.end(),
+              [](const TankGeometryPoint &a, const TankGeometryPoint &b){ return a.raw<b.raw; });
+  }
+  else if(strcmp(key, "sensors")==0){
+    sensors.clear();
+    for(JsonObject o : v.as<JsonArray>()){
+      if(sensors.size()>=MAX_SENSORS) break;
+      SensorInput e;
+      e.name   = o["name"]   | "";
+      e.kind   = o["kind"]   | 0;
+      e.pin    = o["pin"]    | -1;
+      e.reg    = o["reg"]    | 0;
+      e.scale  = o["scale"]  | 1.0f;
+      e.offset = o["offset"] | 0.0f;
+      if(e.kind>SENSOR_SIM || !reservoirNameValid(e.name)) continue;
+      sensors.push_back(e);
+    }
+  }
+  else if(strcmp(key, "triggers")==0){
+    triggers.clear();
+    for(JsonObject o : v.as<JsonArray>()){
+      if(triggers.size()>=MAX_TRIGGERS) break;
+      SensorTrigger t = {};
+      t.id         = o["id"]         | 0;
+      t.sensor     = o["sensor"]     | 0;
+      t.below      = o["below"]      | true;
+      t.threshold  = o["threshold"]  | 0.0f;
+      t.hysteresis = o["hysteresis"] | 0.0f;
+      t.minGapSec  = o["gap"]        | 0UL;
+      t.dailyCapMl = o["cap"]        | 0;
+      t.programId  = o["program"]    | 0UL;
+      t.active     = o["active"]     | false;
+      if(runtime){
+        t.lastFire = o["lastFire"]   | 0L;
+        t.day      = o["day"]        | 0L;
+        t.dayMl    = o["dayMl"]      | 0;
+      }
+      if(t.id==0 || t.hysteresis<0) continue;
+      triggers.push_back(t);
+    }
+  }
+  else if(strcmp(key, "recipes")==0){
+    recipes.clear();
+    for(JsonObject o : v.as<JsonArray>()){
+      if(recipes.size()>=MAX_RECIPES) break;
+      Recipe r;
+      r.id      = o["id"]      | 0;
+      r.name    = o["name"]    | "";
+      r.steps   = o["steps"]   | "";
+      r.cron    = o["cron"]    | "";
+      r.active  = o["active"]  | false;
+      r.lastRun = o["lastRun"] | 0L;
+      r.sched.valid = false;
+      if(!r.cron.isEmpty()) compileCron(r.cron, r.sched);
+      if(r.id==0 || !reservoirNameValid(r.name)) continue;
+      recipes.push_back(r);
+    }
+  }
+  else if(strcmp(key, "repl")==0){
+    JsonObject r = v.as<JsonObject>();
+    replEnabled  = r["enabled"]  | false;
+    replSsid     = r["ssid"]     | "";
+    // Fehlt im Export: bisheriges Passwort behalten
+    if(!r["password"].isNull()) replPassword = r["password"].as<String>();
+    replPort     = r["port"]     | 4210;
+    uint32_t clock = r["clock"]  | 0UL;
+    if(runtime || clock>replClock) replClock = clock;
+
+    JsonArray ts = r["tankStamp"].as<JsonArray>();
+    if(!ts.isNull() && ts.size()==2) {
+      replTankStamp.version = ts[0].as<uint32_t>();
+      replTankStamp.origin  = ts[1].as<uint32_t>();
+    }
+
+    JsonArray fs = r["flowStamps"].as<JsonArray>();
+    if(!fs.isNull()) {
+      for(int i=0; i<4 && i<(int)fs.size(); i++){
+        replFlowStamp[i].version = fs[i][0].as<uint32_t>();
+        replFlowStamp[i].origin  = fs[i][1].as<uint32_t>();
+      }
+    }
+
+    replTombstones.clear();
+    JsonArray tomb = r["tombstones"].as<JsonArray>();
+    if(!tomb.isNull()) {
+      for (JsonVariant e : tomb) {
+        ReplTombstone t;
+        t.id            = e[0].as<uint32_t>();
+        t.stamp.version = e[1].as<uint32_t>();
+        t.stamp.origin  = e[2].as<uint32_t>();
+        t.prog.version  = e[3] | 0UL;
+        t.prog.origin   = e[4] | 0UL;
+        replTombstones.push_back(t);
+      }
+    }
+    replPurged.clear();
+    JsonArray purged = r["purged"].as<JsonArray>();
+    if(!purged.isNull()) {
+      for (JsonVariant e : purged) {
+        if(replPurged.size()>=REPL_MAX_PURGED) break;
+        replPurged.push_back({e[0].as<uint32_t>(), e[1].as<uint32_t>()});
+      }
+    }
+  }
+  // unbekannte Schlüssel werden ignoriert
+}
+
+// Datei blockweise durch den Parser schicken
+bool parseConfigFile(const char *path, ConfigStreamParser &parser) {
+  File file = SPIFFS.open(path, FILE_READ);
+  if(!file) return false;
+  uint8_t buf[256];
+  while(true){
+    size_t n = file.read(buf, sizeof(buf));
+    if(n==0) break;
+    if(!parser.feed(buf, n)) break;
+  }
+  file.close();
+  return parser.finish();
+}
+
+void loadConfig() {
+  if(!SPIFFS.exists("/config.json") && SPIFFS.exists("/config.tmp")){
+    LOG_W("config.json fehlt, übernehme /config.tmp vom letzten Speichern");
+    SPIFFS.rename("/config.tmp", "/config.json");
+  }
+  if(!SPIFFS.exists("/config.json")){
+    LOG_I("Keine config.json, Standardwerte");
+    return;
+  }
+
+  bool migrate = programs.size()==0;
+  ConfigStreamParser *parser = new ConfigStreamParser(CFG_LOAD);
+  bool ok = parseConfigFile("/config.json", *parser);
+  if(!ok) {
+    LOG_E("Fehler beim Parsen der config.json: %s", parser->error().c_str());
+  } else {
+    LOG_I("Konfiguration geladen.");
+  }
+  if(ok && migrate && parser->programs()>0){
+    // Programme aus einer älteren config.json sind jetzt im Programmspeicher
+    LOG_I("%u Programme in den Programmspeicher übernommen", (unsigned)parser->programs());
+    if(!parser->hasTimeZone()){
+      // Letzte Läufe wurden in Lokalzeit gespeichert; ohne Umrechnung läge
+      // rerunAllowedAt() in der Sommerzeit eine Stunde hinter dem nächsten
+      // Wochentermin und jedes Programm setzte eine Woche aus
+      for(size_t i=0; i<programs.size(); i++){
+        time_t local = programs.record(i).lastRun;
+        if(local>0) programs.setLastRun(i, tzToUtc(local));
+      }
+    }
+    saveConfig();
+  }
+  delete parser;
+}
+
+
+/* --------------------------------------------------------------------------
+   Replikation zwischen mehreren Steuerungen
+   --------------------------------------------------------------------------
+   Änderungen an Programmen, Tankstand und Kalibrierung gehen als kompakte
+   Binär-Deltas per Datagramm an alle anderen Knoten. Ein periodischer
+   Digest (Prüfsumme über den Gesamtstand) erkennt Abweichungen, z.B. nach
+   einem Wiederverbinden; dann sendet jeder Knoten seinen vollständigen
+   Stand (Anti-Entropy). Das Zusammenführen ist idempotent.
+   -------------------------------------------------------------------------- */
+
+// Austauschbarer Datagramm-Transport (auf dem Gerät: WiFi-UDP-Broadcast)
+class DatagramTransport {
+public:
+  virtual ~DatagramTransport() {}
+  virtual bool begin(uint16_t port) = 0;
+  virtual bool linkUp() = 0;
+  virtual bool broadcast(const uint8_t *buf, size_t len) = 0;
+  // Länge des nächsten Datagramms, 0 wenn keins vorliegt
+  virtual size_t receive(uint8_t *buf, size_t maxLen) = 0;
+  // Kam das zuletzt empfangene Datagramm vom eigenen Gerät (Echo)?
+  virtual bool receivedFromSelf() { return false; }
+};
+
+class WiFiUdpTransport : public DatagramTransport {
+public:
+  bool begin(uint16_t p) override {
+    port = p;
+    return udp.begin(p)==1;
+  }
+  bool linkUp() override {
+    return WiFi.status()==WL_CONNECTED;
+  }
+  bool broadcast(const uint8_t *buf, size_t len) override {
+    if(!udp.beginPacket(WiFi.broadcastIP(), port)) return false;
+    udp.write(buf, len);
+    return udp.endPacket()==1;
+  }
+  size_t receive(uint8_t *buf, size_t maxLen) override {
+    int n = udp.parsePacket();
+    if(n<=0) return 0;
+    int got = udp.read(buf, maxLen);
+    // Zu große Datagramme verwerfen
+    if(n>(int)maxLen || got<=0) return 0;
+    return (size_t)got;
+  }
+  bool receivedFromSelf() override {
+    return udp.remoteIP()==WiFi.localIP();
+  }
+private:
+  WiFiUDP udp;
+  uint16_t port = 0;
+};
+
+WiFiUdpTransport replUdp;
+DatagramTransport *replTransport = &replUdp;
+
+// Datagramm: magic(2) proto(1) node(4) clock(4), danach Records
+// type(1) len(1) payload(len)
+const uint8_t REPL_MAGIC0 = 'P';
+const uint8_t REPL_MAGIC1 = 'M';
+const uint8_t REPL_PROTO  = 1;
+const size_t  REPL_MTU    = 1200;
+
+enum ReplRecordType : uint8_t {
+  REPL_PROGRAM = 1,
+  REPL_DELETE  = 2,
+  REPL_TANK    = 3,
+  REPL_FLOW    = 4,
+  REPL_DIGEST  = 5,
+  REPL_RESERVOIR = 6  // Stammdaten und Stand eines Behälters, siehe replPutTank
+};
+
+struct ReplPeer {
+  uint32_t node;
+  unsigned long lastSeen;
+  uint32_t digest;
+  bool inSync;
+  unsigned long mismatchSince;  // millis() der ersten Abweichung
+  unsigned long lastConvergeMs; // Dauer bis zur letzten Übereinstimmung
+  uint32_t syncedClock;         // replClock beim letzten gleichen Digest
+};
+
+const size_t REPL_MAX_PEERS = 8;
+std::vector<ReplPeer> replPeers;
+
+unsigned long replTxBytes = 0, replRxBytes = 0;
+unsigned long replTxPackets = 0, replRxPackets = 0;
+
+bool replLinkWasUp = false;
+unsigned long replLastDigest = 0;
+unsigned long replLastFullSync = 0;
+bool replSyncPending = false;
+size_t replSyncPos = 0;
+
+bool replNewer(const ReplStamp &a, const ReplStamp &b) {
+  if(a.version!=b.version) return a.version>b.version;
+  return a.origin>b.origin;
+}
+
+ReplStamp replNextStamp() {
+  ReplStamp st = {++replClock, replNodeId};
+  return st;
+}
+
+void replStampProgram(Program &prog) {
+  ReplStamp st = replNextStamp();
+  prog.version = st.version;
+  prog.origin  = st.origin;
+}
+
+int findProgramById(uint32_t id) {
+  for(size_t i=0; i<programs.size(); i++){
+    if(programs.record(i).id==id) return (int)i;
+  }
+  return -1;
+}
+
+uint32_t replNewProgramId() {
+  while(true){
+    uint32_t id = esp_random();
+    if(id==0) continue;
+    if(findProgramById(id)<0) return id;
+  }
+}
+
+// Ein Tombstone ist bestätigt, wenn jeder bekannte Knoten seit dem Löschen
+// einmal denselben Digest gemeldet hat, das Programm also nicht mehr hat
+bool replTombstoneAcked(const ReplTombstone &t) {
+  if(replPeers.empty()) return false;
+  for(auto &p : replPeers){
+    if(p.syncedClock<t.stamp.version) return false;
+  }
+  return true;
+}
+
+// Höchsten entfernten Programmstand je Ursprungsknoten merken. Ein Knoten
+// stempelt neue Programme immer über seinen bisherigen Stand, ein neues
+// Programm liegt also stets darüber.
+void replPurgeStamp(const ReplStamp &prog) {
+  if(prog.origin==0) return; // Stand unbekannt
+  for(auto &w : replPurged){
+    if(w.origin==prog.origin){
+      if(prog.version>w.version) w.version = prog.version;
+      return;
+    }
+  }
+  if(replPurged.size()>=REPL_MAX_PURGED) replPurged.erase(replPurged.begin());
+  replPurged.push_back(prog);
+}
+
+// Wurde ein Programm mit diesem Stand schon einmal gelöscht und vergessen?
+bool replPurgedBefore(const ReplStamp &st) {
+  for(auto &w : replPurged){
+    if(w.origin==st.origin) return st.version<=w.version;
+  }
+  return false;
+}
+
+// Über REPL_MAX_TOMBSTONES fallen bestätigte Tombstones weg (ältester
+// zuerst), erst über REPL_HARD_TOMBSTONES auch unbestätigte. Ein Knoten, der
+// lange fort war oder aus replPeers verdrängt wurde, könnte ein so
+// vergessenes Programm noch haben: replApplyProgram() nimmt daher von
+// dessen Ursprungsknoten keine unbekannten Programme bis zum vergessenen
+// Stand an (replPurgedBefore).
+void replTrimTombstones() {
+  while(replTombstones.size()>REPL_MAX_TOMBSTONES){
+    size_t k = 0;
+    while(k<replTombstones.size() && !replTombstoneAcked(replTombstones[k])) k++;
+    if(k==replTombstones.size()){
+      if(replTombstones.size()<=REPL_HARD_TOMBSTONES) return;
+      k = 0;
+    }
+    replPurgeStamp(replTombstones[k].prog);
+    replTombstones.erase(replTombstones.begin()+k);
+  }
+}
+
+void replAddTombstone(uint32_t id, const ReplStamp &st, const ReplStamp &prog) {
+  for(auto &t : replTombstones){
+    if(t.id==id){
+      if(replNewer(st, t.stamp)) t.stamp = st;
+      if(t.prog.origin==0) t.prog = prog;
+      return;
+    }
+  }
+  ReplTombstone t = {id, st, prog};
+  replTombstones.push_back(t);
+  replTrimTombstones();
+}
+
+// Prüfsumme über alle Programme und Register, unabhängig von der Reihenfolge
+uint32_t replDigest() {
+  auto mix = [](uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t h = 2166136261u;
+    h = (h ^ a) * 16777619u;
+    h = (h ^ b) * 16777619u;
+    h = (h ^ c) * 16777619u;
+    return h;
+  };
+  uint32_t d = programs.size();
+  for(size_t i=0; i<programs.size(); i++){
+    const ProgramRecord &r = programs.record(i);
+    d ^= mix(r.id, r.version, r.origin);
+  }
+  d ^= mix(0xFFFFFFF0u, replTankStamp.version, replTankStamp.origin);
+  for(int i=0; i<4; i++){
+    d ^= mix(0xFFFFFFF1u+i, replFlowStamp[i].version, replFlowStamp[i].origin);
+  }
+  return d;
+}
+
+/* ---- Kodierung ---- */
+struct ReplWriter {
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+
+  void u8(uint8_t v)   { buf[len++] = v; }
+  void u16(uint16_t v) { u8(v & 0xFF); u8(v >> 8); }
+  void u32(uint32_t v) { u16(v & 0xFFFF); u16(v >> 16); }
+  void f32(float v)    { uint32_t u; memcpy(&u, &v, 4); u32(u); }
+  void str(const String &s) {
+    size_t n = s.length() > 64 ? 64 : s.length();
+    u8((uint8_t)n);
+    memcpy(buf+len, s.c_str(), n);
+    len += n;
+  }
+};
+
+struct ReplReader {
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+  bool ok;
+
+  bool need(size_t n) {
+    if(pos+n>len) ok=false;
+    return ok;
+  }
+  uint8_t u8()   { return need(1) ? buf[pos++] : 0; }
+  uint16_t u16() { uint16_t lo=u8(); return lo | ((uint16_t)u8() << 8); }
+  uint32_t u32() { uint32_t lo=u16(); return lo | ((uint32_t)u16() << 16); }
+  float f32()    { uint32_t u=u32(); float v; memcpy(&v, &u, 4); return v; }
+  String str() {
+    size_t n = u8();
+    if(!need(n)) return "";
+    char tmp[65];
+    memcpy(tmp, buf+pos, n);
+    tmp[n] = 0;
+    pos += n;
+    return String(tmp);
+  }
+};
+
+void replBeginPacket(ReplWriter &w) {
+  w.len = 0;
+  w.u8(REPL_MAGIC0);
+  w.u8(REPL_MAGIC1);
+  w.u8(REPL_PROTO);
+  w.u32(replNodeId);
+  w.u32(replClock);
+}
+
+// Maximale Recordgröße: Programm mit 64 Zeichen Tagen, Zeit und Cron-Ausdruck
+const size_t REPL_MAX_RECORD = 2 + 4*3 + 1 + 1 + 2 + 4 + 65 + 65 + 4*4 + 1 + 2 + 65 + 4;
+
+void replPutProgram(ReplWriter &w, const Program &p) {
+  w.u8(REPL_PROGRAM);
+  size_t lenPos = w.len;
+  w.u8(0);
+  w.u32(p.id);
+  w.u32(p.version);
+  w.u32(p.origin);
+  w.u8(p.active ? 1 : 0);
+  uint8_t mask = 0;
+  for(int i=0; i<4; i++) if(p.pumps[i]) mask |= (1<<i);
+  w.u8(mask);
+  w.u16((uint16_t)p.interval);
+  // Einzelmenge für Knoten mit älterer Firmware
+  int legacy = 0;
+  for(int i=0; i<4; i++) if(p.pumps[i] && p.amounts[i]>legacy) legacy = p.amounts[i];
+  w.u32((uint32_t)legacy);
+  w.str(p.time);
+  w.str(p.days);
+  for(int i=0; i<4; i++) w.u32((uint32_t)p.amounts[i]);
+  w.u8(p.mode);
+  w.u16(p.gapSec);
+  w.str(p.cron);
+  w.u32((uint32_t)p.anchor);
+  w.buf[lenPos] = (uint8_t)(w.len - lenPos - 1);
+}
+
+void replPutDelete(ReplWriter &w, uint32_t id, const ReplStamp &st) {
+  w.u8(REPL_DELETE);
+  w.u8(12);
+  w.u32(id);
+  w.u32(st.version);
+  w.u32(st.origin);
+}
+
+void replPutReservoir(ReplWriter &w, size_t i) {
+  const Reservoir &r = reservoirs[i];
+  w.u8(REPL_RESERVOIR);
+  size_t lenPos = w.len;
+  w.u8(0);
+  w.u32(replTankStamp.version);
+  w.u32(replTankStamp.origin);
+  w.u8((uint8_t)reservoirs.size());
+  w.u8((uint8_t)i);
+  w.str(r.name);
+  w.f32(r.capacity);
+  w.f32(r.reserve);
+  w.f32(r.level);
+  uint8_t mask = 0; // Pumpen, die aus diesem Behälter fördern
+  for(int p=0; p<4; p++) if(pumpTankIndex(p)==(int)i) mask |= (1<<p);
+  w.u8(mask);
+  w.buf[lenPos] = (uint8_t)(w.len - lenPos - 1);
+}
+
+// Erster Stand für Knoten mit älterer Firmware, dann alle Stände nach
+// Index. Neuere Knoten lesen stattdessen die folgenden REPL_RESERVOIR-
+// Records (Name, Größe, Reserve, Stand, Pumpen) und übernehmen die Liste
+// als Ganzes, sobald alle Behälter eines Stempels da sind.
+void replPutTank(ReplWriter &w) {
+  w.u8(REPL_TANK);
+  w.u8((uint8_t)(14 + 4*reservoirs.size()));
+  w.u32(replTankStamp.version);
+  w.u32(replTankStamp.origin);
+  w.f32(reservoirs[0].level);
+  w.u8((uint8_t)reservoirs.size());
+  for(auto &r : reservoirs) w.f32(r.level);
+  w.u8(1); // REPL_RESERVOIR folgen
+  for(size_t i=0; i<reservoirs.size(); i++) replPutReservoir(w, i);
+}
+
+void replPutFlow(ReplWriter &w, int i) {
+  w.u8(REPL_FLOW);
+  w.u8(13);
+  w.u8((uint8_t)i);
+  w.u32(replFlowStamp[i].version);
+  w.u32(replFlowStamp[i].origin);
+  w.f32(pumpFlowRate[i]);
+}
+
+void replPutDigest(ReplWriter &w) {
+  w.u8(REPL_DIGEST);
+  w.u8(6);
+  w.u32(replDigest());
+  w.u16((uint16_t)programs.size());
+}
+
+bool replReady() {
+  return replEnabled && replTransport->linkUp();
+}
+
+void replSend(ReplWriter &w) {
+  if(replTransport->broadcast(w.buf, w.len)){
+    replTxBytes += w.len;
+    replTxPackets++;
+  }
+}
+
+void replSendProgram(const Program &p) {
+  if(!replReady()) return;
+  uint8_t buf[REPL_MTU];
+  ReplWriter w = {buf, sizeof(buf), 0};
+  replBeginPacket(w);
+  replPutProgram(w, p);
+  replSend(w);
+}
+
+void replSendDelete(uint32_t id, const ReplStamp &st) {
+  if(!replReady()) return;
+  uint8_t buf[64];
+  ReplWriter w = {buf, sizeof(buf), 0};
+  replBeginPacket(w);
+  replPutDelete(w, id, st);
+  replSend(w);
+}
+
+void replSendTank() {
+  if(!replReady()) return;
+  uint8_t buf[REPL_MTU];
+  ReplWriter w = {buf, sizeof(buf), 0};
+  replBeginPacket(w);
+  replPutTank(w);
+  replSend(w);
+}
+
+void replSendFlow(int i) {
+  if(!replReady()) return;
+  uint8_t buf[64];
+  ReplWriter w = {buf, sizeof(buf), 0};
+  replBeginPacket(w);
+  replPutFlow(w, i);
+  replSend(w);
+}
+
+void replSendDigest() {
+  uint8_t buf[64];
+  ReplWriter w = {buf, sizeof(buf), 0};
+  replBeginPacket(w);
+  replPutDigest(w);
+  replSend(w);
+  replLastDigest = millis();
+}
+
+// Vollständigen Stand verteilen (Register, Programme, Tombstones),
+// ein Datagramm pro loop()-Durchlauf
+void replScheduleFullSync() {
+  if(replSyncPending) return;
+  if(replLastFullSync!=0 && millis()-replLastFullSync<5000) return;
+  replSyncPending = true;
+  replSyncPos = 0;
+}
+
+void replSendFullSyncChunk() {
+  uint8_t buf[REPL_MTU];
+  ReplWriter w = {buf, sizeof(buf), 0};
+  replBeginPacket(w);
+
+  size_t total = 5 + programs.size() + replTombstones.size();
+  while(replSyncPos<total && w.len+REPL_MAX_RECORD<=w.cap){
+    size_t pos = replSyncPos++;
+    if(pos==0){
+      replPutTank(w); // größer als REPL_MAX_RECORD, steht aber allein am Anfang
+    } else if(pos<5){
+      replPutFlow(w, (int)pos-1);
+    } else if(pos<5+programs.size()){
+      replPutProgram(w, programs.get(pos-5));
+    } else {
+      ReplTombstone &t = replTombstones[pos-5-programs.size()];
+      replPutDelete(w, t.id, t.stamp);
+    }
+  }
+  replSend(w);
+
+  if(replSyncPos>=total){
+    replSyncPending = false;
+    replLastFullSync = millis();
+    // Abschließender Digest, damit die Gegenseite Übereinstimmung feststellt
+    replSendDigest();
+  }
+}
+
+/* ---- Anwenden empfangener Records ---- */
+void replApplyProgram(ReplReader &r) {
+  Program in;
+  in.id      = r.u32();
+  in.version = r.u32();
+  in.origin  = r.u32();
+  in.active  = r.u8()!=0;
+  uint8_t mask = r.u8();
+  for(int i=0; i<4; i++) in.pumps[i] = (mask & (1<<i))!=0;
+  in.interval = constrain((int)r.u16(), 1, 52); // ältere Knoten prüften nicht
+  int legacy  = (int)r.u32();
+  in.time     = r.str();
+  in.days     = r.str();
+  in.lastRun  = 0;
+  if(r.ok && r.pos<r.len){
+    for(int i=0; i<4; i++) in.amounts[i] = (int)r.u32();
+    in.mode   = r.u8();
+    in.gapSec = r.u16();
+  } else {
+    for(int i=0; i<4; i++) in.amounts[i] = in.pumps[i] ? legacy : 0;
+    in.mode   = PROG_PARALLEL;
+    in.gapSec = 0;
+  }
+  in.anchor = 0;
+  if(r.ok && r.pos<r.len){
+    in.cron   = r.str();
+    in.anchor = (time_t)r.u32();
+  }
+  compileSchedule(in);
+  if(!r.ok || in.id==0) return;
+
+  ReplStamp st = {in.version, in.origin};
+  int idx = findProgramById(in.id);
+  if(idx>=0){
+    const ProgramRecord &cur = programs.record(idx);
+    ReplStamp curSt = {cur.version, cur.origin};
+    if(!replNewer(st, curSt)) return;
+    in.lastRun = cur.lastRun; // Ausführungszustand bleibt lokal
+    programs.update(idx, in);
+  } else {
+    for(auto &t : replTombstones){
+      if(t.id==in.id && !replNewer(st, t.stamp)) return;
+    }
+    if(replPurgedBefore(st)){
+      // Nicht neuer als ein gelöschtes Programm desselben Ursprungs, dessen
+      // Tombstone schon vergessen ist: vermutlich wieder eingespielt
+      LOG_D("Replikation: Programm %lx (Stand %lu von %lx) nicht übernommen",
+        (unsigned long)in.id, (unsigned long)in.version, (unsigned long)in.origin);
+      return;
+    }
+    programs.append(in);
+  }
+  markConfigDirty();
+}
+
+void replApplyDelete(ReplReader &r) {
+  uint32_t id = r.u32();
+  ReplStamp st;
+  st.version = r.u32();
+  st.origin  = r.u32();
+  if(!r.ok) return;
+
+  int idx = findProgramById(id);
+  ReplStamp curSt = {0, 0};
+  if(idx>=0){
+    const ProgramRecord &cur = programs.record(idx);
+    curSt = {cur.version, cur.origin};
+    if(!replNewer(st, curSt)) return;
+    programs.erase(idx);
+    markConfigDirty();
+  }
+  replAddTombstone(id, st, curSt);
+}
+
+void replApplyTank(ReplReader &r) {
+  ReplStamp st;
+  st.version = r.u32();
+  st.origin  = r.u32();
+  float levels[MAX_RESERVOIRS];
+  int n = 1;
+  levels[0] = r.f32();
+  if(r.ok && r.pos<r.len){
+    n = r.u8();
+    if(n>MAX_RESERVOIRS) n = MAX_RESERVOIRS;
+    for(int i=0; i<n; i++) levels[i] = r.f32();
+  }
+  // Neuere Knoten schicken die Behälter als REPL_RESERVOIR hinterher
+  bool full = r.ok && r.pos<r.len && r.u8()!=0;
+  if(!r.ok || full || !replNewer(st, replTankStamp)) return;
+  replTankStamp = st;
+  for(int i=0; i<n && i<(int)reservoirs.size(); i++){
+    if(!reservoirMeasured(i)) reservoirs[i].level = levels[i]; // Sensor misst selbst
+  }
+  markConfigDirty();
+}
+
+// Eingehende Behälterliste eines Stempels, bis alle Records da sind
+struct ReplTankIn {
+  ReplStamp stamp;
+  uint8_t count;
+  uint8_t got;                     // Bitmaske der erhaltenen Indizes
+  Reservoir res[MAX_RESERVOIRS];
+  uint8_t pumps[MAX_RESERVOIRS];
+};
+ReplTankIn replTankIn = {};
+
+void replApplyReservoir(ReplReader &r) {
+  ReplStamp st;
+  st.version = r.u32();
+  st.origin  = r.u32();
+  uint8_t count = r.u8();
+  uint8_t idx   = r.u8();
+  Reservoir res;
+  res.name     = r.str();
+  res.capacity = r.f32();
+  res.reserve  = r.f32();
+  res.level    = r.f32();
+  uint8_t pumps = r.u8();
+  if(!r.ok || count==0 || count>MAX_RESERVOIRS || idx>=count) return;
+  if(!replNewer(st, replTankStamp)) return;
+
+  ReplTankIn &in = replTankIn;
+  if(in.stamp.version!=st.version || in.stamp.origin!=st.origin || in.count!=count){
+    in.stamp = st;
+    in.count = count;
+    in.got   = 0;
+  }
+  in.res[idx]   = res;
+  in.pumps[idx] = pumps;
+  in.got |= (1<<idx);
+  if(in.got!=(uint8_t)((1u<<count)-1)) return;
+
+  // Vollständig: Liste übernehmen, den lokalen Sensorbehälter über den
+  // Namen wiederfinden; dessen Stand misst der Sensor hier selbst
+  bool measured = reservoirMeasured(tankSensorReservoir);
+  String sensorTank = tankSensorReservoir<(int)reservoirs.size()
+                    ? reservoirs[tankSensorReservoir].name : String();
+  float sensorLevel = measured ? reservoirs[tankSensorReservoir].level : 0;
+  reservoirs.assign(in.res, in.res+count);
+  tankSensorReservoir = 0;
+  for(int i=0; i<count; i++){
+    if(reservoirs[i].name==sensorTank){ tankSensorReservoir = i; break; }
+  }
+  if(measured) reservoirs[tankSensorReservoir].level = sensorLevel;
+  for(int p=0; p<4; p++){
+    pumpReservoir[p] = 0;
+    for(int i=0; i<count; i++){
+      if(in.pumps[i] & (1<<p)) pumpReservoir[p] = i;
+    }
+  }
+  replTankStamp = st;
+  in.got = 0;
+  markConfigDirty();
+}
+
+void replApplyFlow(ReplReader &r) {
+  int i = r.u8();
+  ReplStamp st;
+  st.version = r.u32();
+  st.origin  = r.u32();
+  float rate = r.f32();
+  if(!r.ok || i<0 || i>3 || !replNewer(st, replFlowStamp[i])) return;
+  replFlowStamp[i] = st;
+  pumpFlowRate[i] = rate;
+  markConfigDirty();
+}
+
+ReplPeer* replPeer(uint32_t node) {
+  for(auto &p : replPeers){
+    if(p.node==node) return &p;
+  }
+  if(replPeers.size()>=REPL_MAX_PEERS){
+    // Am längsten stummen Knoten ersetzen
+    size_t oldest = 0;
+    for(size_t i=1; i<replPeers.size(); i++){
+      if(replPeers[i].lastSeen<replPeers[oldest].lastSeen) oldest=i;
+    }
+    replPeers.erase(replPeers.begin()+oldest);
+  }
+  ReplPeer p = {node, millis(), 0, false, millis(), 0, 0};
+  replPeers.push_back(p);
+  return &replPeers.back();
+}
+
+void replApplyDigest(ReplReader &r, ReplPeer *peer) {
+  uint32_t digest = r.u32();
+  r.u16();
+  if(!r.ok) return;
+  peer->digest = digest;
+  if(digest==replDigest()){
+    peer->syncedClock = replClock;
+    replTrimTombstones();
+    if(!peer->inSync){
+      peer->inSync = true;
+      peer->lastConvergeMs = millis() - peer->mismatchSince;
+    }
+  } else {
+    if(peer->inSync){
+      peer->inSync = false;
+      peer->mismatchSince = millis();
+    }
+    replScheduleFullSync();
+  }
+}
+
+void replHandlePacket(const uint8_t *buf, size_t len) {
+  ReplReader r = {buf, len, 0, true};
+  if(r.u8()!=REPL_MAGIC0 || r.u8()!=REPL_MAGIC1 || r.u8()!=REPL_PROTO) return;
+  uint32_t node  = r.u32();
+  uint32_t clock = r.u32();
+  if(!r.ok) return;
+  if(node==replNodeId){
+    // Eigenes Echo, oder ein anderes Gerät mit derselben Knoten-ID: dessen
+    // Datagramme gingen verloren und Stempel wären nicht mehr eindeutig
+    static unsigned long warnedMs = 0;
+    if(!replTransport->receivedFromSelf()
+       && (warnedMs==0 || millis()-warnedMs>60000)){
+      warnedMs = millis();
+      LOG_W("Replikation: anderer Knoten meldet die eigene ID %lx!", (unsigned long)replNodeId);
+    }
+    return;
+  }
+
+  replRxBytes += len;
+  replRxPackets++;
+  if(clock>replClock) replClock = clock;
+
+  ReplPeer *peer = replPeer(node);
+  peer->lastSeen = millis();
+
+  while(r.ok && r.pos<r.len){
+    uint8_t type = r.u8();
+    uint8_t rlen = r.u8();
+    if(!r.need(rlen)) break;
+    ReplReader rec = {buf+r.pos, rlen, 0, true};
+    r.pos += rlen;
+    switch(type){
+      case REPL_PROGRAM: replApplyProgram(rec); break;
+      case REPL_DELETE:  replApplyDelete(rec);  break;
+      case REPL_TANK:    replApplyTank(rec);    break;
+      case REPL_FLOW:    replApplyFlow(rec);    break;
+      case REPL_DIGEST:  replApplyDigest(rec, peer); break;
+      case REPL_RESERVOIR: replApplyReservoir(rec); break;
+      default: break; // unbekannte Records (neuere Version) überspringen
+    }
+  }
+}
+
+/* ---- Start und Hauptschleife ---- */
+void replBegin() {
+  // mac[0] liegt im niedrigsten Byte; mac[0..2] ist der Herstellerteil,
+  // gerätespezifisch sind mac[2..5]
+  replNodeId = (uint32_t)(ESP.getEfuseMac() >> 16);
+  if(replNodeId==0) replNodeId = esp_random();
+
+  // Programme aus alten Konfigurationen bekommen eine ID
+  for(size_t i=0; i<programs.size(); i++){
+    if(programs.record(i).id!=0) continue;
+    Program p = programs.get(i);
+    p.id = replNewProgramId();
+    replStampProgram(p);
+    programs.update(i, p);
+  }
+
+  if(!replEnabled || replSsid.isEmpty()) return;
+  WiFi.begin(replSsid.c_str(), replPassword.c_str());
+  replTransport->begin(replPort);
+  LOG_I("Replikation aktiv, Knoten %lx, Port %u", (unsigned long)replNodeId, (unsigned)replPort);
+}
+
+// WLAN-Station und Transport nach geänderten Replikationseinstellungen
+void replRestart() {
+  if(replEnabled){
+    WiFi.mode(WIFI_AP_STA);
+    replBegin();
+  } else {
+    WiFi.disconnect();
+    WiFi.mode(WIFI_AP);
+  }
+}
+
+void replLoop() {
+  if(!replEnabled) return;
+
+  bool up = replTransport->linkUp();
+  if(up && !replLinkWasUp){
+    // Wiederverbunden: sofort Digest senden (Anti-Entropy)
+    LOG_I("Replikation: Verbindung hergestellt");
+    replSendDigest();
+  }
+  replLinkWasUp = up;
+
+  if(up){
+    uint8_t buf[REPL_MTU];
+    for(int n=0; n<4; n++){
+      size_t len = replTransport->receive(buf, sizeof(buf));
+      if(len==0) break;
+      replHandlePacket(buf, len);
+    }
+
+    if(replSyncPending){
+      replSendFullSyncChunk();
+    } else if(millis()-replLastDigest>=15000){
+      replSendDigest();
+    }
+  }
+}
+
+String replStatusJson() {
+  String json = "{\"enabled\":"+String(replEnabled?"true":"false")
+    +",\"node\":"+String(replNodeId)
+    +",\"clock\":"+String(replClock)
+    +",\"linkUp\":"+String(replTransport->linkUp()?"true":"false")
+    +",\"digest\":"+String(replDigest())
+    +",\"txBytes\":"+String(replTxBytes)
+    +",\"rxBytes\":"+String(replRxBytes)
+    +",\"txPackets\":"+String(replTxPackets)
+    +",\"rxPackets\":"+String(replRxPackets)
+    +",\"peers\":[";
+  for(size_t i=0; i<replPeers.size(); i++){
+    ReplPeer &p = replPeers[i];
+    if(i>0) json += ",";
+    json += "{\"node\":"+String(p.node)
+      +",\"ageMs\":"+String(millis()-p.lastSeen)
+      +",\"inSync\":"+String(p.inSync?"true":"false")
+      +",\"lastConvergeMs\":"+String(p.lastConvergeMs)+"}";
+  }
+  json += "]}";
+  return json;
+}
+
+
+/* --------------------------------------------------------------------------
+   Konfigurations-Export/-Import
+   --------------------------------------------------------------------------
+   Export schreibt das JSON direkt in eine Chunked-Antwort. Import prüft den
+   Upload schon beim Eintreffen und legt ihn in einer Zwischendatei ab; erst
+   wenn alles gültig ist, wird er in einem Schritt übernommen und einmal
+   gespeichert.
+   -------------------------------------------------------------------------- */
+
+void controlLanePoll();
+
+// Print-Ziel, das in Blöcken an den aktuellen HTTP-Client sendet
+// Gesendete Bytes der laufenden Antwort (für /api/stats)
+size_t responseBytes = 0;
+
+class ChunkedResponse : public Print {
+public:
+  ChunkedResponse() : len(0) {}
+  size_t write(uint8_t c) override {
+    buf[len++] = c;
+    if(len==sizeof(buf)) flush();
+    return 1;
+  }
+  void flush() override {
+    if(len>0) server.sendContent((const char*)buf, len);
+    responseBytes += len;
+    len = 0;
+    controlLanePoll(); // wartende Steuerbefehle zwischen zwei Blöcken
+  }
+  void end() {
+    flush();
+    server.sendContent("");
+  }
+private:
+  uint8_t buf[1024];
+  size_t len;
+};
+
+void handleConfigExport() {
+  server.sendHeader("Content-Disposition", "attachment; filename=\"pumpe-config.json\"");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  ChunkedResponse out;
+  writeConfigJson(out, true);
+  out.end();
+}
+
+File importFile;
+ConfigStreamParser *importParser = nullptr;
+String importError;
+
+void handleConfigImportUpload() {
+  HTTPUpload &up = server.upload();
+  switch(up.status){
+    case UPLOAD_FILE_START:
+      importError = "";
+      delete importParser;
+      importParser = new ConfigStreamParser(CFG_VALIDATE);
+      importFile = SPIFFS.open("/import.tmp", FILE_WRITE);
+      if(!importFile) importError = "Zwischendatei konnte nicht angelegt werden";
+      break;
+    case UPLOAD_FILE_WRITE:
+      if(!importError.isEmpty() || !importParser) break;
+      if(!importParser->feed(up.buf, up.currentSize)){
+        importError = importParser->error();
+      } else if(importFile.write(up.buf, up.currentSize)!=up.currentSize){
+        importError = "Flash voll";
+      }
+      break;
+    case UPLOAD_FILE_END:
+      if(importFile) importFile.close();
+      if(importError.isEmpty() && importParser && !importParser->finish()){
+        importError = importParser->error();
+      }
+      break;
+    case UPLOAD_FILE_ABORTED:
+      if(importFile) importFile.close();
+      importError = "Upload abgebrochen";
+      break;
+  }
+}
+
+void triggerRebuild();
+
+// Übernimmt die geprüfte Zwischendatei als neue Konfiguration
+bool applyImportedConfig(size_t count, String &msg) {
+  // Die neuen Programme werden hinter die alten geschrieben und die alten
+  // erst danach entfernt; dafür muss Platz für beide sein
+  size_t old = programs.size();
+  bool replWas = replEnabled;
+  String ssidWas = replSsid, passWas = replPassword;
+  uint16_t portWas = replPort;
+  if(old+count>programs.capacity()){
+    msg = "Zu viele Programme für den Programmspeicher ("+String(count)+
+          " neue und "+String(old)+" bisherige von "+String(programs.capacity())+")";
+    return false;
+  }
+
+  ConfigStreamParser *parser = new ConfigStreamParser(CFG_IMPORT);
+  bool ok = parseConfigFile("/import.tmp", *parser);
+  if(!ok) msg = parser->error();
+  delete parser;
+  if(!ok){
+    // Sollte nach der Prüfung nicht vorkommen: schon übernommene Programme
+    // verwerfen und die Einstellungen aus config.json wieder einlesen. Nicht
+    // über loadConfig(), das auch Uhr und Pumpenstatus zurückstellen würde.
+    while(programs.size()>old) programs.erase(programs.size()-1);
+    ConfigStreamParser *restore = new ConfigStreamParser(CFG_IMPORT);
+    parseConfigFile("/config.json", *restore);
+    delete restore;
+    replEnabled  = replWas;
+    replSsid     = ssidWas;
+    replPassword = passWas;
+    replPort     = portWas;
+    triggerRebuild();
+    return false;
+  }
+
+  // Bisherige Programme, die der Import nicht enthält, bei den Peers
+  // löschen; sonst spielt der folgende Abgleich sie wieder ein
+  std::vector<uint32_t> kept;
+  kept.reserve(programs.size()-old);
+  for(size_t i=old; i<programs.size(); i++) kept.push_back(programs.record(i).id);
+  std::sort(kept.begin(), kept.end());
+  for(size_t i=0; i<old; i++){
+    const ProgramRecord &rec = programs.record(i);
+    if(std::binary_search(kept.begin(), kept.end(), rec.id)) continue;
+    ReplStamp prog = {rec.version, rec.origin};
+    ReplStamp st = replNextStamp();
+    replAddTombstone(rec.id, st, prog);
+    replSendDelete(rec.id, st);
+  }
+  programs.eraseFirst(old);
+  triggerRebuild();
+
+  // Übernommenen Stand neu stempeln, damit er sich bei den Peers durchsetzt
+  // (Programme schon beim Einlesen, siehe endProgram)
+  replTankStamp = replNextStamp();
+  for(int i=0; i<4; i++) replFlowStamp[i] = replNextStamp();
+
+  saveConfig();
+  // Der Import kann die Replikation ein- oder umgeschaltet haben
+  if(replEnabled!=replWas || replSsid!=ssidWas || replPassword!=passWas
+     || replPort!=portWas){
+    replRestart();
+  }
+  replScheduleFullSync();
+  msg = "Import erfolgreich: "+String(programs.size())+" Programme.";
+  return true;
+}
+
+void handleConfigImportDone() {
+  String msg;
+  bool ok = false;
+  if(!importParser){
+    msg = "Keine Datei empfangen";
+  } else if(!importError.isEmpty()){
+    msg = "Import abgelehnt: "+importError;
+  } else {
+    ok = applyImportedConfig(importParser->programs(), msg);
+  }
+  delete importParser;
+  importParser = nullptr;
+  SPIFFS.remove("/import.tmp");
+  if(ok) LOG_I("%s", msg.c_str());
+  else LOG_W("%s", msg.c_str());
+  server.send(ok?200:400, "text/plain", msg);
+}
+
+
+/* --------------------------------------------------------------------------
+   Zeitplan-Vorschau
+   --------------------------------------------------------------------------
+   Berechnet alle künftigen Ausführungen in einem Zeitraum direkt aus dem
+   vorberechneten Zeitplan (Bitmasken, Intervall),
+   ohne Minute für Minute zu simulieren. Die Programme werden über eine
+   Prioritätswarteschlange nach ihrer nächsten Ausführung zusammengeführt.
+   Die Regeln entsprechen checkPrograms().
+   -------------------------------------------------------------------------- */
+// Nächste Ausführung von Zeitplan s ab earliest (einschließlich), -1 wenn
+// keine; prog nur für das Wochenintervall von Cron-Programmen (nullptr =
+// jede Woche)
+time_t nextScheduleFire(const ProgramSchedule &s, const Program *prog, time_t earliest) {
+  if(!s.valid) return -1;
+  // Auf volle Minute aufrunden, dann die lokalen Tage ab dem Vortag prüfen
+  // (Lokalzeit -> UTC mit den Regeln für Lücke und Doppelstunde)
+  earliest = (earliest+59)/60*60;
+  // Ein Cron-Ausdruck wie "0 0 29 2 *" trifft nur alle paar Jahre,
+  // daher bis zu acht Jahre voraus suchen
+  time_t day = tzLocal(earliest)/SECONDS_PER_DAY - 1;
+  for(int k=0; k<8*366+2; k++){
+    time_t d = day+k;
+    LocalTime lt = splitLocal(d*SECONDS_PER_DAY);
+    if(!scheduleDayMatches(s, lt) || (prog && !programWeekMatches(*prog, d))) continue;
+    for(int h=0; h<24; h++){
+      if(!((s.hours >> h) & 1)) continue;
+      time_t hourStart = d*SECONDS_PER_DAY + h*3600;
+      if(tzToUtc(hourStart+3599)<earliest) continue;
+      for(int m=0; m<60; m++){
+        if(!((s.minutes >> m) & 1)) continue;
+        time_t fire = tzToUtc(hourStart + m*60);
+        if(fire>=earliest) return fire;
+      }
+    }
+  }
+  return -1;
+}
+
+// Nächste Ausführung ab t (einschließlich), -1 wenn keine
+time_t nextProgramFire(const Program &prog, time_t t, time_t lastRun) {
+  time_t allowed = rerunAllowedAt(prog, lastRun);
+  return nextScheduleFire(prog.sched, &prog, allowed>t ? allowed : t);
+}
+
+// Nächste Ausführung von Programm i im Programmspeicher, -1 wenn keine oder
+// inaktiv. Programme mit Wochentagen und Uhrzeit werden dafür nicht
+// dekodiert, nur Cron-Programme.
+time_t storedProgramNextFire(size_t i, time_t t) {
+  const ProgramRecord &r = programs.record(i);
+  if(!r.active) return -1;
+  if(r.cron[0]){
+    Program p = programs.get(i);
+    return nextProgramFire(p, t, p.lastRun);
+  }
+  if(r.hour==0xFF) return -1;
+  ProgramSchedule s;
+  s.minutes  = 1ULL<<r.minute;
+  s.hours    = 1UL<<r.hour;
+  s.mdays    = 0xFFFFFFFEUL;
+  s.months   = 0x1FFE;
+  s.wdays    = r.wdays;
+  s.domOrDow = false;
+  s.valid    = r.wdays!=0;
+  Program p;
+  p.interval = r.interval;
+  time_t allowed = rerunAllowedAt(p, r.lastRun);
+  return nextScheduleFire(s, nullptr, allowed>t ? allowed : t);
+}
+
+// Nächste Ausführung je Programm, bis sie verstrichen ist. Die Seitenabfrage
+// der Programmliste braucht sie für jedes passende Programm; ohne den Cache
+// würde jede Seite sie für alle Programme neu suchen (Cron-Programme dazu
+// aus dem Flash dekodieren). Die Seite läuft weiter über alle Programme,
+// aber nur noch über RAM. Jede Änderung am Programmspeicher, an der Zone
+// oder an der Uhr verwirft den Cache.
+std::vector<int32_t> programNextCache; // PROGRAM_NEXT_UNKNOWN = neu suchen
+uint32_t programNextGen = 0;           // programs.changes() beim Anlegen
+const int32_t PROGRAM_NEXT_UNKNOWN = -2;
+
+void programNextFireReset() {
+  programNextCache.clear();
+}
+
+time_t cachedProgramNextFire(size_t i, time_t t) {
+  if(programNextGen!=programs.changes() || programNextCache.size()!=programs.size()){
+    programNextCache.assign(programs.size(), PROGRAM_NEXT_UNKNOWN);
+    programNextGen = programs.changes();
+  }
+  int32_t &next = programNextCache[i];
+  if(next==PROGRAM_NEXT_UNKNOWN || (next>=0 && next<t)){
+    next = (int32_t)storedProgramNextFire(i, t);
+  }
+  return next;
+}
+
+// Voraussichtliche Laufzeit einer Pumpe für ml (0 = unbekannt)
+float estimatedRunSec(int pump, float ml) {
+  return pumpFlowRate[pump]>0 ? ml/pumpFlowRate[pump] : 0;
+}
+
+// Würde runProgram() diese Pumpe starten?
+bool pumpWouldRun(int pump) {
+  return pumpFlowRate[pump]>0 || flowSensorUsable(pump);
+}
+
+struct ScheduleCursor {
+  time_t next;
+  time_t lastRun;
+  size_t idx;
+  bool operator<(const ScheduleCursor &o) const {
+    // std::priority_queue ist ein Max-Heap
+    if(next!=o.next) return next>o.next;
+    return idx>o.idx;
+  }
+};
+
+// Zeitangabe als Unixzeit oder "YYYY-MM-DD HH:MM:SS"
+time_t parseTimeArg(const String &s, time_t fallback) {
+  if(s.isEmpty()) return fallback;
+  if(s.indexOf('-')>0) return stringToUnixTime(s);
+  return (time_t)s.toInt();
+}
+
+void handleSchedule() {
+  time_t from = parseTimeArg(server.arg("from"), currentUnixTime);
+  time_t to   = parseTimeArg(server.arg("to"), from + SECONDS_PER_WEEK);
+  long limit  = server.hasArg("limit") ? server.arg("limit").toInt() : 500;
+  if(limit<1) limit = 1;
+  if(limit>20000) limit = 20000;
+  if(to<from){
+    server.send(400,"text/plain","to liegt vor from");
+    return;
+  }
+
+  uint32_t t0 = micros();
+  std::priority_queue<ScheduleCursor> queue;
+  programs.forEach([&](size_t i, const Program &p){
+    if(!p.active) return;
+    time_t next = nextProgramFire(p, from, p.lastRun);
+    if(next>=0 && next<=to) queue.push({next, p.lastRun, i});
+  });
+
+  // Belegung je Pumpe für die Konflikterkennung
+  time_t busyUntil[4] = {0,0,0,0};
+  long   busyBy[4]    = {-1,-1,-1,-1};
+  std::vector<float> tank;
+  for(auto &r : reservoirs) tank.push_back(r.level);
+  long count = 0;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  ChunkedResponse out;
+
+  // Stände je Behälter als JSON-Array
+  auto printTank = [&](){
+    out.print('[');
+    for(size_t r=0; r<tank.size(); r++){
+      if(r>0) out.print(',');
+      out.print(tank[r], 1);
+    }
+    out.print(']');
+  };
+
+  out.print("{\"from\":");   out.print((long)from);
+  out.print(",\"to\":");     out.print((long)to);
+  out.print(",\"tankStart\":"); printTank();
+  out.print(",\"firings\":[");
+
+  while(!queue.empty() && count<limit){
+    ScheduleCursor c = queue.top();
+    queue.pop();
+    Program p = programs.get(c.idx);
+
+    if(count>0) out.print(',');
+    out.print("{\"time\":");  out.print((long)c.next);
+    out.print(",\"at\":");
+    writeJsonString(out, unixTimeToDayString(c.next));
+    out.print(",\"program\":"); out.print((unsigned long)c.idx);
+    out.print(",\"id\":");      out.print((unsigned long)p.id);
+
+    // Wie runProgram(): gesperrt, wenn ein Behälter unter die Reserve fiele
+    bool blocked = false;
+    for(size_t r=0; r<reservoirs.size(); r++){
+      float draw = programDraw(p, r);
+      if(reservoirs[r].reserve>0 && draw>0 && tank[r]-draw<reservoirs[r].reserve) blocked = true;
+    }
+    out.print(",\"blocked\":"); out.print(blocked ? "true" : "false");
+    out.print(",\"pumps\":[");
+
+    float volume = 0;
+    float offset = 0; // Startversatz der Pumpe im Modus nacheinander
+    bool firstPump = true;
+    String conflicts;
+    for(int k=0; k<4; k++){
+      if(!p.pumps[k] || p.amounts[k]<=0 || !pumpWouldRun(k)) continue;
+      float sec = estimatedRunSec(k, p.amounts[k]);
+      time_t start = c.next + (time_t)offset;
+
+      if(!firstPump) out.print(',');
+      firstPump = false;
+      out.print("{\"pump\":"); out.print(k);
+      out.print(",\"ml\":");   out.print(p.amounts[k]);
+      out.print(",\"startSec\":"); out.print(offset, 1);
+      out.print(",\"sec\":");  out.print(sec, 1);
+      out.print('}');
+      if(p.mode==PROG_SEQUENTIAL) offset += sec + p.gapSec;
+      if(blocked) continue;
+      volume += p.amounts[k];
+      float &level = tank[pumpTankIndex(k)];
+      level -= p.amounts[k];
+      if(level<0) level = 0;
+
+      // Läuft die Pumpe dann noch für ein anderes Programm?
+      if(start<busyUntil[k] && busyBy[k]>=0){
+        if(!conflicts.isEmpty()) conflicts += ",";
+        conflicts += "{\"pump\":"+String(k)+",\"program\":"+String(busyBy[k])+"}";
+      }
+      time_t end = start + (time_t)ceilf(sec);
+      if(end>busyUntil[k]){
+        busyUntil[k] = end;
+        busyBy[k] = (long)c.idx;
+      }
+    }
+
+    out.print("],\"volume\":");   out.print(volume, 0);
+    out.print(",\"mode\":");    out.print(p.mode==PROG_SEQUENTIAL ? "\"sequential\"" : "\"parallel\"");
+    out.print(",\"durationSec\":"); out.print(programDurationSec(p), 1);
+    out.print(",\"conflicts\":["); out.print(conflicts); out.print(']');
+    out.print(",\"tankAfter\":"); printTank();
+    out.print('}');
+    count++;
+
+    time_t next = nextProgramFire(p, c.next+60, c.next);
+    if(next>=0 && next<=to) queue.push({next, c.next, c.idx});
+  }
+
+  out.print("],\"count\":");    out.print(count);
+  out.print(",\"truncated\":"); out.print(queue.empty() ? "false" : "true");
+  out.print(",\"computeUs\":"); out.print((unsigned long)(micros()-t0));
+  out.print('}');
+  out.end();
+}
+
+
+/* --------------------------------------------------------------------------
+   Setter-Funktionen mit automatischer Sicherung
+   -------------------------------------------------------------------------- */
+void traceClock(time_t from, time_t to);
+
+void setCurrentUnixTime(time_t t) {
+  traceClock(currentUnixTime, t);
+  bool newMinute = t/60 != currentUnixTime/60;
+  currentUnixTime = t;
+  lastUpdateMillis = millis();
+  programNextFireReset();
+  if(!newMinute) return; // Minute schon geprüft, config.json unverändert
+  // Aktuelle Minute prüfen, nichts nachholen; geprüfte Minuten nie
+  // zurücknehmen (kleine Schritte zurück übergeht loop())
+  if(t/60-1>lastProgramCheck) lastProgramCheck = t/60 - 1;
+  saveConfig();
+}
+
+// Automatischer Abgleich mit der Browserzeit beim Öffnen der Oberfläche:
+// nur, wenn die Geräteuhr nicht gestellt ist oder deutlich abweicht. Ein
+// Telefon mit falsch gehender Uhr verschiebt so nicht den Zeitplan.
+#define CLOCK_SYNC_MIN_DIFF 300        // s
+#define CLOCK_UNSET_BEFORE  1577836800 // 2020-01-01: Uhr nie gestellt
+
+bool syncCurrentUnixTime(time_t t) {
+  time_t diff = t>currentUnixTime ? t-currentUnixTime : currentUnixTime-t;
+  if(currentUnixTime>=CLOCK_UNSET_BEFORE && diff<=CLOCK_SYNC_MIN_DIFF) return false;
+  setCurrentUnixTime(t);
+  return true;
+}
+
+void setCurrentDateTime(const String &dt) {
+  setCurrentUnixTime(stringToUnixTime(dt));
+}
+
+bool updateTimeZone(const String &rule) {
+  if(!tzSetRule(rule)) return false;
+  programNextFireReset();
+  saveConfig();
+  return true;
+}
+
+void togglePumpStatus(int idx) {
   if(idx<0 || idx>3) return;
 
-  pumpStatus[idx] = !pumpStatus[idx];
-  int pin;
-  switch(idx){
-    case 0: pin = pump1; break;
-    case 1: pin = pump2; break;
-    case 2: pin = pump3; break;
-    default: pin = pump4; break;
+  pumpStatus[idx] = !pumpStatus[idx];
+  pumpRun[idx].active = false; // manuell übersteuert
+  int pin;
+  switch(idx){
+    case 0: pin = pump1; break;
+    case 1: pin = pump2; break;
+    case 2: pin = pump3; break;
+    default: pin = pump4; break;
+  }
+  digitalWrite(pin, pumpStatus[idx]?HIGH:LOW);
+
+  // LED an, falls mind. eine Pumpe an
+  bool anyOn = false;
+  for(int i=0; i<4; i++){
+    if(pumpStatus[i]) { anyOn=true; break; }
+  }
+  digitalWrite(ledpin, anyOn ? HIGH : LOW);
+
+  saveConfig();
+}
+
+void updateProgramActiveState(int idx, bool newState) {
+  if(idx<0 || idx>=(int)programs.size()) return;
+  Program p = programs.get(idx);
+  p.active = newState;
+  replStampProgram(p);
+  programs.update(idx, p);
+  saveConfig();
+  replSendProgram(p);
+}
+
+bool addProgram(const Program &prog) {
+  Program p = prog;
+  compileSchedule(p);
+  p.id = replNewProgramId();
+  replStampProgram(p);
+  if(!programs.append(p)) return false;
+  saveConfig();
+  replSendProgram(p);
+  return true;
+}
+
+void deleteProgram(int idx) {
+  if(idx>=0 && idx<(int)programs.size()){
+    const ProgramRecord &rec = programs.record(idx);
+    uint32_t id = rec.id;
+    ReplStamp prog = {rec.version, rec.origin};
+    ReplStamp st = replNextStamp();
+    programs.erase(idx);
+    replAddTombstone(id, st, prog);
+    saveConfig();
+    replSendDelete(id, st);
+  }
+}
+
+// Rezept neu anlegen (idx<0) oder ersetzen; Schritte sind schon geprüft
+void saveRecipe(int idx, const Recipe &recipe) {
+  Recipe r = recipe;
+  r.sched.valid = false;
+  if(!r.cron.isEmpty()) compileCron(r.cron, r.sched);
+  if(idx<0){
+    uint16_t id = 0;
+    for(auto &e : recipes) if(e.id>id) id = e.id;
+    r.id = id+1;
+    r.lastRun = 0;
+    recipes.push_back(r);
+  } else {
+    r.id = recipes[idx].id;
+    r.lastRun = recipes[idx].lastRun;
+    recipes[idx] = r;
+  }
+  saveConfig();
+}
+
+void updateRecipeActiveState(int idx, bool active) {
+  recipes[idx].active = active;
+  saveConfig();
+}
+
+void deleteRecipe(int idx) {
+  recipes.erase(recipes.begin()+idx);
+  saveConfig();
+}
+
+void updatePumpFlowRate(int p, float rate) {
+  pumpFlowRate[p] = rate;
+  replFlowStamp[p] = replNextStamp();
+  saveConfig();
+  replSendFlow(p);
+}
+
+void updateTankLevel(int r, float level) {
+  reservoirs[r].level = level;
+  replTankStamp = replNextStamp();
+  saveConfig();
+  replSendTank();
+}
+
+void updateReservoir(int r, const String &name, float capacity, float reserve) {
+  reservoirs[r].name     = name;
+  reservoirs[r].capacity = capacity;
+  reservoirs[r].reserve  = reserve;
+  replTankStamp = replNextStamp();
+  saveConfig();
+  replSendTank();
+}
+
+void addReservoir(const String &name, float capacity, float reserve) {
+  Reservoir r = {name, capacity, 0.0f, reserve};
+  reservoirs.push_back(r);
+  replTankStamp = replNextStamp();
+  saveConfig();
+  replSendTank();
+}
+
+// Pumpen und Sensor des entfernten Behälters fallen auf Behälter 1 zurück
+void removeReservoir(int r) {
+  reservoirs.erase(reservoirs.begin()+r);
+  for(int i=0; i<4; i++){
+    if(pumpReservoir[i]==r) pumpReservoir[i] = 0;
+    else if(pumpReservoir[i]>r) pumpReservoir[i]--;
+  }
+  if(tankSensorReservoir==r) tankSensorReservoir = 0;
+  else if(tankSensorReservoir>r) tankSensorReservoir--;
+  replTankStamp = replNextStamp();
+  saveConfig();
+  replSendTank();
+}
+
+void assignPumpReservoir(int pump, int r) {
+  pumpReservoir[pump] = r;
+  replTankStamp = replNextStamp();
+  saveConfig();
+  replSendTank();
+}
+
+void updateDoseResume(bool resume) {
+  doseResume = resume;
+  saveConfig();
+}
+
+void updateReplicationSettings(bool enabled, const String &ssid,
+                               const String &pass, uint16_t port) {
+  replEnabled  = enabled;
+  replSsid     = ssid;
+  replPassword = pass;
+  replPort     = port;
+  saveConfig();
+  replRestart();
+}
+
+/* --------------------------------------------------------------------------
+   ADC-Abtastung im Continuous-/DMA-Modus
+   --------------------------------------------------------------------------
+   ADC1 tastet alle angemeldeten Kanäle per DMA ab. Eine eigene Task mittelt
+   jeden DMA-Block je Kanal und gibt Mittelwert und Spitzenwert an den
+   Verbraucher des Kanals weiter; loop() wird dadurch nicht belastet.
+   Kanäle müssen vor adcBegin() angemeldet werden.
+   -------------------------------------------------------------------------- */
+typedef void (*AdcFrameHandler)(uint16_t mean, uint16_t peak, uint32_t count);
+
+struct AdcChannel {
+  uint8_t channel;         // ADC1-Kanal 0..7
+  AdcFrameHandler handler;
+};
+
+const size_t   ADC_MAX_CHANNELS = 8;
+const uint32_t ADC_SAMPLE_HZ    = 20000;  // Untergrenze des ESP32 im DMA-Modus
+const uint32_t ADC_FRAME_BYTES  = 256 * SOC_ADC_DIGI_RESULT_BYTES;
+
+AdcChannel adcChannels[ADC_MAX_CHANNELS];
+size_t adcChannelCount = 0;
+TaskHandle_t adcTaskHandle = nullptr;
+
+bool adcAddChannel(int pin, AdcFrameHandler handler) {
+  int ch = digitalPinToAnalogChannel(pin);
+  if(ch<0 || ch>7){
+    LOG_E("GPIO %d ist kein ADC1-Pin!", pin);
+    return false;
+  }
+  if(adcChannelCount>=ADC_MAX_CHANNELS || adcTaskHandle) return false;
+  adcChannels[adcChannelCount].channel = (uint8_t)ch;
+  adcChannels[adcChannelCount].handler = handler;
+  adcChannelCount++;
+  return true;
+}
+
+void adcTask(void *) {
+  static uint8_t buf[ADC_FRAME_BYTES];
+  uint32_t sum[8], cnt[8];
+  uint16_t peak[8];
+  while(true){
+    uint32_t got = 0;
+    if(adc_digi_read_bytes(buf, sizeof(buf), &got, 100)!=ESP_OK || got==0){
+      continue;
+    }
+    memset(sum, 0, sizeof(sum));
+    memset(cnt, 0, sizeof(cnt));
+    memset(peak, 0, sizeof(peak));
+    for(uint32_t i=0; i+SOC_ADC_DIGI_RESULT_BYTES<=got; i+=SOC_ADC_DIGI_RESULT_BYTES){
+      adc_digi_output_data_t *d = (adc_digi_output_data_t*)&buf[i];
+      uint8_t ch = d->type1.channel;
+      if(ch>7) continue;
+      uint16_t v = d->type1.data;
+      sum[ch] += v;
+      cnt[ch]++;
+      if(v>peak[ch]) peak[ch] = v;
+    }
+    for(size_t k=0; k<adcChannelCount; k++){
+      uint8_t ch = adcChannels[k].channel;
+      if(cnt[ch]>0) adcChannels[k].handler(sum[ch]/cnt[ch], peak[ch], cnt[ch]);
+    }
+  }
+}
+
+bool adcBegin() {
+  if(adcChannelCount==0) return false;
+
+  adc_digi_init_config_t init = {};
+  init.max_store_buf_size = ADC_FRAME_BYTES*4;
+  init.conv_num_each_intr = ADC_FRAME_BYTES;
+  for(size_t k=0; k<adcChannelCount; k++){
+    init.adc1_chan_mask |= (1 << adcChannels[k].channel);
+  }
+  if(adc_digi_initialize(&init)!=ESP_OK){
+    LOG_E("ADC-DMA konnte nicht initialisiert werden!");
+    return false;
+  }
+
+  static adc_digi_pattern_config_t pattern[ADC_MAX_CHANNELS];
+  for(size_t k=0; k<adcChannelCount; k++){
+    pattern[k].atten     = ADC_ATTEN_DB_11;
+    pattern[k].channel   = adcChannels[k].channel;
+    pattern[k].unit      = 0; // ADC1
+    pattern[k].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  }
+  adc_digi_configuration_t cfg = {};
+  cfg.conv_limit_en  = true;
+  cfg.conv_limit_num = 250;
+  cfg.pattern_num    = adcChannelCount;
+  cfg.adc_pattern    = pattern;
+  cfg.sample_freq_hz = ADC_SAMPLE_HZ;
+  cfg.conv_mode      = ADC_CONV_SINGLE_UNIT_1;
+  cfg.format         = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if(adc_digi_controller_configure(&cfg)!=ESP_OK || adc_digi_start()!=ESP_OK){
+    LOG_E("ADC-DMA konnte nicht gestartet werden!");
+    return false;
+  }
+
+  // Niedrige Priorität auf Kern 0, loop() läuft auf Kern 1
+  xTaskCreatePinnedToCore(adcTask, "adc", 4096, nullptr, 1, &adcTaskHandle, 0);
+  return true;
+}
+
+/* --------------------------------------------------------------------------
+   Tank-Füllstandssensor
+   --------------------------------------------------------------------------
+   Ultraschall- oder Drucksensor mit Analogausgang. Jeder DMA-Block wird per
+   Median über die letzten Blöcke von Ausreißern befreit und danach
+   exponentiell geglättet. Die Geometrietabelle rechnet den Rohwert in ml
+   um; loop() erkennt daraus Nachfüllen und Leckagen.
+   -------------------------------------------------------------------------- */
+const int   TANK_MEDIAN_N        = 15;
+const float TANK_EMA_ALPHA       = 0.05f;
+const int   TANK_HISTORY_MIN     = 30;     // Minutenwerte für die Erkennung
+const float TANK_REFILL_MIN_ML   = 200.0f; // Anstieg in 5 min => nachgefüllt
+const int   TANK_LEAK_WINDOW_MIN = 15;
+const float TANK_LEAK_MIN_ML     = 50.0f;  // Verlust ohne Pumpenlauf => Leck
+
+portMUX_TYPE tankMux = portMUX_INITIALIZER_UNLOCKED;
+uint16_t tankMedianBuf[TANK_MEDIAN_N];
+int tankMedianCount = 0, tankMedianPos = 0;
+float tankEma = 0;
+volatile float tankFilteredRaw = 0;
+volatile uint32_t tankFrames = 0;
+
+struct TankMinute {
+  float ml;
+  bool pumped; // in dieser Minute lief mindestens eine Pumpe
+};
+TankMinute tankHistory[TANK_HISTORY_MIN];
+int tankHistoryCount = 0, tankHistoryPos = 0;
+bool tankPumpedThisMinute = false;
+unsigned long tankLastSecond = 0, tankLastMinute = 0;
+
+bool  tankLeakSuspected = false;
+time_t tankLeakSince = 0;
+time_t tankLastRefill = 0;
+float tankLastRefillMl = 0;
+
+// Aufruf aus der ADC-Task; auch mit aufgezeichneten Rohwerten speisbar
+void tankPipelinePush(uint16_t raw) {
+  tankMedianBuf[tankMedianPos] = raw;
+  tankMedianPos = (tankMedianPos+1) % TANK_MEDIAN_N;
+  if(tankMedianCount<TANK_MEDIAN_N) tankMedianCount++;
+
+  uint16_t sorted[TANK_MEDIAN_N];
+  memcpy(sorted, tankMedianBuf, tankMedianCount*sizeof(uint16_t));
+  std::sort(sorted, sorted+tankMedianCount);
+  float median = sorted[tankMedianCount/2];
+
+  tankEma = (tankFrames==0) ? median : tankEma + TANK_EMA_ALPHA*(median - tankEma);
+  portENTER_CRITICAL(&tankMux);
+  tankFilteredRaw = tankEma;
+  tankFrames = tankFrames + 1;
+  portEXIT_CRITICAL(&tankMux);
+}
+
+void tankAdcFrame(uint16_t mean, uint16_t, uint32_t) {
+  tankPipelinePush(mean);
+}
+
+float tankSensorRaw() {
+  portENTER_CRITICAL(&tankMux);
+  float raw = tankFilteredRaw;
+  portEXIT_CRITICAL(&tankMux);
+  return raw;
+}
+
+bool tankSensorActive() {
+  return tankSensorPin>=0 && tankGeometry.size()>=2 && tankFrames>0;
+}
+
+// Wird der Stand von Behälter r gemessen statt mitgezählt?
+bool reservoirMeasured(int r) {
+  return tankSensorActive() && r==tankSensorReservoir;
+}
+
+// Behälter mit Sensor (ungültige Zuordnung => Behälter 1)
+Reservoir &sensorTank() {
+  int r = tankSensorReservoir;
+  return reservoirs[r>=0 && r<(int)reservoirs.size() ? r : 0];
+}
+
+// Rohwert -> ml, linear zwischen den Tabellenpunkten (aufsteigend nach Rohwert)
+float tankRawToMl(float raw) {
+  size_t n = tankGeometry.size();
+  if(n==0) return 0;
+  if(n==1 || raw<=tankGeometry[0].raw) return tankGeometry[0].ml;
+  if(raw>=tankGeometry[n-1].raw) return tankGeometry[n-1].ml;
+  size_t k = 1;
+  while(k<n-1 && raw>tankGeometry[k].raw) k++;
+  const TankGeometryPoint &a = tankGeometry[k-1];
+  const TankGeometryPoint &b = tankGeometry[k];
+  float t = (raw - a.raw) / (float)(b.raw - a.raw);
+  float ml = a.ml + t*(b.ml - a.ml);
+  return ml<0 ? 0 : ml;
+}
+
+void tankSensorBegin() {
+  if(tankSensorPin<0) return;
+  adcAddChannel(tankSensorPin, tankAdcFrame);
+}
+
+void addTankGeometryPoint(float ml) {
+  uint16_t raw = (uint16_t)tankSensorRaw();
+  // Vorhandenen Punkt mit gleichem Rohwert ersetzen, sonst sortiert einfügen
+  auto it = tankGeometry.begin();
+  while(it!=tankGeometry.end() && it->raw<raw) ++it;
+  if(it!=tankGeometry.end() && it->raw==raw){
+    it->ml = ml;
+  } else {
+    TankGeometryPoint p = {raw, ml};
+    tankGeometry.insert(it, p);
+  }
+  saveConfig();
+}
+
+void clearTankGeometry() {
+  tankGeometry.clear();
+  saveConfig();
+}
+
+void tankDetectEvents(float ml) {
+  // Nachfüllen: deutlicher Anstieg gegenüber dem Minimum der letzten 5 min
+  int look = tankHistoryCount<5 ? tankHistoryCount : 5;
+  float minMl = ml;
+  for(int k=1; k<=look; k++){
+    int idx = (tankHistoryPos - k + TANK_HISTORY_MIN) % TANK_HISTORY_MIN;
+    if(tankHistory[idx].ml<minMl) minMl = tankHistory[idx].ml;
+  }
+  if(ml-minMl>=TANK_REFILL_MIN_ML){
+    tankLastRefill = currentUnixTime;
+    tankLastRefillMl = ml-minMl;
+    tankLeakSuspected = false;
+    tankHistoryCount = 0; // neue Basis nach dem Nachfüllen
+    LOG_I("Tank nachgefüllt: +%.0f ml", tankLastRefillMl);
+    return;
+  }
+
+  // Leck: Verlust über das ganze Fenster, ohne dass eine Pumpe lief
+  if(tankHistoryCount<TANK_LEAK_WINDOW_MIN) return;
+  bool pumped = false;
+  for(int k=1; k<=TANK_LEAK_WINDOW_MIN; k++){
+    int idx = (tankHistoryPos - k + TANK_HISTORY_MIN) % TANK_HISTORY_MIN;
+    pumped |= tankHistory[idx].pumped;
+  }
+  int first = (tankHistoryPos - TANK_LEAK_WINDOW_MIN + TANK_HISTORY_MIN) % TANK_HISTORY_MIN;
+  float lost = tankHistory[first].ml - ml;
+  if(!pumped && lost>=TANK_LEAK_MIN_ML){
+    if(!tankLeakSuspected){
+      tankLeakSuspected = true;
+      tankLeakSince = currentUnixTime;
+      LOG_W("Tankverlust ohne Pumpenlauf: %.0f ml in %d min",
+        lost, (int)TANK_LEAK_WINDOW_MIN);
+    }
+  } else if(lost<TANK_LEAK_MIN_ML/2){
+    tankLeakSuspected = false;
+  }
+}
+
+// Messwert übernehmen (sekündlich) und Ereignisse erkennen (minütlich)
+void tankSensorLoop() {
+  for(int i=0; i<4; i++) tankPumpedThisMinute |= pumpStatus[i];
+  if(!tankSensorActive()) return;
+
+  unsigned long now = millis();
+  if(now-tankLastSecond<1000) return;
+  tankLastSecond = now;
+
+  float ml = tankRawToMl(tankSensorRaw());
+  sensorTank().level = ml;
+
+  if(now-tankLastMinute<60000) return;
+  tankLastMinute = now;
+  tankDetectEvents(ml);
+  tankHistory[tankHistoryPos].ml = ml;
+  tankHistory[tankHistoryPos].pumped = tankPumpedThisMinute;
+  tankHistoryPos = (tankHistoryPos+1) % TANK_HISTORY_MIN;
+  if(tankHistoryCount<TANK_HISTORY_MIN) tankHistoryCount++;
+  tankPumpedThisMinute = false;
+}
+
+// Neustart nach Änderung der ADC-Kanäle (DMA-Muster ist fest)
+unsigned long restartAtMillis = 0;
+
+void updateTankSensorPin(int pin, int reservoir) {
+  tankSensorPin = pin;
+  tankSensorReservoir = reservoir;
+  saveConfig();
+  restartAtMillis = millis() + 1000;
+}
+
+
+/* --------------------------------------------------------------------------
+   Weboberfläche
+   --------------------------------------------------------------------------
+   Eine statische Seite für alle Ansichten (/, /manual, /calibration,
+   /programs, /recipes, /tank, /sensors). Sie wird nicht mehr auf dem Gerät
+   zusammengebaut, sondern unverändert aus dem Flash gesendet und per ETag im
+   Browser zwischengespeichert; alle Daten kommen aus der JSON-API.
+   -------------------------------------------------------------------------- */
+static const char APP_HTML[] PROGMEM = R"=====(<!DOCTYPE html>
+<html>
+<head>
+<meta charset="UTF-8">
+<title>ESP32 Pumpensteuerung</title>
+<meta name="viewport" content="width=device-width,initial-scale=1.0">
+<style>
+  body { font-family: Arial, sans-serif; margin:0; padding:0; text-align:center; }
+  .header {
+    display:flex; justify-content:space-between; align-items:center;
+    background-color:#333; color:white; padding:10px; position:sticky; top:0;
+  }
+  .home-button { color:white; }
+  .header-title { font-size:18px; font-weight:bold; }
+  .header-datetime { font-size:16px; cursor:pointer; }
+  .section { padding:20px; }
+  .page { display:none; }
+  .page.shown { display:block; }
+  .menu-button {
+    display:inline-block; margin:15px; padding:15px 30px; font-size:18px;
+    background-color:green; color:white; border:none; border-radius:10px;
+    text-decoration:none; cursor:pointer;
+  }
+  .menu-button:hover { background-color:darkgreen; }
+  .pump-button {
+    padding:15px 30px; font-size:18px; margin:15px; border:none; border-radius:10px;
+    color:white; cursor:pointer; text-transform:uppercase; min-width:100px;
+  }
+  .pump-button.on  { background-color:green; }
+  .pump-button.off { background-color:red; }
+  .program-block { border:1px solid #ccc; margin:10px; padding:10px; text-align:left; }
+  input, select, textarea {
+    font-size:16px; margin:5px 0; padding:5px; width:80%; max-width:300px;
+    border-radius:5px; border:1px solid #ccc;
+  }
+  input.small { width:70px; }
+  input[type=checkbox] { width:auto; }
+  button, .button {
+    margin:5px; padding:10px 20px; font-size:16px; border-radius:5px; border:none;
+    cursor:pointer;
+  }
+  button:hover { opacity:0.9; }
+  .delete-button   { background-color:red;   color:white; }
+  .activate-button { background-color:blue;  color:white; }
+  .add-program-form { border:1px solid #ccc; padding:10px; margin:10px; text-align:center; }
+  .day-button, .pump-select-button {
+    background-color:#eee; border:1px solid #ccc; border-radius:5px;
+    display:inline-block; margin:5px; padding:10px; cursor:pointer;
+  }
+  .day-button.active, .pump-select-button.active {
+    background-color:green; color:white;
+  }
+  .calibration-info { margin-top:20px; font-size:16px; }
+  .msg {
+    position:fixed; left:10px; right:10px; bottom:10px; padding:10px;
+    border-radius:5px; background:#333; color:white;
+  }
+  .msg.error  { background:#b00; }
+  .msg.hidden { display:none; }
+  #datetime-overlay {
+    position: fixed; top:0; left:0; right:0; bottom:0; background-color: rgba(0,0,0,0.5);
+    display: none; justify-content: center; align-items: center; z-index: 9999;
+  }
+  #datetime-form {
+    background: white; padding: 20px; border-radius:5px; text-align:center;
+  }
+  #datetime-form input {
+    margin: 5px; padding:5px; width:80px;
+  }
+  @media (max-width: 400px) {
+    .menu-button, .pump-button { width:100%; box-sizing:border-box; margin:10px 0; }
+    input, select, textarea { width:90%; }
+  }
+</style>
+</head>
+<body>
+<div class="header">
+  <a href="/" class="home-button" data-nav>
+    <svg xmlns="http://www.w3.org/2000/svg" width="30" height="30" viewBox="0 0 24 24"
+         fill="none" stroke="currentColor" stroke-width="2" stroke-linecap="round"
+         stroke-linejoin="round">
+      <path d="M3 9L12 2L21 9V22H14V15H10V22H3V9Z"></path>
+    </svg>
+  </a>
+  <span class="header-title" id="title"></span>
+  <span id="datetime" class="header-datetime" onclick="showDateTimeForm()"></span>
+</div>
+<div id="datetime-overlay">
+  <div id="datetime-form">
+    <h3>Datum und Uhrzeit einstellen</h3>
+    <p>Bitte geben Sie Tag, Monat, Jahr, Stunde und Minute ein:</p>
+    <div>
+      <label>Tag: <input type="number" id="day" min="1" max="31"></label><br>
+      <label>Monat: <input type="number" id="month" min="1" max="12"></label><br>
+      <label>Jahr: <input type="number" id="year" min="2000" max="2100" value="2025"></label><br>
+      <label>Stunde: <input type="number" id="hour" min="0" max="23"></label><br>
+      <label>Minute: <input type="number" id="minute" min="0" max="59"></label>
+    </div>
+    <button onclick="submitDateTimeForm()">Setzen</button>
+    <p>Zeitzone (POSIX-Regel, z.B. CET-1CEST,M3.5.0,M10.5.0/3):<br>
+      <input type="text" id="tz"><br>
+      <button onclick="submitTimeZone()">Zeitzone setzen</button>
+    </p>
+    <button onclick="cancelDateTimeForm()">Abbrechen</button>
+  </div>
+</div>
+
+<div class="page" data-page="/">
+  <h1>ESP32 Pumpensteuerung</h1>
+  <p>Bitte wählen Sie eine Funktion aus:</p>
+  <div class="section">
+    <a href="/manual" class="menu-button" data-nav>Manuelle Steuerung</a>
+    <a href="/calibration" class="menu-button" data-nav>Kalibrierung</a>
+    <a href="/programs" class="menu-button" data-nav>Programme</a>
+    <a href="/recipes" class="menu-button" data-nav>Rezepte</a>
+    <a href="/tank" class="menu-button" data-nav>Tankstatus</a>
+    <a href="/sensors" class="menu-button" data-nav>Sensoren</a>
+  </div>
+  <div class="section">
+    <h2>Sicherung</h2>
+    <a href="/api/config/export" class="menu-button">Konfiguration herunterladen</a>
+    <form onsubmit="return importConfig(event)">
+      <input type="file" id="importFile" accept=".json,application/json" required><br>
+      <button type="submit">Konfiguration einspielen</button>
+    </form>
+  </div>
+</div>
+
+<div class="page" data-page="/manual">
+  <h1>Manuelle Steuerung</h1>
+  <p>Tippen Sie auf einen Button, um die Pumpe ein- oder auszuschalten.</p>
+  <div class="section" id="pumpSection"></div>
+  <div class="section">
+    <label><input type="checkbox" id="doseResume" onchange="setDoseResume(this.checked)">
+      Nach Stromausfall unterbrochene Dosierung fortsetzen</label>
+  </div>
+</div>
+
+<div class="page" data-page="/calibration">
+  <h1>Kalibrierung</h1>
+  <p>Starten Sie die Pumpe und stoppen Sie nach exakt der eingestellten Menge
+  (Standard 100 ml). Wiederholen Sie das mehrmals und übernehmen Sie dann den
+  Mittelwert; stark abweichende Läufe werden verworfen. Am genauesten geht es
+  mit einem Taster am Gerät.</p>
+  <div class="section" id="calibrationSection"></div>
+</div>
+
+<div class="page" data-page="/programs">
+  <h1>Programme</h1>
+  <p>Verwalten Sie hier Ihre Programme:</p>
+  <div id="programFilter">
+    <select id="fPump" onchange="loadPrograms()">
+      <option value="">Alle Pumpen</option><option value="0">Pumpe 1</option>
+      <option value="1">Pumpe 2</option><option value="2">Pumpe 3</option><option value="3">Pumpe 4</option>
+    </select>
+    <select id="fDay" onchange="loadPrograms()">
+      <option value="">Alle Tage</option><option value="1">Mo</option><option value="2">Di</option>
+      <option value="3">Mi</option><option value="4">Do</option><option value="5">Fr</option>
+      <option value="6">Sa</option><option value="0">So</option>
+    </select>
+    <select id="fActive" onchange="loadPrograms()">
+      <option value="">Aktiv und inaktiv</option><option value="1">Nur aktive</option><option value="0">Nur inaktive</option>
+    </select>
+    <select id="fWindow" onchange="loadPrograms()">
+      <option value="">Jederzeit</option><option value="86400">Nächste 24 h</option><option value="604800">Nächste 7 Tage</option>
+    </select>
+  </div>
+  <div class="section" id="programList"></div>
+  <button id="programMore" style="display:none" onclick="loadPrograms(true)">Weitere laden</button>
+  <div class="add-program-form">
+    <h2>Neues Programm hinzufügen</h2>
+    <form id="addForm" onsubmit="return addProgram(event)">
+      <div>
+        <h3>Wochentage wählen:</h3>
+        <div id="dayButtons">
+          <span class="day-button" data-day="Mo">Mo</span>
+          <span class="day-button" data-day="Di">Di</span>
+          <span class="day-button" data-day="Mi">Mi</span>
+          <span class="day-button" data-day="Do">Do</span>
+          <span class="day-button" data-day="Fr">Fr</span>
+          <span class="day-button" data-day="Sa">Sa</span>
+          <span class="day-button" data-day="So">So</span>
+        </div>
+      </div>
+      <div>
+        <label>Intervall (1-4 Wochen):<br>
+          <input type="number" id="interval" min="1" max="4" required>
+        </label><br>
+      </div>
+      <div>
+        <label>Uhrzeit (HH:MM):<br>
+          <input type="text" id="time" placeholder="HH:MM">
+        </label><br>
+      </div>
+      <div>
+        <label>Oder Cron-Ausdruck (Min Std Tag Monat Wochentag):<br>
+          <input type="text" id="cron" placeholder="0 8,12,18 * * *" maxlength="64">
+        </label><br>
+      </div>
+      <div>
+        <h3>Pumpe(n) wählen:</h3>
+        <div id="pumpButtons">
+          <span class="pump-select-button" data-pump="0">Pumpe 1</span>
+          <span class="pump-select-button" data-pump="1">Pumpe 2</span>
+          <span class="pump-select-button" data-pump="2">Pumpe 3</span>
+          <span class="pump-select-button" data-pump="3">Pumpe 4</span>
+        </div>
+      </div>
+      <div>
+        <label>Menge je Pumpe (ml):</label><br>
+        <input type="number" class="pump-amount small" data-pump="0" min="0" placeholder="P1">
+        <input type="number" class="pump-amount small" data-pump="1" min="0" placeholder="P2">
+        <input type="number" class="pump-amount small" data-pump="2" min="0" placeholder="P3">
+        <input type="number" class="pump-amount small" data-pump="3" min="0" placeholder="P4">
+      </div>
+      <div>
+        <label>Ablauf:<br>
+          <select id="mode">
+            <option value="parallel">Gleichzeitig</option>
+            <option value="sequential">Nacheinander</option>
+          </select>
+        </label>
+        <label>Pause (s):
+          <input type="number" id="gap" class="small" min="0" max="3600" value="0">
+        </label><br>
+      </div>
+      <button type="submit">Programm hinzufügen</button>
+    </form>
+  </div>
+</div>
+
+<div class="page" data-page="/recipes">
+  <h1>Rezepte</h1>
+  <p>Ein Rezept führt Schritte nacheinander aus, je Zeile oder durch ";" getrennt:
+  "P1 30" (Pumpe 1, 30 ml), "P1 30 + P3 10" (gleichzeitig), "warten 2m",
+  "wenn Tank &lt; 200" (nächsten Schritt nur dann) und "stopp".</p>
+  <div class="section" id="recipeRun"></div>
+  <div class="section" id="recipeList"></div>
+  <div class="add-program-form">
+    <h2 id="recipeFormTitle">Neues Rezept</h2>
+    <form id="recipeForm" onsubmit="return saveRecipe(event)">
+      <input type="hidden" id="recipeIndex">
+      <input type="text" id="recipeName" placeholder="Name" maxlength="32" required><br>
+      <textarea id="recipeSteps" rows="6" cols="30" maxlength="200"
+        placeholder="P1 30&#10;warten 2m&#10;P3 10&#10;P2 50" required></textarea><br>
+      <label>Start per Cron-Ausdruck (leer = nur von Hand):<br>
+        <input type="text" id="recipeCron" placeholder="0 8 * * Mo" maxlength="64">
+      </label><br>
+      <label><input type="checkbox" id="recipeActive"> aktiv</label><br>
+      <button type="submit">Speichern</button>
+      <button type="button" onclick="resetRecipeForm()">Neu</button>
+    </form>
+  </div>
+</div>
+
+<div class="page" data-page="/tank">
+  <h1>Vorratsbehälter</h1>
+  <div class="section" id="reservoirList"></div>
+  <p id="tankLeak"></p>
+  <p id="tankRefill"></p>
+  <h2>Pumpenzuordnung</h2>
+  <div id="pumpReservoirs"></div>
+  <h2>Neuer Behälter</h2>
+  <form onsubmit="return addReservoir(event)">
+    <input type="text" id="resName" placeholder="Name" maxlength="32" required>
+    <input type="number" id="resCapacity" class="small" min="0" placeholder="Inhalt max. (ml)">
+    <input type="number" id="resReserve" class="small" min="0" placeholder="Reserve (ml)">
+    <button type="submit">Hinzufügen</button>
+  </form>
+  <h2>Füllstandssensor</h2>
+  <p id="tankSensorInfo"></p>
+  <form id="geoForm" onsubmit="return addGeoPoint(event)">
+    <label>Aktueller Inhalt (ml) für diesen Rohwert:<br>
+      <input type="number" id="geoInput" required>
+    </label><br>
+    <button type="submit">Punkt aufnehmen</button>
+    <button type="button" onclick="clearGeo()">Tabelle löschen</button>
+  </form>
+  <input type="number" id="tankPin" placeholder="GPIO (-1 = keiner)">
+  <select id="tankSensorRes"></select>
+  <button onclick="setTankSensor()">Sensor setzen (Neustart)</button>
+</div>
+
+<div class="page" data-page="/sensors">
+  <h1>Sensoren</h1>
+  <p>Ein Auslöser startet ein Programm, sobald ein Sensorwert eine Schwelle
+  über- oder unterschreitet, und erst wieder, wenn der Wert die Hysterese
+  zurück überschritten hat.</p>
+  <div class="section" id="sensorList"></div>
+  <h2>Neuer Sensor</h2>
+  <form onsubmit="return addSensor(event)">
+    <input type="text" id="sensorName" placeholder="Name" maxlength="32" required>
+    <select id="sensorKind">
+      <option value="adc">Analog (ADC1)</option>
+      <option value="i2c">I2C (16-Bit-Register)</option>
+      <option value="sim">Simuliert</option>
+    </select>
+    <input type="text" id="sensorPin" class="small" placeholder="GPIO/Adr.">
+    <input type="text" id="sensorReg" class="small" placeholder="Register">
+    <input type="number" id="sensorScale" class="small" step="any" placeholder="Faktor">
+    <input type="number" id="sensorOffset" class="small" step="any" placeholder="Offset">
+    <button type="submit">Hinzufügen</button>
+  </form>
+  <h2>Auslöser</h2>
+  <div class="section" id="triggerList"></div>
+  <form id="triggerForm" onsubmit="return addTrigger(event)">
+    <select id="trigSensor"></select>
+    <select id="trigBelow">
+      <option value="1">unter</option>
+      <option value="0">über</option>
+    </select>
+    <input type="number" id="trigThreshold" class="small" step="any" placeholder="Schwelle" required>
+    <input type="number" id="trigHyst" class="small" step="any" min="0" placeholder="Hysterese"><br>
+    <label>Programm Nr.: <input type="number" id="trigProgram" class="small" min="1" required></label>
+    <label>Abstand (min): <input type="number" id="trigGap" class="small" min="0" value="60"></label>
+    <label>Max. ml/Tag: <input type="number" id="trigCap" class="small" min="0" value="0"></label><br>
+    <button type="submit">Auslöser anlegen</button>
+  </form>
+</div>
+
+<div id="msg" class="msg hidden"></div>
+
+<script>
+const $ = id => document.getElementById(id);
+const TITLES = {'/':'Startseite', '/manual':'Manuelle Steuerung', '/calibration':'Kalibrierung',
+                '/programs':'Programme verwalten', '/recipes':'Rezepte', '/tank':'Tankstatus',
+                '/sensors':'Sensoren'};
+const WDAYS = ['So','Mo','Di','Mi','Do','Fr','Sa'];
+let page = '/';
+
+function esc(s){
+  return String(s).replace(/[&<>"']/g, c=>'&#'+c.charCodeAt(0)+';');
+}
+function showMsg(text, error){
+  const m = $('msg');
+  m.textContent = text;
+  m.className = 'msg'+(error?' error':'');
+  clearTimeout(showMsg.timer);
+  showMsg.timer = setTimeout(()=>{ m.className = 'msg hidden'; }, 4000);
+}
+// Anfrage an die JSON-API; Meldung anzeigen, bei Fehler null
+async function fetchJson(url, opt){
+  const r = await fetch(url, opt);
+  if(r.status===429) return {error:'Zu viele Anfragen, bitte kurz warten.'};
+  const d = await r.json();
+  if(!r.ok && !d.error) d.error = 'Fehler '+r.status;
+  return d;
+}
+function report(d){
+  if(d.error){ showMsg(d.error, true); return null; }
+  if(d.message) showMsg(d.message);
+  return d;
+}
+async function api(path, method, params){
+  const opt = {method: method||'GET'};
+  if(params) opt.body = new URLSearchParams(params);
+  let d;
+  try {
+    d = await fetchJson(path, opt);
+  } catch(e) {
+    d = {error:'Keine Verbindung'};
+  }
+  return report(d);
+}
+// Schalt- und Kalibrierbefehle über den Steuer-Port, den das Gerät vor
+// Seitenabrufen bedient; ist er nicht erreichbar, über die Seite selbst
+const CONTROL = `${location.protocol}//${location.hostname}:8081`;
+let controlPort = true;
+async function ctl(path, params){
+  if(controlPort){
+    try {
+      return report(await fetchJson(CONTROL+path, {method:'POST', body:new URLSearchParams(params)}));
+    } catch(e) {
+      controlPort = false;
+    }
+  }
+  return api(path, 'POST', params);
+}
+
+/* ---- Navigation ---- */
+const loaders = {
+  '/manual':      ()=>api('/api/pumps').then(renderPumps),
+  '/calibration': ()=>api('/api/calibration').then(renderCalibration),
+  '/programs':    ()=>loadPrograms(),
+  '/recipes':     ()=>api('/api/recipes').then(renderRecipes),
+  '/tank':        ()=>api('/api/tank').then(renderTank),
+  '/sensors':     ()=>api('/api/sensors').then(renderSensors),
+};
+function show(path){
+  if(!TITLES[path]) path = '/';
+  page = path;
+  document.querySelectorAll('.page').forEach(p=>
+    p.classList.toggle('shown', p.dataset.page===path));
+  $('title').textContent = TITLES[path];
+  document.title = TITLES[path];
+  if(loaders[path]) loaders[path]();
+}
+document.addEventListener('click', e=>{
+  const a = e.target.closest('a[data-nav]');
+  if(!a) return;
+  e.preventDefault();
+  const path = a.getAttribute('href');
+  if(path!==location.pathname) history.pushState(null, '', path);
+  show(path);
+});
+window.addEventListener('popstate', ()=>show(location.pathname));
+
+/* ---- Uhrzeit ---- */
+let clockOffset = null; // Lokalzeit des Geräts minus Browser-UTC in s
+// Lokalzeit in s (Zone schon eingerechnet) wie auf dem Gerät formatieren
+function fmtLocal(t){
+  const d = new Date(t*1000);
+  const p = n=>String(n).padStart(2,'0');
+  return `${WDAYS[d.getUTCDay()]} ${d.getUTCDate()}.${d.getUTCMonth()+1}.${d.getUTCFullYear()} `
+       + `${p(d.getUTCHours())}:${p(d.getUTCMinutes())}`;
+}
+function applyTime(d){
+  if(!d) return;
+  clockOffset = d.unix + d.offset - Date.now()/1000;
+  if(document.activeElement!==$('tz')) $('tz').value = d.tz;
+}
+function tick(){
+  if(clockOffset!==null) $('datetime').textContent = fmtLocal(Date.now()/1000 + clockOffset);
+}
+function showDateTimeForm(){ $('datetime-overlay').style.display = 'flex'; }
+function cancelDateTimeForm(){ $('datetime-overlay').style.display = 'none'; }
+async function submitDateTimeForm(){
+  const v = ['day','month','year','hour','minute'].map(id=>$(id).value);
+  if(v.some(x=>!x)){ showMsg("Bitte alle Felder ausfüllen!", true); return; }
+  const [dd, mm, yyyy, hh, min] = v.map(x=>x.padStart(2,'0'));
+  const d = await api('/api/time', 'POST', {datetime:`${yyyy}-${mm}-${dd} ${hh}:${min}:00`});
+  if(d){ applyTime(d); tick(); cancelDateTimeForm(); }
+}
+async function submitTimeZone(){
+  const d = await api('/api/time', 'POST', {tz:$('tz').value});
+  if(d){ applyTime(d); tick(); }
+}
+
+/* ---- Manuelle Steuerung ---- */
+function renderPumps(d){
+  if(!d) return;
+  $('pumpSection').innerHTML = d.pumps.map((p,i)=>
+    `<button class='pump-button ${p.on?'on':'off'}' onclick='togglePump(${i},${p.on?0:1})'>`
+    + `Pumpe ${i+1} (${p.on?'ON':'OFF'})</button>`
+    + (p.health && p.health!=='ok' && p.health!=='aus' ? ` <b>${p.health}</b>` : '')
+    + (p.maintenance ? ' <b>Wartung fällig</b>' : '') + '<br>').join('');
+  $('doseResume').checked = d.doseResume;
+}
+// Zielzustand statt "toggle", damit ein Wiederholen nichts umschaltet
+async function togglePump(i, on){
+  renderPumps(await ctl('/api/pumps', {index:i, on:on}));
+}
+async function setDoseResume(on){
+  renderPumps(await ctl('/api/pumps', {doseResume:on?1:0}));
+}
+
+/* ---- Kalibrierung ---- */
+function renderCalibration(d){
+  if(!d) return;
+  $('calibrationSection').innerHTML = d.pumps.map((p,i)=>{
+    let sensor = p.sensorPin<0 ? 'keiner (Zeitmodus)'
+      : `GPIO ${p.sensorPin}, ${p.ppm.toFixed(2)} Impulse/ml`
+        + (p.sensorFault ? ' <b>(Fehler, Zeitmodus)</b>' : '');
+    const c = p.current;
+    const current = c.pin<0 ? 'keiner'
+      : `GPIO ${c.pin}, ${c.cutoff ? '<b>'+c.state+' (abgeschaltet)</b>' : c.state}`
+        + (c.base.runs ? `, gelernt aus ${c.base.runs} Läufen: Strom ${c.base.mean}, Anlauf ${c.base.inrush}` : '');
+    const n = p.counters;
+    const sum = x=>`${x.onMin} min, ${x.starts} Starts, ${Math.round(x.ml)} / ${Math.round(x.calMl)} ml`;
+    const counters = `Laufzeit ${n.onHours} h, ${n.starts} Starts, abgebucht ${Math.round(n.ml)} ml,`
+      + ` kalibriert ${Math.round(n.calMl)} ml<br>Heute: ${sum(n.today)}<br>Gestern: ${sum(n.yesterday)}`
+      + `<br>7 Tage: ${sum(n.week)}<br>Vorwoche: ${sum(n.lastWeek)}`
+      + `<br>Seit Wartung (${n.service.atText}): ${n.service.onHours} h, ${Math.round(n.service.calMl)} ml`
+      + (n.due ? ' <b>Wartung fällig</b>' : '');
+    const runs = p.runs.map((r,k)=>`${k+1}: ${r.sec.toFixed(3)} s`
+      + (r.outlier ? ' (verworfen)' : '')).join('<br>');
+    return `<h2>Pumpe ${i+1}</h2>`
+      + (p.runs.length ? '' : `<input type='number' id='cml${i}' class='small' value='${p.targetMl}'> ml je Lauf<br>`)
+      + `<button class='button' onclick='calibrate(${i},"start")'>Start</button>`
+      + `<button class='button' onclick='calibrate(${i},"stop")'>Stop</button>`
+      + (p.runs.length ? `<button class='button' onclick='calibrate(${i},"commit")'>Übernehmen</button>`
+        + `<button class='delete-button' onclick='calibrate(${i},"discard")'>Verwerfen</button>` : '')
+      + `<div class='calibration-info'>Aktuelle Rate: `
+      + (p.rate>0 ? p.rate.toFixed(2)+' ml/s' : 'Noch nicht kalibriert')
+      + (p.running ? ' <b>(läuft)</b>' : '')
+      + (p.runs.length ? `<br>Läufe (${p.targetMl} ml, mindestens ${d.minRuns} gültige):<br>${runs}`
+        + (p.used>1 ? `<br>Mittel ${p.meanSec.toFixed(3)} s, Streuung ${p.cvPct.toFixed(2)} %` : '') : '')
+      + `<br>Durchflusssensor: ${sensor}`
+      + (d.button.pin>=0 && d.button.pump==i ? `<br>Taster: GPIO ${d.button.pin}` : '')
+      + `<br>Stromsensor: ${current}<br>${counters}</div>`
+      + `<input type='number' id='fpin${i}' placeholder='GPIO (-1 = keiner)' value='${p.sensorPin}'>`
+      + `<button class='button' onclick='setSensor(${i})'>Sensor setzen</button><br>`
+      + `<input type='number' id='ipin${i}' placeholder='Strom-GPIO (-1 = keiner)' value='${c.pin}'>`
+      + `<button class='button' onclick='setCurrentSensor(${i})'>Stromsensor setzen</button>`
+      + (c.pin>=0 ? `<button class='button' onclick='resetCurrent(${i})'>Neu lernen</button>` : '') + '<br>'
+      + `<input type='number' id='bpin${i}' placeholder='Taster-GPIO (-1 = keiner)'>`
+      + `<button class='button' onclick='setButton(${i})'>Taster setzen</button><br>`
+      + `Wartung nach <input type='number' id='mh${i}' class='small' min='0' value='${n.limit.hours}'> h`
+      + ` oder <input type='number' id='mml${i}' class='small' min='0' value='${n.limit.ml}'> ml (0 = nie)`
+      + `<button class='button' onclick='setMaintenance(${i})'>Setzen</button>`
+      + `<button class='button' onclick='serviceDone(${i})'>Wartung erledigt</button>`;
+  }).join('');
+}
+async function calibrate(i, action){
+  const params = {pump:i, action:action};
+  if(action==='start' && $('cml'+i)) params.ml = $('cml'+i).value;
+  renderCalibration(await ctl('/api/calibration', params));
+}
+async function setButton(i){
+  renderCalibration(await ctl('/api/calibration', {pump:i, buttonPin:$('bpin'+i).value}));
+}
+async function setSensor(i){
+  renderCalibration(await ctl('/api/calibration', {pump:i, pin:$('fpin'+i).value}));
+}
+async function setCurrentSensor(i){
+  renderCalibration(await ctl('/api/calibration', {pump:i, currentPin:$('ipin'+i).value}));
+}
+async function resetCurrent(i){
+  renderCalibration(await ctl('/api/calibration', {pump:i, currentReset:1}));
+}
+async function setMaintenance(i){
+  renderCalibration(await ctl('/api/calibration', {pump:i, maintHours:$('mh'+i).value||0, maintMl:$('mml'+i).value||0}));
+}
+async function serviceDone(i){
+  if(!confirm("Wartung von Pumpe "+(i+1)+" als erledigt vermerken?")) return;
+  renderCalibration(await ctl('/api/calibration', {pump:i, service:1}));
+}
+
+/* ---- Programme ---- */
+// Die Liste wird seitenweise geladen; der Cursor der letzten Seite
+// liefert die nächste
+const PROGRAM_PAGE = 20;
+let programCursor = null;
+function programQuery(){
+  const q = {limit: PROGRAM_PAGE};
+  if($('fPump').value !== '') q.pump = $('fPump').value;
+  if($('fDay').value !== '') q.day = $('fDay').value;
+  if($('fActive').value !== '') q.state = $('fActive').value;
+  if($('fWindow').value !== ''){
+    const now = Math.floor(Date.now()/1000);
+    q.from = now;
+    q.to = now + (+$('fWindow').value);
+  }
+  return q;
+}
+async function loadPrograms(more){
+  const q = programQuery();
+  if(more && programCursor) q.cursor = programCursor;
+  renderPrograms(await api('/api/programs?'+new URLSearchParams(q)), more);
+}
+function renderPrograms(d, append){
+  if(!d) return;
+  programCursor = d.cursor || null;
+  $('programMore').style.display = programCursor ? '' : 'none';
+  if(!d.programs.length && !append){
+    $('programList').innerHTML = d.total ? '<p>Keine Programme passen zum Filter.</p>'
+                                         : '<p>Es sind keine Programme verfügbar.</p>';
+    return;
+  }
+  const html = d.programs.map(e=>{
+    const p = e.program;
+    const pumps = p.pumps.map((on,k)=>on ? `Pumpe ${k+1} (${p.amounts[k]} ml)` : null)
+                   .filter(x=>x).join(', ') || 'Keine Pumpe ausgewählt';
+    return `<div class='program-block'><strong>Programm ${e.index+1}:</strong><br>`
+      + (p.cron ? `Zeitplan: ${esc(p.cron)}<br>`
+                : `Wochentage: ${esc(p.days)}<br>Uhrzeit: ${esc(p.time)}<br>`)
+      + `Intervall (Wochen): ${p.interval}<br>Pumpen: ${pumps}<br>`
+      + `Ablauf: ${p.mode==1 ? 'nacheinander, '+p.gap+' s Pause' : 'gleichzeitig'}`
+      + `, ca. ${Math.round(e.durationSec)} s<br>`
+      + `Letzte Ausführung: ${e.lastRunText}<br>`
+      + (p.active ? `Nächste Ausführung: ${e.nextText}<br>` : '')
+      + (e.blockedBy ? `<b>Gesperrt: ${esc(e.blockedBy)} unter Reserve</b><br>` : '')
+      + `<button class='activate-button' onclick='toggleProgram(${e.index},${p.active?0:1})'>`
+      + `${p.active?'Deaktivieren':'Aktivieren'}</button>`
+      + `<button class='delete-button' onclick='deleteProgram(${e.index})'>Löschen</button></div>`;
+  }).join('');
+  if(append) $('programList').insertAdjacentHTML('beforeend', html);
+  else $('programList').innerHTML = html;
+}
+async function toggleProgram(idx, active){
+  renderPrograms(await api('/api/programs', 'POST', {...programQuery(), index:idx, active:active}));
+}
+async function deleteProgram(idx){
+  if(!confirm("Wirklich löschen?")) return;
+  renderPrograms(await api('/api/programs?'+new URLSearchParams({...programQuery(), index:idx}), 'DELETE'));
+}
+document.querySelectorAll('.day-button, .pump-select-button').forEach(btn=>
+  btn.addEventListener('click', ()=>btn.classList.toggle('active')));
+async function addProgram(e){
+  e.preventDefault();
+  const days = [...document.querySelectorAll('.day-button.active')].map(b=>b.dataset.day);
+  const pumps = [...document.querySelectorAll('.pump-select-button.active')].map(b=>b.dataset.pump);
+  const cron = $('cron').value.trim();
+  if(!cron && (!days.length || !$('time').value)){
+    showMsg("Bitte Wochentage und Uhrzeit oder einen Cron-Ausdruck angeben!", true);
+    return false;
+  }
+  if(!pumps.length){
+    showMsg("Bitte mindestens eine Pumpe auswählen!", true);
+    return false;
+  }
+  // Menge je Pumpe (nicht gewählte Pumpen => 0)
+  const amounts = [0,0,0,0];
+  for(const p of pumps){
+    const v = document.querySelector(`.pump-amount[data-pump="${p}"]`).value;
+    if(!(v>0)){
+      showMsg("Bitte Menge für Pumpe "+(+p+1)+" angeben!", true);
+      return false;
+    }
+    amounts[p] = v;
+  }
+  const d = await api('/api/programs', 'POST', {...programQuery(),
+    days: days.join(","), interval: $('interval').value, time: $('time').value, cron,
+    amounts: amounts.join(","), pumps: pumps.join(","),
+    mode: $('mode').value, gap: $('gap').value});
+  if(d){
+    renderPrograms(d);
+    $('addForm').reset();
+    document.querySelectorAll('#addForm .active').forEach(b=>b.classList.remove('active'));
+  }
+  return false;
+}
+
+/* ---- Rezepte ---- */
+let recipeData = null;
+function recipeLines(text){
+  return text.split(/[;\n]/).map(x=>x.trim()).filter(x=>x);
+}
+function renderRecipes(d){
+  if(!d) return;
+  recipeData = d;
+  const run = d.run;
+  if(run){
+    const r = d.recipes.find(x=>x.id===run.id);
+    const line = r ? recipeLines(r.steps)[run.step] || '' : '';
+    $('recipeRun').innerHTML = `<div class='program-block'><strong>Läuft: ${esc(run.name)}</strong>`
+      + ` (seit ${run.startedText})<br>Schritt ${run.step+1} von ${run.stepCount}: ${esc(line)}`
+      + (run.phase==='waiting' ? `, noch ${run.waitSec} s` : '')
+      + (run.phase==='pending' ? ', wartet auf freie Pumpe' : '')
+      + `<br><button class='delete-button' onclick='cancelRecipe()'>Abbrechen</button></div>`;
+  } else {
+    $('recipeRun').innerHTML = d.lastResult ? `Zuletzt: ${esc(d.lastResult)}` : '';
+  }
+  $('recipeList').innerHTML = d.recipes.length ? d.recipes.map(r=>
+    `<div class='program-block'><strong>${esc(r.name)}</strong><br>`
+    + recipeLines(r.steps).map((l,k)=>`${k+1}. ${esc(l)}`).join('<br>') + '<br>'
+    + (r.cron ? `Zeitplan: ${esc(r.cron)}${r.active ? '' : ' (inaktiv)'}<br>` : '')
+    + (r.nextText ? `Nächster Start: ${r.nextText}<br>` : '')
+    + `Letzter Start: ${r.lastRunText}<br>`
+    + `<button class='activate-button' onclick='startRecipe(${r.index})'>Starten</button>`
+    + (r.cron ? `<button class='activate-button' onclick='toggleRecipe(${r.index},${r.active?0:1})'>`
+      + `${r.active?'Deaktivieren':'Aktivieren'}</button>` : '')
+    + `<button onclick='editRecipe(${r.index})'>Bearbeiten</button>`
+    + `<button class='delete-button' onclick='deleteRecipe(${r.index})'>Löschen</button></div>`).join('')
+    : '<p>Es sind keine Rezepte vorhanden.</p>';
+}
+async function startRecipe(idx){
+  renderRecipes(await api('/api/recipes', 'POST', {index:idx, action:'start'}));
+}
+async function cancelRecipe(){
+  renderRecipes(await api('/api/recipes', 'POST', {action:'cancel'}));
+}
+async function toggleRecipe(idx, active){
+  renderRecipes(await api('/api/recipes', 'POST', {index:idx, active:active}));
+}
+async function deleteRecipe(idx){
+  if(!confirm("Wirklich löschen?")) return;
+  renderRecipes(await api(`/api/recipes?index=${idx}`, 'DELETE'));
+}
+function editRecipe(idx){
+  const r = recipeData.recipes[idx];
+  $('recipeIndex').value = idx;
+  $('recipeName').value = r.name;
+  $('recipeSteps').value = recipeLines(r.steps).join('\n');
+  $('recipeCron').value = r.cron;
+  $('recipeActive').checked = r.active;
+  $('recipeFormTitle').textContent = 'Rezept bearbeiten';
+}
+function resetRecipeForm(){
+  $('recipeForm').reset();
+  $('recipeIndex').value = '';
+  $('recipeFormTitle').textContent = 'Neues Rezept';
+}
+async function saveRecipe(e){
+  e.preventDefault();
+  const params = {name:$('recipeName').value, steps:$('recipeSteps').value,
+                  cron:$('recipeCron').value, active:$('recipeActive').checked?1:0};
+  if($('recipeIndex').value!=='') params.index = $('recipeIndex').value;
+  const d = await api('/api/recipes', 'POST', params);
+  if(d){
+    renderRecipes(d);
+    resetRecipeForm();
+  }
+  return false;
+}
+
+/* ---- Tank ---- */
+function resOptions(sel, list){
+  return list.map(r=>`<option value="${r.index}"${r.index==sel?' selected':''}>${esc(r.name)}</option>`).join('');
+}
+function renderTank(d){
+  if(!d) return;
+  const list = d.reservoirs;
+  $('reservoirList').innerHTML = list.map(r=>
+    `<div class='program-block'><strong>${esc(r.name)}</strong>`
+    + (r.low ? ' <b>(unter Reserve)</b>' : '') + '<br>'
+    + `Inhalt: ${r.level.toFixed(1)} ml` + (r.capacity>0 ? ` von ${Math.round(r.capacity)} ml` : '')
+    + (r.measured ? ' (gemessen)' : ' (manuell)') + '<br>'
+    + `Reserve: ${Math.round(r.reserve)} ml<br>`
+    + `Pumpen: ${r.pumps.map(k=>'Pumpe '+(k+1)).join(', ') || 'keine'}<br>`
+    + `Voraussichtlich leer: ${r.emptyDate || '(kein Verbrauch)'}<br>`
+    + (r.measured ? '' : `<input type="number" id="lvl${r.index}" class="small" placeholder="ml">`
+      + `<button onclick="setTankLevel(${r.index})">Stand setzen</button><br>`)
+    + `<input type="text" id="name${r.index}" value="${esc(r.name)}" maxlength="32">`
+    + `<input type="number" id="cap${r.index}" class="small" value="${r.capacity}">`
+    + `<input type="number" id="res${r.index}" class="small" value="${r.reserve}">`
+    + `<button onclick="saveReservoir(${r.index})">Speichern</button>`
+    + (list.length>1 ? `<button class='delete-button' onclick='removeReservoir(${r.index})'>Entfernen</button>` : '')
+    + '</div>').join('');
+  const pumpRes = [0,1,2,3].map(k=>(list.find(r=>r.pumps.includes(k))||list[0]).index);
+  $('pumpReservoirs').innerHTML = pumpRes.map((r,k)=>
+    `<label>Pumpe ${k+1}: <select onchange="assignPump(${k},this.value)">${resOptions(r, list)}</select></label><br>`).join('');
+  $('tankLeak').innerHTML = d.leak
+    ? `<b>WARNUNG: Tank verliert ohne Pumpenlauf Wasser (seit ${d.leakSince})</b>` : '';
+  $('tankRefill').textContent = d.lastRefill>0
+    ? `Zuletzt nachgefüllt: ${d.lastRefillText} (+${Math.round(d.lastRefillMl)} ml)` : '';
+  const s = d.sensor;
+  $('tankSensorInfo').innerHTML = s.pin<0 ? 'Kein Sensor eingerichtet.'
+    : `GPIO ${s.pin} in ${esc((list[s.reservoir]||list[0]).name)}, Rohwert ${Math.round(s.raw)}`
+      + `<br>Geometrietabelle (Rohwert &rarr; ml):<br>`
+      + s.table.map(g=>`${g[0]} &rarr; ${Math.round(g[1])} ml`).join('<br>');
+  $('geoForm').style.display = s.pin<0 ? 'none' : '';
+  if(document.activeElement!==$('tankPin')) $('tankPin').value = s.pin;
+  $('tankSensorRes').innerHTML = resOptions(s.reservoir, list);
+}
+async function addGeoPoint(e){
+  e.preventDefault();
+  renderTank(await api('/api/tank', 'POST', {point:$('geoInput').value}));
+  return false;
+}
+async function clearGeo(){
+  if(!confirm("Tabelle wirklich löschen?")) return;
+  renderTank(await api('/api/tank', 'POST', {clear:1}));
+}
+async function setTankSensor(){
+  renderTank(await api('/api/tank', 'POST', {pin:$('tankPin').value, reservoir:$('tankSensorRes').value}));
+}
+async function setTankLevel(r){
+  renderTank(await api('/api/tank', 'POST', {reservoir:r, level:$('lvl'+r).value}));
+}
+async function saveReservoir(r){
+  renderTank(await api('/api/tank', 'POST', {reservoir:r, name:$('name'+r).value,
+    capacity:$('cap'+r).value, reserve:$('res'+r).value}));
+}
+async function removeReservoir(r){
+  if(!confirm("Behälter wirklich entfernen?")) return;
+  renderTank(await api('/api/tank', 'POST', {remove:r}));
+}
+async function assignPump(k, r){
+  renderTank(await api('/api/tank', 'POST', {pump:k, reservoir:r}));
+}
+async function addReservoir(e){
+  e.preventDefault();
+  renderTank(await api('/api/tank', 'POST', {name:$('resName').value,
+    capacity:$('resCapacity').value||0, reserve:$('resReserve').value||0}));
+  e.target.reset();
+  return false;
+}
+
+/* ---- Sensoren ---- */
+const TRIGGER_STATES = {armed:'bereit', fired:'ausgelöst', waiting:'wartet'};
+function renderSensors(d){
+  if(!d) return;
+  $('sensorList').innerHTML = d.sensors.length ? d.sensors.map(s=>
+    `<div class='program-block'><strong>${esc(s.name)}</strong> (${s.kind.toUpperCase()}`
+    + (s.kind==='adc' ? `, GPIO ${s.pin}` : s.kind==='i2c' ? `, 0x${s.pin.toString(16)}/${s.reg}` : '')
+    + `)<br>Wert: ${s.value===null ? '-' : s.value}${s.ok ? '' : ' (keine Messung)'}<br>`
+    + (s.kind==='sim' ? `<input type="number" id="sim${s.index}" class="small" step="any">`
+      + `<button onclick="setSimValue(${s.index})">Wert setzen</button><br>` : '')
+    + `<button class='delete-button' onclick='deleteSensor(${s.index})'>Löschen</button></div>`).join('')
+    : '<p>Keine Sensoren eingerichtet.</p>';
+  $('triggerList').innerHTML = d.triggers.length ? d.triggers.map(t=>{
+    const s = d.sensors[t.sensor];
+    return `<div class='program-block'><strong>${esc(s ? s.name : '?')} ${t.below ? '&lt;' : '&gt;'} ${t.threshold}</strong>`
+      + ` (Hysterese ${t.hysteresis})<br>`
+      + `Programm: ${t.program>=0 ? t.program+1 : '<b>fehlt</b>'}, Abstand ${Math.round(t.gap/60)} min`
+      + (t.cap>0 ? `, heute ${t.dayMl} von ${t.cap} ml` : '') + '<br>'
+      + `Zustand: ${TRIGGER_STATES[t.state]}, zuletzt: ${t.lastFireText}<br>`
+      + `<button class='activate-button' onclick='toggleTrigger(${t.index},${t.active?0:1})'>`
+      + `${t.active?'Deaktivieren':'Aktivieren'}</button>`
+      + `<button class='delete-button' onclick='deleteTrigger(${t.index})'>Löschen</button></div>`;
+  }).join('') : '<p>Keine Auslöser.</p>';
+  $('trigSensor').innerHTML = d.sensors.map(s=>`<option value="${s.index}">${esc(s.name)}</option>`).join('');
+  $('triggerForm').style.display = d.sensors.length ? '' : 'none';
+}
+async function addSensor(e){
+  e.preventDefault();
+  renderSensors(await api('/api/sensors', 'POST', {name:$('sensorName').value,
+    kind:$('sensorKind').value, pin:$('sensorPin').value||-1, reg:$('sensorReg').value||0,
+    scale:$('sensorScale').value||1, offset:$('sensorOffset').value||0}));
+  e.target.reset();
+  return false;
+}
+async function deleteSensor(s){
+  if(!confirm("Sensor samt Auslösern löschen?")) return;
+  renderSensors(await api(`/api/sensors?sensor=${s}`, 'DELETE'));
+}
+async function setSimValue(s){
+  renderSensors(await api('/api/sensors', 'POST', {sensor:s, value:$('sim'+s).value}));
+}
+async function addTrigger(e){
+  e.preventDefault();
+  renderSensors(await api('/api/sensors', 'POST', {sensor:$('trigSensor').value,
+    below:$('trigBelow').value, threshold:$('trigThreshold').value,
+    hysteresis:$('trigHyst').value||0, program:$('trigProgram').value-1,
+    gap:($('trigGap').value||0)*60, cap:$('trigCap').value||0}));
+  return false;
+}
+async function toggleTrigger(k, active){
+  renderSensors(await api('/api/sensors', 'POST', {trigger:k, active:active}));
+}
+async function deleteTrigger(k){
+  if(!confirm("Auslöser löschen?")) return;
+  renderSensors(await api(`/api/sensors?trigger=${k}`, 'DELETE'));
+}
+
+/* ---- Sicherung ---- */
+async function importConfig(e){
+  e.preventDefault();
+  const f = $('importFile').files[0];
+  if(!f) return false;
+  const data = new FormData();
+  data.append('config', f, f.name);
+  const r = await fetch('/api/config/import', {method:'POST', body:data});
+  showMsg(await r.text(), !r.ok);
+  return false;
+}
+
+// Beim Öffnen Browserzeit (UTC) anbieten; das Gerät übernimmt sie nur,
+// wenn seine Uhr nicht gestellt ist oder deutlich abweicht. Dann lokal
+// weiterzählen und jede Minute abgleichen
+api('/api/time', 'POST', {unix: Math.floor(Date.now()/1000), auto: 1}).then(applyTime);
+setInterval(tick, 1000);
+setInterval(()=>api('/api/time').then(applyTime), 60000);
+// Pumpenstatus, Kalibrierläufe (Taster am Gerät), Rezeptfortschritt und
+// Sensorwerte alle 5 s nachladen, außer während einer Eingabe
+setInterval(()=>{
+  const a = document.activeElement;
+  if(a && (a.tagName==='INPUT' || a.tagName==='TEXTAREA')) return;
+  if(page==='/manual' || page==='/calibration' || page==='/recipes'
+     || page==='/sensors') loaders[page]();
+}, 5000);
+show(location.pathname);
+</script>
+</body>
+</html>
+)=====";
+
+/* --------------------------------------------------------------------------
+   Anfrage-Prioritäten
+   --------------------------------------------------------------------------
+   Der WebServer bearbeitet eine Anfrage nach der anderen. Damit ein
+   Schalt- oder Kalibrierbefehl nicht hinter einer großen Seite wartet (die
+   Wartezeit ginge beim Kalibrieren direkt in die gemessene Dauer ein),
+   gibt es drei Spuren:
+     LANE_CONTROL  /api/pumps, /api/calibration: zusätzlich auf eigenem
+                   Port (CONTROL_PORT), der vor dem Web-Port und zwischen
+                   zwei Blöcken jeder längeren Antwort abgefragt wird
+     LANE_API      übrige JSON-API
+     LANE_PAGE     Seite, Export, Zeitplan, Statistik
+   API und Seiten sind je Client (IP) per Token-Bucket begrenzt; zu viele
+   Anfragen bekommen 429 statt Rechenzeit. Die Tabelle hat Platz für alle
+   Stationen des Access Points plus einige Clients aus dem Netz der
+   Replikation. Muss trotzdem ein gerade aktiver Eintrag weichen, startet
+   der neue Client mit leerem Bucket statt mit vollem Burst; sonst könnten
+   viele Clients im Wechsel die Grenze umgehen.
+   -------------------------------------------------------------------------- */
+#define CONTROL_PORT 8081
+#define AP_MAX_CLIENTS 10              // Höchstzahl Stationen am Access Point
+#define CLIENT_BUCKET_IDLE_MS 10000    // jünger: Eintrag gilt als aktiv
+
+enum RouteLane { LANE_CONTROL, LANE_API, LANE_PAGE, LANE_COUNT };
+static const char *LANE_NAMES[LANE_COUNT] = {"control", "api", "page"};
+
+// Anfragen pro Sekunde und Burst je Client
+const float LANE_RATE[LANE_COUNT]  = {0, 10.0f, 2.0f};
+const float LANE_BURST[LANE_COUNT] = {0, 20.0f, 8.0f};
+
+WebServer controlServer(CONTROL_PORT);
+
+struct ClientBucket {
+  uint32_t ip;
+  unsigned long lastMs;
+  float tokens[LANE_COUNT];
+};
+const int CLIENT_BUCKETS = AP_MAX_CLIENTS + 6;
+ClientBucket clientBuckets[CLIENT_BUCKETS];
+uint32_t laneThrottled[LANE_COUNT];
+uint32_t clientBucketEvictions;
+
+RouteLane routeLane(const String &path) {
+  if(path=="/api/pumps" || path=="/api/calibration") return LANE_CONTROL;
+  if(path.startsWith("/api/") && path!="/api/schedule"
+     && path!="/api/stats" && path!="/api/log" && path!="/api/trace/data"
+     && path!="/api/config/export") return LANE_API;
+  return LANE_PAGE;
+}
+
+// Token des Clients für diese Spur abbuchen; false = Grenze erreicht
+bool laneAdmit(RouteLane lane) {
+  if(LANE_RATE[lane]<=0) return true;
+  uint32_t ip = (uint32_t)server.client().remoteIP();
+  unsigned long now = millis();
+
+  // Eintrag des Clients, sonst den am längsten unbenutzten ersetzen
+  ClientBucket *b = &clientBuckets[0];
+  for(int i=0; i<CLIENT_BUCKETS; i++){
+    if(clientBuckets[i].ip==ip){ b = &clientBuckets[i]; break; }
+    if(clientBuckets[i].lastMs<b->lastMs) b = &clientBuckets[i];
+  }
+  if(b->ip!=ip){
+    bool active = b->ip!=0 && now - b->lastMs < CLIENT_BUCKET_IDLE_MS;
+    if(active) clientBucketEvictions++;
+    b->ip = ip;
+    for(int l=0; l<LANE_COUNT; l++) b->tokens[l] = active ? 0 : LANE_BURST[l];
+  } else {
+    float dt = (now - b->lastMs)/1000.0f;
+    for(int l=0; l<LANE_COUNT; l++){
+      b->tokens[l] += dt*LANE_RATE[l];
+      if(b->tokens[l]>LANE_BURST[l]) b->tokens[l] = LANE_BURST[l];
+    }
+  }
+  b->lastMs = now;
+  if(b->tokens[lane]<1.0f){
+    laneThrottled[lane]++;
+    return false;
+  }
+  b->tokens[lane] -= 1.0f;
+  return true;
+}
+
+// Steuer-Port abfragen; auch aus laufenden Antworten heraus, aber nicht
+// verschachtelt
+void controlLanePoll() {
+  static bool busy = false;
+  if(busy) return;
+  busy = true;
+  controlServer.handleClient();
+  busy = false;
+}
+
+/* --------------------------------------------------------------------------
+   Anfrage-Arena
+   --------------------------------------------------------------------------
+   Die Antworten der häufigen API-Anfragen (Schalten, Kalibrieren, Uhrzeit,
+   Fehler) werden nicht als String zusammengesetzt, sondern in einen Block
+   geschrieben, der einmal beim Start angelegt wird. Meldungstexte kommen
+   über requestArena.printf() in denselben Block. Nach dem Handler setzt
+   timedRoute() den Block auf den Stand vor der Anfrage zurück; das kostet
+   nur eine Zuweisung. Eine aus einer laufenden Antwort heraus bearbeitete
+   Steueranfrage setzt nur ihren eigenen Teil zurück.
+   Reicht der Block nicht, schreibt ArenaPrint im Heap weiter und zählt das
+   als Überlauf (/api/stats, "arena"). Die Kopfzeilen und Argumente baut der
+   WebServer weiterhin selbst als String.
+   -------------------------------------------------------------------------- */
+#define REQUEST_ARENA_SIZE 8192
+
+class RequestArena {
+public:
+  RequestArena() : base(nullptr), cap(0), top(0), peak(0), overflows(0), requests(0) {}
+
+  void begin(size_t size) {
+    base = (char*)malloc(size);
+    cap = base ? size : 0;
+    top = 0;
+  }
+
+  // Formatierter Text bis zum Ende der Anfrage; bei vollem Block gekürzt
+  // in einem festen Ersatzpuffer (gilt nur bis zum nächsten Überlauf)
+  const char *printf(const char *fmt, ...) {
+    static char spill[128];
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = cap>top ? cap-top : 0;
+    int n = vsnprintf(base ? base+top : spill, base ? room : 0, fmt, ap);
+    va_end(ap);
+    if(n>=0 && base && (size_t)n<room){
+      const char *s = base + top;
+      top += n+1;
+      if(top>peak) peak = top;
+      return s;
+    }
+    overflows++;
+    va_start(ap, fmt);
+    vsnprintf(spill, sizeof(spill), fmt, ap);
+    va_end(ap);
+    return spill;
+  }
+
+  size_t mark() const { return top; }
+  void release(size_t at) { top = at; requests++; }
+
+  String json() const {
+    return "{\"size\":"+String((unsigned long)cap)+",\"peak\":"+String((unsigned long)peak)
+      +",\"overflows\":"+String(overflows)+",\"requests\":"+String(requests)+"}";
+  }
+
+private:
+  friend class ArenaPrint;
+  char *base;
+  size_t cap, top, peak;
+  uint32_t overflows, requests;
+};
+
+RequestArena requestArena;
+
+// Print-Ziel im restlichen Block der Arena. Der Block gehört bis data()
+// diesem Schreiber; was in der Zeit aus der Arena angefordert wird, landet
+// im Ersatzpuffer statt im halb geschriebenen Text.
+class ArenaPrint : public Print {
+public:
+  explicit ArenaPrint(RequestArena &a) : arena(a), start(a.top), len(0), spilled(false) {
+    arena.top = arena.cap;
+  }
+  size_t write(uint8_t c) override {
+    if(!spilled && start+len+1<arena.cap){
+      arena.base[start+len++] = c;
+      return 1;
+    }
+    if(!spilled){
+      // Bisherigen Text in den Heap übernehmen und dort weiterschreiben
+      spilled = true;
+      arena.overflows++;
+      if(arena.base) spill.concat(arena.base+start, len);
+    }
+    spill += (char)c;
+    len++;
+    return 1;
+  }
+  // Fertiger Text; ab hier ist der Rest des Blocks wieder frei
+  const char *data() {
+    if(spilled){
+      arena.top = start;
+      return spill.c_str();
+    }
+    if(!arena.base){
+      arena.top = 0;
+      return "";
+    }
+    arena.base[start+len] = 0;
+    arena.top = start+len+1;
+    if(arena.top>arena.peak) arena.peak = arena.top;
+    return arena.base+start;
+  }
+  size_t length() const { return len; }
+
+private:
+  RequestArena &arena;
+  size_t start, len;
+  bool spilled;
+  String spill;
+};
+
+/* --------------------------------------------------------------------------
+   Startablauf
+   --------------------------------------------------------------------------
+   setup() bringt nur das hoch, was Pumpen und Zeitplan brauchen: Pins,
+   Programmspeicher, SPIFFS mit config.json und Dosierjournal. WLAN, DNS
+   und Webserver startet loop() erst danach (netBegin()), damit eine fällige
+   Minute nicht hinter dem Aufbau des Access Points wartet.
+   Uhrzeit und zuletzt geprüfte Minute stehen zusätzlich in einem kleinen
+   Datensatz im RTC-Speicher, der jeden Reset außer dem Einschalten
+   übersteht. Nach einem Watchdog- oder Brownout-Neustart läuft die Uhr
+   daraus sekundengenau weiter statt ab dem letzten Speichern der
+   config.json, und loop() holt Minuten nach, die der Neustart gekostet hat.
+   Die Zeitpunkte der einzelnen Schritte stehen unter /api/stats ("boot").
+   -------------------------------------------------------------------------- */
+#define BOOT_STAGES_MAX 12
+#define PROGRAM_CATCHUP_MIN 10
+#define BOOT_HOT_MAGIC  0x484F5431UL // "HOT1"
+
+struct BootStage {
+  const char *name;
+  uint32_t us;       // micros() beim Abschluss des Schritts
+};
+BootStage bootStages[BOOT_STAGES_MAX];
+int bootStageCount = 0;
+bool bootHotUsed = false;
+bool netStarted = false;
+
+struct BootHotRecord {
+  uint32_t magic;
+  uint32_t utc;
+  uint32_t lastCheck;  // lastProgramCheck
+  uint32_t check;
+};
+RTC_NOINIT_ATTR BootHotRecord bootHot;
+
+void bootMark(const char *name) {
+  if(bootStageCount<BOOT_STAGES_MAX) bootStages[bootStageCount++] = {name, (uint32_t)micros()};
+}
+
+static uint32_t bootHotCheck(const BootHotRecord &h) {
+  return (h.magic ^ 0x5A5A5A5AUL) + h.utc*31 + h.lastCheck*131;
+}
+
+// Jede Sekunde aus loop(): nur ein paar Bytes im RTC-Speicher
+void bootHotSave() {
+  bootHot.magic     = BOOT_HOT_MAGIC;
+  bootHot.utc       = (uint32_t)currentUnixTime;
+  bootHot.lastCheck = (uint32_t)lastProgramCheck;
+  bootHot.check     = bootHotCheck(bootHot);
+}
+
+// Nach loadConfig(): Uhr und Minutenstand aus dem RTC-Speicher übernehmen
+void bootHotRestore() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  if(reason==ESP_RST_POWERON || bootHot.magic!=BOOT_HOT_MAGIC
+     || bootHot.check!=bootHotCheck(bootHot)) return;
+  if((time_t)bootHot.utc<currentUnixTime) return; // Zeit wurde seither gespeichert
+  currentUnixTime  = bootHot.utc;
+  lastUpdateMillis = millis();
+  lastProgramCheck = bootHot.lastCheck;
+  bootHotUsed = true;
+  LOG_I("Uhrzeit aus dem RTC-Speicher übernommen (Reset-Grund %d)", (int)reason);
+}
+
+String bootStatsJson() {
+  String json = "{\"reset\":"+String((int)esp_reset_reason())
+    +",\"hot\":"+String(bootHotUsed?"true":"false")+",\"stagesMs\":{";
+  for(int i=0; i<bootStageCount; i++){
+    if(i>0) json += ",";
+    json += "\""+String(bootStages[i].name)+"\":"+String(bootStages[i].us/1000.0f, 1);
+  }
+  return json+"}}";
+}
+
+/* --------------------------------------------------------------------------
+   Eingabemitschnitt
+   --------------------------------------------------------------------------
+   Auf Wunsch (/api/trace, enabled=1) zeichnet das Gerät jede Eingabe von
+   außen in einer Ringdatei im SPIFFS auf: HTTP-Anfragen mit Pfad und
+   Argumenten, gesetzte Uhrzeit und Neustarts. Dazu kommen als Ergebnisse
+   die Bearbeitungszeit jeder Anfrage, die Minutenprüfungen, gestartete
+   oder gesperrte Programme und jede Schaltflanke der Pumpen.
+   tools/tracereplay.py spielt einen heruntergeladenen Mitschnitt
+   (/api/trace/data) an einer Testeinheit nach und vergleicht deren
+   Ergebnisse mit den aufgezeichneten.
+   Die Datei hat TRACE_BLOCKS Blöcke zu TRACE_BLOCK Bytes. Jeder Block
+   beginnt mit Folgenummer, millis() und Unixzeit und lässt sich für sich
+   lesen; ist der Ring voll, wird der älteste Block überschrieben. Ein
+   Eintrag besteht aus Typ, Abstand zum vorigen Eintrag in ms (varint) und
+   Nutzdaten. Der laufende Block liegt im RAM und wird geschrieben, wenn er
+   voll ist, spätestens aber nach TRACE_FLUSH_MS.
+   Geheime Argumente (Passwörter, Schlüssel) werden nicht aufgezeichnet,
+   die Anfrage trägt dann TRACE_REQ_REDACTED; die Datei ist ohne Anmeldung
+   abrufbar.
+   -------------------------------------------------------------------------- */
+#define TRACE_PATH      "/trace.bin"
+#define TRACE_BLOCK     256
+#define TRACE_BLOCKS    256            // 64 KB
+#define TRACE_MAGIC     0x31435254UL   // "TRC1"
+#define TRACE_FLUSH_MS  10000
+#define TRACE_ARG_MAX   96             // längere Werte werden gekürzt
+
+enum TraceType : uint8_t {
+  TR_BOOT = 1,  // Reset-Grund, Uhr aus RTC übernommen, Unixzeit
+  TR_CLOCK,     // Uhr gesetzt: alte und neue Unixzeit
+  TR_REQUEST,   // Flags, Methode (HTTPMethod), Pfad, Argumente
+  TR_DONE,      // Bearbeitungszeit der vorigen Anfrage in µs
+  TR_MINUTE,    // Minutenprüfung: Minute (Unixzeit/60), Verspätung in s
+  TR_PROGRAM,   // Programm-ID, gestartet (1) oder gesperrt (0)
+  TR_PUMP,      // Pumpe, 0x80 = eingeschaltet
+};
+
+#define TRACE_REQ_CONTROL   0x01
+#define TRACE_REQ_TRUNCATED 0x02
+#define TRACE_REQ_REDACTED  0x04
+
+// Argumente, deren Wert nicht in den Mitschnitt darf
+static const char *TRACE_SECRET_ARGS[] = {"password", "pass", "key", "token", "secret"};
+
+bool traceSecretArg(const String &name) {
+  for(const char *secret : TRACE_SECRET_ARGS){
+    if(name.equalsIgnoreCase(secret)) return true;
+  }
+  return false;
+}
+
+struct TraceBlockHeader {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t ms;     // millis() beim Blockbeginn
+  uint32_t utc;    // Unixzeit beim Blockbeginn
+  uint16_t used;   // belegte Bytes nach dem Kopf
+  uint16_t reserved;
+};
+
+alignas(4) uint8_t traceBuf[TRACE_BLOCK];
+size_t traceLen = 0;          // 0 = noch kein Block begonnen
+uint32_t traceSeq = 0;
+uint32_t traceLastMs = 0;
+unsigned long traceFlushMs = 0;
+bool traceDirty = false;
+bool tracePumpOn[4];
+uint32_t traceDropped = 0;
+
+// Nutzdaten eines Eintrags
+struct TraceWriter {
+  static const size_t CAP = TRACE_BLOCK - sizeof(TraceBlockHeader) - 6;
+  uint8_t buf[CAP];
+  size_t len = 0;
+  size_t room() const { return CAP - len; }
+  void u8(uint8_t v) { if(len<CAP) buf[len++] = v; }
+  void var(uint32_t v) {
+    while(v>=0x80){ u8((uint8_t)(v | 0x80)); v >>= 7; }
+    u8((uint8_t)v);
+  }
+  void str(const char *s, size_t n) {
+    u8((uint8_t)n);
+    for(size_t i=0; i<n; i++) u8((uint8_t)s[i]);
+  }
+};
+
+static TraceBlockHeader &traceHeader() {
+  return *(TraceBlockHeader*)traceBuf;
+}
+
+// Laufenden Block an seinen Platz im Ring schreiben
+static void traceWriteBlock() {
+  if(traceLen==0) return;
+  File f = SPIFFS.open(TRACE_PATH, "r+");
+  if(!f){
+    traceDropped++;
+    return;
+  }
+  f.seek((traceSeq % TRACE_BLOCKS) * TRACE_BLOCK);
+  f.write(traceBuf, TRACE_BLOCK);
+  f.close();
+  traceDirty = false;
+  traceFlushMs = millis();
+}
+
+static void traceStartBlock() {
+  memset(traceBuf, 0, sizeof(traceBuf));
+  TraceBlockHeader &h = traceHeader();
+  h.magic = TRACE_MAGIC;
+  h.seq   = traceSeq;
+  h.ms    = millis();
+  h.utc   = (uint32_t)currentUnixTime;
+  traceLen = sizeof(TraceBlockHeader);
+  traceLastMs = h.ms;
+}
+
+// Ringdatei anlegen oder die nächste Folgenummer aus den Blockköpfen lesen
+static bool traceOpen() {
+  traceLen = 0;
+  traceSeq = 0;
+  File f = SPIFFS.open(TRACE_PATH, FILE_READ);
+  if(f && f.size()==TRACE_BLOCKS*TRACE_BLOCK){
+    TraceBlockHeader h;
+    for(int b=0; b<TRACE_BLOCKS; b++){
+      f.seek(b*TRACE_BLOCK);
+      if(f.read((uint8_t*)&h, sizeof(h))!=sizeof(h)) break;
+      if(h.magic==TRACE_MAGIC && h.seq+1>traceSeq) traceSeq = h.seq+1;
+    }
+    f.close();
+    return true;
+  }
+  if(f) f.close();
+  f = SPIFFS.open(TRACE_PATH, FILE_WRITE);
+  if(!f){
+    LOG_E("Mitschnitt: %s konnte nicht angelegt werden", TRACE_PATH);
+    return false;
+  }
+  uint8_t zero[TRACE_BLOCK] = {};
+  for(int b=0; b<TRACE_BLOCKS; b++) f.write(zero, sizeof(zero));
+  f.close();
+  return true;
+}
+
+static void traceRecord(TraceType type, const TraceWriter &w) {
+  uint32_t now = millis();
+  if(traceLen==0) traceStartBlock();
+  uint32_t dt = now - traceLastMs;
+  size_t need = 1 + 5 + w.len; // varint höchstens 5 Bytes
+  if(traceLen + need > TRACE_BLOCK){
+    traceWriteBlock();
+    traceSeq++;
+    traceStartBlock();
+    dt = now - traceLastMs;
+  }
+  traceBuf[traceLen++] = type;
+  while(dt>=0x80){ traceBuf[traceLen++] = (uint8_t)(dt | 0x80); dt >>= 7; }
+  traceBuf[traceLen++] = (uint8_t)dt;
+  memcpy(traceBuf + traceLen, w.buf, w.len);
+  traceLen += w.len;
+  traceLastMs = now;
+  traceHeader().used = traceLen - sizeof(TraceBlockHeader);
+  traceDirty = true;
+}
+
+void traceBoot() {
+  if(!traceEnabled) return;
+  if(!traceOpen()){
+    traceEnabled = false;
+    return;
+  }
+  TraceWriter w;
+  w.u8((uint8_t)esp_reset_reason());
+  w.u8(bootHotUsed ? 1 : 0);
+  w.var((uint32_t)currentUnixTime);
+  traceRecord(TR_BOOT, w);
+}
+
+void traceClock(time_t from, time_t to) {
+  if(!traceEnabled) return;
+  TraceWriter w;
+  w.var((uint32_t)from);
+  w.var((uint32_t)to);
+  traceRecord(TR_CLOCK, w);
+}
+
+// Anfrage beim Eintreffen; Argumente, die nicht mehr in einen Block
+// passen, fallen weg (TRACE_REQ_TRUNCATED), geheime ebenso
+// (TRACE_REQ_REDACTED)
+void traceRequest(WebServer &http) {
+  if(!traceEnabled) return;
+  TraceWriter w;
+  uint8_t flags = &http==&controlServer ? TRACE_REQ_CONTROL : 0;
+  w.u8(flags);
+  w.u8((uint8_t)http.method());
+  String uri = http.uri();
+  w.str(uri.c_str(), uri.length()<64 ? uri.length() : 64);
+  size_t countAt = w.len;
+  w.u8(0);
+  for(int i=0; i<http.args() && i<255; i++){
+    String name = http.argName(i);
+    if(traceSecretArg(name)){
+      flags |= TRACE_REQ_REDACTED;
+      continue;
+    }
+    String value = http.arg(i);
+    size_t n = name.length()<32 ? name.length() : 32;
+    size_t v = value.length()<TRACE_ARG_MAX ? value.length() : TRACE_ARG_MAX;
+    if(n<name.length() || v<value.length()) flags |= TRACE_REQ_TRUNCATED;
+    if(2+n+v > w.room()){
+      flags |= TRACE_REQ_TRUNCATED;
+      break;
+    }
+    w.str(name.c_str(), n);
+    w.str(value.c_str(), v);
+    w.buf[countAt]++;
+  }
+  w.buf[0] = flags;
+  traceRecord(TR_REQUEST, w);
+}
+
+void traceDone(uint32_t us) {
+  if(!traceEnabled) return;
+  TraceWriter w;
+  w.var(us);
+  traceRecord(TR_DONE, w);
+}
+
+void traceMinute(time_t minute) {
+  if(!traceEnabled) return;
+  int32_t late = (int32_t)(currentUnixTime - minute*60);
+  TraceWriter w;
+  w.var((uint32_t)minute);
+  w.u8(late<0 ? 0 : late>255 ? 255 : late);
+  traceRecord(TR_MINUTE, w);
+}
+
+void traceProgram(uint32_t id, bool started) {
+  if(!traceEnabled) return;
+  TraceWriter w;
+  w.var(id);
+  w.u8(started ? 1 : 0);
+  traceRecord(TR_PROGRAM, w);
+}
+
+// Aus loop(): Schaltflanken der Pumpen und verzögertes Schreiben
+void tracePoll() {
+  if(!traceEnabled) return;
+  for(int i=0; i<4; i++){
+    if(pumpStatus[i]==tracePumpOn[i]) continue;
+    tracePumpOn[i] = pumpStatus[i];
+    TraceWriter w;
+    w.u8(i | (pumpStatus[i] ? 0x80 : 0));
+    traceRecord(TR_PUMP, w);
+  }
+  if(traceDirty && millis()-traceFlushMs>=TRACE_FLUSH_MS) traceWriteBlock();
+}
+
+void traceFlush() {
+  if(traceEnabled && traceDirty) traceWriteBlock();
+}
+
+void updateTraceEnabled(bool on) {
+  if(on==traceEnabled) return;
+  if(on){
+    if(!traceOpen()) return;
+    for(int i=0; i<4; i++) tracePumpOn[i] = false; // laufende Pumpen als Flanke
+    traceEnabled = true;
+  } else {
+    traceFlush();
+    traceEnabled = false;
+  }
+  saveConfig();
+}
+
+void traceClear() {
+  traceFlush();
+  SPIFFS.remove(TRACE_PATH);
+  traceLen = 0;
+  traceSeq = 0;
+  if(traceEnabled && !traceOpen()) traceEnabled = false;
+}
+
+/* --------------------------------------------------------------------------
+   Laufzeitstatistik
+   --------------------------------------------------------------------------
+   Antwortzeiten je Route, Verspätung beim Abschalten zeitgesteuerter Pumpen
+   und Abstand zwischen zwei loop()-Durchläufen, als Histogramme mit
+   Vierteloktaven (~19 % Auflösung). Abrufbar unter /api/stats, z.B. während
+   eines Lasttests mit tools/loadgen.py.
+   -------------------------------------------------------------------------- */
+struct LatencyHist {
+  static const int BUCKETS = 104; // bis ~2^26
+  uint32_t count;
+  uint32_t maxVal;
+  uint64_t sum;
+  uint32_t buckets[BUCKETS];
+
+  static int bucketOf(uint32_t v) {
+    if(v<4) return v;
+    int msb = 31 - __builtin_clz(v);
+    int idx = 4 + (msb-2)*4 + ((v >> (msb-2)) & 3);
+    return idx<BUCKETS ? idx : BUCKETS-1;
+  }
+  static uint32_t upperOf(int idx) {
+    if(idx<4) return idx;
+    int shift = (idx-4)/4;
+    uint32_t lower = (uint32_t)(4 + (idx-4)%4) << shift;
+    return lower + (1UL << shift) - 1;
+  }
+
+  void reset() {
+    memset(this, 0, sizeof(*this));
+  }
+  void add(uint32_t v) {
+    count++;
+    sum += v;
+    if(v>maxVal) maxVal = v;
+    buckets[bucketOf(v)]++;
+  }
+  uint32_t percentile(float p) const {
+    if(count==0) return 0;
+    uint32_t rank = (uint32_t)ceilf(p*count);
+    if(rank<1) rank = 1;
+    uint32_t seen = 0;
+    for(int i=0; i<BUCKETS; i++){
+      seen += buckets[i];
+      if(seen>=rank){
+        uint32_t up = upperOf(i);
+        return up<maxVal ? up : maxVal;
+      }
+    }
+    return maxVal;
+  }
+  String json() const {
+    return "{\"count\":"+String(count)
+      +",\"mean\":"+String(count ? (uint32_t)(sum/count) : 0)
+      +",\"p50\":"+String(percentile(0.50f))
+      +",\"p99\":"+String(percentile(0.99f))
+      +",\"p999\":"+String(percentile(0.999f))
+      +",\"max\":"+String(maxVal)+"}";
+  }
+};
+
+struct RouteStat {
+  String path;
+  LatencyHist *hist; // erst beim ersten Aufruf angelegt
+  uint64_t bytes;    // Antwortgröße (nur über apiSend/ChunkedResponse/sendApp)
+};
+
+std::vector<RouteStat> routeStats;
+LatencyHist cutoffDelayHist;   // ms nach der Sollzeit
+LatencyHist loopGapHist;       // µs zwischen zwei loop()-Durchläufen
+unsigned long statsSinceMs = 0;
+
+void resetStats() {
+  for(auto &r : routeStats){
+    if(r.hist) r.hist->reset();
+    r.bytes = 0;
+  }
+  cutoffDelayHist.reset();
+  loopGapHist.reset();
+  for(int l=0; l<LANE_COUNT; l++) laneThrottled[l] = 0;
+  clientBucketEvictions = 0;
+  statsSinceMs = millis();
+}
+
+// Handler mit Zeitmessung und Begrenzung je Spur registrieren
+WebServer::THandlerFunction timedRoute(const String &path, WebServer::THandlerFunction fn,
+                                       RouteLane lane, WebServer &http = server) {
+  routeStats.push_back({path, nullptr, 0});
+  size_t slot = routeStats.size()-1;
+  return [slot, fn, lane, &http](){
+    uint32_t t0 = micros();
+    traceRequest(http);
+    if(!laneAdmit(lane)){
+      server.sendHeader("Retry-After", "1");
+      server.send(429, "text/plain", "Zu viele Anfragen");
+      traceDone(micros() - t0);
+      return;
+    }
+    // Eine aus einer laufenden Antwort heraus bearbeitete Steueranfrage
+    // darf deren Bytezähler nicht verlieren
+    size_t outerBytes = responseBytes;
+    responseBytes = 0;
+    size_t arenaMark = requestArena.mark();
+    fn();
+    requestArena.release(arenaMark);
+    traceDone(micros() - t0);
+    RouteStat &r = routeStats[slot];
+    r.bytes += responseBytes;
+    responseBytes = outerBytes;
+    if(!r.hist){
+      r.hist = new LatencyHist;
+      r.hist->reset();
+    }
+    r.hist->add(micros() - t0);
+  };
+}
+
+void onRoute(const String &path, WebServer::THandlerFunction fn) {
+  server.on(path, timedRoute(path, fn, routeLane(path)));
+}
+
+void onRoute(const String &path, HTTPMethod method, WebServer::THandlerFunction fn) {
+  server.on(path, method, timedRoute(path, fn, routeLane(path)));
+}
+
+void onRoute(const String &path, HTTPMethod method, WebServer::THandlerFunction fn,
+             WebServer::THandlerFunction upload) {
+  server.on(path, method, timedRoute(path, fn, routeLane(path)), upload);
+}
+
+// Route auf dem Steuer-Port; eigene Statistikzeile mit Präfix "ctl:"
+void onControlRoute(const String &path, WebServer::THandlerFunction fn) {
+  controlServer.on(path, timedRoute("ctl:"+path, fn, LANE_CONTROL, controlServer));
+}
+
+String statsJson() {
+  unsigned long span = millis() - statsSinceMs;
+  String json = "{\"sinceMs\":"+String(span)+",\"routes\":[";
+  bool first = true;
+  for(auto &r : routeStats){
+    if(!r.hist || r.hist->count==0) continue;
+    if(!first) json += ",";
+    first = false;
+    json += "{\"path\":\""+r.path+"\",\"rps\":"
+      +String(span ? r.hist->count*1000.0f/span : 0, 2)
+      +",\"bytesPerReq\":"+String((uint32_t)(r.bytes/r.hist->count))
+      +",\"us\":"+r.hist->json()+"}";
+  }
+  json += "],\"throttled\":{";
+  for(int l=0; l<LANE_COUNT; l++){
+    if(l>0) json += ",";
+    json += "\""+String(LANE_NAMES[l])+"\":"+String(laneThrottled[l]);
+  }
+  json += "},\"clientEvictions\":"+String(clientBucketEvictions)
+    +",\"pumpCutoffDelayMs\":"+cutoffDelayHist.json()
+    +",\"loopGapUs\":"+loopGapHist.json()
+    +",\"freeHeap\":"+String(ESP.getFreeHeap())
+    +",\"maxAllocHeap\":"+String(ESP.getMaxAllocHeap())
+    +",\"programStore\":{\"programs\":"+String((unsigned long)programs.size())
+    +",\"capacity\":"+String((unsigned long)programs.capacity())
+    +",\"freeSlots\":"+String((unsigned long)programs.freeSlots())
+    +",\"indexBytes\":"+String((unsigned long)programs.indexBytes())
+    +",\"openMs\":"+String((unsigned long)programs.openMs)+"}"
+    +",\"arena\":"+requestArena.json()
+    +",\"boot\":"+bootStatsJson()+"}";
+  return json;
+}
+
+// Letzte Protokolleinträge ab Nummer "since"; "next" für die Folgeabfrage
+void handleLog() {
+  uint32_t head = logHead.load(std::memory_order_acquire);
+  uint32_t since = server.hasArg("since") ? strtoul(server.arg("since").c_str(), nullptr, 10) : 0;
+  int maxLevel = server.hasArg("level") ? server.arg("level").toInt() : LOG_LVL_DEBUG;
+  if(head - since > (uint32_t)LOG_ENTRIES) since = head - LOG_ENTRIES;
+
+  server.sendHeader("Cache-Control", "no-store");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  ChunkedResponse out;
+  out.print("{\"entries\":[");
+  bool first = true;
+  uint32_t pos = since;
+  for(; pos!=head; pos++){
+    LogEntry &e = logRing[pos % LOG_ENTRIES];
+    if(e.seq.load(std::memory_order_acquire)!=pos+1){
+      // Noch in Arbeit oder schon überschrieben
+      if(pos - logUartPos.load(std::memory_order_acquire) < (uint32_t)LOG_ENTRIES) break;
+      continue;
+    }
+    char text[LOG_TEXT_MAX];
+    uint32_t ms = e.ms;
+    uint8_t level = e.level;
+    memcpy(text, e.text, sizeof(text));
+    text[sizeof(text)-1] = 0;
+    if(e.seq.load(std::memory_order_acquire)!=pos+1) continue;
+    if(level>maxLevel) continue;
+    if(!first) out.print(',');
+    first = false;
+    out.print("{\"seq\":"); out.print(pos);
+    out.print(",\"ms\":");  out.print(ms);
+    out.print(",\"level\":\""); out.print(LOG_LEVEL_CHARS[level & 3]);
+    out.print("\",\"text\":"); writeJsonString(out, text);
+    out.print('}');
+  }
+  out.print("],\"next\":");     out.print(pos);
+  out.print(",\"dropped\":");   out.print(logDropped.load(std::memory_order_relaxed));
+  out.print(",\"truncated\":"); out.print(logTruncated.load(std::memory_order_relaxed));
+  out.print('}');
+  out.end();
+}
+
+
+/* --------------------------------------------------------------------------
+   Durchflusssensoren (Hall-Impulsgeber, gezählt vom PCNT-Peripheral)
+   --------------------------------------------------------------------------
+   Optional je Pumpe. Ist ein Sensor eingetragen, stoppt eine Dosierung nach
+   der gezählten Menge statt nach der berechneten Zeit, und die Flussrate
+   wird aus den Impulsen nachkalibriert. Ohne Sensor (oder bei Sensorfehler)
+   bleibt der Zeitmodus.
+   --------------------------------------------------------------------------*/
+// Keine Impulse nach dieser Zeit => Sensor defekt, Zeitmodus
+const unsigned long FLOW_NO_PULSE_MS = 3000;
+// Gewicht der neuen Messung bei der Nachkalibrierung
+const float FLOW_RECAL_WEIGHT = 0.3f;
+
+// Austauschbare Impulsquelle (auf dem Gerät PCNT)
+class FlowPulseSource {
+public:
+  virtual ~FlowPulseSource() {}
+  virtual bool begin(int ch, int pin) = 0;
+  virtual void end(int ch) = 0;
+  // Fortlaufende Impulszahl seit begin()
+  virtual uint32_t pulses(int ch) = 0;
+};
+
+class PcntFlowSource : public FlowPulseSource {
+public:
+  bool begin(int ch, int pin) override {
+    pcnt_unit_t unit = (pcnt_unit_t)(PCNT_UNIT_0 + ch);
+    pcnt_config_t cfg = {};
+    cfg.pulse_gpio_num = pin;
+    cfg.ctrl_gpio_num  = PCNT_PIN_NOT_USED;
+    cfg.channel        = PCNT_CHANNEL_0;
+    cfg.unit           = unit;
+    cfg.pos_mode       = PCNT_COUNT_INC;
+    cfg.neg_mode       = PCNT_COUNT_DIS;
+    cfg.lctrl_mode     = PCNT_MODE_KEEP;
+    cfg.hctrl_mode     = PCNT_MODE_KEEP;
+    cfg.counter_h_lim  = INT16_MAX;
+    cfg.counter_l_lim  = 0;
+    if(pcnt_unit_config(&cfg)!=ESP_OK) return false;
+
+    // Prellen der Hallsensoren ausfiltern (Takt APB 80 MHz => ~12 µs)
+    pcnt_set_filter_value(unit, 1000);
+    pcnt_filter_enable(unit);
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+    total[ch] = 0;
+    return true;
+  }
+  void end(int ch) override {
+    pcnt_counter_pause((pcnt_unit_t)(PCNT_UNIT_0 + ch));
+  }
+  uint32_t pulses(int ch) override {
+    pcnt_unit_t unit = (pcnt_unit_t)(PCNT_UNIT_0 + ch);
+    int16_t c = 0;
+    pcnt_get_counter_value(unit, &c);
+    // Hardwarezähler ist 16 Bit: rechtzeitig in den 32-Bit-Zähler übertragen
+    if(c>20000){
+      pcnt_counter_clear(unit);
+      total[ch] += c;
+      c = 0;
+    }
+    return total[ch] + c;
+  }
+private:
+  uint32_t total[4] = {0,0,0,0};
+};
+
+PcntFlowSource pcntFlow;
+FlowPulseSource *flowSource = &pcntFlow;
+
+void flowBegin() {
+  for(int i=0; i<4; i++){
+    if(flowSensorPin[i]<0) continue;
+    pinMode(flowSensorPin[i], INPUT_PULLUP);
+    if(!flowSource->begin(i, flowSensorPin[i])){
+      LOG_E("Durchflusssensor Pumpe %d nicht initialisiert", i+1);
+      flowSensorFault[i] = true;
+    }
+  }
+}
+
+void updateFlowSensor(int p, int pin, float pulsesPerMl) {
+  if(flowSensorPin[p]>=0) flowSource->end(p);
+  flowSensorPin[p]   = pin;
+  flowPulsesPerMl[p] = pulsesPerMl;
+  flowSensorFault[p] = false;
+  if(pin>=0){
+    pinMode(pin, INPUT_PULLUP);
+    if(!flowSource->begin(p, pin)) flowSensorFault[p] = true;
+  }
+  saveConfig();
+}
+
+/* --------------------------------------------------------------------------
+   Dosierjournal
+   --------------------------------------------------------------------------
+   Laufende Dosierungen werden als 16-Byte-Einträge an /dose.log angehängt
+   (Start, Fortschritt alle paar Sekunden, Ende). Das kostet je Eintrag
+   einen kleinen Schreibzugriff statt eines kompletten saveConfig(). Nach
+   einem Stromausfall stellt doseJournalRecover() beim Start fest, welche
+   Dosierung offen war, und setzt sie je nach Einstellung fort oder bricht
+   sie ab (dann wird die nicht geförderte Menge dem Tank gutgeschrieben).
+   Laufende Rezepte halten hier ebenfalls ihren Schritt fest, nacheinander
+   laufende Programme ihre ganze Warteschlange (ein Eintrag je Schritt beim
+   Programmstart, einer je Entnahme), damit ein Neustart keine Pumpe
+   vergisst. Der Tankabzug wird vor dem Starteintrag gespeichert.
+   -------------------------------------------------------------------------- */
+#define DOSE_JOURNAL_PATH      "/dose.log"
+#define DOSE_JOURNAL_MAX_BYTES 4096  // danach kürzen, sobald nichts läuft
+#define DOSE_CHECKPOINT_MS     2000
+
+enum DoseRecordType : uint8_t {
+  DOSE_START    = 1, // a = Sollmenge (1/100 ml), b = Unixzeit
+  DOSE_PROGRESS = 2, // a = bisher gefördert (1/100 ml)
+  DOSE_END      = 3, // a = gefördert (1/100 ml)
+  DOSE_RECIPE   = 4, // pump = Phase, a = Rezept-ID<<16 | Schritt (ID 0 =
+                     // keins), b = Ende der Pause (Unixzeit)
+  DOSE_QUEUED   = 5, // Schritt eingereiht: a = Menge (1/100 ml), b = Pause (s)
+  DOSE_DEQUEUED = 6, // vorderster Schritt entnommen und gestartet
+  DOSE_QUEUE_CLEAR = 7 // alle wartenden Schritte verworfen
+};
+
+struct DoseRecord {
+  uint8_t  type;
+  uint8_t  pump;
+  uint8_t  check;    // Prüfsumme über alle übrigen Bytes
+  uint8_t  reserved;
+  uint32_t seq;
+  uint32_t a;
+  uint32_t b;
+};
+
+File doseJournal;
+uint32_t doseJournalSeq = 0;
+bool doseJournalOpen[4] = {false, false, false, false};
+uint16_t doseJournalQueued = 0;    // eingereihte, noch nicht entnommene Schritte
+DoseRecord doseJournalRecipe = {}; // letzter Rezepteintrag beim Start
+
+uint8_t doseRecordCheck(const DoseRecord &r) {
+  const uint8_t *b = (const uint8_t*)&r;
+  uint8_t sum = 0xA5;
+  for(size_t i=0; i<sizeof(r); i++){
+    if(i!=offsetof(DoseRecord, check)) sum = (uint8_t)(sum*31 + b[i]);
+  }
+  return sum;
+}
+
+void doseJournalWrite(uint8_t type, int pump, uint32_t a, uint32_t b) {
+  if(!doseJournal) return;
+  DoseRecord r = {};
+  r.type = type;
+  r.pump = (uint8_t)pump;
+  r.seq  = ++doseJournalSeq;
+  r.a    = a;
+  r.b    = b;
+  r.check = doseRecordCheck(r);
+  doseJournal.write((const uint8_t*)&r, sizeof(r));
+  doseJournal.flush();
+}
+
+void doseJournalAppend(uint8_t type, int pump, float ml, uint32_t b = 0) {
+  doseJournalWrite(type, pump, ml>0 ? (uint32_t)(ml*100.0f+0.5f) : 0, b);
+}
+
+// Bisher geförderte Menge einer laufenden Dosierung
+float doseDispensedMl(int i) {
+  PumpRun &run = pumpRun[i];
+  if(run.closedLoop && flowPulsesPerMl[i]>0){
+    return (flowSource->pulses(i) - run.startPulses) / flowPulsesPerMl[i];
+  }
+  float ml = (millis() - run.startMs) / 1000.0f * pumpFlowRate[i];
+  return ml<run.targetMl ? ml : run.targetMl;
+}
+
+// Sollmenge einer laufenden Dosierung (im Zeitmodus aus der Laufzeit)
+float doseTargetMl(int i) {
+  PumpRun &run = pumpRun[i];
+  if(run.closedLoop || pumpFlowRate[i]<=0) return run.targetMl;
+  return run.durationMs / 1000.0f * pumpFlowRate[i];
+}
+
+void doseJournalStart(int i) {
+  doseJournalAppend(DOSE_START, i, doseTargetMl(i), (uint32_t)currentUnixTime);
+  pumpRun[i].journalMs = millis();
+  doseJournalOpen[i] = true;
+}
+
+void doseJournalProgress(int i) {
+  doseJournalAppend(DOSE_PROGRESS, i, doseDispensedMl(i));
+  pumpRun[i].journalMs = millis();
+}
+
+void doseJournalEnd(int i, float ml) {
+  if(!doseJournalOpen[i]) return;
+  doseJournalAppend(DOSE_END, i, ml);
+  doseJournalOpen[i] = false;
+}
+
+void doseJournalQueue(int pump, int ml, uint16_t gapSec) {
+  doseJournalAppend(DOSE_QUEUED, pump, ml, gapSec);
+  doseJournalQueued++;
+}
+
+void doseJournalDequeue(int pump) {
+  doseJournalWrite(DOSE_DEQUEUED, pump, 0, 0);
+  if(doseJournalQueued) doseJournalQueued--;
+}
+
+void doseJournalQueueClear() {
+  doseJournalWrite(DOSE_QUEUE_CLEAR, 0, 0, 0);
+  doseJournalQueued = 0;
+}
+
+void recipeJournal();
+
+// Journal kürzen, wenn es groß geworden ist und weder eine Dosierung offen
+// ist noch Schritte warten
+void doseJournalCompact() {
+  if(!doseJournal || doseJournal.size()<DOSE_JOURNAL_MAX_BYTES) return;
+  if(doseJournalQueued) return;
+  for(int i=0; i<4; i++){
+    if(doseJournalOpen[i]) return;
+  }
+  doseJournal.close();
+  doseJournal = SPIFFS.open(DOSE_JOURNAL_PATH, FILE_WRITE);
+  recipeJournal(); // Stand eines laufenden Rezepts erhalten
+}
+
+/* --------------------------------------------------------------------------
+   Nicht-blockierender Pumpenlauf
+   --------------------------------------------------------------------------*/
+int pumpPin(int i){
+  switch(i){
+    case 0: return pump1;
+    case 1: return pump2;
+    case 2: return pump3;
+    default: return pump4;
+  }
+}
+
+// Pumpe i für ml Milliliter starten (geregelt, falls Sensor vorhanden)
+bool startPumpDose(int i, float ml){
+  if(i<0||i>3||ml<=0) return false;
+
+  bool closedLoop = flowSensorUsable(i);
+  if(!closedLoop && pumpFlowRate[i]<=0) return false;
+
+  unsigned long now = millis();
+  PumpRun &run = pumpRun[i];
+  float sec = pumpFlowRate[i]>0 ? ml/pumpFlowRate[i] : 0;
+  unsigned long durMs;
+  if(closedLoop){
+    // Doppelte Sollzeit als Sicherheitsgrenze, ohne Kalibrierung 10 min
+    durMs = sec>0 ? (unsigned long)(sec*2000.0f)+10000 : 600000UL;
+  } else {
+    durMs = (unsigned long)(sec*1000.0f);
+  }
+
+  if(run.active && pumpStatus[i]){
+    // Läuft bereits: die längere Dosierung gewinnt
+    if(run.closedLoop && closedLoop){
+      uint32_t pulses = (uint32_t)(ml*flowPulsesPerMl[i]);
+      uint32_t done = flowSource->pulses(i) - run.startPulses;
+      if(done+pulses>run.targetPulses) {
+        run.targetPulses = done+pulses;
+        run.targetMl = run.targetPulses/flowPulsesPerMl[i];
+      }
+    }
+    unsigned long endMs = now + durMs;
+    if((long)(endMs-(run.startMs+run.durationMs))>0){
+      run.durationMs = endMs - run.startMs;
+    }
+    // Neue Sollmenge festhalten, bisherigen Fortschritt gleich dazu
+    doseJournalStart(i);
+    doseJournalProgress(i);
+    return true;
+  }
+
+  run.active       = true;
+  run.closedLoop   = closedLoop;
+  run.targetMl     = ml;
+  run.startMs      = now;
+  run.durationMs   = durMs;
+  run.startPulses  = closedLoop ? flowSource->pulses(i) : 0;
+  run.targetPulses = closedLoop ? (uint32_t)(ml*flowPulsesPerMl[i]) : 0;
+  doseJournalStart(i);
+
+  pumpStatus[i] = true;
+  digitalWrite(pumpPin(i), HIGH);
+
+  // LED an
+  digitalWrite(ledpin, HIGH);
+  return true;
+}
+
+// Pumpe i ausschalten
+void stopPump(int i){
+  if(i<0||i>3) return;
+  if(pumpRun[i].active) doseJournalEnd(i, doseDispensedMl(i));
+  pumpStatus[i] = false;
+  pumpRun[i].active = false;
+
+  digitalWrite(pumpPin(i), LOW);
+
+  // LED aus, wenn keine Pumpe mehr an
+  bool anyOn=false;
+  for(int k=0;k<4;k++){
+    if(pumpStatus[k]) { anyOn=true; break; }
+  }
+  if(!anyOn) digitalWrite(ledpin, LOW);
+}
+
+// Pumpe mitten in einer Dosierung anhalten und die nicht geförderte Menge
+// dem Behälter gutschreiben (abgezogen wurde beim Start die ganze Menge)
+void stopPumpCredited(int i){
+  if(i<0||i>3) return;
+  float rest = pumpRun[i].active ? doseTargetMl(i) - doseDispensedMl(i) : 0;
+  stopPump(i);
+  if(rest>0 && !reservoirMeasured(pumpTankIndex(i))){
+    reservoirDraw(i, -rest);
+    saveConfig();
+    LOG_I("Pumpe %d: %.1f ml nicht gefördert, gutgeschrieben", i+1, rest);
+  }
+}
+
+// Geregelte Dosierung abgeschlossen: Flussrate aus den Impulsen nachführen
+void finishClosedLoopDose(int i, uint32_t pulses, unsigned long elapsedMs){
+  PumpRun &run = pumpRun[i];
+  float ml  = pulses / flowPulsesPerMl[i];
+  float sec = elapsedMs / 1000.0f;
+  stopPump(i);
+
+  // Behälterstand um die Abweichung zur Sollmenge korrigieren
+  reservoirDraw(i, ml - run.targetMl);
+
+  if(sec>0.5f && ml>0){
+    float measured = ml/sec;
+    float rate = pumpFlowRate[i]>0
+      ? pumpFlowRate[i] + FLOW_RECAL_WEIGHT*(measured - pumpFlowRate[i])
+      : measured;
+    LOG_I("Pumpe %d geregelt fertig: %.1f ml in %.1f s, Rate %.3f -> %.3f ml/s",
+      i+1, ml, sec, pumpFlowRate[i], rate);
+    pumpFlowRate[i] = rate;
+    replFlowStamp[i] = replNextStamp();
+    replSendFlow(i);
+    markConfigDirty();
+  }
+}
+
+// Laufende Dosierungen überwachen (aus loop())
+void pumpRunPoll(){
+  unsigned long now = millis();
+  for(int i=0; i<4; i++){
+    PumpRun &run = pumpRun[i];
+    if(!pumpStatus[i] || !run.active){
+      // Manuell übersteuert: Dosierung gilt als beendet
+      if(doseJournalOpen[i]) doseJournalEnd(i, 0);
+      continue;
+    }
+    unsigned long elapsed = now - run.startMs;
+    if(now - run.journalMs >= DOSE_CHECKPOINT_MS) doseJournalProgress(i);
+
+    if(run.closedLoop){
+      uint32_t got = flowSource->pulses(i) - run.startPulses;
+      if(got>=run.targetPulses){
+        finishClosedLoopDose(i, got, elapsed);
+        continue;
+      }
+      if(got==0 && elapsed>=FLOW_NO_PULSE_MS){
+        // Sensor liefert nichts: auf Zeitmodus zurückfallen
+        flowSensorFault[i] = true;
+        run.closedLoop = false;
+        if(pumpFlowRate[i]>0){
+          run.durationMs = (unsigned long)(run.targetMl/pumpFlowRate[i]*1000.0f);
+          LOG_W("Durchflusssensor Pumpe %d ohne Impulse => Zeitmodus", i+1);
+        } else {
+          LOG_W("Durchflusssensor Pumpe %d ohne Impulse und nicht kalibriert => AUS", i+1);
+          stopPump(i);
+          continue;
+        }
+      }
+    }
+
+    if(elapsed>=run.durationMs){
+      if(run.closedLoop){
+        LOG_W("Pumpe %d Sollmenge nicht erreicht => Sicherheitsabschaltung", i+1);
+      } else {
+        cutoffDelayHist.add(elapsed - run.durationMs);
+        LOG_I("Pumpe %d Lauf abgelaufen => AUS", i+1);
+      }
+      stopPump(i);
+    }
+  }
+  doseJournalCompact();
+}
+
+/* --------------------------------------------------------------------------
+   Motorstrom-Überwachung
+   --------------------------------------------------------------------------
+   Optional je Pumpe ein Stromsensor (Shunt-Verstärker oder Hall-Sensor) an
+   einem ADC1-Pin, abgetastet über die ADC-DMA. Die ADC-Task verdichtet die
+   Blöcke eines Laufs zu einer Signatur: Anlaufspitze in den ersten
+   CURRENT_INRUSH_MS, danach Mittel und Streuung der Blockmittel (Welford)
+   und ein schnelles EMA für die Erkennung. Gesunde Läufe gehen gewichtet in
+   die gelernte Basis ein. loop() schaltet ab bei
+     - keinem Strom (Motor oder Leitung offen), auch ohne Basis,
+     - Trockenlauf (deutlich weniger Strom als gelernt),
+     - Blockade (deutlich mehr Strom als gelernt bzw. ADC am Anschlag),
+   und markiert Läufe, deren Signatur von der Basis abweicht, als auffällig.
+   Alle Zeiten zählen über die Abtastwerte, nicht über millis(): so liefert
+   currentPush() mit künstlichen Verläufen dieselben Ergebnisse wie am Gerät
+   (siehe /api/currentsim im Benchmark-Build).
+   -------------------------------------------------------------------------- */
+const float    CURRENT_INRUSH_MS    = 300;
+const float    CURRENT_MIN_RAW      = 30;    // darunter fließt kein Strom
+const float    CURRENT_MAX_RAW      = 4000;  // ADC am Anschlag
+const float    CURRENT_DRY_RATIO    = 0.7f;  // Anteil des gelernten Mittels
+const float    CURRENT_STALL_RATIO  = 1.6f;
+const float    CURRENT_DEAD_MS      = 1000;
+const float    CURRENT_DRY_MS       = 2000;
+const float    CURRENT_STALL_MS     = 500;
+const float    CURRENT_FAST_ALPHA   = 0.3f;
+const uint16_t CURRENT_LEARN_RUNS   = 3;     // vorher keine Trockenlauf-/Abweichungsprüfung
+const float    CURRENT_LEARN_WEIGHT = 0.2f;
+const float    CURRENT_LEARN_MIN_MS = 1000;  // Dauerlauf, ab dem ein Lauf zählt
+
+enum CurrentState : uint8_t {
+  CUR_OFF, CUR_LEARNING, CUR_OK, CUR_ANOMALY, // ohne Abschaltung
+  CUR_DRY, CUR_STALL, CUR_DEAD                // Pumpe wird abgeschaltet
+};
+const char *CURRENT_STATE_NAMES[] = {
+  "aus", "lernt", "ok", "auffällig", "Trockenlauf", "blockiert", "kein Strom"
+};
+
+// Signatur des laufenden bzw. letzten Laufs
+struct CurrentSignature {
+  uint32_t run;        // Laufnummer, beim Einschalten erhöht
+  bool on;
+  float ms;            // Laufzeit aus der Zahl der Abtastwerte
+  float inrush;
+  uint32_t steady;     // Blöcke nach dem Anlauf
+  float mean, m2;      // Welford über die Blockmittel
+  float fast;
+  float dryBelow, stallAbove; // Schwellen, beim Einschalten aus der Basis
+  float deadMs, dryMs, stallMs; // Dauer der Unter-/Überschreitung am Stück
+};
+
+struct CurrentMonitor {
+  CurrentState state;
+  uint32_t learnedRun; // Lauf, dessen Ende schon ausgewertet ist
+};
+
+portMUX_TYPE currentMux = portMUX_INITIALIZER_UNLOCKED;
+CurrentSignature currentSig[4] = {}; // von der ADC-Task veröffentlicht
+CurrentMonitor currentMon[4] = {};
+
+float currentSd(const CurrentSignature &s) {
+  return s.steady>1 ? sqrtf(s.m2/(s.steady-1)) : 0;
+}
+
+// Einen DMA-Block (Mittel, Spitze, Zahl der Werte) in die Signatur einrechnen
+void currentPush(CurrentSignature &s, const CurrentBaseline &b, bool on,
+                 uint16_t mean, uint16_t peak, uint32_t samples, float msPerSample) {
+  if(on && !s.on){
+    uint32_t run = s.run + 1;
+    s = {};
+    s.run = run;
+    s.on  = true;
+    bool learned = b.runs>=CURRENT_LEARN_RUNS;
+    s.dryBelow   = learned ? b.mean*CURRENT_DRY_RATIO : 0;
+    s.stallAbove = learned && b.mean*CURRENT_STALL_RATIO<CURRENT_MAX_RAW
+                 ? b.mean*CURRENT_STALL_RATIO : CURRENT_MAX_RAW;
+  }
+  if(!on){
+    s.on = false;
+    return;
+  }
+  float dt = samples*msPerSample;
+  s.ms += dt;
+  if(s.ms<=CURRENT_INRUSH_MS){
+    if(peak>s.inrush) s.inrush = peak;
+    return;
+  }
+  s.steady++;
+  float d = mean - s.mean;
+  s.mean += d/s.steady;
+  s.m2   += d*(mean - s.mean);
+  s.fast  = s.steady==1 ? mean : s.fast + CURRENT_FAST_ALPHA*(mean - s.fast);
+  s.deadMs  = s.fast<CURRENT_MIN_RAW ? s.deadMs+dt : 0;
+  s.dryMs   = s.fast<s.dryBelow      ? s.dryMs+dt  : 0;
+  s.stallMs = s.fast>s.stallAbove    ? s.stallMs+dt : 0;
+}
+
+CurrentState currentEvaluate(const CurrentSignature &s, const CurrentBaseline &b) {
+  if(s.deadMs>=CURRENT_DEAD_MS)   return CUR_DEAD;
+  if(s.stallMs>=CURRENT_STALL_MS) return CUR_STALL;
+  if(s.dryMs>=CURRENT_DRY_MS)     return CUR_DRY;
+  if(b.runs<CURRENT_LEARN_RUNS)   return CUR_LEARNING;
+  if(s.ms<CURRENT_INRUSH_MS+CURRENT_LEARN_MIN_MS) return CUR_OK;
+  bool meanOff   = fabsf(s.mean - b.mean) > 0.2f*b.mean;
+  bool noisy     = currentSd(s) > 2*b.sd + CURRENT_MIN_RAW;
+  bool inrushOff = b.inrush>0 && fabsf(s.inrush - b.inrush) > 0.4f*b.inrush;
+  return meanOff || noisy || inrushOff ? CUR_ANOMALY : CUR_OK;
+}
+
+// Abgeschlossenen Lauf in die Basis übernehmen; nur ungestörte Läufe
+bool currentLearn(const CurrentSignature &s, CurrentBaseline &b, CurrentState st) {
+  if(st>=CUR_ANOMALY || s.ms<CURRENT_INRUSH_MS+CURRENT_LEARN_MIN_MS || s.steady<2) return false;
+  float sd = currentSd(s);
+  if(b.runs==0){
+    b.mean   = s.mean;
+    b.sd     = sd;
+    b.inrush = s.inrush;
+  } else {
+    b.mean   += CURRENT_LEARN_WEIGHT*(s.mean - b.mean);
+    b.sd     += CURRENT_LEARN_WEIGHT*(sd - b.sd);
+    b.inrush += CURRENT_LEARN_WEIGHT*(s.inrush - b.inrush);
+  }
+  if(b.runs<0xFFFF) b.runs++;
+  return true;
+}
+
+// Aufruf aus der ADC-Task, je Pumpe eine Instanz
+template<int P>
+void currentAdcFrame(uint16_t mean, uint16_t peak, uint32_t count) {
+  static CurrentSignature work = {};
+  portENTER_CRITICAL(&currentMux);
+  CurrentBaseline b = currentBase[P];
+  portEXIT_CRITICAL(&currentMux);
+  currentPush(work, b, pumpStatus[P], mean, peak, count,
+              1000.0f*adcChannelCount/ADC_SAMPLE_HZ);
+  portENTER_CRITICAL(&currentMux);
+  currentSig[P] = work;
+  portEXIT_CRITICAL(&currentMux);
+}
+
+void currentBegin() {
+  static const AdcFrameHandler handlers[4] = {
+    currentAdcFrame<0>, currentAdcFrame<1>, currentAdcFrame<2>, currentAdcFrame<3>
+  };
+  for(int i=0; i<4; i++){
+    if(currentSensePin[i]<0) continue;
+    if(!adcAddChannel(currentSensePin[i], handlers[i])){
+      LOG_E("Stromsensor Pumpe %d nicht angemeldet", i+1);
+    }
+  }
+}
+
+void doseAbortPump(int i);
+
+// Signaturen auswerten, bei Fehlern abschalten, Laufende lernen (aus loop())
+void currentPoll() {
+  for(int i=0; i<4; i++){
+    if(currentSensePin[i]<0) continue;
+    portENTER_CRITICAL(&currentMux);
+    CurrentSignature s = currentSig[i];
+    portEXIT_CRITICAL(&currentMux);
+    CurrentMonitor &m = currentMon[i];
+    if(s.run==0) continue;
+
+    if(s.on){
+      CurrentState st = currentEvaluate(s, currentBase[i]);
+      if(st==CUR_ANOMALY && m.state!=CUR_ANOMALY){
+        LOG_W("Pumpe %d: Stromsignatur auffällig (Mittel %.0f statt %.0f, Anlauf %.0f statt %.0f)",
+          i+1, s.mean, currentBase[i].mean, s.inrush, currentBase[i].inrush);
+      }
+      m.state = st;
+      if(st>=CUR_DRY && pumpStatus[i]){
+        LOG_W("Pumpe %d: %s (Strom %.0f) => AUS", i+1, CURRENT_STATE_NAMES[st], s.fast);
+        doseAbortPump(i);
+      }
+    } else if(s.run!=m.learnedRun){
+      m.learnedRun = s.run;
+      CurrentBaseline b = currentBase[i];
+      if(currentLearn(s, b, m.state)){
+        portENTER_CRITICAL(&currentMux);
+        currentBase[i] = b;
+        portEXIT_CRITICAL(&currentMux);
+        markConfigDirty();
+      }
+    }
+  }
+}
+
+void resetCurrentBaseline(int p) {
+  portENTER_CRITICAL(&currentMux);
+  currentBase[p] = {};
+  portEXIT_CRITICAL(&currentMux);
+  currentMon[p].state = CUR_OFF;
+  saveConfig();
+}
+
+// Stromsensor setzen (-1 entfernt ihn); die Basis wird neu gelernt
+void updateCurrentSensor(int p, int pin) {
+  bool restart = pin!=currentSensePin[p];
+  currentSensePin[p] = pin;
+  resetCurrentBaseline(p);
+  if(restart) restartAtMillis = millis() + 1000; // ADC-Muster ist fest
+}
+
+void writeCurrentJson(Print &out, int p) {
+  portENTER_CRITICAL(&currentMux);
+  CurrentSignature s = currentSig[p];
+  CurrentBaseline b = currentBase[p];
+  portEXIT_CRITICAL(&currentMux);
+  CurrentState st = s.run==0 ? CUR_OFF : currentMon[p].state;
+  out.print("{\"pin\":");     out.print(currentSensePin[p]);
+  out.print(",\"state\":\""); out.print(CURRENT_STATE_NAMES[st]);
+  out.print("\",\"cutoff\":"); out.print(st>=CUR_DRY?"true":"false");
+  out.print(",\"mean\":");    out.print(s.mean, 0);
+  out.print(",\"sd\":");      out.print(currentSd(s), 1);
+  out.print(",\"inrush\":");  out.print(s.inrush, 0);
+  out.print(",\"base\":{\"mean\":"); out.print(b.mean, 0);
+  out.print(",\"sd\":");      out.print(b.sd, 1);
+  out.print(",\"inrush\":");  out.print(b.inrush, 0);
+  out.print(",\"runs\":");    out.print(b.runs);
+  out.print("}}");
+}
+
+/* --------------------------------------------------------------------------
+   Pumpenzähler
+   --------------------------------------------------------------------------
+   Je Pumpe Laufzeit, Starts, abgebuchte Menge (was reservoirDraw() vom
+   Behälter abzieht) und kalibrierte Menge (Laufzeit mal Flussrate, mit
+   Durchflusssensor die gezählten Impulse). Weichen beide voneinander ab,
+   passen Tankverbrauch und Kalibrierung nicht zusammen; Handbetrieb und
+   Kalibrierläufe erscheinen nur in der kalibrierten Menge.
+   Gezählt wird an den Flanken von pumpStatus, damit jeder Weg, der eine
+   Pumpe schaltet, erfasst ist; ein langer Lauf wird jede Minute verbucht.
+   Die Zähler liegen im RTC-Speicher und überstehen damit jeden Reset außer
+   dem Einschalten, ohne den Flash zu beschreiben. Alle
+   COUNTER_CHECKPOINT_MIN Minuten geht eine Kopie als ein Blob in den NVS,
+   aber nie während eine Pumpe läuft (Abschaltlatenz). Nach einem
+   Stromausfall fehlt also höchstens diese Zeitspanne. Tageswerte der
+   letzten COUNTER_DAYS Tage ergeben Tages- und Wochensummen; Wartungsgrenzen
+   (Stunden bzw. ml seit der letzten Wartung) melden fällige Wartung.
+   -------------------------------------------------------------------------- */
+#define COUNTER_DAYS           14
+#define COUNTER_CHECKPOINT_MIN 30
+#define COUNTER_FLUSH_MS       60000UL
+#define COUNTER_MAGIC          0x434E5431UL // "CNT1"
+
+struct PumpDayCount {
+  int32_t  day;        // lokaler Tag (Tage seit 1970)
+  uint32_t onMs;
+  uint32_t starts;
+  float    ml;
+  float    calMl;
+};
+
+struct PumpTotalCount {
+  uint64_t onMs;
+  double   ml;
+  double   calMl;
+  uint32_t starts;
+  uint32_t serviceAt;   // Unixzeit der letzten Wartung, 0 = nie
+  uint64_t serviceOnMs; // onMs bei der letzten Wartung
+  double   serviceMl;   // calMl bei der letzten Wartung
+};
+
+struct PumpCounterBlock {
+  uint32_t magic;
+  uint32_t seq;         // zählt jede Änderung; der höhere Stand gewinnt
+  PumpTotalCount total[4];
+  PumpDayCount   days[4][COUNTER_DAYS];
+  uint32_t check;
+};
+RTC_NOINIT_ATTR PumpCounterBlock pumpCounters;
+
+bool counterWasOn[4] = {};
+unsigned long counterRunMs[4];   // Beginn des noch nicht verbuchten Laufstücks
+uint32_t counterRunPulses[4];
+uint32_t counterSavedSeq = 0;    // Stand im NVS
+unsigned long counterCheckpointMs = 0;
+const char *counterSource = "neu";
+
+static uint32_t counterCheck(const PumpCounterBlock &b) {
+  uint32_t h = 2166136261UL; // FNV-1a
+  const uint8_t *p = (const uint8_t*)&b;
+  for(size_t i=0; i<offsetof(PumpCounterBlock, check); i++) h = (h ^ p[i]) * 16777619UL;
+  return h;
+}
+
+static void counterTouch() {
+  pumpCounters.seq++;
+  pumpCounters.check = counterCheck(pumpCounters);
+}
+
+static int32_t counterToday() {
+  return tzLocal(currentUnixTime)/SECONDS_PER_DAY;
+}
+
+static PumpDayCount &counterDay(int p, int32_t day) {
+  PumpDayCount &d = pumpCounters.days[p][day % COUNTER_DAYS];
+  if(d.day!=day) d = {day, 0, 0, 0.0f, 0.0f};
+  return d;
+}
+
+// Aufruf aus reservoirDraw(): abgebuchte Menge (Korrekturen negativ)
+void pumpCounterDraw(int p, float ml) {
+  pumpCounters.total[p].ml += ml;
+  counterDay(p, counterToday()).ml += ml;
+  counterTouch();
+}
+
+static uint32_t counterPulses(int p) {
+  return flowSensorPin[p]>=0 ? flowSource->pulses(p) : 0;
+}
+
+// Laufstück seit counterRunMs verbuchen
+static void counterBookRun(int p, unsigned long now) {
+  uint32_t ms = now - counterRunMs[p];
+  float cal = flowSensorUsable(p)
+    ? (counterPulses(p) - counterRunPulses[p]) / flowPulsesPerMl[p]
+    : ms/1000.0f * pumpFlowRate[p];
+  PumpTotalCount &t = pumpCounters.total[p];
+  t.onMs  += ms;
+  t.calMl += cal;
+  PumpDayCount &d = counterDay(p, counterToday());
+  d.onMs  += ms;
+  d.calMl += cal;
+  counterRunMs[p] = now;
+  counterRunPulses[p] = counterPulses(p);
+}
+
+void counterCheckpoint() {
+  Preferences nvs;
+  if(!nvs.begin("pumpe", false)
+     || nvs.putBytes("counters", &pumpCounters, sizeof(pumpCounters))!=sizeof(pumpCounters)){
+    LOG_E("Pumpenzähler konnten nicht gesichert werden!");
+  }
+  nvs.end();
+  counterSavedSeq = pumpCounters.seq;
+  counterCheckpointMs = millis();
+}
+
+// Nach loadConfig(), vor doseJournalRecover() (bucht über reservoirDraw())
+void counterBegin() {
+  bool rtcOk = esp_reset_reason()!=ESP_RST_POWERON
+    && pumpCounters.magic==COUNTER_MAGIC && pumpCounters.check==counterCheck(pumpCounters);
+  PumpCounterBlock *saved = new PumpCounterBlock;
+  bool nvsOk = false;
+  Preferences nvs;
+  if(nvs.begin("pumpe", true)){
+    nvsOk = nvs.getBytes("counters", saved, sizeof(*saved))==sizeof(*saved)
+      && saved->magic==COUNTER_MAGIC && saved->check==counterCheck(*saved);
+    nvs.end();
+  }
+  if(rtcOk && (!nvsOk || pumpCounters.seq>=saved->seq)){
+    counterSource = "rtc";
+  } else if(nvsOk){
+    pumpCounters = *saved;
+    counterSource = "nvs";
+  } else {
+    memset(&pumpCounters, 0, sizeof(pumpCounters));
+    pumpCounters.magic = COUNTER_MAGIC;
+    counterTouch();
+    counterSource = "neu";
+  }
+  counterSavedSeq = nvsOk ? saved->seq : 0;
+  delete saved;
+  counterCheckpointMs = millis();
+  LOG_I("Pumpenzähler aus %s (Stand %lu)", counterSource, (unsigned long)pumpCounters.seq);
+}
+
+// Flanken von pumpStatus zählen, lange Läufe minütlich verbuchen und
+// gelegentlich in den NVS sichern (aus loop())
+void counterPoll() {
+  unsigned long now = millis();
+  bool changed = false;
+  bool anyOn = false;
+  for(int p=0; p<4; p++){
+    bool on = pumpStatus[p];
+    anyOn |= on;
+    if(on && !counterWasOn[p]){
+      pumpCounters.total[p].starts++;
+      counterDay(p, counterToday()).starts++;
+      counterRunMs[p] = now;
+      counterRunPulses[p] = counterPulses(p);
+      changed = true;
+    } else if(counterWasOn[p] && (!on || now-counterRunMs[p]>=COUNTER_FLUSH_MS)){
+      counterBookRun(p, now);
+      changed = true;
+    }
+    counterWasOn[p] = on;
+  }
+  if(changed) counterTouch();
+  if(!anyOn && pumpCounters.seq!=counterSavedSeq
+     && now-counterCheckpointMs>=COUNTER_CHECKPOINT_MIN*60000UL){
+    counterCheckpoint();
+  }
+}
+
+bool counterMaintenanceDue(int p) {
+  const PumpTotalCount &t = pumpCounters.total[p];
+  const PumpMaintenance &m = pumpMaint[p];
+  return (m.hours>0 && (t.onMs - t.serviceOnMs)/3600000.0f >= m.hours)
+      || (m.ml>0 && t.calMl - t.serviceMl >= m.ml);
+}
+
+void counterServiceDone(int p) {
+  PumpTotalCount &t = pumpCounters.total[p];
+  t.serviceAt   = currentUnixTime;
+  t.serviceOnMs = t.onMs;
+  t.serviceMl   = t.calMl;
+  counterTouch();
+  counterCheckpoint();
+}
+
+void updatePumpMaintenance(int p, float hours, float ml) {
+  pumpMaint[p] = {hours, ml};
+  saveConfig();
+}
+
+static void writeCounterSumJson(Print &out, int p, int32_t from, int32_t to) {
+  uint32_t onMs = 0, starts = 0;
+  float ml = 0, calMl = 0;
+  for(int k=0; k<COUNTER_DAYS; k++){
+    const PumpDayCount &d = pumpCounters.days[p][k];
+    if(d.day<from || d.day>to) continue;
+    onMs += d.onMs;
+    starts += d.starts;
+    ml += d.ml;
+    calMl += d.calMl;
+  }
+  out.print("{\"onMin\":");  out.print(onMs/60000.0f, 1);
+  out.print(",\"starts\":"); out.print(starts);
+  out.print(",\"ml\":");     out.print(ml, 1);
+  out.print(",\"calMl\":");  out.print(calMl, 1);
+  out.print('}');
+}
+
+void writeCounterJson(Print &out, int p) {
+  const PumpTotalCount &t = pumpCounters.total[p];
+  const PumpMaintenance &m = pumpMaint[p];
+  int32_t today = counterToday();
+  char when[40];
+  out.print("{\"onHours\":");   out.print(t.onMs/3600000.0, 2);
+  out.print(",\"starts\":");    out.print(t.starts);
+  out.print(",\"ml\":");        out.print(t.ml, 1);
+  out.print(",\"calMl\":");     out.print(t.calMl, 1);
+  out.print(",\"today\":");     writeCounterSumJson(out, p, today, today);
+  out.print(",\"yesterday\":"); writeCounterSumJson(out, p, today-1, today-1);
+  out.print(",\"week\":");      writeCounterSumJson(out, p, today-6, today);
+  out.print(",\"lastWeek\":");  writeCounterSumJson(out, p, today-13, today-7);
+  out.print(",\"service\":{\"at\":"); out.print((unsigned long)t.serviceAt);
+  out.print(",\"atText\":\"");
+  out.print(t.serviceAt ? formatDayString(when, sizeof(when), t.serviceAt) : "nie");
+  out.print("\",\"onHours\":"); out.print((t.onMs - t.serviceOnMs)/3600000.0, 2);
+  out.print(",\"calMl\":");     out.print(t.calMl - t.serviceMl, 1);
+  out.print("},\"limit\":{\"hours\":"); out.print(m.hours, 1);
+  out.print(",\"ml\":");        out.print(m.ml, 0);
+  out.print("},\"due\":");      out.print(counterMaintenanceDue(p)?"true":"false");
+  out.print('}');
+}
+
+/* --------------------------------------------------------------------------
+   Programmausführung
+   --------------------------------------------------------------------------
+   Parallele Programme starten alle Pumpen sofort. Bei "nacheinander" landen
+   die Schritte in einer Warteschlange, die aus loop() abgearbeitet wird:
+   nächste Pumpe erst, wenn die vorige aus ist und die Pause verstrichen ist.
+   -------------------------------------------------------------------------- */
+struct DoseStep {
+  int8_t pump;
+  int ml;
+  uint16_t gapSec; // Pause nach diesem Schritt
+};
+std::queue<DoseStep> doseQueue;
+int8_t doseQueuePump = -1;          // Pumpe des laufenden Schritts
+uint16_t doseQueueGap = 0;
+unsigned long doseQueueNextMs = 0;  // frühester Start des nächsten Schritts
+
+// Mehrere Pumpen gleichzeitig dosieren (ml je Pumpe, 0 = nicht beteiligt).
+// Erst werden alle Behälter verringert und einmal gespeichert, dann die
+// Pumpen gestartet: so steht der Abzug im Flash, bevor das Journal die
+// Dosierung als offen führt. Liefert die gestarteten Pumpen als Bitmaske.
+uint8_t runDoseSteps(const int ml[4]){
+  uint8_t use = 0;
+  for(int i=0; i<4; i++){
+    if(ml[i]<=0) continue;
+    if(pumpFlowRate[i]<=0 && !flowSensorUsable(i)){
+      LOG_W("Pumpe %d Flow=0 => skip", i+1);
+      continue;
+    }
+    reservoirDraw(i, ml[i]);
+    use |= 1<<i;
+  }
+  if(!use) return 0;
+  saveConfig(); // Tankabzug sichern
+  uint8_t started = 0;
+  for(int i=0; i<4; i++){
+    if(!(use & (1<<i))) continue;
+    LOG_I(" -> Pumpe %d %d ml%s, %s=%.1f ml", i+1, ml[i],
+      flowSensorUsable(i) ? " (geregelt)" : "",
+      pumpTank(i).name.c_str(), pumpTank(i).level);
+    if(startPumpDose(i, ml[i])) started |= 1<<i;
+  }
+  return started;
+}
+
+// Eine Pumpe dosieren und den Stand ihres Behälters verringern
+bool runDoseStep(int i, int ml){
+  int amounts[4] = {0, 0, 0, 0};
+  amounts[i] = ml;
+  return runDoseSteps(amounts)!=0;
+}
+
+void doseQueuePush(const DoseStep &step){
+  doseQueue.push(step);
+  doseJournalQueue(step.pump, step.ml, step.gapSec);
+}
+
+// Wartende Schritte verwerfen (Abbruch wegen einer gestörten Pumpe)
+void doseQueueClear(){
+  doseQueuePump = -1;
+  if(doseQueue.empty()) return;
+  LOG_W("%u wartende Schritte verworfen", (unsigned)doseQueue.size());
+  std::queue<DoseStep>().swap(doseQueue);
+  doseJournalQueueClear();
+}
+
+// Wartende Schritte nacheinander laufender Programme starten (aus loop())
+void doseQueuePoll(){
+  unsigned long now = millis();
+  if(doseQueuePump>=0){
+    if(pumpStatus[doseQueuePump]) return;
+    doseQueuePump = -1;
+    doseQueueNextMs = now + doseQueueGap*1000UL;
+  }
+  while(!doseQueue.empty() && (long)(now-doseQueueNextMs)>=0){
+    DoseStep step = doseQueue.front();
+    doseQueue.pop();
+    doseJournalDequeue(step.pump);
+    if(runDoseStep(step.pump, step.ml)){
+      doseQueuePump = step.pump;
+      doseQueueGap  = step.gapSec;
+      return;
+    }
+  }
+}
+
+// Programm ausführen (alle angehakten Pumpen); false, wenn gesperrt.
+// Nur zeitgesteuerte Läufe setzen lastRun: ein Lauf durch einen Auslöser
+// darf die nächste planmäßige Ausführung (Wochenintervall) nicht verschieben.
+bool runProgram(size_t idx, bool scheduled){
+  Program prog = programs.get(idx);
+  int blocked = programBlockingReservoir(prog);
+  if(blocked>=0){
+    LOG_W("Programm gesperrt: %s fiele unter die Reserve von %.0f ml",
+      reservoirs[blocked].name.c_str(), reservoirs[blocked].reserve);
+    traceProgram(prog.id, false);
+    return false;
+  }
+  traceProgram(prog.id, true);
+  bool sequential = prog.mode==PROG_SEQUENTIAL;
+  bool cron = !prog.cron.isEmpty();
+  LOG_I("Starte Programm: %s%s%s, %d ml %s",
+    cron ? prog.cron.c_str() : prog.days.c_str(), cron ? "" : " ",
+    cron ? "" : prog.time.c_str(),
+    programVolume(prog), sequential ? "nacheinander" : "gleichzeitig");
+  int amounts[4] = {0, 0, 0, 0};
+  for(int i=0; i<4; i++){
+    if(!prog.pumps[i] || prog.amounts[i]<=0) continue;
+    if(sequential){
+      doseQueuePush({(int8_t)i, prog.amounts[i], prog.gapSec});
+    } else {
+      amounts[i] = prog.amounts[i];
+    }
+  }
+  if(sequential) doseQueuePoll();
+  else runDoseSteps(amounts);
+  if(scheduled) programs.setLastRun(idx, currentUnixTime); // steht direkt im Programmspeicher
+  return true;
+}
+
+// Beim Start: Journal auswerten, Pins mit dem Status abgleichen und offene
+// Dosierungen fortsetzen oder abbrechen
+void doseJournalRecover() {
+  struct Pending { bool open; float target; float done; };
+  Pending pending[4] = {};
+  std::deque<DoseStep> queued;   // noch nicht entnommene Schritte
+  DoseStep lastDequeued = {-1, 0, 0};
+
+  File f = SPIFFS.open(DOSE_JOURNAL_PATH, FILE_READ);
+  if(f){
+    DoseRecord r;
+    while(f.read((uint8_t*)&r, sizeof(r))==sizeof(r)){
+      // Abgerissener oder beschädigter Eintrag: Rest ignorieren
+      if(r.check!=doseRecordCheck(r) || r.pump>3) break;
+      if(r.type==DOSE_RECIPE){
+        doseJournalRecipe = r;
+        continue;
+      }
+      Pending &p = pending[r.pump];
+      switch(r.type){
+        case DOSE_START:    p.open = true; p.target = r.a/100.0f; p.done = 0; break;
+        case DOSE_PROGRESS: p.done = r.a/100.0f; break;
+        case DOSE_END:      p.open = false; break;
+        case DOSE_QUEUED:
+          queued.push_back({(int8_t)r.pump, (int)((r.a+50)/100), (uint16_t)r.b});
+          break;
+        case DOSE_DEQUEUED:
+          if(!queued.empty()){
+            lastDequeued = queued.front();
+            queued.pop_front();
+          }
+          break;
+        case DOSE_QUEUE_CLEAR:
+          queued.clear();
+          lastDequeued.pump = -1;
+          break;
+      }
+    }
+    f.close();
+  }
+
+  // Der gespeicherte Pumpenstatus entspricht nach einem Neustart nicht den
+  // Pins: alles aus, fortgesetzte Dosierungen schalten unten wieder ein
+  for(int i=0; i<4; i++){
+    pumpStatus[i] = false;
+    pumpRun[i] = {};
+    digitalWrite(pumpPin(i), LOW);
+  }
+  digitalWrite(ledpin, LOW);
+
+  doseJournal = SPIFFS.open(DOSE_JOURNAL_PATH, FILE_WRITE);
+  if(!doseJournal) LOG_E("Dosierjournal konnte nicht geöffnet werden!");
+
+  bool changed = false;
+  for(int i=0; i<4; i++){
+    if(!pending[i].open) continue;
+    float rest = pending[i].target - pending[i].done;
+    if(rest<1.0f) continue;
+    if(doseResume && startPumpDose(i, rest)){
+      LOG_I("Dosierjournal: Pumpe %d setzt fort, %.1f ml offen", i+1, rest);
+    } else {
+      // Abzug erfolgte beim Start der Dosierung: Rest wieder gutschreiben
+      if(!reservoirMeasured(pumpTankIndex(i))) reservoirDraw(i, -rest);
+      changed = true;
+      LOG_W("Dosierjournal: Pumpe %d abgebrochen, %.1f ml nicht gefördert", i+1, rest);
+    }
+  }
+  if(changed) saveConfig();
+
+  // Warteschlange eines nacheinander laufenden Programms. Eingereihte
+  // Schritte sind noch nicht vom Tank abgezogen, beim Abbrechen ist also
+  // nichts gutzuschreiben.
+  if(queued.empty()) return;
+  if(!doseResume){
+    LOG_W("Dosierjournal: %u wartende Schritte verworfen", (unsigned)queued.size());
+    return;
+  }
+  int8_t running = lastDequeued.pump;
+  if(running>=0 && pumpStatus[running]){
+    doseQueuePump = running;       // Pause danach wie geplant einhalten
+    doseQueueGap  = lastDequeued.gapSec;
+  }
+  for(const DoseStep &step : queued) doseQueuePush(step);
+  LOG_I("Dosierjournal: %u wartende Schritte fortgesetzt", (unsigned)queued.size());
+}
+
+/* --------------------------------------------------------------------------
+   Sensor-Auslöser
+   --------------------------------------------------------------------------
+   Ein Auslöser startet ein Programm, wenn ein Sensorwert eine Schwelle
+   unter- oder überschreitet, und wird erst wieder scharf, wenn der Wert
+   die Schwelle um die Hysterese zurück überschritten hat. Mindestabstand
+   und Tageshöchstmenge halten eine fällige Auslösung zurück, bis sie
+   erlaubt ist (Warteschlange nach Zeitpunkt); gestartet wird über
+   runProgram() wie bei zeitgesteuerten Programmen.
+   Die Sensoren werden im Sekundentakt gelesen. Jeder Auslöser liefert je
+   Sensor zwei Kanten (Auslösen, wieder scharf), sortiert nach Wert; ein
+   Takt sucht per Binärsuche die Kanten zwischen altem und neuem Wert und
+   fasst nur diese Auslöser an. Die Kosten je Takt wachsen also nicht mit
+   der Zahl der Auslöser, sondern mit den tatsächlich überquerten Schwellen.
+   I2C-Sensoren hängen an SDA 21 / SCL 22 und dürfen diese Pins nicht mit
+   einem Durchflusssensor teilen.
+   -------------------------------------------------------------------------- */
+const unsigned long SENSOR_TICK_MS     = 1000;
+const float         SENSOR_ADC_ALPHA   = 0.1f; // Glättung der DMA-Blöcke
+const int           SENSOR_I2C_SDA     = 21;
+const int           SENSOR_I2C_SCL     = 22;
+const time_t        TRIGGER_RETRY_SEC  = 60;   // gesperrtes Programm erneut
+
+enum TriggerState : uint8_t {
+  TRIG_ARMED   = 0, // wartet auf das Überqueren der Schwelle
+  TRIG_FIRED   = 1, // ausgelöst, wartet auf die Rückkehr über die Hysterese
+  TRIG_WAITING = 2  // fällig, aber durch Abstand, Tagesmenge oder Sperre verzögert
+};
+static const char *TRIGGER_STATE_NAMES[] = {"armed", "fired", "waiting"};
+static const char *SENSOR_KIND_NAMES[]   = {"adc", "i2c", "sim"};
+
+// Schwelle eines Auslösers; zählt nur beim Überqueren in Richtung falling
+struct TriggerEdge {
+  float at;
+  uint16_t trig;
+  bool falling;
+  bool fire;     // sonst: wieder scharf schalten
+};
+
+struct TriggerRetry {
+  time_t at;
+  uint16_t trig;
+  uint16_t gen;  // veraltet, wenn der Auslöser inzwischen weitergeschaltet hat
+  bool operator>(const TriggerRetry &o) const { return at>o.at; }
+};
+
+// Laufzeitzustand je Auslöser (Index wie triggers)
+struct TriggerRun {
+  uint8_t state;
+  uint16_t gen;
+};
+
+portMUX_TYPE sensorMux = portMUX_INITIALIZER_UNLOCKED;
+volatile float    sensorAdcRaw[MAX_SENSORS];
+volatile uint32_t sensorAdcFrames[MAX_SENSORS];
+float sensorSimRaw[MAX_SENSORS] = {NAN, NAN, NAN, NAN};
+float sensorValue[MAX_SENSORS]  = {NAN, NAN, NAN, NAN}; // letzter gültiger Wert
+float sensorPrev[MAX_SENSORS]   = {NAN, NAN, NAN, NAN}; // Wert des vorigen Takts
+bool  sensorOk[MAX_SENSORS]     = {};
+bool  sensorI2cStarted = false;
+
+std::vector<TriggerEdge> triggerEdges[MAX_SENSORS];
+std::vector<TriggerRun> triggerRun;
+std::priority_queue<TriggerRetry, std::vector<TriggerRetry>,
+                    std::greater<TriggerRetry>> triggerRetry;
+unsigned long triggerLastTickMs = 0;
+
+// Aufruf aus der ADC-Task, je Sensor eine Instanz
+template<int S>
+void sensorAdcFrame(uint16_t mean, uint16_t, uint32_t) {
+  portENTER_CRITICAL(&sensorMux);
+  sensorAdcRaw[S] = sensorAdcFrames[S]==0 ? (float)mean
+                  : sensorAdcRaw[S] + SENSOR_ADC_ALPHA*(mean - sensorAdcRaw[S]);
+  sensorAdcFrames[S] = sensorAdcFrames[S] + 1;
+  portEXIT_CRITICAL(&sensorMux);
+}
+
+void sensorI2cBegin() {
+  if(sensorI2cStarted) return;
+  Wire.begin(SENSOR_I2C_SDA, SENSOR_I2C_SCL);
+  sensorI2cStarted = true;
+}
+
+// Aktuellen Wert lesen; false, wenn (noch) keiner vorliegt
+bool sensorRead(size_t s, float &v) {
+  const SensorInput &e = sensors[s];
+  float raw = NAN;
+  if(e.kind==SENSOR_ADC){
+    portENTER_CRITICAL(&sensorMux);
+    if(sensorAdcFrames[s]>0) raw = sensorAdcRaw[s];
+    portEXIT_CRITICAL(&sensorMux);
+  } else if(e.kind==SENSOR_I2C){
+    // 16-Bit-Register, höherwertiges Byte zuerst, mit Vorzeichen
+    Wire.beginTransmission((uint8_t)e.pin);
+    Wire.write(e.reg);
+    if(Wire.endTransmission(false)==0 && Wire.requestFrom((uint8_t)e.pin, (uint8_t)2)==2){
+      uint8_t hi = Wire.read();
+      uint8_t lo = Wire.read();
+      raw = (int16_t)((hi<<8) | lo);
+    }
+  } else {
+    raw = sensorSimRaw[s];
+  }
+  if(isnan(raw)) return false;
+  v = raw*e.scale + e.offset;
+  return true;
+}
+
+// Programm des Auslösers starten oder, falls noch nicht erlaubt, vormerken
+void triggerTryFire(size_t k) {
+  SensorTrigger &t = triggers[k];
+  TriggerRun &run = triggerRun[k];
+  time_t now = currentUnixTime;
+  run.gen++;
+
+  int idx = findProgramById(t.programId);
+  if(idx<0){
+    LOG_W("Auslöser %u: Programm fehlt", t.id);
+    run.state = TRIG_FIRED;
+    return;
+  }
+  int32_t day = tzLocal(now)/SECONDS_PER_DAY;
+  if(t.day!=day){
+    t.day = day;
+    t.dayMl = 0;
+  }
+  int ml = programVolume(programs.get(idx));
+
+  time_t retry = 0;
+  if(t.lastFire>0 && t.lastFire<=now && now<t.lastFire+(time_t)t.minGapSec){
+    retry = t.lastFire + t.minGapSec;
+  } else if(t.dailyCapMl>0 && t.dayMl+ml>t.dailyCapMl){
+    retry = tzToUtc((time_t)(day+1)*SECONDS_PER_DAY);
+  } else {
+    LOG_I("Auslöser %u: %s %.2f %s %.2f => Programm %d", t.id,
+      sensors[t.sensor].name.c_str(), sensorValue[t.sensor],
+      t.below ? "<" : ">", t.threshold, idx+1);
+    if(!runProgram(idx, false)) retry = now + TRIGGER_RETRY_SEC;
+  }
+  if(retry){
+    LOG_D("Auslöser %u wartet bis %s", t.id, unixTimeToDayString(retry).c_str());
+    run.state = TRIG_WAITING;
+    triggerRetry.push({retry, (uint16_t)k, run.gen});
+    return;
+  }
+  t.lastFire = now;
+  t.dayMl += ml;
+  run.state = TRIG_FIRED;
+  markConfigDirty();
+}
+
+void triggerCross(const TriggerEdge &e) {
+  TriggerRun &run = triggerRun[e.trig];
+  if(!e.fire){
+    if(run.state!=TRIG_ARMED){
+      run.state = TRIG_ARMED;
+      run.gen++; // eine vorgemerkte Auslösung entfällt
+    }
+  } else if(run.state==TRIG_ARMED){
+    triggerTryFire(e.trig);
+  }
+}
+
+// Neuen Wert von Sensor s gegen die Schwellen prüfen
+void triggerStep(size_t s, float v) {
+  float p = sensorPrev[s];
+  sensorPrev[s] = v;
+  const std::vector<TriggerEdge> &edges = triggerEdges[s];
+
+  // Erster Wert nach Start oder Änderung: jeden Auslöser einmal einordnen
+  if(isnan(p)){
+    for(const TriggerEdge &e : edges){
+      TriggerRun &run = triggerRun[e.trig];
+      bool beyond = e.falling ? v<e.at : v>e.at;
+      if(!beyond) continue;
+      if(e.fire && run.state==TRIG_ARMED) triggerTryFire(e.trig);
+      else if(!e.fire && run.state==TRIG_FIRED) run.state = TRIG_ARMED;
+    }
+    return;
+  }
+
+  if(v<p){
+    // fallend: Kanten in (v, p]
+    auto it = std::upper_bound(edges.begin(), edges.end(), v,
+      [](float x, const TriggerEdge &e){ return x<e.at; });
+    for(; it!=edges.end() && it->at<=p; ++it){
+      if(it->falling) triggerCross(*it);
+    }
+  } else if(v>p){
+    // steigend: Kanten in [p, v)
+    auto it = std::lower_bound(edges.begin(), edges.end(), p,
+      [](const TriggerEdge &e, float x){ return e.at<x; });
+    for(; it!=edges.end() && it->at<v; ++it){
+      if(!it->falling) triggerCross(*it);
+    }
+  }
+}
+
+// Kanten neu aufbauen (nach jeder Änderung an Sensoren oder Auslösern).
+// Der Zustand bleibt erhalten; der nächste Wert ordnet jeden Auslöser neu
+// ein, vorgemerkte Auslösungen werden dabei neu berechnet.
+void triggerRebuild() {
+  for(size_t s=0; s<MAX_SENSORS; s++){
+    triggerEdges[s].clear();
+    sensorPrev[s] = NAN;
+  }
+  while(!triggerRetry.empty()) triggerRetry.pop();
+  triggerRun.resize(triggers.size());
+  for(size_t k=0; k<triggers.size(); k++){
+    const SensorTrigger &t = triggers[k];
+    TriggerRun &run = triggerRun[k];
+    run.gen++;
+    if(run.state==TRIG_WAITING) run.state = TRIG_ARMED;
+    if(!t.active || t.sensor>=sensors.size()){
+      run.state = TRIG_ARMED;
+      continue;
+    }
+    float rearm = t.below ? t.threshold + t.hysteresis : t.threshold - t.hysteresis;
+    triggerEdges[t.sensor].push_back({t.threshold, (uint16_t)k, t.below, true});
+    triggerEdges[t.sensor].push_back({rearm, (uint16_t)k, !t.below, false});
+  }
+  for(size_t s=0; s<MAX_SENSORS; s++){
+    std::sort(triggerEdges[s].begin(), triggerEdges[s].end(),
+              [](const TriggerEdge &a, const TriggerEdge &b){ return a.at<b.at; });
+  }
+}
+
+void sensorsBegin() {
+  static const AdcFrameHandler handlers[MAX_SENSORS] = {
+    sensorAdcFrame<0>, sensorAdcFrame<1>, sensorAdcFrame<2>, sensorAdcFrame<3>
+  };
+  for(size_t s=0; s<sensors.size(); s++){
+    const SensorInput &e = sensors[s];
+    if(e.kind==SENSOR_ADC && !adcAddChannel(e.pin, handlers[s])){
+      LOG_E("Sensor %s nicht angemeldet", e.name.c_str());
+    }
+    if(e.kind==SENSOR_I2C) sensorI2cBegin();
+  }
+  triggerRebuild();
+}
+
+// Sensoren lesen und Auslöser auswerten (aus loop())
+void triggerPoll() {
+  unsigned long now = millis();
+  if(now-triggerLastTickMs<SENSOR_TICK_MS) return;
+  triggerLastTickMs = now;
+
+  for(size_t s=0; s<sensors.size(); s++){
+    float v;
+    sensorOk[s] = sensorRead(s, v);
+    if(!sensorOk[s]) continue;
+    sensorValue[s] = v;
+    triggerStep(s, v);
+  }
+  while(!triggerRetry.empty() && triggerRetry.top().at<=currentUnixTime){
+    TriggerRetry r = triggerRetry.top();
+    triggerRetry.pop();
+    if(r.trig<triggerRun.size() && triggerRun[r.trig].gen==r.gen
+       && triggerRun[r.trig].state==TRIG_WAITING){
+      triggerTryFire(r.trig);
+    }
+  }
+}
+
+void addSensor(const SensorInput &e) {
+  sensors.push_back(e);
+  if(e.kind==SENSOR_I2C) sensorI2cBegin();
+  triggerRebuild();
+  saveConfig();
+  if(e.kind==SENSOR_ADC) restartAtMillis = millis() + 1000; // ADC-Muster ist fest
+}
+
+// Entfernt den Sensor samt seinen Auslösern; die folgenden rücken auf
+void deleteSensor(size_t s) {
+  bool restart = false;
+  for(size_t k=s; k<sensors.size(); k++) restart |= sensors[k].kind==SENSOR_ADC;
+  sensors.erase(sensors.begin()+s);
+  for(size_t k=s; k<sensors.size(); k++) sensorSimRaw[k] = sensorSimRaw[k+1];
+  sensorSimRaw[sensors.size()] = NAN;
+  for(size_t k=triggers.size(); k-->0; ){
+    if(triggers[k].sensor==s){
+      triggers.erase(triggers.begin()+k);
+      triggerRun.erase(triggerRun.begin()+k);
+    } else if(triggers[k].sensor>s) {
+      triggers[k].sensor--;
+    }
+  }
+  triggerRebuild();
+  saveConfig();
+  if(restart) restartAtMillis = millis() + 1000;
+}
+
+void setSensorSimValue(size_t s, float raw) {
+  sensorSimRaw[s] = raw;
+  triggerLastTickMs = millis() - SENSOR_TICK_MS; // sofort auswerten
+}
+
+void addTrigger(const SensorTrigger &trigger) {
+  SensorTrigger t = trigger;
+  uint16_t id = 0;
+  for(auto &e : triggers) if(e.id>id) id = e.id;
+  t.id = id+1;
+  t.lastFire = 0;
+  t.day = 0;
+  t.dayMl = 0;
+  triggers.push_back(t);
+  triggerRebuild();
+  saveConfig();
+}
+
+void updateTriggerActiveState(size_t k, bool active) {
+  triggers[k].active = active;
+  triggerRebuild();
+  saveConfig();
+}
+
+void deleteTrigger(size_t k) {
+  triggers.erase(triggers.begin()+k);
+  triggerRun.erase(triggerRun.begin()+k);
+  triggerRebuild();
+  saveConfig();
+}
+
+/* --------------------------------------------------------------------------
+   Rezepte
+   --------------------------------------------------------------------------
+   Ein Rezept ist eine Schrittfolge, getrennt durch ';' oder Zeilenumbruch:
+     P1 30             Pumpe 1 fördert 30 ml
+     P1 30 + P3 10     mehrere Pumpen gleichzeitig, weiter wenn alle fertig
+     warten 2m         Pause (s, m oder h; ohne Einheit Sekunden)
+     wenn Tank < 200   nächsten Schritt nur ausführen, wenn die Bedingung
+                       für den Behälter gilt (<, <=, >, >=, Menge in ml)
+     stopp             Rezept beenden
+   recipePoll() arbeitet die Schritte aus loop() ab: Bedingungen und Pausen
+   ohne Dauer gehen im selben Durchlauf weiter, der nächste Pumpenschritt
+   startet, sobald der vorige fertig und seine Pumpen frei sind. Es läuft
+   höchstens ein Rezept. Phase und Schritt stehen im Dosierjournal, damit
+   ein Neustart an derselben Stelle weitermacht.
+   -------------------------------------------------------------------------- */
+#define RECIPE_MAX_STEPS 32
+
+enum RecipeStepKind : uint8_t { STEP_DOSE, STEP_WAIT, STEP_IF, STEP_STOP };
+enum RecipeCompare  : uint8_t { CMP_LT, CMP_LE, CMP_GT, CMP_GE };
+
+struct RecipeStep {
+  uint8_t kind;      // RecipeStepKind
+  uint8_t cmp;       // RecipeCompare (STEP_IF)
+  int8_t reservoir;  // STEP_IF
+  uint16_t ml[4];    // STEP_DOSE: Menge je Pumpe, 0 = nicht beteiligt
+  uint32_t value;    // STEP_WAIT: Sekunden, STEP_IF: ml
+};
+
+enum RecipePhase : uint8_t {
+  RECIPE_IDLE    = 0,
+  RECIPE_PENDING = 1, // Schritt "step" ist als nächstes dran
+  RECIPE_DOSING  = 2, // Pumpen des Schritts laufen
+  RECIPE_WAITING = 3  // Pause läuft
+};
+
+struct RecipeRun {
+  uint16_t id;       // 0 = kein Rezept aktiv
+  String name;
+  std::vector<RecipeStep> steps; // beim Start übersetzt
+  uint16_t step;
+  uint8_t phase;
+  uint8_t pumps;     // gestartete Pumpen (Bitmaske)
+  unsigned long waitUntilMs;
+  time_t waitEnd;    // dasselbe als Unixzeit (für das Journal)
+  time_t startedAt;
+};
+RecipeRun recipeRun = {};
+String recipeLastResult; // Ergebnis des letzten Laufs
+
+static void recipeSkipSpaces(const char *&p) {
+  while(*p==' ' || *p=='\t') p++;
+}
+
+// Ein Schritt ohne Trenner; liefert Fehlertext oder ""
+static String compileRecipeStep(const String &src, RecipeStep &st) {
+  memset(&st, 0, sizeof(st));
+  const char *p = src.c_str();
+  if(src.equalsIgnoreCase("stopp")){
+    st.kind = STEP_STOP;
+    return "";
+  }
+  if(strncasecmp(p, "warten", 6)==0){
+    p += 6;
+    recipeSkipSpaces(p);
+    if(!isdigit((unsigned char)*p)) return "Dauer fehlt";
+    long v = strtol(p, (char**)&p, 10);
+    char unit = tolower(*p);
+    if(unit=='m') v *= 60;
+    else if(unit=='h') v *= 3600;
+    else if(unit && unit!='s') return "Einheit s, m oder h erwartet";
+    if(unit) p++;
+    recipeSkipSpaces(p);
+    if(*p) return "Unerwartetes nach der Dauer";
+    if(v<0 || v>86400) return "Pause höchstens 24 h";
+    st.kind = STEP_WAIT;
+    st.value = v;
+    return "";
+  }
+  if(strncasecmp(p, "wenn", 4)==0){
+    String rest = src.substring(4);
+    int at = -1;
+    for(unsigned int i=0; i<rest.length(); i++){
+      if(rest[i]=='<' || rest[i]=='>'){ at = i; break; }
+    }
+    if(at<0) return "Vergleich mit < oder > erwartet";
+    String name = rest.substring(0, at);
+    name.trim();
+    st.reservoir = -1;
+    for(size_t r=0; r<reservoirs.size(); r++){
+      if(reservoirs[r].name==name) st.reservoir = r;
+    }
+    if(st.reservoir<0) return "Unbekannter Behälter: "+name;
+    p = rest.c_str() + at;
+    bool less = *p++=='<';
+    bool equal = *p=='=';
+    if(equal) p++;
+    st.cmp = less ? (equal ? CMP_LE : CMP_LT) : (equal ? CMP_GE : CMP_GT);
+    recipeSkipSpaces(p);
+    if(!isdigit((unsigned char)*p)) return "Menge fehlt";
+    st.value = strtoul(p, (char**)&p, 10);
+    recipeSkipSpaces(p);
+    if(strncasecmp(p, "ml", 2)==0) p += 2;
+    if(*p) return "Unerwartetes nach der Menge";
+    st.kind = STEP_IF;
+    return "";
+  }
+  // "P1 30 + P3 10"
+  st.kind = STEP_DOSE;
+  while(true){
+    recipeSkipSpaces(p);
+    if(toupper(*p)!='P' || p[1]<'1' || p[1]>'4') return "Unbekannter Schritt: "+src;
+    int pump = p[1]-'1';
+    p += 2;
+    recipeSkipSpaces(p);
+    if(!isdigit((unsigned char)*p)) return "Menge für Pumpe "+String(pump+1)+" fehlt";
+    long ml = strtol(p, (char**)&p, 10);
+    if(ml<1 || ml>10000) return "Menge 1-10000 ml";
+    if(st.ml[pump]) return "Pumpe "+String(pump+1)+" doppelt";
+    st.ml[pump] = ml;
+    recipeSkipSpaces(p);
+    if(strncasecmp(p, "ml", 2)==0) p += 2;
+    recipeSkipSpaces(p);
+    if(!*p) return "";
+    if(*p++!='+') return "'+' erwartet";
+  }
+}
+
+// Schrittfolge übersetzen; liefert Fehlertext oder ""
+String compileRecipe(const String &text, std::vector<RecipeStep> &steps) {
+  steps.clear();
+  if(text.length()>RECIPE_MAX_TEXT) return "Rezept zu lang";
+  int from = 0;
+  while(from<=(int)text.length()){
+    int end = from;
+    while(end<(int)text.length() && text[end]!=';' && text[end]!='\n') end++;
+    String src = text.substring(from, end);
+    src.trim();
+    from = end+1;
+    if(src.isEmpty()) continue;
+    if(steps.size()>=RECIPE_MAX_STEPS) return "Mehr als "+String(RECIPE_MAX_STEPS)+" Schritte";
+    RecipeStep st;
+    String err = compileRecipeStep(src, st);
+    if(!err.isEmpty()) return "Schritt "+String(steps.size()+1)+": "+err;
+    steps.push_back(st);
+  }
+  if(steps.empty()) return "Keine Schritte";
+  return "";
+}
+
+int recipeIndexById(uint16_t id) {
+  for(size_t i=0; i<recipes.size(); i++){
+    if(recipes[i].id==id) return i;
+  }
+  return -1;
+}
+
+// Stand des laufenden Rezepts ins Dosierjournal
+void recipeJournal() {
+  RecipeRun &run = recipeRun;
+  doseJournalWrite(DOSE_RECIPE, run.id ? run.phase : RECIPE_IDLE,
+                   (uint32_t)run.id<<16 | run.step,
+                   run.phase==RECIPE_WAITING ? (uint32_t)run.waitEnd : 0);
+}
+
+void recipeFinish(const String &result) {
+  recipeLastResult = recipeRun.name+": "+result;
+  LOG_I("Rezept %s", recipeLastResult.c_str());
+  recipeRun.id = 0;
+  recipeRun.phase = RECIPE_IDLE;
+  recipeRun.steps.clear();
+  recipeRun.steps.shrink_to_fit();
+  recipeJournal();
+}
+
+// Rezept übersetzen und als laufend eintragen (Schritt 0)
+static bool recipeLoad(const Recipe &r, String &msg) {
+  if(recipeRun.id){
+    msg = "Rezept "+recipeRun.name+" läuft noch.";
+    return false;
+  }
+  std::vector<RecipeStep> steps;
+  String err = compileRecipe(r.steps, steps);
+  if(!err.isEmpty()){
+    msg = r.name+": "+err;
+    return false;
+  }
+  recipeRun.id        = r.id;
+  recipeRun.name      = r.name;
+  recipeRun.steps.swap(steps);
+  recipeRun.step      = 0;
+  recipeRun.phase     = RECIPE_PENDING;
+  recipeRun.pumps     = 0;
+  recipeRun.startedAt = currentUnixTime;
+  return true;
+}
+
+// Rezept starten; false mit Meldung, wenn es nicht geht
+bool recipeStart(int idx, String &msg) {
+  Recipe &r = recipes[idx];
+  if(!recipeLoad(r, msg)) return false;
+  r.lastRun = currentUnixTime;
+  markConfigDirty();
+  LOG_I("Starte Rezept %s, %d Schritte", r.name.c_str(), (int)recipeRun.steps.size());
+  msg = "Rezept "+r.name+" gestartet.";
+  return true;
+}
+
+void recipeCancel() {
+  if(!recipeRun.id) return;
+  if(recipeRun.phase==RECIPE_DOSING){
+    for(int i=0; i<4; i++){
+      if(recipeRun.pumps & (1<<i)) stopPumpCredited(i);
+    }
+  }
+  recipeFinish("abgebrochen bei Schritt "+String(recipeRun.step+1));
+}
+
+// Gestörte Pumpe (Motorstrom) abschalten. Die nicht geförderte Menge wird
+// gutgeschrieben; ein nacheinander laufendes Programm oder Rezept, zu dem
+// die Dosierung gehört, läuft nicht ohne sie weiter.
+void doseAbortPump(int i) {
+  stopPumpCredited(i);
+  if(doseQueuePump==i) doseQueueClear();
+  if(recipeRun.id && recipeRun.phase==RECIPE_DOSING && (recipeRun.pumps & (1<<i))){
+    recipeCancel();
+  }
+}
+
+static bool recipeCondition(const RecipeStep &st) {
+  float level = st.reservoir<(int)reservoirs.size() ? reservoirs[st.reservoir].level : 0;
+  switch(st.cmp){
+    case CMP_LT: return level<st.value;
+    case CMP_LE: return level<=st.value;
+    case CMP_GT: return level>st.value;
+    default:     return level>=st.value;
+  }
+}
+
+// Schritte des laufenden Rezepts weiterschalten (aus loop())
+void recipePoll() {
+  RecipeRun &run = recipeRun;
+  for(int guard=0; run.id && guard<=RECIPE_MAX_STEPS; guard++){
+    if(run.phase==RECIPE_DOSING){
+      for(int i=0; i<4; i++){
+        if((run.pumps & (1<<i)) && pumpStatus[i]) return;
+      }
+      run.step++;
+      run.phase = RECIPE_PENDING;
+    }
+    if(run.phase==RECIPE_WAITING){
+      if((long)(millis()-run.waitUntilMs)<0) return;
+      run.step++;
+      run.phase = RECIPE_PENDING;
+    }
+    if(run.step>=run.steps.size()){
+      recipeFinish("fertig");
+      return;
+    }
+
+    const RecipeStep &st = run.steps[run.step];
+    switch(st.kind){
+      case STEP_STOP:
+        recipeFinish("beendet bei Schritt "+String(run.step+1));
+        return;
+
+      case STEP_IF:
+        run.step += recipeCondition(st) ? 1 : 2;
+        break;
+
+      case STEP_WAIT:
+        run.phase       = RECIPE_WAITING;
+        run.waitUntilMs = millis() + st.value*1000UL;
+        run.waitEnd     = currentUnixTime + st.value;
+        recipeJournal();
+        break;
+
+      case STEP_DOSE: {
+        // Belegte Pumpen (von Hand, Programm): warten, bis sie frei sind
+        for(int i=0; i<4; i++){
+          if(st.ml[i] && pumpStatus[i]) return;
+        }
+        for(size_t r=0; r<reservoirs.size(); r++){
+          float draw = 0;
+          for(int i=0; i<4; i++){
+            if(pumpTankIndex(i)==(int)r) draw += st.ml[i];
+          }
+          if(reservoirs[r].reserve>0 && draw>0
+             && reservoirs[r].level-draw<reservoirs[r].reserve){
+            recipeFinish("gesperrt bei Schritt "+String(run.step+1)+", "
+              +reservoirs[r].name+" unter Reserve");
+            return;
+          }
+        }
+        int amounts[4];
+        for(int i=0; i<4; i++) amounts[i] = st.ml[i];
+        run.pumps = runDoseSteps(amounts);
+        run.phase = RECIPE_DOSING;
+        recipeJournal();
+        return;
+      }
+    }
+  }
+}
+
+// Nach doseJournalRecover(): unterbrochenes Rezept fortsetzen
+void recipeRecover() {
+  const DoseRecord &r = doseJournalRecipe;
+  uint16_t id = r.a>>16;
+  if(r.type!=DOSE_RECIPE || id==0 || r.pump==RECIPE_IDLE) return;
+  int idx = recipeIndexById(id);
+  String msg;
+  if(idx<0 || !recipeLoad(recipes[idx], msg)){
+    LOG_W("Rezept %u nicht fortsetzbar", (unsigned)id);
+    return;
+  }
+  RecipeRun &run = recipeRun;
+  run.step = r.a & 0xFFFF;
+  if(run.step>=run.steps.size()){
+    recipeFinish("nach Neustart nicht fortsetzbar");
+    return;
+  }
+  if(r.pump==RECIPE_DOSING){
+    // Die Dosierung selbst hat doseJournalRecover() fortgesetzt (oder nicht)
+    if(!doseResume){
+      recipeFinish("nach Stromausfall abgebrochen bei Schritt "+String(run.step+1));
+      return;
+    }
+    run.phase = RECIPE_DOSING;
+    run.pumps = 0;
+    for(int i=0; i<4; i++){
+      if(run.steps[run.step].ml[i]) run.pumps |= 1<<i;
+    }
+  } else if(r.pump==RECIPE_WAITING){
+    uint32_t full = run.steps[run.step].value;
+    long rest = (long)r.b - (long)currentUnixTime;
+    if(rest<0) rest = 0;
+    if(rest>(long)full) rest = full;
+    run.phase       = RECIPE_WAITING;
+    run.waitUntilMs = millis() + rest*1000UL;
+    run.waitEnd     = currentUnixTime + rest;
+  }
+  recipeJournal();
+  LOG_I("Rezept %s setzt bei Schritt %d fort", run.name.c_str(), run.step+1);
+}
+
+/* --------------------------------------------------------------------------
+   Kalibrierung
+   --------------------------------------------------------------------------
+   Gemessen wird die Zeit zwischen den beiden Flanken am Pumpen-Pin, mit
+   micros() direkt beim Schalten. Wer die Pumpe per Taster an
+   calButtonPin schaltet, misst ohne WLAN-Verzögerung: die ISR schaltet den
+   Pin selbst. Jeder Lauf wird gesammelt; erst "commit" übernimmt den
+   Mittelwert, nachdem Läufe mit mehr als CAL_OUTLIER_REL Abweichung vom
+   Median verworfen wurden. Mit Durchflusssensor gilt dasselbe für die
+   Impulse pro ml.
+   -------------------------------------------------------------------------- */
+const int   CAL_MAX_RUNS    = 8;
+const int   CAL_MIN_RUNS    = 2;     // gültige Läufe für commit
+const float CAL_OUTLIER_REL = 0.05f; // Abweichung vom Median => Ausreißer
+const unsigned long CAL_DEBOUNCE_US = 50000;
+
+struct CalibrationSession {
+  float targetMl;  // Menge je Lauf
+  int runs;
+  uint32_t durationUs[CAL_MAX_RUNS];
+  uint32_t pulses[CAL_MAX_RUNS];
+};
+CalibrationSession calSession[4] = {{100,0},{100,0},{100,0},{100,0}};
+
+struct CalibrationStats {
+  int used;
+  uint8_t outliers;  // Bit je Lauf
+  float meanSec;
+  float sdSec;       // Standardabweichung der gültigen Läufe
+  float meanPulses;
+};
+
+// Pins als veränderliches Array im RAM, damit die ISR sie lesen darf
+int calPumpPins[4] = {pump1, pump2, pump3, pump4};
+
+// Flanken, gesetzt beim Schalten des Pins (auch aus der ISR)
+volatile unsigned long calEdgeOnUs[4];
+volatile unsigned long calEdgeOffUs[4];
+volatile bool calPending[4];     // Zustand von der ISR geändert, loop() gleicht ab
+
+void IRAM_ATTR calibrationEdge(int p, bool on) {
+  digitalWrite(calPumpPins[p], on ? HIGH : LOW);
+  if(on) calEdgeOnUs[p] = micros();
+  else   calEdgeOffUs[p] = micros();
+  calibrationRunning[p] = on;
+}
+
+void IRAM_ATTR calButtonIsr() {
+  static unsigned long last = 0;
+  unsigned long now = micros();
+  if(now-last<CAL_DEBOUNCE_US) return;
+  last = now;
+  int p = calButtonPump;
+  // Läuft die Pumpe gerade für etwas anderes, nichts tun
+  if(pumpStatus[p] && !calibrationRunning[p]) return;
+  calibrationEdge(p, !calibrationRunning[p]);
+  calPending[p] = true;
+}
+
+void calibrationStarted(int p) {
+  pumpStatus[p] = true;
+  if(flowSensorPin[p]>=0) calibrationStartPulses[p] = flowSource->pulses(p);
+  digitalWrite(ledpin, HIGH);
+}
+
+// Lauf aus den Flanken übernehmen; liefert die Meldung
+String calibrationStopped(int p) {
+  pumpStatus[p] = false;
+  bool anyOn = false;
+  for(int k=0; k<4; k++) anyOn |= pumpStatus[k];
+  if(!anyOn) digitalWrite(ledpin, LOW);
+
+  CalibrationSession &s = calSession[p];
+  uint32_t us = calEdgeOffUs[p] - calEdgeOnUs[p];
+  uint32_t pulses = flowSensorPin[p]>=0 ? flowSource->pulses(p) - calibrationStartPulses[p] : 0;
+  if(s.runs>=CAL_MAX_RUNS){
+    // Ältesten Lauf verwerfen
+    memmove(s.durationUs, s.durationUs+1, (CAL_MAX_RUNS-1)*sizeof(uint32_t));
+    memmove(s.pulses, s.pulses+1, (CAL_MAX_RUNS-1)*sizeof(uint32_t));
+    s.runs--;
+  }
+  s.durationUs[s.runs] = us;
+  s.pulses[s.runs] = pulses;
+  s.runs++;
+  if(flowSensorPin[p]>=0){
+    LOG_I("Pumpe %d Lauf %d: %.3f s, %lu Impulse", p+1, s.runs, us/1e6f, (unsigned long)pulses);
+  } else {
+    LOG_I("Pumpe %d Lauf %d: %.3f s", p+1, s.runs, us/1e6f);
+  }
+  return "Pumpe "+String(p+1)+" Lauf "+String(s.runs)+": "
+    +String(us/1e6f,3)+" s"+(flowSensorPin[p]>=0 ? ", "+String(pulses)+" Impulse" : "")+".";
+}
+
+// Vom Taster geschaltete Läufe übernehmen (aus loop())
+void calibrationPoll() {
+  for(int p=0; p<4; p++){
+    if(!calPending[p]) continue;
+    calPending[p] = false;
+    if(calibrationRunning[p]) calibrationStarted(p);
+    else calibrationStopped(p);
+  }
+}
+
+// Über HTTP; vorher offene Tasterflanken übernehmen, damit kein Lauf doppelt zählt
+void startCalibration(int p) {
+  calibrationPoll();
+  calibrationEdge(p, true);
+  calibrationStarted(p);
+}
+
+String stopCalibration(int p) {
+  calibrationPoll();
+  calibrationEdge(p, false);
+  return calibrationStopped(p);
+}
+
+CalibrationStats calibrationStats(int p) {
+  const CalibrationSession &s = calSession[p];
+  CalibrationStats st = {0, 0, 0, 0, 0};
+  if(s.runs==0) return st;
+  uint32_t sorted[CAL_MAX_RUNS];
+  memcpy(sorted, s.durationUs, s.runs*sizeof(uint32_t));
+  std::sort(sorted, sorted+s.runs);
+  float median = s.runs%2 ? sorted[s.runs/2]
+                          : (sorted[s.runs/2-1] + (float)sorted[s.runs/2])/2;
+  double sum = 0, sumSq = 0, pulses = 0;
+  for(int i=0; i<s.runs; i++){
+    float sec = s.durationUs[i]/1e6f;
+    if(fabsf(s.durationUs[i]-median) > CAL_OUTLIER_REL*median){
+      st.outliers |= 1<<i;
+      continue;
+    }
+    st.used++;
+    sum += sec;
+    sumSq += sec*sec;
+    pulses += s.pulses[i];
+  }
+  if(st.used>0){
+    st.meanSec = sum/st.used;
+    st.meanPulses = pulses/st.used;
+  }
+  if(st.used>1){
+    st.sdSec = sqrt((sumSq - sum*sum/st.used)/(st.used-1));
+  }
+  return st;
+}
+
+// Mittelwert der gültigen Läufe übernehmen; liefert Fehlertext oder Meldung
+bool commitCalibration(int p, String &msg) {
+  CalibrationSession &s = calSession[p];
+  CalibrationStats st = calibrationStats(p);
+  if(st.used<CAL_MIN_RUNS){
+    msg = "Mindestens "+String(CAL_MIN_RUNS)+" gültige Läufe nötig ("+String(st.used)+" vorhanden).";
+    return false;
+  }
+  float rate = s.targetMl / st.meanSec;
+  String sensorInfo;
+  if(flowSensorPin[p]>=0){
+    if(st.meanPulses>0){
+      flowPulsesPerMl[p] = st.meanPulses/s.targetMl;
+      flowSensorFault[p] = false;
+      sensorInfo = " Sensor: "+String(flowPulsesPerMl[p],2)+" Impulse/ml.";
+    } else {
+      sensorInfo = " Sensor: keine Impulse!";
+    }
+  }
+  updatePumpFlowRate(p, rate);
+  msg = "Pumpe "+String(p+1)+": "+String(st.used)+" Läufe, "
+    +String(st.meanSec,3)+" s ± "+String(st.sdSec,3)+" s. Rate: "
+    +String(rate,3)+" ml/s."+sensorInfo;
+  s.runs = 0;
+  return true;
+}
+
+void discardCalibration(int p) {
+  calSession[p].runs = 0;
+}
+
+void calButtonBegin() {
+  if(calButtonPin<0) return;
+  pinMode(calButtonPin, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(calButtonPin), calButtonIsr, FALLING);
+}
+
+void updateCalButton(int pin, int pump) {
+  if(calButtonPin>=0) detachInterrupt(digitalPinToInterrupt(calButtonPin));
+  calButtonPin  = pin;
+  calButtonPump = pump;
+  calButtonBegin();
+  saveConfig();
+}
+
+/* --------------------------------------------------------------------------
+   Hilfsfunktionen
+   --------------------------------------------------------------------------*/
+// Fällige Programme für die Minute von t (UTC) starten.
+// Eine lokale Minute gehört zu der UTC-Minute, die tzToUtc() für sie liefert:
+// normalerweise genau eine; nach einem Sprung vor übernimmt die erste Minute
+// alle übersprungenen, in der wiederholten Stunde beim Sprung zurück gehört
+// keine lokale Minute zu t, weil sie beim ersten Auftreten schon dran war.
+void checkPrograms(time_t t){
+  t = t/60*60;
+  time_t firstLocal = (t - 60 + tzOffsetAt(t - 60))/60 + 1;
+  time_t lastLocal  = tzLocal(t)/60;
+
+  for(time_t lm=firstLocal; lm<=lastLocal; lm++){
+    if(tzToUtc(lm*60)!=t) continue;
+    LocalTime lt = splitLocal(lm*60);
+
+    LOG_D("Programmprüfung %s %02d:%02d", wdays[lt.wday], lt.hour, lt.minute);
+    // Der Minutenindex sortiert die meisten Programme aus, ohne sie zu lesen
+    int minuteOfDay = lt.hour*60 + lt.minute;
+    for(size_t i=0; i<programs.size(); i++){
+      if(!programs.mayFireAt(i, minuteOfDay)) continue;
+      Program prog = programs.get(i);
+      if(!prog.active || !prog.sched.valid) continue;
+      if(!scheduleMatches(prog.sched, lt)) continue;
+      if(!programWeekMatches(prog, lm/1440)) continue;
+      if(t<rerunAllowedAt(prog, prog.lastRun)) continue;
+      // Cron-Programme: eine doppelt geprüfte Minute nicht zweimal dosieren
+      if(!prog.cron.isEmpty() && prog.lastRun/60==t/60) continue;
+      runProgram(i, true);
+    }
+    for(size_t i=0; i<recipes.size(); i++){
+      Recipe &r = recipes[i];
+      if(!r.active || !r.sched.valid || !scheduleMatches(r.sched, lt)) continue;
+      if(r.lastRun/60==t/60) continue; // in dieser Minute schon gestartet
+      String msg;
+      if(!recipeStart(i, msg)) LOG_W("Rezept nicht gestartet: %s", msg.c_str());
+    }
+  }
+}
+
+/* --------------------------------------------------------------------------
+   JSON-API (Version 1)
+   --------------------------------------------------------------------------
+   GET liefert den Zustand, POST/DELETE ändern ihn und liefern den neuen
+   Zustand samt "message" zurück, damit die Seite ohne Neuladen
+   aktualisiert werden kann. Fehler kommen als {"error":"..."}.
+     /api/pumps        POST index,on=0|1|toggle  oder  doseResume=0|1
+     /api/calibration  POST pump,action=start[,ml]|stop|commit|discard
+                       oder  pump,pin[,ppm]  oder  pump,buttonPin
+                       oder  pump,currentPin  oder  pump,currentReset=1
+                       oder  pump,maintHours,maintMl  oder  pump,service=1
+     /api/programs     POST neues Programm  oder  index,active=0|1
+                       DELETE index
+                       mit limit[,cursor,pump,day,state,from,to] (auch bei
+                       GET) nur eine Seite, sortiert nach nächster Ausführung
+     /api/tank         POST level[,reservoir] | name,capacity,reserve[,reservoir]
+                       | remove=r | pump,reservoir | pin[,reservoir]
+                       | point=ml | clear=1
+     /api/time         POST unix[,auto=1] | datetime (Lokalzeit) | tz (POSIX-Regel)
+     /api/recipes      POST name,steps[,cron][,active][,index = ersetzen]
+                       | index,active=0|1 | index,action=start | action=cancel
+                       DELETE index
+     /api/sensors      POST name,kind=adc|i2c|sim,pin[,reg,scale,offset]
+                       | sensor,value (nur sim)
+                       | sensor,program,threshold[,below=0|1,hysteresis,gap,cap]
+                       | trigger,active=0|1
+                       DELETE sensor | trigger
+     /api/trace        POST enabled=0|1 | clear=1 (Ringdatei unter
+                       /api/trace/data)
+   -------------------------------------------------------------------------- */
+#define API_VERSION 1
+
+// Antwort über den Server, der die Anfrage angenommen hat (Web- oder
+// Steuer-Port); die Seite ruft den Steuer-Port von Port 80 aus auf
+void apiSend(WebServer &http, int code, const String &json) {
+  http.sendHeader("X-Api-Version", String(API_VERSION));
+  http.sendHeader("Cache-Control", "no-store");
+  if(&http==&controlServer) http.sendHeader("Access-Control-Allow-Origin", "*");
+  http.send(code, "application/json", json);
+  responseBytes += json.length();
+}
+
+void apiSend(int code, const String &json) {
+  apiSend(server, code, json);
+}
+
+// Antwort aus der Anfrage-Arena, ohne Kopie in einen String
+void apiSend(WebServer &http, int code, ArenaPrint &out) {
+  const char *json = out.data();
+  http.sendHeader("X-Api-Version", String(API_VERSION));
+  http.sendHeader("Cache-Control", "no-store");
+  if(&http==&controlServer) http.sendHeader("Access-Control-Allow-Origin", "*");
+  http.send_P(code, "application/json", json, out.length());
+  responseBytes += out.length();
+}
+
+void apiError(WebServer &http, int code, const char *msg) {
+  ArenaPrint out(requestArena);
+  out.print("{\"error\":");
+  writeJsonString(out, msg);
+  out.print('}');
+  apiSend(http, code, out);
+}
+
+void apiError(WebServer &http, int code, const String &msg) {
+  apiError(http, code, msg.c_str());
+}
+
+void apiError(int code, const char *msg) {
+  apiError(server, code, msg);
+}
+
+void apiError(int code, const String &msg) {
+  apiError(server, code, msg.c_str());
+}
+
+// Sammelt die Ausgabe in einem String (für die String-gebauten Antworten)
+struct StringPrint : public Print {
+  String s;
+  size_t write(uint8_t c) override { s += (char)c; return 1; }
+};
+
+void writeApiMessage(Print &out, const char *msg) {
+  if(!msg || !*msg) return;
+  out.print(",\"message\":");
+  writeJsonString(out, msg);
+}
+
+String apiMessage(const String &msg) {
+  StringPrint out;
+  writeApiMessage(out, msg.c_str());
+  return out.s;
+}
+
+// Statische Seite mit ETag: unverändert => 304 ohne Inhalt
+void sendApp() {
+  static String etag;
+  if(etag.isEmpty()){
+    uint32_t h = 2166136261UL; // FNV-1a
+    for(size_t i=0; i<sizeof(APP_HTML)-1; i++){
+      h = (h ^ (uint8_t)pgm_read_byte(&APP_HTML[i])) * 16777619UL;
+    }
+    etag = "\""+String(h, HEX)+"\"";
+  }
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  if(server.header("If-None-Match")==etag){
+    server.send(304);
+    return;
+  }
+  // In Blöcken senden, damit Steuerbefehle dazwischen drankommen
+  const size_t total = sizeof(APP_HTML)-1;
+  server.setContentLength(total);
+  server.send(200, "text/html; charset=UTF-8", "");
+  for(size_t pos=0; pos<total; pos+=2048){
+    server.sendContent_P(APP_HTML+pos, total-pos<2048 ? total-pos : 2048);
+    controlLanePoll();
+  }
+  responseBytes += total;
+}
+
+/* ---- Pumpen ---- */
+void writeApiPumpsJson(Print &out, const char *msg) {
+  out.print("{\"pumps\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print("{\"on\":");      out.print(pumpStatus[i]?"true":"false");
+    out.print(",\"dosing\":");  out.print(pumpRun[i].active?"true":"false");
+    if(currentSensePin[i]>=0){
+      out.print(",\"health\":\"");
+      out.print(CURRENT_STATE_NAMES[currentMon[i].state]);
+      out.print('"');
+    }
+    if(counterMaintenanceDue(i)) out.print(",\"maintenance\":true");
+    out.print('}');
+  }
+  out.print("],\"doseResume\":"); out.print(doseResume?"true":"false");
+  writeApiMessage(out, msg);
+  out.print('}');
+}
+
+void apiSendPumps(WebServer &http, const char *msg) {
+  ArenaPrint out(requestArena);
+  writeApiPumpsJson(out, msg);
+  apiSend(http, 200, out);
+}
+
+void handleApiPumps(WebServer &http) {
+  if(http.method()!=HTTP_POST){
+    apiSendPumps(http, nullptr);
+    return;
+  }
+  if(http.hasArg("doseResume")){
+    updateDoseResume(http.arg("doseResume")=="1");
+    apiSendPumps(http, doseResume
+      ? "Unterbrochene Dosierungen werden fortgesetzt."
+      : "Unterbrochene Dosierungen werden abgebrochen.");
+    return;
+  }
+  if(!http.hasArg("index")){
+    apiError(http, 400, "Missing index");
+    return;
+  }
+  int idx = http.arg("index").toInt();
+  if(idx<0||idx>3){
+    apiError(http, 400, "Invalid index");
+    return;
+  }
+  String on = http.arg("on");
+  bool want = (on=="toggle"||on.isEmpty()) ? !pumpStatus[idx] : on=="1";
+  if(want!=pumpStatus[idx]) togglePumpStatus(idx);
+  apiSendPumps(http, nullptr);
+}
+
+/* ---- Kalibrierung ---- */
+void writeApiCalibrationJson(Print &out, const char *msg) {
+  out.print("{\"pumps\":[");
+  for(int i=0; i<4; i++){
+    if(i>0) out.print(',');
+    out.print("{\"rate\":");         out.print(pumpFlowRate[i], 4);
+    out.print(",\"running\":");      out.print(calibrationRunning[i]?"true":"false");
+    out.print(",\"sensorPin\":");    out.print(flowSensorPin[i]);
+    out.print(",\"ppm\":");          out.print(flowPulsesPerMl[i], 3);
+    out.print(",\"sensorFault\":");  out.print(flowSensorFault[i]?"true":"false");
+    out.print(",\"current\":");      writeCurrentJson(out, i);
+    out.print(",\"counters\":");     writeCounterJson(out, i);
+    // Gesammelte Läufe der laufenden Kalibrierung
+    const CalibrationSession &cs = calSession[i];
+    CalibrationStats st = calibrationStats(i);
+    out.print(",\"targetMl\":");     out.print(cs.targetMl, 0);
+    out.print(",\"runs\":[");
+    for(int r=0; r<cs.runs; r++){
+      if(r>0) out.print(',');
+      out.print("{\"sec\":");        out.print(cs.durationUs[r]/1e6f, 3);
+      out.print(",\"pulses\":");     out.print(cs.pulses[r]);
+      out.print(",\"outlier\":");    out.print((st.outliers>>r)&1 ? "true" : "false");
+      out.print('}');
+    }
+    out.print("],\"used\":");        out.print(st.used);
+    out.print(",\"meanSec\":");      out.print(st.meanSec, 3);
+    out.print(",\"sdSec\":");        out.print(st.sdSec, 3);
+    out.print(",\"cvPct\":");        out.print(st.meanSec>0 ? 100*st.sdSec/st.meanSec : 0.0f, 2);
+    out.print('}');
+  }
+  out.print("],\"minRuns\":");       out.print(CAL_MIN_RUNS);
+  out.print(",\"button\":{\"pin\":"); out.print(calButtonPin);
+  out.print(",\"pump\":");           out.print(calButtonPump);
+  out.print('}');
+  writeApiMessage(out, msg);
+  out.print('}');
+}
+
+void apiSendCalibration(WebServer &http, const char *msg) {
+  ArenaPrint out(requestArena);
+  writeApiCalibrationJson(out, msg);
+  apiSend(http, 200, out);
+}
+
+void handleApiCalibration(WebServer &http) {
+  if(http.method()!=HTTP_POST){
+    apiSendCalibration(http, nullptr);
+    return;
+  }
+  if(!http.hasArg("pump")){
+    apiError(http, 400, "Missing pump");
+    return;
+  }
+  int p = http.arg("pump").toInt();
+  if(p<0||p>3){
+    apiError(http, 400, "Invalid pump");
+    return;
+  }
+
+  // Taster für diese Pumpe setzen (buttonPin=-1 entfernt ihn)
+  if(http.hasArg("buttonPin")){
+    int pin = http.arg("buttonPin").toInt();
+    if(pin<-1||pin>39){
+      apiError(http, 400, "Invalid pin");
+      return;
+    }
+    updateCalButton(pin, p);
+    apiSendCalibration(http, pin<0 ? "Taster entfernt."
+      : requestArena.printf("Taster an GPIO %d schaltet Pumpe %d.", pin, p+1));
+    return;
+  }
+
+  // Stromsensor setzen (currentPin=-1 entfernt ihn) oder neu lernen
+  if(http.hasArg("currentPin")){
+    int pin = http.arg("currentPin").toInt();
+    if(pin<-1||pin>39){
+      apiError(http, 400, "Invalid pin");
+      return;
+    }
+    bool restart = pin!=currentSensePin[p];
+    updateCurrentSensor(p, pin);
+    apiSendCalibration(http, pin<0
+      ? requestArena.printf("Stromsensor für Pumpe %d entfernt.%s", p+1, restart ? " Neustart..." : "")
+      : requestArena.printf("Stromsensor für Pumpe %d an GPIO %d gesetzt.%s", p+1, pin,
+                            restart ? " Neustart..." : ""));
+    return;
+  }
+  if(http.hasArg("currentReset")){
+    resetCurrentBaseline(p);
+    apiSendCalibration(http, requestArena.printf("Stromsignatur von Pumpe %d wird neu gelernt.", p+1));
+    return;
+  }
+
+  // Wartung: Grenzen setzen oder als erledigt vermerken
+  if(http.hasArg("maintHours") || http.hasArg("maintMl")){
+    float hours = http.arg("maintHours").toFloat();
+    float ml    = http.arg("maintMl").toFloat();
+    if(hours<0 || ml<0){
+      apiError(http, 400, "Ungültige Wartungsgrenze");
+      return;
+    }
+    updatePumpMaintenance(p, hours, ml);
+    apiSendCalibration(http, requestArena.printf("Wartungsgrenzen für Pumpe %d gesetzt.", p+1));
+    return;
+  }
+  if(http.hasArg("service")){
+    counterServiceDone(p);
+    apiSendCalibration(http, requestArena.printf("Wartung von Pumpe %d vermerkt.", p+1));
+    return;
+  }
+
+  // Durchflusssensor setzen
+  if(http.hasArg("pin")){
+    int pin = http.arg("pin").toInt();
+    if(pin<-1||pin>39){
+      apiError(http, 400, "Invalid pin");
+      return;
+    }
+    float ppm = http.hasArg("ppm") ? http.arg("ppm").toFloat() : flowPulsesPerMl[p];
+    updateFlowSensor(p, pin, ppm);
+    apiSendCalibration(http, pin<0
+      ? requestArena.printf("Durchflusssensor für Pumpe %d entfernt.", p+1)
+      : requestArena.printf("Durchflusssensor für Pumpe %d an GPIO %d gesetzt.", p+1, pin));
+    return;
+  }
+
+  String action = http.arg("action");
+  if(action=="start"){
+    if(pumpStatus[p]){
+      apiError(http, 409, "Pumpe läuft bereits.");
+      return;
+    }
+    // Menge je Lauf nur für den ersten Lauf wählbar
+    if(http.hasArg("ml") && calSession[p].runs==0){
+      float ml = http.arg("ml").toFloat();
+      if(ml<1 || ml>10000){
+        apiError(http, 400, "Ungültige Menge");
+        return;
+      }
+      calSession[p].targetMl = ml;
+    }
+    startCalibration(p);
+    apiSendCalibration(http, requestArena.printf("Kalibrierung für Pumpe %d gestartet.", p+1));
+  } else if(action=="stop"){
+    if(!calibrationRunning[p]){
+      apiError(http, 409, "Kalibrierung wurde nicht gestartet.");
+      return;
+    }
+    apiSendCalibration(http, stopCalibration(p).c_str());
+  } else if(action=="commit"){
+    String msg;
+    if(!commitCalibration(p, msg)){
+      apiError(http, 409, msg);
+      return;
+    }
+    apiSendCalibration(http, msg.c_str());
+  } else if(action=="discard"){
+    discardCalibration(p);
+    apiSendCalibration(http, requestArena.printf("Läufe für Pumpe %d verworfen.", p+1));
+  } else {
+    apiError(http, 400, "Missing action");
+  }
+}
+
+/* ---- Programme ---- */
+void writeApiProgramEntry(Print &out, size_t i, const Program &prog, time_t next) {
+    out.print("{\"index\":");       out.print((unsigned long)i);
+    out.print(",\"next\":");        out.print((long)next);
+    out.print(",\"nextText\":");
+    writeJsonString(out, next>=0 ? unixTimeToDayString(next) : String("Nie"));
+    out.print(",\"lastRunText\":");
+    writeJsonString(out, prog.lastRun>0 ? unixTimeToDayString(prog.lastRun) : String("Noch nie"));
+    out.print(",\"durationSec\":"); out.print(programDurationSec(prog), 1);
+    int blocked = programBlockingReservoir(prog);
+    out.print(",\"blockedBy\":");
+    writeJsonString(out, blocked>=0 ? reservoirs[blocked].name : String());
+    out.print(",\"program\":");
+    writeProgramJson(out, prog);
+    out.print('}');
+}
+
+void writeApiProgramsJson(Print &out, const String &msg) {
+  out.print("{\"programs\":[");
+  programs.forEach([&](size_t i, const Program &prog){
+    if(i>0) out.print(',');
+    time_t next = prog.active ? nextProgramFire(prog, currentUnixTime, prog.lastRun) : -1;
+    writeApiProgramEntry(out, i, prog, next);
+  });
+  out.print(']');
+  writeApiMessage(out, msg.c_str());
+  out.print('}');
+}
+
+/* ---- Programmliste seitenweise ----
+   Gefiltert wird nur über den Index des Programmspeichers (Pumpen-,
+   Wochentags- und Aktiv-Maske im RAM). Sortiert wird nach der nächsten
+   Ausführung, dann nach ID; Programme ohne nächste Ausführung kommen ans
+   Ende. Ein begrenzter Heap hält nur die limit+1 kleinsten Schlüssel hinter
+   dem Cursor, dekodiert werden nur die Programme der Seite; die nächste
+   Ausführung kommt aus cachedProgramNextFire(). Der Cursor ist der Schlüssel des
+   letzten Eintrags der vorigen Seite und bleibt gültig, wenn sich die
+   Liste dazwischen ändert. */
+struct ProgramQuery {
+  int pump   = -1;   // 0..3
+  int wday   = -1;   // 0 = So
+  int active = -1;   // state=0|1
+  time_t from = 0, to = 0; // Fenster für die nächste Ausführung, 0 = offen
+  bool hasCursor = false;
+  uint64_t after = 0;
+  size_t limit = 20;
+};
+
+ProgramQuery programQueryFromArgs() {
+  ProgramQuery q;
+  if(server.hasArg("pump"))   q.pump   = constrain((int)server.arg("pump").toInt(), 0, 3);
+  if(server.hasArg("day"))    q.wday   = constrain((int)server.arg("day").toInt(), 0, 6);
+  if(server.hasArg("state"))  q.active = server.arg("state")=="1";
+  q.from = parseTimeArg(server.arg("from"), 0);
+  q.to   = parseTimeArg(server.arg("to"), 0);
+  if(server.hasArg("cursor") && !server.arg("cursor").isEmpty()){
+    q.hasCursor = true;
+    q.after = strtoull(server.arg("cursor").c_str(), nullptr, 10);
   }
-  digitalWrite(pin, pumpStatus[idx]?HIGH:LOW);
+  q.limit = constrain((int)server.arg("limit").toInt(), 1, 100);
+  return q;
+}
 
-  // LED an, falls mind. eine Pumpe an
-  bool anyOn = false;
-  for(int i=0; i<4; i++){
-    if(pumpStatus[i]) { anyOn=true; break; }
+void writeApiProgramsPage(Print &out, const ProgramQuery &q, const String &msg) {
+  struct Hit {
+    uint64_t key;
+    uint32_t idx;
+    time_t next;
+    bool operator<(const Hit &o) const { return key<o.key; }
+  };
+  std::priority_queue<Hit> best; // größter Schlüssel oben
+  size_t matched = 0;
+  for(size_t i=0; i<programs.size(); i++){
+    if(!programs.indexMatches(i, q.pump, q.wday, q.active)) continue;
+    time_t next = cachedProgramNextFire(i, currentUnixTime);
+    if(q.from>0 && next<q.from) continue;
+    if(q.to>0 && (next<0 || next>q.to)) continue;
+    matched++;
+    uint64_t key = ((uint64_t)(next<0 ? 0xFFFFFFFFUL : (uint32_t)next) << 32)
+                 | programs.record(i).id;
+    if(q.hasCursor && key<=q.after) continue;
+    if(best.size()<=q.limit){
+      best.push({key, (uint32_t)i, next});
+    } else if(key<best.top().key){
+      best.pop();
+      best.push({key, (uint32_t)i, next});
+    }
+  }
+  bool more = best.size()>q.limit;
+  if(more) best.pop();
+  std::vector<Hit> page;
+  while(!best.empty()){
+    page.push_back(best.top());
+    best.pop();
   }
-  digitalWrite(ledpin, anyOn ? HIGH : LOW);
 
-  saveConfig();
+  out.print("{\"programs\":[");
+  for(size_t k=page.size(); k-->0; ){
+    if(k+1<page.size()) out.print(',');
+    writeApiProgramEntry(out, page[k].idx, programs.get(page[k].idx), page[k].next);
+  }
+  out.print("],\"matched\":");
+  out.print((unsigned long)matched);
+  out.print(",\"total\":");
+  out.print((unsigned long)programs.size());
+  out.print(",\"cursor\":");
+  if(more && !page.empty()){
+    char cur[24];
+    snprintf(cur, sizeof(cur), "\"%llu\"", (unsigned long long)page.front().key);
+    out.print(cur);
+  } else {
+    out.print("null");
+  }
+  writeApiMessage(out, msg.c_str());
+  out.print('}');
 }
 
-void updateProgramActiveState(int idx, bool newState) {
-  if(idx<0 || idx>=(int)programs.size()) return;
-  programs[idx].active = newState;
-  saveConfig();
+void apiSendPrograms(const String &msg) {
+  server.sendHeader("X-Api-Version", String(API_VERSION));
+  server.sendHeader("Cache-Control", "no-store");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  ChunkedResponse out;
+  if(server.hasArg("limit")) writeApiProgramsPage(out, programQueryFromArgs(), msg);
+  else writeApiProgramsJson(out, msg);
+  out.end();
 }
 
-void addProgram(const Program &prog) {
-  programs.push_back(prog);
-  saveConfig();
+// Neues Programm aus den Formularfeldern; leerer String = in Ordnung
+String programFromArgs(Program &prog) {
+  // Mit "cron" entfallen days und time; interval zählt dann Wochen ab
+  // "anchor" (YYYY-MM-DD, sonst die aktuelle Woche)
+  bool cron = server.arg("cron").length()>0;
+  if((!cron && (!server.hasArg("days")||!server.hasArg("time")))
+     ||!server.hasArg("interval")
+     ||(!server.hasArg("amounts")&&!server.hasArg("amount"))||!server.hasArg("pumps")){
+    return "Fehlende Parameter";
+  }
+  prog.days     = cron ? "" : server.arg("days");
+  prog.interval = server.arg("interval").toInt();
+  prog.time     = cron ? "" : server.arg("time");
+  prog.cron     = server.arg("cron");
+  prog.cron.trim();
+  prog.anchor   = currentUnixTime;
+  if(cron && server.hasArg("anchor")){
+    prog.anchor = stringToUnixTime(server.arg("anchor")+" 00:00:00");
+    if(prog.anchor==0) return "Ungültiges Bezugsdatum";
+  }
+  if(cron){
+    if(prog.cron.length()>64) return "Cron-Ausdruck zu lang";
+    String err = compileCron(prog.cron, prog.sched);
+    if(!err.isEmpty()) return err;
+  }
+  if(prog.interval<1 || prog.interval>52) return "Ungültiges Intervall";
+  prog.mode     = server.arg("mode")=="sequential" ? PROG_SEQUENTIAL : PROG_PARALLEL;
+  prog.gapSec   = constrain(server.arg("gap").toInt(), 0L, 3600L);
+  prog.active   = false;
+  prog.lastRun  = 0;
+
+  // Mengen: "amounts=10,0,25,0" je Pumpe oder alt "amount=10" für alle
+  if(server.hasArg("amounts")){
+    String aStr = server.arg("amounts");
+    int from=0;
+    for(int i=0;i<4;i++){
+      prog.amounts[i] = 0;
+      if(from<0) continue;
+      int comma = aStr.indexOf(',', from);
+      prog.amounts[i] = (comma==-1 ? aStr.substring(from)
+                                   : aStr.substring(from, comma)).toInt();
+      from = comma==-1 ? -1 : comma+1;
+    }
+  } else {
+    int amount = server.arg("amount").toInt();
+    for(int i=0;i<4;i++) prog.amounts[i] = amount;
+  }
+
+  // pumps[] reset
+  for(int i=0;i<4;i++){
+    prog.pumps[i] = false;
+  }
+  // Beispiel: "0,2" => Pumpe1+3
+  String pStr = server.arg("pumps");
+  int start=0;
+  while(true){
+    int commaIndex = pStr.indexOf(',', start);
+    String val = (commaIndex==-1)
+                  ? pStr.substring(start)
+                  : pStr.substring(start, commaIndex);
+    val.trim();
+    if(val.length()>0){
+      int idx = val.toInt();
+      if(idx>=0 && idx<4){
+        prog.pumps[idx] = true;
+      }
+    }
+    if(commaIndex==-1) break;
+    start = commaIndex+1;
+  }
+  for(int i=0;i<4;i++){
+    if(prog.pumps[i] && prog.amounts[i]<=0){
+      return "Ungültige Menge für Pumpe "+String(i+1);
+    }
+  }
+  return "";
 }
 
-void deleteProgram(int idx) {
-  if(idx>=0 && idx<(int)programs.size()){
-    programs.erase(programs.begin()+idx);
-    saveConfig();
+void handleApiPrograms() {
+  HTTPMethod method = server.method();
+  if(method!=HTTP_POST && method!=HTTP_DELETE){
+    apiSendPrograms("");
+    return;
+  }
+
+  // Neues Programm
+  if(method==HTTP_POST && !server.hasArg("index")){
+    Program prog;
+    String err = programFromArgs(prog);
+    if(!err.isEmpty()){
+      apiError(400, err);
+      return;
+    }
+    if(!addProgram(prog)){
+      apiError(507, "Programmspeicher voll");
+      return;
+    }
+    apiSendPrograms("Programm hinzugefügt.");
+    return;
+  }
+
+  int idx = server.arg("index").toInt();
+  if(idx<0||idx>=(int)programs.size()){
+    apiError(400, "Invalid index");
+    return;
+  }
+  if(method==HTTP_DELETE){
+    deleteProgram(idx);
+    apiSendPrograms("Programm "+String(idx+1)+" wurde gelöscht.");
+    return;
   }
+  bool newState = server.hasArg("active") ? server.arg("active")=="1"
+                                          : !programs.record(idx).active;
+  updateProgramActiveState(idx, newState);
+  apiSendPrograms("Programm "+String(idx+1)
+    +" ist jetzt "+(newState?"aktiv":"inaktiv")+".");
 }
 
-void updatePumpFlowRate(int p, float rate) {
-  pumpFlowRate[p] = rate;
-  saveConfig();
+/* ---- Rezepte ---- */
+// Nächster Start per Cron-Ausdruck, -1 = keiner
+time_t recipeNextFire(const Recipe &r) {
+  if(!r.active || !r.sched.valid) return -1;
+  Program trigger = {};
+  trigger.cron     = r.cron;
+  trigger.interval = 1;
+  trigger.sched    = r.sched;
+  return nextProgramFire(trigger, currentUnixTime, r.lastRun);
 }
 
-/* --------------------------------------------------------------------------
-   HTML und CSS (unverändert)
-   -------------------------------------------------------------------------- */
-String createCSS() {
-  return R"=====(
-<style>
-  body { font-family: Arial, sans-serif; margin:0; padding:0; text-align:center; }
-  .header {
-    display:flex; justify-content:space-between; align-items:center;
-    background-color:#333; color:white; padding:10px; position:sticky; top:0;
+void writeApiRecipesJson(Print &out, const String &msg) {
+  static const char *PHASES[] = {"idle", "pending", "dosing", "waiting"};
+  out.print("{\"recipes\":[");
+  for(size_t i=0; i<recipes.size(); i++){
+    const Recipe &r = recipes[i];
+    time_t next = recipeNextFire(r);
+    if(i>0) out.print(',');
+    out.print("{\"index\":");   out.print((unsigned long)i);
+    out.print(",\"id\":");      out.print(r.id);
+    out.print(",\"name\":");    writeJsonString(out, r.name);
+    out.print(",\"steps\":");   writeJsonString(out, r.steps);
+    out.print(",\"cron\":");    writeJsonString(out, r.cron);
+    out.print(",\"active\":");  out.print(r.active ? "true" : "false");
+    out.print(",\"lastRunText\":");
+    writeJsonString(out, r.lastRun>0 ? unixTimeToDayString(r.lastRun) : String("Noch nie"));
+    out.print(",\"nextText\":");
+    writeJsonString(out, next>=0 ? unixTimeToDayString(next) : String());
+    out.print('}');
   }
-  .home-button img { width:30px; height:30px; }
-  .header-title { font-size:18px; font-weight:bold; }
-  .header-datetime { font-size:16px; cursor:pointer; }
-  .section { padding:20px; }
-  .menu-button {
-    display:inline-block; margin:15px; padding:15px 30px; font-size:18px;
-    background-color:green; color:white; border:none; border-radius:10px;
-    text-decoration:none; cursor:pointer;
+  out.print("],\"run\":");
+  const RecipeRun &run = recipeRun;
+  if(!run.id){
+    out.print("null");
+  } else {
+    long rest = 0;
+    if(run.phase==RECIPE_WAITING){
+      rest = (long)(run.waitUntilMs - millis());
+      rest = rest>0 ? (rest+999)/1000 : 0;
+    }
+    out.print("{\"id\":");          out.print(run.id);
+    out.print(",\"name\":");        writeJsonString(out, run.name);
+    out.print(",\"step\":");        out.print(run.step);
+    out.print(",\"stepCount\":");   out.print((unsigned long)run.steps.size());
+    out.print(",\"phase\":\"");     out.print(PHASES[run.phase & 3]);
+    out.print("\",\"waitSec\":");   out.print(rest);
+    out.print(",\"startedText\":");
+    writeJsonString(out, unixTimeToDayString(run.startedAt));
+    out.print('}');
   }
-  .menu-button:hover { background-color:darkgreen; }
-  .pump-button {
-    padding:15px 30px; font-size:18px; margin:15px; border:none; border-radius:10px; 
-    color:white; cursor:pointer; text-transform:uppercase; min-width:100px;
+  out.print(",\"lastResult\":");
+  writeJsonString(out, recipeLastResult);
+  writeApiMessage(out, msg.c_str());
+  out.print('}');
+}
+
+void apiSendRecipes(const String &msg) {
+  server.sendHeader("X-Api-Version", String(API_VERSION));
+  server.sendHeader("Cache-Control", "no-store");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  ChunkedResponse out;
+  writeApiRecipesJson(out, msg);
+  out.end();
+}
+
+void handleApiRecipes() {
+  HTTPMethod method = server.method();
+  if(method!=HTTP_POST && method!=HTTP_DELETE){
+    apiSendRecipes("");
+    return;
   }
-  .pump-button.on  { background-color:green; }
-  .pump-button.off { background-color:red; }
-  .program-block { border:1px solid #ccc; margin:10px; padding:10px; text-align:left; }
-  input, select {
-    font-size:16px; margin:5px 0; padding:5px; width:80%; max-width:300px; 
-    border-radius:5px; border:1px solid #ccc;
+  String action = server.arg("action");
+  if(action=="cancel"){
+    if(!recipeRun.id){
+      apiError(409, "Kein Rezept aktiv.");
+      return;
+    }
+    recipeCancel();
+    apiSendRecipes(recipeLastResult);
+    return;
   }
-  button, .button {
-    margin:5px; padding:10px 20px; font-size:16px; border-radius:5px; border:none; 
-    cursor:pointer;
+
+  int idx = server.hasArg("index") ? server.arg("index").toInt() : -1;
+  if(server.hasArg("index") && (idx<0 || idx>=(int)recipes.size())){
+    apiError(400, "Invalid index");
+    return;
   }
-  button:hover { opacity:0.9; }
-  .delete-button   { background-color:red;   color:white; }
-  .activate-button { background-color:blue;  color:white; }
-  .add-program-form { border:1px solid #ccc; padding:10px; margin:10px; text-align:center; }
-  .day-button, .pump-select-button {
-    background-color:#eee; border:1px solid #ccc; border-radius:5px; 
-    display:inline-block; margin:5px; padding:10px; cursor:pointer;
+  bool running = idx>=0 && recipeRun.id==recipes[idx].id;
+
+  if(method==HTTP_DELETE){
+    if(idx<0){
+      apiError(400, "Missing index");
+      return;
+    }
+    if(running){
+      apiError(409, "Rezept läuft gerade.");
+      return;
+    }
+    String name = recipes[idx].name;
+    deleteRecipe(idx);
+    apiSendRecipes("Rezept "+name+" gelöscht.");
+    return;
   }
-  .day-button.active, .pump-select-button.active {
-    background-color:green; color:white;
+
+  if(action=="start"){
+    String msg;
+    if(idx<0){
+      apiError(400, "Missing index");
+      return;
+    }
+    if(!recipeStart(idx, msg)){
+      apiError(409, msg);
+      return;
+    }
+    recipePoll(); // erster Schritt sofort
+    apiSendRecipes(msg);
+    return;
   }
-  .calibration-info { margin-top:20px; font-size:16px; }
-  #datetime-overlay {
-    position: fixed; top:0; left:0; right:0; bottom:0; background-color: rgba(0,0,0,0.5);
-    display: none; justify-content: center; align-items: center; z-index: 9999;
+
+  if(idx>=0 && server.hasArg("active") && !server.hasArg("steps")){
+    bool active = server.arg("active")=="1";
+    updateRecipeActiveState(idx, active);
+    apiSendRecipes("Rezept "+recipes[idx].name+" ist jetzt "+(active?"aktiv":"inaktiv")+".");
+    return;
   }
-  #datetime-form {
-    background: white; padding: 20px; border-radius:5px; text-align:center;
+
+  // Anlegen oder (mit index) ersetzen
+  Recipe r = {};
+  r.name   = server.arg("name");
+  r.steps  = server.arg("steps");
+  r.cron   = server.arg("cron");
+  r.active = server.arg("active")=="1";
+  r.name.trim();
+  r.cron.trim();
+  if(!reservoirNameValid(r.name)){
+    apiError(400, "Ungültiger Name");
+    return;
   }
-  #datetime-form input {
-    margin: 5px; padding:5px; width:80px;
+  std::vector<RecipeStep> steps;
+  String err = compileRecipe(r.steps, steps);
+  if(err.isEmpty() && !r.cron.isEmpty()){
+    err = r.cron.length()>64 ? String("Cron-Ausdruck zu lang") : compileCron(r.cron, r.sched);
+  }
+  if(!err.isEmpty()){
+    apiError(400, err);
+    return;
   }
-  #datetime-form button {
-    margin: 5px; padding: 10px 20px;
+  if(running){
+    apiError(409, "Rezept läuft gerade.");
+    return;
   }
-  @media (max-width: 400px) {
-    .menu-button, .pump-button { width:100%; box-sizing:border-box; margin:10px 0; }
-    input, select { width:90%; }
+  if(idx<0 && recipes.size()>=MAX_RECIPES){
+    apiError(409, "Höchstens "+String(MAX_RECIPES)+" Rezepte.");
+    return;
   }
-</style>
-)=====";
+  saveRecipe(idx, r);
+  apiSendRecipes("Rezept "+r.name+(idx<0 ? " angelegt." : " gespeichert."));
 }
 
-// Kopfbereich mit Datum/Uhrzeit-Einblendung
-String createHeader(String title) {
-  return R"=====(<div class="header">
-    <a href="/" class="home-button">
-      <svg xmlns="http://www.w3.org/2000/svg" width="30" height="30" viewBox="0 0 24 24" 
-           fill="none" stroke="currentColor" stroke-width="2" stroke-linecap="round" 
-           stroke-linejoin="round">
-        <path d="M3 9L12 2L21 9V22H14V15H10V22H3V9Z"></path>
-      </svg>
-    </a>
-    <span class="header-title">)=====" + title + R"=====(</span>
-    <span id="datetime" class="header-datetime" onclick="showDateTimeForm()">)====="
-    + getCurrentDateTime() + 
-    R"=====(</span>
-  </div>
-  <div id="datetime-overlay">
-    <div id="datetime-form">
-      <h3>Datum und Uhrzeit einstellen</h3>
-      <p>Bitte geben Sie Tag, Monat, Jahr, Stunde und Minute ein:</p>
-      <div>
-        <label>Tag: <input type="number" id="day" min="1" max="31"></label><br>
-        <label>Monat: <input type="number" id="month" min="1" max="12"></label><br>
-        <label>Jahr: <input type="number" id="year" min="2000" max="2100" value="2025"></label><br>
-        <label>Stunde: <input type="number" id="hour" min="0" max="23"></label><br>
-        <label>Minute: <input type="number" id="minute" min="0" max="59"></label>
-      </div>
-      <button onclick="submitDateTimeForm()">Setzen</button>
-      <button onclick="cancelDateTimeForm()">Abbrechen</button>
-    </div>
-  </div>
-  <script>
-    function showDateTimeForm() {
-      document.getElementById('datetime-overlay').style.display = 'flex';
-    }
-    function cancelDateTimeForm() {
-      document.getElementById('datetime-overlay').style.display = 'none';
-    }
-    async function submitDateTimeForm() {
-      const day    = document.getElementById('day').value;
-      const month  = document.getElementById('month').value;
-      const year   = document.getElementById('year').value;
-      const hour   = document.getElementById('hour').value;
-      const minute = document.getElementById('minute').value;
-      if(!day||!month||!year||!hour||!minute){
-        alert("Bitte alle Felder ausfüllen!");
+/* ---- Sensoren ---- */
+String apiSensorsJson(const String &msg) {
+  String json = "{\"sensors\":[";
+  for(size_t s=0; s<sensors.size(); s++){
+    const SensorInput &e = sensors[s];
+    if(s>0) json += ",";
+    json += "{\"index\":"+String(s)
+      +",\"name\":\""+e.name+"\""
+      +",\"kind\":\""+String(SENSOR_KIND_NAMES[e.kind])+"\""
+      +",\"pin\":"+String(e.pin)
+      +",\"reg\":"+String(e.reg)
+      +",\"scale\":"+String(e.scale,6)
+      +",\"offset\":"+String(e.offset,3)
+      +",\"ok\":"+String(sensorOk[s]?"true":"false")
+      +",\"value\":"+(isnan(sensorValue[s]) ? String("null") : String(sensorValue[s],2))+"}";
+  }
+  json += "],\"triggers\":[";
+  for(size_t k=0; k<triggers.size(); k++){
+    const SensorTrigger &t = triggers[k];
+    uint8_t state = k<triggerRun.size() ? triggerRun[k].state : TRIG_ARMED;
+    if(k>0) json += ",";
+    json += "{\"index\":"+String(k)
+      +",\"id\":"+String(t.id)
+      +",\"sensor\":"+String(t.sensor)
+      +",\"below\":"+String(t.below?"true":"false")
+      +",\"threshold\":"+String(t.threshold,2)
+      +",\"hysteresis\":"+String(t.hysteresis,2)
+      +",\"gap\":"+String((unsigned long)t.minGapSec)
+      +",\"cap\":"+String(t.dailyCapMl)
+      +",\"program\":"+String(findProgramById(t.programId))
+      +",\"active\":"+String(t.active?"true":"false")
+      +",\"state\":\""+String(TRIGGER_STATE_NAMES[state])+"\""
+      +",\"dayMl\":"+String(t.day==tzLocal(currentUnixTime)/SECONDS_PER_DAY ? t.dayMl : 0)
+      +",\"lastFireText\":\""+(t.lastFire>0 ? unixTimeToDayString(t.lastFire) : String("Noch nie"))+"\"}";
+  }
+  json += "]"+apiMessage(msg)+"}";
+  return json;
+}
+
+void handleApiSensors() {
+  HTTPMethod method = server.method();
+  if(method!=HTTP_POST && method!=HTTP_DELETE){
+    apiSend(200, apiSensorsJson(""));
+    return;
+  }
+
+  int k = server.hasArg("trigger") ? server.arg("trigger").toInt() : -1;
+  if(server.hasArg("trigger") && (k<0 || k>=(int)triggers.size())){
+    apiError(400, "Invalid trigger");
+    return;
+  }
+  int s = server.hasArg("sensor") ? server.arg("sensor").toInt() : -1;
+  if(server.hasArg("sensor") && (s<0 || s>=(int)sensors.size())){
+    apiError(400, "Invalid sensor");
+    return;
+  }
+
+  if(method==HTTP_DELETE){
+    if(k>=0){
+      deleteTrigger(k);
+      apiSend(200, apiSensorsJson("Auslöser gelöscht."));
+    } else if(s>=0){
+      String name = sensors[s].name;
+      deleteSensor(s);
+      apiSend(200, apiSensorsJson("Sensor "+name+" samt Auslösern gelöscht."));
+    } else {
+      apiError(400, "Missing sensor or trigger");
+    }
+    return;
+  }
+
+  // Auslöser an/aus
+  if(k>=0){
+    bool active = server.arg("active")=="1";
+    updateTriggerActiveState(k, active);
+    apiSend(200, apiSensorsJson(String("Auslöser ist jetzt ")+(active?"aktiv":"inaktiv")+"."));
+    return;
+  }
+
+  // Wert eines simulierten Sensors
+  if(s>=0 && server.hasArg("value")){
+    if(sensors[s].kind!=SENSOR_SIM){
+      apiError(409, "Nur simulierte Sensoren nehmen Werte an.");
+      return;
+    }
+    setSensorSimValue(s, server.arg("value").toFloat());
+    triggerPoll();
+    apiSend(200, apiSensorsJson(""));
+    return;
+  }
+
+  // Neuer Auslöser
+  if(server.hasArg("program")){
+    int p = server.arg("program").toInt();
+    if(s<0 || !server.hasArg("threshold")){
+      apiError(400, "Sensor und Schwelle angeben");
+      return;
+    }
+    if(p<0 || p>=(int)programs.size()){
+      apiError(400, "Invalid program");
+      return;
+    }
+    SensorTrigger t = {};
+    t.sensor     = s;
+    t.below      = server.arg("below")!="0";
+    t.threshold  = server.arg("threshold").toFloat();
+    t.hysteresis = server.arg("hysteresis").toFloat();
+    long gap     = server.arg("gap").toInt();
+    long cap     = server.arg("cap").toInt();
+    t.programId  = programs.record(p).id;
+    t.active     = server.arg("active")!="0";
+    if(t.hysteresis<0 || gap<0 || cap<0 || cap>0xFFFF){
+      apiError(400, "Ungültige Hysterese, Abstand oder Tagesmenge");
+      return;
+    }
+    if(triggers.size()>=MAX_TRIGGERS){
+      apiError(409, "Höchstens "+String(MAX_TRIGGERS)+" Auslöser.");
+      return;
+    }
+    t.minGapSec  = gap;
+    t.dailyCapMl = cap;
+    addTrigger(t);
+    apiSend(200, apiSensorsJson("Auslöser angelegt."));
+    return;
+  }
+
+  // Neuer Sensor
+  SensorInput e;
+  e.name = server.arg("name");
+  e.name.trim();
+  String kind = server.arg("kind");
+  e.kind   = kind=="i2c" ? SENSOR_I2C : kind=="sim" ? SENSOR_SIM : SENSOR_ADC;
+  e.pin    = strtol(server.arg("pin").c_str(), nullptr, 0);  // I2C-Adresse auch als 0x..
+  e.reg    = strtol(server.arg("reg").c_str(), nullptr, 0);
+  e.scale  = server.hasArg("scale") ? server.arg("scale").toFloat() : 1.0f;
+  e.offset = server.arg("offset").toFloat();
+  if(!reservoirNameValid(e.name)){
+    apiError(400, "Ungültiger Name");
+    return;
+  }
+  if(e.kind==SENSOR_ADC){
+    int ch = digitalPinToAnalogChannel(e.pin);
+    if(ch<0 || ch>7){
+      apiError(400, "Kein ADC1-Pin");
+      return;
+    }
+  } else if(e.kind==SENSOR_I2C && (e.pin<0x08 || e.pin>0x77)){
+    apiError(400, "Ungültige I2C-Adresse");
+    return;
+  }
+  if(sensors.size()>=MAX_SENSORS){
+    apiError(409, "Höchstens "+String(MAX_SENSORS)+" Sensoren.");
+    return;
+  }
+  addSensor(e);
+  apiSend(200, apiSensorsJson("Sensor "+e.name+" angelegt."
+    +(e.kind==SENSOR_ADC ? " Neustart..." : "")));
+}
+
+/* ---- Tank ---- */
+String apiTankJson(const String &msg) {
+  String json = "{\"reservoirs\":[";
+  for(size_t r=0; r<reservoirs.size(); r++){
+    const Reservoir &t = reservoirs[r];
+    String pumps;
+    for(int i=0; i<4; i++){
+      if(pumpTankIndex(i)!=(int)r) continue;
+      if(!pumps.isEmpty()) pumps += ",";
+      pumps += String(i);
+    }
+    if(r>0) json += ",";
+    json += "{\"index\":"+String(r)
+      +",\"name\":\""+t.name+"\""
+      +",\"capacity\":"+String(t.capacity,1)
+      +",\"level\":"+String(t.level,1)
+      +",\"reserve\":"+String(t.reserve,1)
+      +",\"low\":"+String(t.reserve>0 && t.level<t.reserve ? "true" : "false")
+      +",\"measured\":"+String(reservoirMeasured(r)?"true":"false")
+      +",\"emptyDate\":\""+calculateTankEmptyDate(r)+"\""
+      +",\"pumps\":["+pumps+"]}";
+  }
+  json += "],\"leak\":"+String(tankLeakSuspected?"true":"false")
+    +",\"leakSince\":\""+unixTimeToDayString(tankLeakSince)+"\""
+    +",\"lastRefill\":"+String((long)tankLastRefill)
+    +",\"lastRefillText\":\""+unixTimeToDayString(tankLastRefill)+"\""
+    +",\"lastRefillMl\":"+String(tankLastRefillMl,0)
+    +",\"sensor\":{\"pin\":"+String(tankSensorPin)
+    +",\"reservoir\":"+String(tankSensorReservoir)
+    +",\"raw\":"+String(tankSensorPin>=0 ? tankSensorRaw() : 0.0f,0)
+    +",\"table\":[";
+  for(size_t i=0; i<tankGeometry.size(); i++){
+    if(i>0) json += ",";
+    json += "["+String(tankGeometry[i].raw)+","+String(tankGeometry[i].ml,1)+"]";
+  }
+  return json + "]}" + apiMessage(msg) + "}";
+}
+
+// Behälterindex aus dem Argument, -1 wenn ungültig
+int apiReservoirArg(const char *name) {
+  int r = server.hasArg(name) ? server.arg(name).toInt() : 0;
+  return r>=0 && r<(int)reservoirs.size() ? r : -1;
+}
+
+void handleApiTank() {
+  if(server.method()!=HTTP_POST){
+    apiSend(200, apiTankJson(""));
+    return;
+  }
+  if(server.hasArg("level")){
+    int r = apiReservoirArg("reservoir");
+    if(r<0){
+      apiError(400, "Invalid reservoir");
+      return;
+    }
+    if(reservoirMeasured(r)){
+      apiError(409, "Wasserstand wird vom Sensor gemessen.");
+      return;
+    }
+    float newLevel = server.arg("level").toFloat();
+    if(newLevel<0) newLevel=0;
+    updateTankLevel(r, newLevel);
+    apiSend(200, apiTankJson(reservoirs[r].name+" aktualisiert auf "
+      +String(reservoirs[r].level,1)+" ml"));
+  }
+  else if(server.hasArg("pump")){
+    int pump = server.arg("pump").toInt();
+    int r = apiReservoirArg("reservoir");
+    if(pump<0 || pump>3 || r<0){
+      apiError(400, "Invalid pump or reservoir");
+      return;
+    }
+    assignPumpReservoir(pump, r);
+    apiSend(200, apiTankJson("Pumpe "+String(pump+1)+" fördert aus "+reservoirs[r].name+"."));
+  }
+  else if(server.hasArg("name")){
+    // Ohne "reservoir" neuer Behälter, sonst Änderung
+    String name = server.arg("name");
+    name.trim();
+    float capacity = server.arg("capacity").toFloat();
+    float reserve  = server.arg("reserve").toFloat();
+    if(!reservoirNameValid(name)){
+      apiError(400, "Ungültiger Name");
+      return;
+    }
+    if(capacity<0 || reserve<0 || (capacity>0 && reserve>capacity)){
+      apiError(400, "Ungültige Menge");
+      return;
+    }
+    if(!server.hasArg("reservoir")){
+      if(reservoirs.size()>=MAX_RESERVOIRS){
+        apiError(409, "Maximal "+String(MAX_RESERVOIRS)+" Behälter.");
         return;
       }
-      const dd  = day.padStart(2,'0');
-      const mm  = month.padStart(2,'0');
-      const hh  = hour.padStart(2,'0');
-      const min = minute.padStart(2,'0');
-      const newDateTime = `${year}-${mm}-${dd} ${hh}:${min}:00`;
-      const r = await fetch(`/set_datetime?datetime=${encodeURIComponent(newDateTime)}`);
-      alert(await r.text());
-      location.reload();
-    }
-    // Jede Sekunde aktualisieren
-    setInterval(async ()=>{
-      const r = await fetch('/get_datetime');
-      const d = await r.text();
-      document.getElementById('datetime').innerText = d;
-    },1000);
-  </script>
-  )=====";
-}
-
-// Startseite
-String createHomePage() {
-  return String(R"=====(<!DOCTYPE html>
-<html>
-<head>
-<meta charset="UTF-8">
-<title>Startseite</title>
-<meta name="viewport" content="width=device-width, initial-scale=1.0">
-)=====") 
-  + createCSS() 
-  + R"=====(</head>
-<body>)====="
-  + createHeader("Startseite")
-  + R"=====(<h1>ESP32 Pumpensteuerung</h1>
-<p>Bitte wählen Sie eine Funktion aus:</p>
-<div class="section">
-  <a href="/manual" class="menu-button">Manuelle Steuerung</a>
-  <a href="/calibration" class="menu-button">Kalibrierung</a>
-  <a href="/programs" class="menu-button">Programme</a>
-  <a href="/tank" class="menu-button">Tankstatus</a> <!-- NEU -->
-</div>
-<script>
-window.onload = async () => {
-  let now = new Date();
-  let yyyy = now.getFullYear();
-  let MM = String(now.getMonth() + 1).padStart(2, '0');
-  let dd = String(now.getDate()).padStart(2, '0');
-  let hh = String(now.getHours()).padStart(2, '0');
-  let mm = String(now.getMinutes()).padStart(2, '0');
-  let ss = String(now.getSeconds()).padStart(2, '0');
-  let datetime = `${yyyy}-${MM}-${dd} ${hh}:${mm}:${ss}`;
-  await fetch(`/set_datetime?datetime=${encodeURIComponent(datetime)}`);
-  console.log("Zeit synchronisiert:", datetime);
-};
-</script>
-</body>
-</html>)=====";
+      addReservoir(name, capacity, reserve);
+      apiSend(200, apiTankJson(name+" hinzugefügt."));
+      return;
+    }
+    int r = apiReservoirArg("reservoir");
+    if(r<0){
+      apiError(400, "Invalid reservoir");
+      return;
+    }
+    updateReservoir(r, name, capacity, reserve);
+    apiSend(200, apiTankJson(name+" gespeichert."));
+  }
+  else if(server.hasArg("remove")){
+    int r = apiReservoirArg("remove");
+    if(r<0 || reservoirs.size()<2){
+      apiError(400, "Invalid reservoir");
+      return;
+    }
+    String name = reservoirs[r].name;
+    removeReservoir(r);
+    apiSend(200, apiTankJson(name+" entfernt."));
+  }
+  else if(server.hasArg("pin")){
+    int pin = server.arg("pin").toInt();
+    int r = apiReservoirArg("reservoir");
+    if(pin!=-1 && (digitalPinToAnalogChannel(pin)<0 || digitalPinToAnalogChannel(pin)>7)){
+      apiError(400, "Kein ADC1-Pin (32-39)");
+      return;
+    }
+    if(r<0){
+      apiError(400, "Invalid reservoir");
+      return;
+    }
+    updateTankSensorPin(pin, r);
+    apiSend(200, apiTankJson("Sensor-Pin gesetzt, Neustart..."));
+  }
+  else if(server.hasArg("clear")){
+    clearTankGeometry();
+    apiSend(200, apiTankJson("Geometrietabelle gelöscht."));
+  }
+  else if(server.hasArg("point")){
+    if(tankSensorPin<0 || tankFrames==0){
+      apiError(409, "Kein Sensorwert vorhanden.");
+      return;
+    }
+    addTankGeometryPoint(server.arg("point").toFloat());
+    apiSend(200, apiTankJson("Punkt aufgenommen ("+String(tankGeometry.size())+" Punkte)."));
+  }
+  else {
+    apiError(400, "Missing level");
+  }
 }
 
+/* ---- Uhrzeit ---- */
+void writeApiTimeJson(Print &out, const char *msg) {
+  char text[40];
+  out.print("{\"unix\":");   out.print((long)currentUnixTime);
+  out.print(",\"offset\":"); out.print(tzOffsetAt(currentUnixTime));
+  out.print(",\"text\":\""); out.print(formatDayString(text, sizeof(text), currentUnixTime));
+  // Die Regel kann "<" und ">" enthalten, aber keine Anführungszeichen
+  out.print("\",\"tz\":\""); out.print(tzRule);
+  out.print('"');
+  writeApiMessage(out, msg);
+  out.print('}');
+}
 
-// Manuelle Steuerung
-String createManualPage() {
-  String page = R"=====(<!DOCTYPE html>
-<html>
-<head>
-<meta charset="UTF-8">
-<title>Manuelle Steuerung</title>
-<meta name="viewport" content="width=device-width,initial-scale=1.0">
-)=====" + createCSS() + R"=====(</head>
-<body>)====="
-  + createHeader("Manuelle Steuerung")
-  + R"=====(<h1>Manuelle Steuerung</h1>
-<p>Tippen Sie auf einen Button, um die Pumpe ein- oder auszuschalten.</p>
-<div class="section" id="pumpSection">
-)=====";
+void apiSendTime(const char *msg) {
+  ArenaPrint out(requestArena);
+  writeApiTimeJson(out, msg);
+  apiSend(server, 200, out);
+}
 
-  for(int i=0; i<4; i++){
-    String state = pumpStatus[i] ? "on" : "off";
-    String label= "Pumpe " + String(i+1) + " (" + (pumpStatus[i]?"ON":"OFF") + ")";
-    page += "<button class='pump-button "+state+"' onclick='togglePump("+String(i)+")'>"
-          + label + "</button><br>";
+void handleApiTime() {
+  if(server.method()!=HTTP_POST){
+    apiSendTime(nullptr);
+    return;
+  }
+  const char *msg = nullptr;
+  if(server.hasArg("tz")){
+    if(!updateTimeZone(server.arg("tz"))){
+      apiError(400, "Ungültige Zeitzone");
+      return;
+    }
+    msg = "Zeitzone gesetzt.";
+  }
+  if(server.hasArg("unix")){
+    time_t t = (time_t)server.arg("unix").toInt();
+    if(server.arg("auto")=="1") syncCurrentUnixTime(t);
+    else setCurrentUnixTime(t);
+  } else if(server.hasArg("datetime")){
+    time_t t = stringToUnixTime(server.arg("datetime"));
+    if(t==0){
+      apiError(400, "Invalid datetime");
+      return;
+    }
+    setCurrentUnixTime(t);
+  } else if(!msg){
+    apiError(400, "Missing unix");
+    return;
+  }
+  apiSendTime(msg);
+}
+
+/* ---- Eingabemitschnitt ---- */
+void apiSendTrace(const char *msg) {
+  ArenaPrint out(requestArena);
+  out.print("{\"enabled\":");    out.print(traceEnabled ? "true" : "false");
+  out.print(",\"seq\":");        out.print(traceSeq);
+  out.print(",\"blocks\":");     out.print(TRACE_BLOCKS);
+  out.print(",\"blockSize\":");  out.print(TRACE_BLOCK);
+  out.print(",\"dropped\":");    out.print(traceDropped);
+  writeApiMessage(out, msg);
+  out.print('}');
+  apiSend(server, 200, out);
+}
+
+void handleApiTrace() {
+  if(server.method()!=HTTP_POST){
+    apiSendTrace(nullptr);
+    return;
+  }
+  if(server.hasArg("clear")){
+    traceClear();
+    apiSendTrace("Mitschnitt gelöscht.");
+    return;
+  }
+  if(!server.hasArg("enabled")){
+    apiError(400, "Missing enabled");
+    return;
+  }
+  bool on = server.arg("enabled")=="1";
+  updateTraceEnabled(on);
+  if(on && !traceEnabled){
+    apiError(500, "Mitschnittdatei konnte nicht angelegt werden");
+    return;
   }
+  apiSendTrace(on ? "Mitschnitt läuft." : "Mitschnitt angehalten.");
+}
 
-  page += R"=====(</div>
-<script>
-async function togglePump(index){
-  const response = await fetch(`/toggle_pump?index=${index}`);
-  const data = await response.json();
-  updatePumps(data);
-}
-function updatePumps(data){
-  const section = document.getElementById('pumpSection');
-  section.innerHTML = '';
-  data.forEach((p, i)=>{
-    const st = p.on ? 'on':'off';
-    const label = `Pumpe ${i+1} (${p.on?'ON':'OFF'})`;
-    section.innerHTML += `<button class='pump-button ${st}' onclick='togglePump(${i})'>${label}</button><br>`;
-  });
+// Ringdatei unverändert; die Blöcke ordnet tools/tracereplay.py
+void handleTraceData() {
+  traceFlush();
+  File f = SPIFFS.open(TRACE_PATH, FILE_READ);
+  if(!f){
+    server.send(404, "text/plain", "Kein Mitschnitt");
+    return;
+  }
+  size_t total = f.size();
+  server.sendHeader("Cache-Control", "no-store");
+  server.setContentLength(total);
+  server.send(200, "application/octet-stream", "");
+  uint8_t buf[1024];
+  size_t n;
+  while((n = f.read(buf, sizeof(buf)))>0){
+    server.sendContent((const char*)buf, n);
+    responseBytes += n;
+    controlLanePoll();
+  }
+  f.close();
 }
-// Polling alle 5s
-setInterval(async ()=>{
-  const r = await fetch('/get_pumps');
-  const d = await r.json();
-  updatePumps(d);
-},5000);
-</script>
-</body></html>)=====";
-  return page;
+
+/* --------------------------------------------------------------------------
+   Benchmarks (nur im Build mit -DPUMPE_BENCH, siehe platformio.ini)
+   --------------------------------------------------------------------------
+   /api/bench misst die API-Antworten, Speichern/Laden, die Tankprognose
+   und die Minutenprüfung mit künstlichen Programmsätzen, "triggerTick" die
+   Auswertung ebenso vieler Sensor-Auslöser (bis 1000). Allokationen und
+   Spitzenbelegung zählen die per --wrap umgeleiteten malloc/free.
+   Ergebnisse lassen sich als Baseline sichern und später vergleichen.
+   /api/currentsim spielt künstliche Stromverläufe durch die Erkennung der
+   Motorstrom-Überwachung. /api/arenasim vergleicht Allokationen und
+   Heap-Zersplitterung der API-Antworten als String und in der
+   Anfrage-Arena über bis zu einer Million simulierte Anfragen.
+   Die Programmsätze werden in den Programmspeicher geschrieben; der muss
+   dafür leer sein oder mit wipe=1 geleert werden. "storeOpen" ist die
+   Startzeit des Programmspeichers, seine Spitzenbelegung der Index im RAM.
+   --------------------------------------------------------------------------*/
+#ifdef PUMPE_BENCH
+#include <esp_heap_caps.h>
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void  __real_free(void *ptr);
 }
 
-// Kalibrierung
-String createCalibrationPage() {
-  String page = R"=====(<!DOCTYPE html>
-<html>
-<head>
-<meta charset="UTF-8">
-<title>Kalibrierung</title>
-<meta name="viewport" content="width=device-width,initial-scale=1.0">
-)=====" + createCSS() 
-  + R"=====(</head>
-<body>)====="
-  + createHeader("Kalibrierung")
-  + R"=====(<h1>Kalibrierung</h1>
-<p>Starten Sie die Pumpe und stoppen Sie nach exakt 100 ml, um die Flussrate zu berechnen.</p>
-<div class="section" id="calibrationSection">
-)=====";
+volatile bool benchCounting = false;
+volatile uint32_t benchAllocs = 0;
+volatile int32_t  benchLiveBytes = 0;
+volatile int32_t  benchPeakBytes = 0;
+
+static void benchTrackAlloc(void *p) {
+  if(!p || !benchCounting) return;
+  int32_t live = __atomic_add_fetch(&benchLiveBytes,
+                   (int32_t)heap_caps_get_allocated_size(p), __ATOMIC_RELAXED);
+  __atomic_add_fetch(&benchAllocs, 1, __ATOMIC_RELAXED);
+  if(live>benchPeakBytes) benchPeakBytes = live;
+}
 
-  for(int i=0; i<4; i++){
-    page += "<h2>Pumpe "+String(i+1)+"</h2>";
-    page += "<button class='button' onclick='startCal("+String(i)+")'>Start Kalibrierung</button>";
-    page += "<button class='button' onclick='stopCal("+String(i)+")'>Stop Kalibrierung</button>";
-    page += "<div class='calibration-info' id='info"+String(i)+"'>Aktuelle Rate: ";
-    if(pumpFlowRate[i]>0){
-      page += String(pumpFlowRate[i],2)+" ml/s";
-    } else {
-      page += "Noch nicht kalibriert";
-    }
-    page += "</div>";
-  }
+static void benchTrackFree(void *p) {
+  if(!p || !benchCounting) return;
+  __atomic_sub_fetch(&benchLiveBytes,
+    (int32_t)heap_caps_get_allocated_size(p), __ATOMIC_RELAXED);
+}
 
-  page += R"=====(</div>
-<script>
-async function startCal(i){
-  let r = await fetch(`/start_calibration?pump=${i}`);
-  alert(await r.text());
+extern "C" {
+void *__wrap_malloc(size_t size) {
+  void *p = __real_malloc(size);
+  benchTrackAlloc(p);
+  return p;
 }
-async function stopCal(i){
-  let r = await fetch(`/stop_calibration?pump=${i}`);
-  alert(await r.text());
-  location.reload();
+void *__wrap_calloc(size_t n, size_t size) {
+  void *p = __real_calloc(n, size);
+  benchTrackAlloc(p);
+  return p;
+}
+void *__wrap_realloc(void *ptr, size_t size) {
+  benchTrackFree(ptr);
+  void *p = __real_realloc(ptr, size);
+  benchTrackAlloc(p);
+  return p;
+}
+void __wrap_free(void *ptr) {
+  benchTrackFree(ptr);
+  __real_free(ptr);
 }
-</script>
-</body></html>)=====";
-  return page;
 }
 
+struct BenchResult {
+  String name;
+  int n;
+  uint32_t us;      // Median über die Wiederholungen
+  uint32_t allocs;  // je Durchlauf
+  int32_t peak;     // Spitzenbelegung je Durchlauf in Bytes
+};
 
-// Tank
-String createTankPage() {
-  String page = R"=====(<!DOCTYPE html>
-<html>
-<head>
-<meta charset="UTF-8">
-<title>Tankstatus</title>
-<meta name="viewport" content="width=device-width,initial-scale=1.0">
-)=====";
-  page += createCSS();
-  page += R"=====(</head><body>)=====";
-  page += createHeader("Tankstatus");
-
-  page += "<h1>Aktueller Wasserstand</h1>";
-  page += "<p>Derzeitiger Inhalt: " + String(currentTankLevel,1) + " ml</p>";
-
-  // Leer-Datum berechnen
-  String emptyDate = calculateTankEmptyDate();
-  page += "<p>Voraussichtlich leer: ";
-  if(emptyDate.isEmpty()) {
-    page += "(keine aktiven Programme oder kein Verbrauch)";
-  } else {
-    page += emptyDate;
-  }
-  page += "</p>";
-
-  // Formular zum Setzen eines neuen Wasserstands
-  page += R"=====(<h2>Wasserstand aktualisieren</h2>
-<form onsubmit="return setTankLevel(event)">
-  <label>Neuer Wasserstand (ml):<br>
-    <input type="number" id="tankInput" placeholder="z.B. 1000" required>
-  </label><br><br>
-  <button type="submit">Setzen</button>
-</form>
-<script>
-async function setTankLevel(e){
-  e.preventDefault();
-  let val = document.getElementById('tankInput').value;
-  if(!val){alert("Bitte Wert eingeben.");return false;}
-  let resp = await fetch('/update_tank?level='+encodeURIComponent(val));
-  let txt  = await resp.text();
-  alert(txt);
-  location.reload();
-}
-</script>
-)=====";
+// Zählt nur die Bytes, statt sie zu senden
+struct BenchCountingPrint : public Print {
+  size_t count = 0;
+  size_t write(uint8_t) override { count++; return 1; }
+};
 
-  page += "</body></html>";
-  return page;
+// Künstliches Programm; alle Startzeiten liegen auf ungeraden Minuten, damit
+// die Minutenprüfung auf einer geraden Minute nie eine Pumpe startet
+Program benchProgram(int i) {
+  static const char* dayCombos[4] = {"Mo,Mi,Fr", "Di,Do", "Sa,So", "Mo,Di,Mi,Do,Fr"};
+  Program p;
+  char t[6];
+  snprintf(t, sizeof(t), "%02d:%02d", i%24, ((i*7)%30)*2+1);
+  p.days     = dayCombos[i%4];
+  p.interval = 1 + i%4;
+  p.time     = t;
+  for(int k=0; k<4; k++) p.amounts[k] = 10 + (i+k*13)%90;
+  p.mode     = (i%2) ? PROG_SEQUENTIAL : PROG_PARALLEL;
+  p.gapSec   = (i%2) ? 5 : 0;
+  p.active   = (i%3)!=0;
+  for(int k=0; k<4; k++) p.pumps[k] = ((i>>k)&1) || k==0;
+  p.lastRun  = 0;
+  p.id       = i+1;
+  p.version  = 1;
+  p.origin   = replNodeId;
+  p.anchor   = 0;
+  compileSchedule(p);
+  return p;
 }
 
-// Programme-Seite
-String createProgramsPage() {
-  String page = R"=====(<!DOCTYPE html>
-<html>
-<head>
-<meta charset="UTF-8">
-<title>Programme</title>
-<meta name="viewport" content="width=device-width,initial-scale=1.0">
-)=====" + createCSS() + R"=====(</head>
-<body>)====="
-  + createHeader("Programme verwalten")
-  + R"=====(<h1>Programme</h1>
-<p>Verwalten Sie hier Ihre Programme:</p>
-<div class="section">
-)=====";
+template<typename F>
+BenchResult benchRun(const char *name, int n, int reps, F fn) {
+  uint32_t times[9];
+  if(reps>9) reps = 9;
+  BenchResult r = {name, n, 0, 0, 0};
+  for(int k=0; k<reps; k++){
+    // Nicht auf 0 setzen: Freigaben älterer Blöcke zögen den Stand sonst ins
+    // Negative. Gemeldet wird die Spitze über dem Stand beim Start.
+    benchAllocs = 0;
+    int32_t base = benchLiveBytes;
+    benchPeakBytes = base;
+    benchCounting = true;
+    uint32_t t0 = micros();
+    fn();
+    times[k] = micros() - t0;
+    benchCounting = false;
+    r.allocs = benchAllocs;
+    r.peak   = benchPeakBytes - base;
+    esp_task_wdt_reset();
+  }
+  std::sort(times, times+reps);
+  r.us = times[reps/2];
+  return r;
+}
 
-  if(programs.empty()){
-    page += "<p>Es sind keine Programme verfügbar.</p>";
-  } else {
-    for(size_t i=0; i<programs.size(); i++){
-      Program &prog = programs[i];
-      page += "<div class='program-block'>";
-      page += "<strong>Programm "+String(i+1)+":</strong><br>";
-      page += "Wochentage: "+prog.days+"<br>";
-      page += "Intervall (Wochen): "+String(prog.interval)+"<br>";
-      page += "Uhrzeit: "+prog.time+"<br>";
-      page += "Menge: "+String(prog.amount)+" ml<br>";
-
-      // Mehrere Pumpen auflisten
-      String pumpList;
-      for(int k=0; k<4; k++){
-        if(prog.pumps[k]){
-          if(!pumpList.isEmpty()) pumpList+=", ";
-          pumpList += "Pumpe "+String(k+1);
-        }
-      }
-      if(pumpList.isEmpty()) pumpList="Keine Pumpe ausgewählt";
-      page += "Pumpen: "+pumpList+"<br>";
+#define BENCH_MAX_TRIGGERS 1000 // je Auslöser ~40 Bytes RAM
 
-      page += "Letzte Ausführung: "
-            + (prog.lastRun>0 ? unixTimeToDayString(prog.lastRun) : "Noch nie")
-            + "<br>";
+void benchSizes(int n, int reps, std::vector<BenchResult> &out) {
+  if((size_t)n>programs.capacity()){
+    BenchResult skip = {"skipped:capacity", n, 0, 0, 0};
+    out.push_back(skip);
+    return;
+  }
+  // Im RAM: Programmindex (6 Bytes je Eintrag, der Vektor wächst beim Füllen
+  // bis aufs Doppelte), bis BENCH_MAX_TRIGGERS die Auslöser samt Sicherung
+  // und Kanten, dazu Luft für die Antworten. Der Index braucht einen Block
+  // am Stück, daher zählt der größte freie Block, nicht der freie Heap.
+  size_t need = (size_t)n*2*8 + 16384;
+  if(n<=BENCH_MAX_TRIGGERS){
+    need += (size_t)n*(2*sizeof(SensorTrigger) + sizeof(TriggerRun) + 2*sizeof(TriggerEdge));
+  }
+  if(need>heap_caps_get_largest_free_block(MALLOC_CAP_8BIT)){
+    BenchResult skip = {"skipped:heap", n, 0, 0, 0};
+    out.push_back(skip);
+    return;
+  }
 
-      page += "<button class='activate-button' onclick='toggleProgram("+String(i)+")'>"
-            + String(prog.active?"Deaktivieren":"Aktivieren")+"</button>";
-      page += "<button class='delete-button' onclick='deleteProgram("+String(i)+")'>Löschen</button>";
-      page += "</div>";
+  out.push_back(benchRun("storeFill", n, 1, [&](){
+    programs.clear();
+    for(int i=0; i<n; i++){
+      programs.append(benchProgram(i));
+      if(i%256==0) esp_task_wdt_reset();
+    }
+  }));
+
+  volatile size_t sink = 0;
+  out.push_back(benchRun("apiPrograms", n, reps, [&](){
+    BenchCountingPrint counter;
+    writeApiProgramsJson(counter, "");
+    sink += counter.count;
+  }));
+  out.push_back(benchRun("apiTank", n, reps, [&](){ sink += apiTankJson("").length(); }));
+  out.push_back(benchRun("calculateTankEmptyDate", n, reps, [&](){ sink += calculateTankEmptyDate(0).length(); }));
+  out.push_back(benchRun("saveConfig", n, reps, [&](){ writeConfigFile("/bench.json"); }));
+  out.push_back(benchRun("loadConfig", n, reps, [&](){
+    ConfigStreamParser *parser = new ConfigStreamParser(CFG_LOAD);
+    parseConfigFile("/bench.json", *parser);
+    delete parser;
+  }));
+  out.push_back(benchRun("storeOpen", n, reps, [&](){ programs.begin(); }));
+
+  // Minutenprüfung auf einer geraden Minute (Mittwoch 12:00); die echten
+  // Rezepte sind dabei ausgelagert, damit keines wirklich startet
+  time_t checkTime = stringToUnixTime("2025-01-01 12:00:00");
+  std::vector<Recipe> keepRecipes;
+  keepRecipes.swap(recipes);
+  out.push_back(benchRun("checkPrograms", n, reps, [&](){ checkPrograms(checkTime); }));
+  recipes.swap(keepRecipes);
+
+  // 100 Sensortakte mit n Auslösern auf einem simulierten Sensor; der Wert
+  // wandert je Takt über wenige Schwellen. Die Tagesmenge von 1 ml hält
+  // jede Auslösung zurück, es läuft also keine Pumpe.
+  if(n<=BENCH_MAX_TRIGGERS){
+    std::vector<SensorInput> keepSensors = sensors;
+    std::vector<SensorTrigger> keepTriggers = triggers;
+    std::vector<TriggerRun> keepRun = triggerRun;
+    sensors.assign(1, SensorInput{"bench", SENSOR_SIM, -1, 0, 1.0f, 0.0f});
+    triggers.clear();
+    for(int i=0; i<n; i++){
+      SensorTrigger t = {};
+      t.id         = i+1;
+      t.below      = i%2==0;
+      t.threshold  = i;
+      t.hysteresis = 2;
+      t.dailyCapMl = 1;
+      t.programId  = programs.record(0).id;
+      t.active     = true;
+      triggers.push_back(t);
     }
+    triggerRebuild();
+    float v = n/2.0f;
+    uint32_t rng = 1;
+    triggerStep(0, v);
+    out.push_back(benchRun("triggerTick", n, reps, [&](){
+      for(int k=0; k<100; k++){
+        rng = rng*1664525UL + 1013904223UL;
+        v += ((int)((rng>>16)%5) - 2)*0.7f;
+        v = v<0 ? 0 : v>n ? n : v;
+        triggerStep(0, v);
+      }
+    }));
+    sensors  = keepSensors;
+    triggers = keepTriggers;
+    triggerRun = keepRun;
+    triggerRebuild();
   }
 
-  // Formular zum Neuanlegen
-  page += R"=====(<div class="add-program-form">
-  <h2>Neues Programm hinzufügen</h2>
-  <form onsubmit="return addProgram(event)">
-    <div>
-      <h3>Wochentage wählen:</h3>
-      <div id="dayButtons">
-        <span class="day-button" data-day="Mo">Mo</span>
-        <span class="day-button" data-day="Di">Di</span>
-        <span class="day-button" data-day="Mi">Mi</span>
-        <span class="day-button" data-day="Do">Do</span>
-        <span class="day-button" data-day="Fr">Fr</span>
-        <span class="day-button" data-day="Sa">Sa</span>
-        <span class="day-button" data-day="So">So</span>
-      </div>
-      <input type="hidden" id="days" name="days">
-    </div>
-    <div>
-      <label>Intervall (1-4 Wochen):<br>
-        <input type="number" id="interval" min="1" max="4" required>
-      </label><br>
-    </div>
-    <div>
-      <label>Uhrzeit (HH:MM):<br>
-        <input type="text" id="time" placeholder="HH:MM" required>
-      </label><br>
-    </div>
-    <div>
-      <label>Menge (ml):<br>
-        <input type="number" id="amount" required>
-      </label><br>
-    </div>
-    <div>
-      <h3>Pumpe(n) wählen:</h3>
-      <div id="pumpButtons">
-        <span class="pump-select-button" data-pump="0">Pumpe 1</span>
-        <span class="pump-select-button" data-pump="1">Pumpe 2</span>
-        <span class="pump-select-button" data-pump="2">Pumpe 3</span>
-        <span class="pump-select-button" data-pump="3">Pumpe 4</span>
-      </div>
-      <input type="hidden" id="pumps">
-    </div>
-    <button type="submit">Programm hinzufügen</button>
-  </form>
-</div>
+  SPIFFS.remove("/bench.json");
+  programs.clear();
+}
 
-<script>
-const dayBtns = document.querySelectorAll('.day-button');
-dayBtns.forEach(btn=>{
-  btn.addEventListener('click', ()=>{
-    btn.classList.toggle('active');
-  });
-});
-const pumpBtns = document.querySelectorAll('.pump-select-button');
-pumpBtns.forEach(btn=>{
-  btn.addEventListener('click', ()=>{
-    btn.classList.toggle('active');
-  });
-});
+// Vorhandene Programme für die Dauer des Benchmarks auslagern, eine Zeile
+// JSON je Programm; false, wenn der Platz im SPIFFS nicht reicht
+#define BENCH_KEEP_PATH "/bench_keep.txt"
 
-async function toggleProgram(idx){
-  let r = await fetch(`/toggle_program?index=${idx}`);
-  alert(await r.text());
-  location.reload();
-}
-async function deleteProgram(idx){
-  if(confirm("Wirklich löschen?")){
-    let r = await fetch(`/delete_program?index=${idx}`);
-    alert(await r.text());
-    location.reload();
+bool benchKeepPrograms() {
+  File f = SPIFFS.open(BENCH_KEEP_PATH, FILE_WRITE);
+  if(!f) return false;
+  BenchCountingPrint need;
+  {
+    BufferedPrint out(f);
+    programs.forEach([&](size_t, const Program &p){
+      writeProgramJson(out, p);
+      out.print('\n');
+      writeProgramJson(need, p);
+      need.print('\n');
+    });
   }
+  bool ok = f.size()==need.count;
+  f.close();
+  if(!ok) SPIFFS.remove(BENCH_KEEP_PATH);
+  return ok;
 }
 
-async function addProgram(e){
-  e.preventDefault();
-  // Wochentage
-  const selectedDays=[];
-  document.querySelectorAll('.day-button.active')
-    .forEach(b=>selectedDays.push(b.getAttribute('data-day')));
-  const daysStr = selectedDays.join(",");
-
-  // Pumpen
-  const selectedPumps=[];
-  document.querySelectorAll('.pump-select-button.active')
-    .forEach(b=>selectedPumps.push(b.getAttribute('data-pump')));
-  if(!selectedPumps.length){
-    alert("Bitte mindestens eine Pumpe auswählen!");
-    return false;
+// Ausgelagerte Programme zurückschreiben (IDs und Stempel bleiben erhalten)
+void benchRestorePrograms() {
+  File f = SPIFFS.open(BENCH_KEEP_PATH, FILE_READ);
+  if(!f) return;
+  programs.clear();
+  size_t n = 0;
+  while(f.available()){
+    String line = f.readStringUntil('\n');
+    JsonDocument doc;
+    if(deserializeJson(doc, line)) continue;
+    if(!programs.append(programFromJson(doc.as<JsonObject>()))) break;
+    if(++n%256==0) esp_task_wdt_reset();
   }
-  const pumpStr = selectedPumps.join(",");
-
-  const interval= document.getElementById('interval').value;
-  const time   = document.getElementById('time').value;
-  const amount = document.getElementById('amount').value;
-
-  const params = new URLSearchParams();
-  params.append('days',daysStr);
-  params.append('interval', interval);
-  params.append('time', time);
-  params.append('amount', amount);
-  params.append('pumps', pumpStr);
-
-  let r = await fetch('/add_program', {method:'POST', body:params});
-  let txt=await r.text();
-  alert(txt);
-  location.reload();
+  f.close();
+  SPIFFS.remove(BENCH_KEEP_PATH);
+  triggerRebuild();
+  LOG_I("Benchmark: %u Programme wiederhergestellt", (unsigned)programs.size());
 }
-</script>
-)=====";
 
-  page += "</div></body></html>";
-  return page;
+// Baseline-Datei: eine Zeile "name n us allocs" je Ergebnis
+bool benchBaseline(const BenchResult &r, uint32_t &us) {
+  File f = SPIFFS.open("/bench_baseline.txt", FILE_READ);
+  if(!f) return false;
+  bool found = false;
+  while(f.available() && !found){
+    String line = f.readStringUntil('\n');
+    char name[40];
+    int n;
+    unsigned long bus, ballocs;
+    if(sscanf(line.c_str(), "%39s %d %lu %lu", name, &n, &bus, &ballocs)==4
+       && r.name==name && r.n==n){
+      us = bus;
+      found = true;
+    }
+  }
+  f.close();
+  return found;
 }
 
-/* --------------------------------------------------------------------------
-   Nicht-blockierender Pumpenlauf
-   --------------------------------------------------------------------------*/
-time_t pumpRunEnd[4] = {0,0,0,0};
-
-// Pumpe i starten für durationSec Sekunden
-void startPumpTimed(int i, float durationSec){
-  if(i<0||i>3||durationSec<=0) return;
-
-  pumpStatus[i] = true;
-  int pin;
-  switch(i){
-    case 0: pin=pump1; break;
-    case 1: pin=pump2; break;
-    case 2: pin=pump3; break;
-    default: pin=pump4; break;
+void handleBench() {
+  // Ein abgebrochener Lauf (Neustart) hat seine Sicherung hinterlassen
+  if(SPIFFS.exists(BENCH_KEEP_PATH)) benchRestorePrograms();
+  bool keep = programs.size()>0;
+  if(keep && server.arg("wipe")!="1"){
+    server.send(409, "text/plain",
+      "Programmspeicher nicht leer (wipe=1 lagert die Programme für den Lauf aus)");
+    return;
   }
-  digitalWrite(pin, HIGH);
-
-  // LED an
-  digitalWrite(ledpin, HIGH);
-
-  time_t endTime = currentUnixTime + (time_t)round(durationSec);
-  if(endTime>pumpRunEnd[i]){
-    pumpRunEnd[i] = endTime;
+  if(keep && !benchKeepPrograms()){
+    server.send(507, "text/plain", "Kein Platz, um die Programme auszulagern");
+    return;
   }
-}
-
-// Pumpe i ausschalten
-void stopPump(int i){
-  if(i<0||i>3) return;
-  pumpStatus[i] = false;
-  pumpRunEnd[i] = 0;
-
-  int pin;
-  switch(i){
-    case 0: pin=pump1; break;
-    case 1: pin=pump2; break;
-    case 2: pin=pump3; break;
-    default: pin=pump4; break;
+  String sizes = server.hasArg("n") ? server.arg("n") : "100,1000,10000";
+  int reps = server.hasArg("reps") ? server.arg("reps").toInt() : 5;
+  float threshold = server.hasArg("threshold") ? server.arg("threshold").toFloat() : 10.0f;
+  if(reps<1) reps = 1;
+
+  std::vector<BenchResult> results;
+  int start = 0;
+  while(start<(int)sizes.length()){
+    int comma = sizes.indexOf(',', start);
+    if(comma<0) comma = sizes.length();
+    int n = sizes.substring(start, comma).toInt();
+    if(n>0) benchSizes(n, reps, results);
+    start = comma+1;
+  }
+  if(keep) benchRestorePrograms();
+
+  bool anyRegression = false;
+  String json = "{\"reps\":"+String(reps)+",\"threshold\":"+String(threshold,1)
+    +",\"freeHeap\":"+String(ESP.getFreeHeap())+",\"results\":[";
+  for(size_t i=0; i<results.size(); i++){
+    BenchResult &r = results[i];
+    if(i>0) json += ",";
+    json += "{\"name\":\""+r.name+"\",\"n\":"+String(r.n)
+      +",\"us\":"+String(r.us)+",\"allocs\":"+String(r.allocs)
+      +",\"peakBytes\":"+String(r.peak);
+    uint32_t base;
+    if(benchBaseline(r, base)){
+      bool regression = r.us > base*(1.0f+threshold/100.0f);
+      anyRegression |= regression;
+      json += ",\"baselineUs\":"+String(base)
+        +",\"regression\":"+String(regression?"true":"false");
+    }
+    json += "}";
   }
-  digitalWrite(pin, LOW);
+  json += "],\"regression\":"+String(anyRegression?"true":"false")+"}";
 
-  // LED aus, wenn keine Pumpe mehr an
-  bool anyOn=false;
-  for(int k=0;k<4;k++){
-    if(pumpStatus[k]) { anyOn=true; break; }
+  if(server.hasArg("save")){
+    File f = SPIFFS.open("/bench_baseline.txt", FILE_WRITE);
+    for(auto &r : results){
+      f.printf("%s %d %lu %lu\n", r.name.c_str(), r.n,
+               (unsigned long)r.us, (unsigned long)r.allocs);
+    }
+    f.close();
   }
-  if(!anyOn) digitalWrite(ledpin, LOW);
+  server.send(anyRegression ? 409 : 200, "application/json", json);
 }
 
-// Programm ausführen (alle angehakten Pumpen)
-void runProgram(Program &prog){
-  Serial.println("Starte Programm: "+prog.days
-    +", time="+prog.time
-    +", amount="+String(prog.amount));
-  for(int i=0; i<4; i++){
-    if(prog.pumps[i]){
-      if(pumpFlowRate[i]<=0){
-        Serial.println("WARNUNG: Pumpe "+String(i+1)+" Flow=0 => skip");
-        continue;
-      }
-      float sec = prog.amount / pumpFlowRate[i];
-      
-      // NEU: Tankstand verringern
-      currentTankLevel -= prog.amount;
-      if(currentTankLevel<0) currentTankLevel=0;
-      Serial.println(" -> Pumpe "+String(i+1)+" "+String(sec,1)+"s, Tank="+String(currentTankLevel,1)+" ml");
+// Künstlicher Stromverlauf für /api/currentsim: Anlauf mit dem 2,5-fachen
+// Dauerstrom, danach Rauschen; ab 1 s je nach Fehlerbild verändert
+float benchCurrentLevel(const String &trace, float ms, uint32_t &rng) {
+  const float steady = 1200;
+  rng = rng*1664525UL + 1013904223UL;
+  float noise = ((rng>>16)%81) - 40.0f;
+  if(trace=="dead") return (rng>>16)%6;
+  float v = ms<150 ? steady*(1 + 1.5f*(1 - ms/150)) : steady;
+  if(trace=="dry"   && ms>1500) v = steady*0.55f;
+  if(trace=="stall" && ms>1000) v = steady*2.0f;
+  if(trace=="noisy") noise *= 10;
+  v += noise;
+  return v<0 ? 0 : v>4095 ? 4095 : v;
+}
 
-      // Pumpe starten
-      startPumpTimed(i, sec);
+// Ein Lauf durch currentPush()/currentEvaluate() wie am Gerät; liefert den
+// Endzustand und trägt Zustandswechsel in json ein
+CurrentState benchCurrentRun(const String &trace, float durMs, CurrentSignature &s,
+                             CurrentBaseline &b, uint32_t &rng, String *json) {
+  const uint32_t samples = 64;
+  const float msPerSample = 0.2f; // 5 kHz je Kanal
+  CurrentState st = CUR_OFF;
+  float ms = 0;
+  while(ms<durMs){
+    float level = benchCurrentLevel(trace, ms, rng);
+    currentPush(s, b, true, (uint16_t)level, (uint16_t)fminf(level*1.1f, 4095),
+                samples, msPerSample);
+    ms += samples*msPerSample;
+    CurrentState next = currentEvaluate(s, b);
+    if(next!=st && json){
+      if(json->endsWith("}")) *json += ",";
+      *json += "{\"ms\":"+String(ms,0)+",\"state\":\""+CURRENT_STATE_NAMES[next]+"\"}";
     }
+    st = next;
+    if(st>=CUR_DRY) break; // abgeschaltet
   }
-  prog.lastRun = currentUnixTime;
-  saveConfig();
+  currentPush(s, b, false, 0, 0, 0, msPerSample);
+  return st;
 }
 
-/* --------------------------------------------------------------------------
-   Hilfsfunktionen
-   --------------------------------------------------------------------------*/
-// Check, ob dayShort in days (z.B. "Mo,Di,Fr") enthalten ist
-bool isDayInList(const String &days, const char* dayShort){
-  String withComma = days + ",";
-  String look = String(dayShort)+",";
-  return (withComma.indexOf(look)>=0);
+// trace=normal|dry|stall|dead|noisy: erst drei normale Läufe lernen, dann
+// den gewählten Verlauf prüfen
+void handleCurrentSim() {
+  String trace = server.hasArg("trace") ? server.arg("trace") : "normal";
+  CurrentSignature s = {};
+  CurrentBaseline b = {};
+  uint32_t rng = 1;
+  for(int k=0; k<CURRENT_LEARN_RUNS; k++){
+    CurrentState st = benchCurrentRun("normal", 3000, s, b, rng, nullptr);
+    currentLearn(s, b, st);
+  }
+  String states = "[";
+  CurrentState st = benchCurrentRun(trace, 5000, s, b, rng, &states);
+  String json = "{\"trace\":\""+trace+"\",\"states\":"+states+"]"
+    +",\"final\":\""+CURRENT_STATE_NAMES[st]+"\""
+    +",\"cutoff\":"+String(st>=CUR_DRY?"true":"false")
+    +",\"cutoffMs\":"+String(st>=CUR_DRY ? s.ms : 0, 0)
+    +",\"signature\":{\"mean\":"+String(s.mean,0)+",\"sd\":"+String(currentSd(s),1)
+    +",\"inrush\":"+String(s.inrush,0)+"}"
+    +",\"base\":{\"mean\":"+String(b.mean,0)+",\"sd\":"+String(b.sd,1)
+    +",\"inrush\":"+String(b.inrush,0)+",\"runs\":"+String(b.runs)+"}}";
+  server.send(200, "application/json", json);
 }
 
+// Bildet Antworten wie vor der Anfrage-Arena: der Text wächst in einem
+// String im Heap
+struct BenchStringPrint : public Print {
+  String s;
+  size_t write(uint8_t c) override { s += (char)c; return 1; }
+};
+
+static String benchHeapJson() {
+  uint32_t freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  uint32_t block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  return "{\"free\":"+String(freeBytes)+",\"maxAlloc\":"+String(block)
+    +",\"fragPct\":"+String(freeBytes ? 100.0f - 100.0f*block/freeBytes : 0.0f, 1)+"}";
+}
 
+// n simulierte Anfragen im Wechsel Pumpen, Kalibrierung (mit Meldung),
+// Uhrzeit und Fehler. Alle 64 Anfragen wird einer von 16 langlebigen
+// Blöcken mit wechselnder Größe neu angelegt, wie es Protokoll und
+// Konfiguration nebenher tun.
+String benchArenaRun(bool arena, uint32_t n) {
+  std::vector<String> keep(16);
+  String before = benchHeapJson();
+  volatile size_t sink = 0;
+  benchAllocs = 0;
+  benchCounting = true;
+  uint32_t t0 = micros();
+  for(uint32_t i=0; i<n; i++){
+    int p = i%4;
+    int kind = (i/4)%4;
+    if(arena){
+      size_t mark = requestArena.mark();
+      const char *msg = kind==1 ? requestArena.printf("Wartung von Pumpe %d vermerkt.", p+1) : nullptr;
+      ArenaPrint out(requestArena);
+      if(kind==0)      writeApiPumpsJson(out, msg);
+      else if(kind==1) writeApiCalibrationJson(out, msg);
+      else if(kind==2) writeApiTimeJson(out, msg);
+      else             out.print("{\"error\":\"Invalid index\"}");
+      sink += out.length() + out.data()[0];
+      requestArena.release(mark);
+    } else {
+      String msg = kind==1 ? "Wartung von Pumpe "+String(p+1)+" vermerkt." : String();
+      BenchStringPrint out;
+      if(kind==0)      writeApiPumpsJson(out, msg.c_str());
+      else if(kind==1) writeApiCalibrationJson(out, msg.c_str());
+      else if(kind==2) writeApiTimeJson(out, msg.c_str());
+      else             out.s = "{\"error\":\""+String("Invalid index")+"\"}";
+      sink += out.s.length();
+    }
+    if(i%64==0){
+      String &k = keep[(i/64)%16];
+      k = String();
+      k.reserve(32 + (i*7919u)%480);
+    }
+    if(i%1024==0) esp_task_wdt_reset();
+  }
+  uint32_t us = micros() - t0;
+  benchCounting = false;
+  return "{\"mode\":\""+String(arena ? "arena" : "string")+"\""
+    +",\"usPerReq\":"+String(n ? (float)us/n : 0.0f, 2)
+    +",\"allocsPerReq\":"+String(n ? (float)benchAllocs/n : 0.0f, 3)
+    +",\"before\":"+before+",\"after\":"+benchHeapJson()+"}";
+}
 
-// Wochentag, Stunde, Minute aus currentUnixTime
-void getTimeComponents(time_t t, int &wday, int &hour, int &minute){
-  struct tm *tmStruct = localtime(&t);
-  wday   = tmStruct->tm_wday; // 0=So,...6=Sa
-  hour   = tmStruct->tm_hour;
-  minute = tmStruct->tm_min;
+// /api/arenasim?n=1000000: beide Wege nacheinander mit gleichem Ablauf
+void handleArenaSim() {
+  uint32_t n = server.hasArg("n") ? strtoul(server.arg("n").c_str(), nullptr, 10) : 100000;
+  if(n<1) n = 1;
+  if(n>1000000) n = 1000000;
+  String json = "{\"n\":"+String(n)+",\"runs\":["+benchArenaRun(false, n)
+    +","+benchArenaRun(true, n)+"],\"arena\":"+requestArena.json()+"}";
+  server.send(200, "application/json", json);
 }
+#endif
 
 /* --------------------------------------------------------------------------
    setup()
    --------------------------------------------------------------------------*/
-time_t lastProgramCheck = 0;
-
-void setup() {
-  Serial.begin(115200);
-  delay(100);
-
-  pinMode(ledpin, OUTPUT);
-  pinMode(pump1,  OUTPUT);
-  pinMode(pump2,  OUTPUT);
-  pinMode(pump3,  OUTPUT);
-  pinMode(pump4,  OUTPUT);
 
-  // TZ
-  setenv("TZ","UTC0",1);
-  tzset();
-
-  // SPIFFS mounten
-  if(!SPIFFS.begin(true)){
-    Serial.println("SPIFFS konnte nicht gemountet werden!");
-  }
-  loadConfig();
+// Access Point, DNS, Replikation und Webserver; einmal aus loop(), sobald
+// der Zeitplan zum ersten Mal geprüft ist
+void netBegin() {
+  netStarted = true;
 
   // Alte AP-Daten ignorieren
   WiFi.persistent(false);
-  WiFi.mode(WIFI_AP);
-  WiFi.softAP(ssid, password);
+  WiFi.mode(replEnabled ? WIFI_AP_STA : WIFI_AP);
+  WiFi.softAP(ssid, password, 1, 0, AP_MAX_CLIENTS);
   WiFi.softAPConfig(local_ip, gateway, subnet);
-  Serial.println("Access Point SSID: " + String(WiFi.softAPSSID())
-    + " / IP: "+WiFi.softAPIP().toString());
+  LOG_I("Access Point SSID: %s / IP: %s",
+    WiFi.softAPSSID().c_str(), WiFi.softAPIP().toString().c_str());
 
   dnsServer.start(53, "*", local_ip);
+  bootMark("wifi");
 
-  // Routen
-  server.on("/", [](){
-    server.send(200, "text/html; charset=UTF-8", createHomePage());
-  });
-  server.on("/manual", [](){
-    server.send(200, "text/html; charset=UTF-8", createManualPage());
-  });
-  server.on("/calibration", [](){
-    server.send(200, "text/html; charset=UTF-8", createCalibrationPage());
-  });
-  server.on("/programs", [](){
-    server.send(200, "text/html; charset=UTF-8", createProgramsPage());
-  });
-  server.on("/tank", [](){
-  server.send(200,"text/html; charset=UTF-8", createTankPage());
-  });
-  server.on("/update_tank", [](){
-  if(!server.hasArg("level")){
-    server.send(400,"text/plain","Missing level");
-    return;
-  }
-  float newLevel = server.arg("level").toFloat();
-  if(newLevel<0) newLevel=0;
-  
-  currentTankLevel = newLevel;
-  saveConfig();
-  server.send(200,"text/plain","Wasserstand aktualisiert auf "+
-              String(currentTankLevel,1)+" ml");
-});
+  // Replikation (Peer-Netz als Station, UDP-Broadcast)
+  replBegin();
 
+  server.begin();
+  controlServer.begin();
+  resetStats();
+  bootMark("http");
+  LOG_I("HTTP Server gestartet.");
+}
 
-  // AJAX Endpoints
-  server.on("/get_pumps", [](){
-    String json="[";
-    for(int i=0;i<4;i++){
-      if(i>0) json+=",";
-      json+="{\"on\":"+String(pumpStatus[i]?"true":"false")+"}";
-    }
-    json+="]";
-    server.send(200,"application/json",json);
+void registerRoutes() {
+  // Routen: eine statische Seite für alle Ansichten, Daten über die JSON-API
+  static const char *appHeaders[] = {"If-None-Match"};
+  server.collectHeaders(appHeaders, 1);
+  onRoute("/", sendApp);
+  onRoute("/manual", sendApp);
+  onRoute("/calibration", sendApp);
+  onRoute("/programs", sendApp);
+  onRoute("/tank", sendApp);
+  onRoute("/recipes", sendApp);
+  onRoute("/sensors", sendApp);
+
+  onRoute("/api/pumps", [](){ handleApiPumps(server); });
+  onRoute("/api/calibration", [](){ handleApiCalibration(server); });
+  onRoute("/api/programs", handleApiPrograms);
+  onRoute("/api/tank", handleApiTank);
+  onRoute("/api/time", handleApiTime);
+  onRoute("/api/recipes", handleApiRecipes);
+  onRoute("/api/sensors", handleApiSensors);
+
+  // Sicherung und Wiederherstellung
+  onRoute("/api/config/export", HTTP_GET, handleConfigExport);
+  onRoute("/api/config/import", HTTP_POST, handleConfigImportDone,
+          handleConfigImportUpload);
+
+  // Replikation
+  onRoute("/api/repl", [](){
+    server.send(200,"application/json", replStatusJson());
   });
-
-  server.on("/toggle_pump", [](){
-    if(!server.hasArg("index")){
-      server.send(400,"text/plain","Missing index");
+  onRoute("/set_replication", [](){
+    if(!server.hasArg("enabled")){
+      server.send(400,"text/plain","Missing enabled");
       return;
     }
-    int idx=server.arg("index").toInt();
-    if(idx<0||idx>3){
-      server.send(400,"text/plain","Invalid index");
+    bool enabled = server.arg("enabled")=="1";
+    String ssid  = server.hasArg("ssid") ? server.arg("ssid") : replSsid;
+    String pass  = server.hasArg("password") ? server.arg("password") : replPassword;
+    uint16_t port = server.hasArg("port") ? server.arg("port").toInt() : replPort;
+    if(enabled && ssid.isEmpty()){
+      server.send(400,"text/plain","Missing ssid");
       return;
     }
-    togglePumpStatus(idx);
-
-    // Rückgabe
-    String json="[";
-    for(int i=0;i<4;i++){
-      if(i>0) json+=",";
-      json+="{\"on\":"+String(pumpStatus[i]?"true":"false")+"}";
-    }
-    json+="]";
-    server.send(200,"application/json",json);
+    updateReplicationSettings(enabled, ssid, pass, port);
+    server.send(200,"text/plain",
+      String("Replikation ")+(enabled?"aktiviert.":"deaktiviert."));
   });
 
-  // Kalibrierung
-  server.on("/start_calibration", [](){
-    if(!server.hasArg("pump")){
-      server.send(400,"text/plain","Missing pump");
-      return;
-    }
-    int p = server.arg("pump").toInt();
-    if(p<0||p>3){
-      server.send(400,"text/plain","Invalid pump");
-      return;
-    }
-    calibrationStartTime[p] = millis();
-    calibrationRunning[p] = true;
-
-    // Pumpe an
-    int pin;
-    switch(p){
-      case 0: pin=pump1; break;
-      case 1: pin=pump2; break;
-      case 2: pin=pump3; break;
-      default: pin=pump4; break;
-    }
-    digitalWrite(pin, HIGH);
-    pumpStatus[p] = true;
+  // Zeitplan-Vorschau
+  onRoute("/api/schedule", HTTP_GET, handleSchedule);
 
-    server.send(200,"text/plain","Kalibrierung für Pumpe "+String(p+1)+" gestartet.");
+  // Laufzeitstatistik
+  onRoute("/api/stats", [](){
+    if(server.hasArg("reset")) resetStats();
+    server.send(200,"application/json", statsJson());
   });
+  onRoute("/api/log", HTTP_GET, handleLog);
 
-  server.on("/stop_calibration", [](){
-    if(!server.hasArg("pump")){
-      server.send(400,"text/plain","Missing pump");
-      return;
-    }
-    int p=server.arg("pump").toInt();
-    if(p<0||p>3){
-      server.send(400,"text/plain","Invalid pump");
-      return;
-    }
-    if(!calibrationRunning[p]){
-      server.send(400,"text/plain","Kalibrierung wurde nicht gestartet.");
-      return;
-    }
-    unsigned long duration = millis() - calibrationStartTime[p];
-    calibrationRunning[p] = false;
-
-    // Pumpe aus
-    int pin;
-    switch(p){
-      case 0: pin=pump1; break;
-      case 1: pin=pump2; break;
-      case 2: pin=pump3; break;
-      default: pin=pump4; break;
-    }
-    digitalWrite(pin, LOW);
-    pumpStatus[p] = false;
+  // Eingabemitschnitt
+  onRoute("/api/trace", handleApiTrace);
+  onRoute("/api/trace/data", HTTP_GET, handleTraceData);
 
-    float durationSec = (float)duration/1000.0;
-    float rate = 100.0 / durationSec; // 100 ml / Dauer
-    updatePumpFlowRate(p, rate);
+#ifdef PUMPE_BENCH
+  onRoute("/api/bench", handleBench);
+  onRoute("/api/currentsim", HTTP_GET, handleCurrentSim);
+  onRoute("/api/arenasim", HTTP_GET, handleArenaSim);
+#endif
 
-    server.send(200,"text/plain",
-      "Kalibrierung für Pumpe "+String(p+1)+" gestoppt. Dauer: "
-      +String(durationSec,2)+" s. Rate: "+String(rate,2)+" ml/s.");
-  });
+  // Not-Found-Handler: Leitet unbekannte Anfragen auf die Startseite um
+  server.onNotFound(timedRoute("(nicht gefunden)", [](){
+    server.sendHeader("Location", "/", true);
+    server.send(302, "text/plain", "");
+  }, LANE_PAGE));
 
-  // Programme
-  server.on("/toggle_program", [](){
-    if(!server.hasArg("index")){
-      server.send(400,"text/plain","Missing index");
-      return;
-    }
-    int idx=server.arg("index").toInt();
-    if(idx<0||idx>=(int)programs.size()){
-      server.send(400,"text/plain","Invalid index");
-      return;
-    }
-    bool newState = !programs[idx].active;
-    updateProgramActiveState(idx,newState);
-    server.send(200,"text/plain","Programm "+String(idx+1)
-      +" ist jetzt "+(newState?"aktiv":"inaktiv")+".");
-  });
+  // Steuer-Port: nur Schalten und Kalibrieren, wird bevorzugt abgefragt
+  onControlRoute("/api/pumps", [](){ handleApiPumps(controlServer); });
+  onControlRoute("/api/calibration", [](){ handleApiCalibration(controlServer); });
+}
 
-  server.on("/delete_program", [](){
-    if(!server.hasArg("index")){
-      server.send(400,"text/plain","Missing index");
-      return;
-    }
-    int idx=server.arg("index").toInt();
-    if(idx<0||idx>=(int)programs.size()){
-      server.send(400,"text/plain","Invalid index");
-      return;
-    }
-    deleteProgram(idx);
-    server.send(200,"text/plain","Programm "+String(idx+1)+" wurde gelöscht.");
-  });
+// Reihenfolge siehe "Startablauf": erst Pumpen und Zeitplan, das Netz
+// danach aus loop()
+void setup() {
+  // Kein Warten auf die serielle Schnittstelle: das Protokoll puffert
+  Serial.begin(115200);
 
-  // add_program => Mehrere Pumpen
-  server.on("/add_program", HTTP_POST, [](){
-    if(!server.hasArg("days")||!server.hasArg("interval")||!server.hasArg("time")
-       ||!server.hasArg("amount")||!server.hasArg("pumps")){
-      server.send(400,"text/plain","Fehlende Parameter");
-      return;
-    }
-    Program prog;
-    prog.days     = server.arg("days");
-    prog.interval = server.arg("interval").toInt();
-    prog.time     = server.arg("time");
-    prog.amount   = server.arg("amount").toInt();
-    prog.active   = false;
-    prog.lastRun  = 0;
-
-    // pumps[] reset
-    for(int i=0;i<4;i++){
-      prog.pumps[i] = false;
-    }
-    // Beispiel: "0,2" => Pumpe1+3
-    String pStr = server.arg("pumps");
-    int start=0;
-    while(true){
-      int commaIndex = pStr.indexOf(',', start);
-      String val = (commaIndex==-1)
-                    ? pStr.substring(start)
-                    : pStr.substring(start, commaIndex);
-      val.trim();
-      if(val.length()>0){
-        int idx = val.toInt();
-        if(idx>=0 && idx<4){
-          prog.pumps[idx] = true;
-        }
-      }
-      if(commaIndex==-1) break;
-      start = commaIndex+1;
-    }
+  // Pumpen sofort in einen definierten Zustand (aus)
+  digitalWrite(pump1, LOW);
+  digitalWrite(pump2, LOW);
+  digitalWrite(pump3, LOW);
+  digitalWrite(pump4, LOW);
+  pinMode(ledpin, OUTPUT);
+  pinMode(pump1,  OUTPUT);
+  pinMode(pump2,  OUTPUT);
+  pinMode(pump3,  OUTPUT);
+  pinMode(pump4,  OUTPUT);
+  bootMark("pins");
 
-    addProgram(prog);
-    server.send(200,"text/plain","Programm hinzugefügt.");
-  });
+  // Zeitzone (Standard, bis loadConfig() die gespeicherte setzt)
+  tzSetRule(tzRule);
 
-  // Datum/Uhrzeit
-  server.on("/get_datetime", [](){
-    server.send(200,"text/plain", getCurrentDateTime());
-  });
-  server.on("/set_datetime", [](){
-    if(!server.hasArg("datetime")){
-      server.send(400,"text/plain","Missing datetime");
-      return;
-    }
-    setCurrentDateTime(server.arg("datetime"));
-    server.send(200,"text/plain","Datum und Uhrzeit wurden gesetzt.");
-  });
+  programs.begin(); // vor loadConfig(), das ältere Programme übernimmt
+  bootMark("programs");
 
-  // Not-Found-Handler: Leitet unbekannte Anfragen auf die Startseite um
-  server.onNotFound([](){
-    server.sendHeader("Location", "/", true);
-    server.send(302, "text/plain", "");
-  });
-  
-  server.begin();
-  Serial.println("HTTP Server gestartet.");
+  // SPIFFS mounten
+  if(!SPIFFS.begin(true)){
+    LOG_E("SPIFFS konnte nicht gemountet werden!");
+  }
+  bootMark("spiffs");
+  loadConfig();
+  bootHotRestore();
+  counterBegin();
+  traceBoot();
+  bootMark("config");
+  flowBegin();
+  calButtonBegin();
+  doseJournalRecover();
+  recipeRecover();
+  tankSensorBegin();
+  currentBegin();
+  sensorsBegin();
+  adcBegin();
+  bootMark("hardware");
+
+  // Routen anmelden; gestartet wird der Server erst in netBegin()
+  requestArena.begin(REQUEST_ARENA_SIZE);
+  registerRoutes();
 }
 
 /* --------------------------------------------------------------------------
    loop()
    --------------------------------------------------------------------------*/
+unsigned long lastLoopMicros = 0;
+
 void loop() {
-  dnsServer.processNextRequest();
-  server.handleClient();
+  unsigned long loopStart = micros();
+  if(lastLoopMicros!=0) loopGapHist.add(loopStart - lastLoopMicros);
+  lastLoopMicros = loopStart;
+
+  if(netStarted){
+    dnsServer.processNextRequest();
+    controlLanePoll();
+    server.handleClient();
+    replLoop();
+  }
+  saveConfigIfDirty();
+  logDrain();
 
   // Sekundentakt
   unsigned long nowMs = millis();
   if(nowMs - lastUpdateMillis >= 1000){
     lastUpdateMillis += 1000;
     currentUnixTime++;
+    bootHotSave();
   }
 
-  // Pumpen abschalten, deren Zeit vorbei ist
-  for(int i=0; i<4; i++){
-    if(pumpStatus[i] && pumpRunEnd[i]>0){
-      if(currentUnixTime >= pumpRunEnd[i]){
-        Serial.println("Pumpe "+String(i+1)+" Lauf abgelaufen => AUS");
-        stopPump(i);
-      }
-    }
+  // Pumpen abschalten, deren Menge oder Zeit erreicht ist
+  pumpRunPoll();
+  currentPoll();
+  counterPoll();
+  triggerPoll();
+  doseQueuePoll();
+  recipePoll();
+  calibrationPoll();
+
+  // Gemessenen Tankstand übernehmen
+  tankSensorLoop();
+  tracePoll();
+
+  if(restartAtMillis!=0 && (long)(millis()-restartAtMillis)>=0){
+    ESP.restart();
   }
 
-  // Programme minütlich checken
+  // Programme minütlich checken; Minuten, die ein Neustart oder eine lange
+  // Blockade gekostet hat, werden nachgeholt (höchstens PROGRAM_CATCHUP_MIN)
+  // Wurde die Uhr nur wenig zurückgestellt, warten, bis die schon geprüften
+  // Minuten wieder erreicht sind, statt sie ein zweites Mal zu prüfen
   time_t nowMin = currentUnixTime/60;
-  if(nowMin != lastProgramCheck){
+  bool stepBack = nowMin<lastProgramCheck && lastProgramCheck-nowMin<=PROGRAM_CATCHUP_MIN;
+  if(nowMin != lastProgramCheck && !stepBack){
+    time_t fromMin = nowMin;
+    if(nowMin>lastProgramCheck && nowMin-lastProgramCheck<=PROGRAM_CATCHUP_MIN){
+      fromMin = lastProgramCheck+1;
+    }
     lastProgramCheck = nowMin;
-
-    int wday,hour,minute;
-    getTimeComponents(currentUnixTime, wday, hour, minute);
-    const char* dayMap[7] = {"So","Mo","Di","Mi","Do","Fr","Sa"};
-    const char* currentDay = dayMap[wday];
-
-    char hmBuf[6];
-    snprintf(hmBuf,sizeof(hmBuf),"%02d:%02d",hour,minute);
-
-    // Serial.println("== Program check: " + String(currentDay)+" "+String(hmBuf));
-    for(auto &prog : programs){
-      if(!prog.active) continue;
-      if(!isDayInList(prog.days, currentDay)) continue;
-
-      time_t intervalSec = prog.interval * 7 * 24 * 3600;
-      if(prog.lastRun!=0 && currentUnixTime<(prog.lastRun+intervalSec)){
-        continue;
-      }
-      if(String(hmBuf)==prog.time){
-        runProgram(prog);
-      }
+    for(time_t m=fromMin; m<=nowMin; m++){
+      traceMinute(m);
+      checkPrograms(m*60);
     }
+    bootHotSave();
+  }
+
+  if(!netStarted){
+    bootMark("scheduler");
+    netBegin();
   }
 
   esp_task_wdt_reset();
@@ -0,0 +1,362 @@
+#!/usr/bin/env python3
+"""Lastgenerator für die Pumpensteuerung.
+
+Spielt eine aufgezeichnete oder synthetische Folge von HTTP-Anfragen mit
+einstellbarer Parallelität gegen das Gerät (oder jeden anderen Server mit
+denselben Routen) und gibt Durchsatz sowie p50/p99/p999 je Route aus.
+Vorher wird /api/stats zurückgesetzt und danach abgefragt, damit die
+Antwortzeiten auf dem Gerät und die Verspätung beim Abschalten der Pumpen
+mit ausgegeben werden.
+
+Synthetische Last besteht aus Benutzeraktionen, die je nach --api aus
+einer oder mehreren Anfragen bestehen: "legacy" bildet die alte Oberfläche
+nach (Aktion plus Neuladen der ganzen HTML-Seite), "v1" die JSON-API mit
+statischer, per ETag zwischengespeicherter Seite. Je Aktion werden die
+übertragenen Bytes und die Rechenzeit auf dem Gerät (Summe der mittleren
+Antwortzeiten aus /api/stats) ausgegeben, so dass sich alte und neue
+Firmware direkt vergleichen lassen.
+
+Mit --probe misst ein zusätzlicher Thread während der Last die Antwortzeit
+eines Steuerbefehls (Pumpe 1 aus) über den Web-Port ("web") oder den
+bevorzugten Steuer-Port ("control"), z.B. unter einer Flut von
+Seitenaufrufen:
+    loadgen.py --mix page=1 --concurrency 16 --probe control
+Vom Gerät wegen der Ratenbegrenzung abgelehnte Anfragen (429) werden je
+Route gezählt und gehen nicht in die Antwortzeiten ein.
+
+Trace-Format (eine JSON-Zeile pro Anfrage):
+    {"at_ms": 120, "method": "GET", "path": "/api/time"}
+    {"at_ms": 300, "method": "POST", "path": "/api/programs", "body": "days=Mo&..."}
+
+Achtung: die Aktionen "toggle", "add" und "tank" verändern den Zustand des
+Geräts. Nur an einer Testeinheit ohne angeschlossene Pumpen verwenden.
+"""
+import argparse
+import http.client
+import json
+import random
+import sys
+import threading
+import time
+from collections import defaultdict
+
+SYNTHETIC_MIX = {
+    "page": 40,     # Seitenaufrufe
+    "clock": 45,    # Uhrzeit-Abfrage aus dem Seitenkopf
+    "toggle": 5,    # Pumpe schalten
+    "add": 5,       # Programm anlegen
+    "tank": 5,      # Wasserstand setzen
+}
+
+PAGES = ["/", "/manual", "/calibration", "/programs", "/tank"]
+PAGE_API = {"/manual": "/api/pumps", "/calibration": "/api/calibration",
+            "/programs": "/api/programs", "/tank": "/api/tank"}
+
+
+def add_body(rnd, legacy):
+    body = "days=Mo&interval=1&time=%02d:%02d&pumps=0" % (
+        rnd.randrange(24), rnd.randrange(60))
+    return body + ("&amount=1" if legacy else "&amounts=1,0,0,0")
+
+
+def synthetic_action(api, kind, rnd):
+    """Anfragen einer Benutzeraktion als Liste (method, path, body)."""
+    page = rnd.choice(PAGES)
+    if api == "legacy":
+        if kind == "page":
+            return [("GET", page, None)]
+        if kind == "clock":
+            return [("GET", "/get_datetime", None)]
+        if kind == "toggle":
+            return [("GET", "/toggle_pump?index=%d" % rnd.randrange(4), None)]
+        if kind == "add":
+            return [("POST", "/add_program", add_body(rnd, True)),
+                    ("GET", "/programs", None)]
+        if kind == "tank":
+            return [("GET", "/update_tank?level=1000", None), ("GET", "/tank", None)]
+    else:
+        if kind == "page":
+            reqs = [("GET", page, None)]
+            if page in PAGE_API:
+                reqs.append(("GET", PAGE_API[page], None))
+            return reqs
+        if kind == "clock":
+            return [("GET", "/api/time", None)]
+        if kind == "toggle":
+            return [("POST", "/api/pumps", "index=%d&on=toggle" % rnd.randrange(4))]
+        if kind == "add":
+            return [("POST", "/api/programs", add_body(rnd, False))]
+        if kind == "tank":
+            return [("POST", "/api/tank", "level=1000")]
+    raise ValueError(kind)
+
+
+def load_trace(path):
+    reqs = []
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            r = json.loads(line)
+            reqs.append((r.get("at_ms", 0), r.get("method", "GET"),
+                         r["path"], r.get("body")))
+    reqs.sort(key=lambda r: r[0])
+    return reqs
+
+
+def route_of(path):
+    return path.split("?", 1)[0]
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    k = max(0, min(len(values) - 1, int(round(p * len(values) + 0.5)) - 1))
+    return values[k]
+
+
+def fetch_json(host, port, path, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request("GET", path)
+        return json.loads(conn.getresponse().read())
+    except (OSError, ValueError):
+        return None
+    finally:
+        conn.close()
+
+
+class Runner:
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.latency = defaultdict(list)
+        self.errors = defaultdict(int)
+        self.throttled = defaultdict(int)
+        self.probe = []
+        self.probe_errors = 0
+        self.bytes = defaultdict(int)
+        self.action_count = defaultdict(int)
+        self.action_bytes = defaultdict(int)
+        self.action_ms = defaultdict(float)
+        self.action_routes = defaultdict(lambda: defaultdict(int))
+        self.start = 0.0
+
+    def do_request(self, method, path, body, etags=None, port=None):
+        """Eine Anfrage; liefert (Bytes, ms). etags: Browser-Cache je Pfad."""
+        headers = {}
+        status = 0
+        if body is not None:
+            headers["Content-Type"] = "application/x-www-form-urlencoded"
+        if etags is not None and path in etags:
+            headers["If-None-Match"] = etags[path]
+        t0 = time.perf_counter()
+        try:
+            conn = http.client.HTTPConnection(self.args.host, port or self.args.port,
+                                              timeout=self.args.timeout)
+            conn.request(method, path, body=body, headers=headers)
+            resp = conn.getresponse()
+            data = resp.read()
+            status = resp.status
+            ok = resp.status < 500
+            if etags is not None and resp.getheader("ETag"):
+                etags[path] = resp.getheader("ETag")
+            conn.close()
+        except OSError:
+            ok, data = False, b""
+        dt = (time.perf_counter() - t0) * 1000.0
+        route = route_of(path)
+        with self.lock:
+            if status == 429:
+                self.throttled[route] += 1
+            elif ok:
+                self.latency[route].append(dt)
+                self.bytes[route] += len(data)
+            else:
+                self.errors[route] += 1
+        return len(data), dt, status
+
+    def worker_probe(self):
+        """Steuerbefehl in festem Takt; misst, wie lange er hinter der Last wartet."""
+        port = self.args.control_port if self.args.probe == "control" else self.args.port
+        deadline = self.start + self.args.duration
+        while time.perf_counter() < deadline:
+            _, dt, status = self.do_request("POST", "/api/pumps", "index=0&on=0", port=port)
+            with self.lock:
+                if status == 200:
+                    self.probe.append(dt)
+                else:
+                    self.probe_errors += 1
+            time.sleep(self.args.probe_interval)
+
+    def worker_trace(self, queue):
+        while True:
+            with self.lock:
+                if not queue:
+                    return
+                at_ms, method, path, body = queue.pop(0)
+            if self.args.paced:
+                delay = self.start + at_ms / 1000.0 - time.perf_counter()
+                if delay > 0:
+                    time.sleep(delay)
+            self.do_request(method, path, body)
+
+    def worker_synthetic(self, seed, mix):
+        rnd = random.Random(seed)
+        kinds = list(mix.keys())
+        weights = [mix[k] for k in kinds]
+        etags = {}  # wie ein Browser mit Cache
+        deadline = self.start + self.args.duration
+        while time.perf_counter() < deadline:
+            kind = rnd.choices(kinds, weights)[0]
+            size, ms = 0, 0.0
+            reqs = synthetic_action(self.args.api, kind, rnd)
+            for method, path, body in reqs:
+                b, dt, _ = self.do_request(method, path, body, etags)
+                size += b
+                ms += dt
+            with self.lock:
+                self.action_count[kind] += 1
+                self.action_bytes[kind] += size
+                self.action_ms[kind] += ms
+                for _, path, _ in reqs:
+                    self.action_routes[kind][route_of(path)] += 1
+
+    def run(self):
+        args = self.args
+        fetch_json(args.host, args.port, "/api/stats?reset=1", args.timeout)
+        self.start = time.perf_counter()
+        threads = []
+        if args.trace:
+            queue = load_trace(args.trace)
+            target = lambda: self.worker_trace(queue)
+            threads = [threading.Thread(target=target) for _ in range(args.concurrency)]
+        else:
+            mix = dict(SYNTHETIC_MIX)
+            if args.mix:
+                mix = {k: int(v) for k, v in (p.split("=") for p in args.mix.split(","))}
+            threads = [threading.Thread(target=self.worker_synthetic, args=(i, mix))
+                       for i in range(args.concurrency)]
+            if args.probe != "none":
+                threads.append(threading.Thread(target=self.worker_probe))
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.perf_counter() - self.start
+        device = fetch_json(args.host, args.port, "/api/stats", args.timeout)
+        return self.report(elapsed, device)
+
+    def report(self, elapsed, device):
+        routes = {}
+        for route in sorted(set(self.latency) | set(self.errors) | set(self.throttled)):
+            lat = self.latency[route]
+            routes[route] = {
+                "count": len(lat),
+                "errors": self.errors[route],
+                "throttled": self.throttled[route],
+                "rps": len(lat) / elapsed if elapsed else 0.0,
+                "bytes": self.bytes[route],
+                "p50_ms": percentile(lat, 0.50),
+                "p99_ms": percentile(lat, 0.99),
+                "p999_ms": percentile(lat, 0.999),
+            }
+        device_us = {}
+        if device:
+            device_us = {r["path"]: r["us"]["mean"] for r in device.get("routes", [])}
+        actions = {}
+        for kind, n in sorted(self.action_count.items()):
+            cpu = sum(cnt * device_us.get(route, 0)
+                      for route, cnt in self.action_routes[kind].items())
+            actions[kind] = {
+                "count": n,
+                "bytes_per_action": self.action_bytes[kind] / n,
+                "ms_per_action": self.action_ms[kind] / n,
+                "device_us_per_action": cpu / n,
+            }
+        total = sum(len(v) for v in self.latency.values())
+        return {
+            "elapsed_s": elapsed,
+            "concurrency": self.args.concurrency,
+            "total_rps": total / elapsed if elapsed else 0.0,
+            "routes": routes,
+            "actions": actions,
+            "probe": {
+                "port": self.args.probe,
+                "count": len(self.probe),
+                "errors": self.probe_errors,
+                "p50_ms": percentile(self.probe, 0.50),
+                "p99_ms": percentile(self.probe, 0.99),
+                "max_ms": max(self.probe) if self.probe else 0.0,
+            } if self.args.probe != "none" else None,
+            "device": device,
+        }
+
+
+def print_report(rep):
+    print("Dauer %.1f s, Parallelität %d, gesamt %.1f Anfragen/s"
+          % (rep["elapsed_s"], rep["concurrency"], rep["total_rps"]))
+    print("%-28s %7s %6s %6s %8s %9s %9s %9s" %
+          ("Route", "Anzahl", "Fehler", "429", "req/s", "p50 ms", "p99 ms", "p999 ms"))
+    for route, r in rep["routes"].items():
+        print("%-28s %7d %6d %6d %8.1f %9.1f %9.1f %9.1f" %
+              (route, r["count"], r["errors"], r["throttled"], r["rps"],
+               r["p50_ms"], r["p99_ms"], r["p999_ms"]))
+    p = rep["probe"]
+    if p:
+        print("Steuerbefehl über %s-Port: n=%d Fehler=%d p50=%.1f ms p99=%.1f ms max=%.1f ms"
+              % (p["port"], p["count"], p["errors"], p["p50_ms"], p["p99_ms"], p["max_ms"]))
+    if rep["actions"]:
+        print("%-28s %7s %12s %9s %12s" %
+              ("Aktion", "Anzahl", "Bytes/Akt.", "ms/Akt.", "Gerät µs"))
+        for kind, a in rep["actions"].items():
+            print("%-28s %7d %12.0f %9.1f %12.0f" %
+                  (kind, a["count"], a["bytes_per_action"], a["ms_per_action"],
+                   a["device_us_per_action"]))
+    dev = rep["device"]
+    if dev:
+        c = dev.get("pumpCutoffDelayMs", {})
+        print("Pumpenabschaltung verspätet (ms): n=%s p50=%s p99=%s max=%s"
+              % (c.get("count"), c.get("p50"), c.get("p99"), c.get("max")))
+        g = dev.get("loopGapUs", {})
+        print("loop()-Abstand (µs): p50=%s p99=%s max=%s"
+              % (g.get("p50"), g.get("p99"), g.get("max")))
+    else:
+        print("/api/stats nicht erreichbar")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default="192.168.1.1")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--concurrency", type=int, default=8)
+    ap.add_argument("--duration", type=float, default=30.0,
+                    help="Laufzeit in s für synthetische Last")
+    ap.add_argument("--mix", help="Gewichte, z.B. page=40,clock=45,toggle=5,add=5,tank=5")
+    ap.add_argument("--api", choices=["v1", "legacy"], default="v1",
+                    help="Form der Aktionen: JSON-API oder alte HTML-Oberfläche")
+    ap.add_argument("--trace", help="JSONL-Trace statt synthetischer Last")
+    ap.add_argument("--paced", action="store_true",
+                    help="Trace im aufgezeichneten Takt (at_ms) abspielen")
+    ap.add_argument("--probe", choices=["none", "web", "control"], default="none",
+                    help="Antwortzeit eines Steuerbefehls während der Last messen")
+    ap.add_argument("--control-port", type=int, default=8081)
+    ap.add_argument("--probe-interval", type=float, default=0.2,
+                    help="Pause zwischen zwei Steuerbefehlen in s")
+    ap.add_argument("--timeout", type=float, default=10.0)
+    ap.add_argument("--json", action="store_true", help="Ergebnis als JSON ausgeben")
+    args = ap.parse_args()
+
+    rep = Runner(args).run()
+    if args.json:
+        json.dump(rep, sys.stdout, indent=2)
+        print()
+    else:
+        print_report(rep)
+
+
+if __name__ == "__main__":
+    main()
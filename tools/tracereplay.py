@@ -0,0 +1,524 @@
+#!/usr/bin/env python3
+"""Eingabemitschnitt der Pumpensteuerung lesen, nachspielen und vergleichen.
+
+Das Gerät zeichnet nach POST /api/trace enabled=1 jede Eingabe von außen
+in einer Ringdatei auf (siehe "Eingabemitschnitt" in main.cpp): HTTP-
+Anfragen mit Argumenten, gesetzte Uhrzeit und Neustarts, dazu als
+Ergebnisse die Bearbeitungszeit je Anfrage, die Minutenprüfungen,
+gestartete oder gesperrte Programme und die Schaltflanken der Pumpen.
+
+    tracereplay.py fetch --host 192.168.1.1 -o feld.bin
+    tracereplay.py dump feld.bin                 # Einträge als JSON-Zeilen
+    tracereplay.py dump feld.bin --loadgen       # Trace für loadgen.py
+    tracereplay.py replay feld.bin --host 192.168.4.1 [--config feld.json]
+    tracereplay.py compare feld.bin labor.bin
+
+"replay" spielt einen Abschnitt (von einem Neustart bis zum nächsten,
+Standard: der letzte) an einer Testeinheit nach: Uhr auf die aufgezeichnete
+Zeit setzen, Mitschnitt dort neu starten, dann jede Anfrage und jedes
+Uhrzeit-Setzen in der aufgezeichneten Reihenfolge und im aufgezeichneten
+Abstand senden. Anschließend wird der Mitschnitt der Testeinheit geholt
+und mit dem Original verglichen:
+  - Bearbeitungszeit je Route (p50/p99); langsamer als --threshold Prozent
+    gilt als Regression
+  - Minutenprüfungen: ausgelassene Minuten und Verspätung
+  - Programmentscheidungen je Minute (gestartet/gesperrt)
+  - Schaltflanken je Pumpe in Reihenfolge, Zeitabweichung bis
+    --edge-tolerance ms
+Der Exit-Code ist 1, wenn sich etwas unterscheidet.
+
+Nicht aufgezeichnet werden Sensorwerte, Durchflussimpulse, Taster und
+Replikationspakete; die Testeinheit sollte daher ohne Sensoren laufen und
+mit der Konfiguration des Geräts starten (--config lädt einen Export von
+/api/config/export hoch). Mitschnitt-Anfragen (/api/trace...) werden auf
+beiden Seiten ignoriert. Geheime Argumente (password, key, ...) zeichnet
+das Gerät nicht auf; solche Anfragen werden ohne sie nachgespielt, die
+Testeinheit behält dann ihren eigenen Wert.
+
+Achtung: das Nachspielen schaltet Pumpen der Testeinheit. Nur an einer
+Testeinheit ohne angeschlossene Pumpen verwenden.
+"""
+import argparse
+import http.client
+import json
+import struct
+import sys
+import time
+import urllib.parse
+from collections import defaultdict
+
+BLOCK_SIZE = 256
+MAGIC = 0x31435254  # "TRC1"
+HEADER = struct.Struct("<IIIIHH")
+
+TR_BOOT, TR_CLOCK, TR_REQUEST, TR_DONE, TR_MINUTE, TR_PROGRAM, TR_PUMP = range(1, 8)
+TYPE_NAMES = {TR_BOOT: "boot", TR_CLOCK: "clock", TR_REQUEST: "request",
+              TR_DONE: "done", TR_MINUTE: "minute", TR_PROGRAM: "program",
+              TR_PUMP: "pump"}
+REQ_CONTROL = 0x01
+REQ_TRUNCATED = 0x02
+REQ_REDACTED = 0x04
+
+# HTTPMethod des ESP32-WebServers (Werte aus http_parser)
+METHODS = {0: "DELETE", 1: "GET", 2: "HEAD", 3: "POST", 4: "PUT", 6: "OPTIONS",
+           28: "PATCH"}
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def u8(self):
+        v = self.data[self.pos]
+        self.pos += 1
+        return v
+
+    def var(self):
+        v, shift = 0, 0
+        while True:
+            b = self.u8()
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                return v
+
+    def str(self):
+        n = self.u8()
+        s = self.data[self.pos:self.pos + n].decode("utf-8", "replace")
+        self.pos += n
+        return s
+
+
+def decode_record(kind, r):
+    if kind == TR_BOOT:
+        return {"reset": r.u8(), "hot": bool(r.u8()), "utc": r.var()}
+    if kind == TR_CLOCK:
+        return {"from": r.var(), "to": r.var()}
+    if kind == TR_REQUEST:
+        flags = r.u8()
+        method = r.u8()
+        path = r.str()
+        args = [(r.str(), r.str()) for _ in range(r.u8())]
+        return {"control": bool(flags & REQ_CONTROL),
+                "truncated": bool(flags & REQ_TRUNCATED),
+                "redacted": bool(flags & REQ_REDACTED),
+                "method": METHODS.get(method, str(method)), "path": path, "args": args}
+    if kind == TR_DONE:
+        return {"us": r.var()}
+    if kind == TR_MINUTE:
+        return {"minute": r.var(), "late_s": r.u8()}
+    if kind == TR_PROGRAM:
+        return {"id": r.var(), "started": bool(r.u8())}
+    if kind == TR_PUMP:
+        v = r.u8()
+        return {"pump": v & 0x7F, "on": bool(v & 0x80)}
+    raise ValueError("unbekannter Eintrag %d" % kind)
+
+
+def parse_trace(data):
+    """Blöcke nach Folgenummer ordnen; liefert Einträge mit ms und utc."""
+    blocks = []
+    for off in range(0, len(data) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        magic, seq, ms, utc, used, _ = HEADER.unpack_from(data, off)
+        if magic == MAGIC and used <= BLOCK_SIZE - HEADER.size:
+            body = data[off + HEADER.size:off + HEADER.size + used]
+            blocks.append((seq, ms, utc, body))
+    blocks.sort(key=lambda b: b[0])
+    events = []
+    for seq, ms, utc, body in blocks:
+        r = Reader(body)
+        t = ms
+        while r.pos < len(body):
+            kind = r.u8()
+            t = (t + r.var()) & 0xFFFFFFFF
+            try:
+                ev = decode_record(kind, r)
+            except (IndexError, ValueError):
+                break  # Blockende abgerissen
+            ev["type"] = TYPE_NAMES[kind]
+            ev["seq"] = seq
+            ev["ms"] = t
+            # Unixzeit aus dem Blockkopf; ein Uhrzeit-Setzen im Block gilt ab dort
+            ev["utc"] = utc + ((t - ms) & 0xFFFFFFFF) // 1000
+            events.append(ev)
+    return events
+
+
+def segments(events):
+    """Abschnitte zwischen zwei Neustarts (millis() beginnt dort neu)."""
+    segs, cur = [], []
+    for ev in events:
+        if ev["type"] == "boot" and cur:
+            segs.append(cur)
+            cur = []
+        cur.append(ev)
+    if cur:
+        segs.append(cur)
+    return segs
+
+
+def is_trace_route(path):
+    return path.startswith("/api/trace")
+
+
+def annotate(seg):
+    """Ordnet Ergebnisse ihrer Ursache zu und wirft Mitschnitt-Anfragen weg.
+
+    Anfragen bekommen ihre Bearbeitungszeit ("us"); Uhrzeit-Setzen und
+    Programmentscheidungen innerhalb einer Anfrage zählen zu ihr,
+    Programme sonst zur letzten Minutenprüfung. Steueranfragen, die das
+    Gerät aus einer laufenden Antwort heraus bearbeitet, liegen verschachtelt.
+    """
+    out = []
+    stack = []
+    minute = None
+    for ev in seg:
+        kind = ev["type"]
+        if kind == "request":
+            stack.append(dict(ev))
+            if not is_trace_route(ev["path"]):
+                out.append(stack[-1])
+            continue
+        if kind == "done":
+            if stack:
+                stack.pop()["us"] = ev["us"]
+            continue
+        ev = dict(ev)
+        open_req = stack[-1] if stack else None
+        if open_req is not None:
+            if is_trace_route(open_req["path"]):
+                continue
+            ev["cause"] = "request"
+        if kind == "minute":
+            minute = ev["minute"]
+        if kind == "program" and open_req is None:
+            ev["cause"] = "minute:%s" % minute
+        out.append(ev)
+    return out
+
+
+def is_input(ev):
+    return ev["type"] == "request" or (ev["type"] == "clock" and ev.get("cause") != "request")
+
+
+def fetch_trace(host, port, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request("GET", "/api/trace/data")
+        resp = conn.getresponse()
+        data = resp.read()
+        if resp.status != 200:
+            raise RuntimeError("/api/trace/data: HTTP %d" % resp.status)
+        return data
+    finally:
+        conn.close()
+
+
+def post_form(host, port, path, fields, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request("POST", path, body=urllib.parse.urlencode(fields),
+                     headers={"Content-Type": "application/x-www-form-urlencoded"})
+        resp = conn.getresponse()
+        return resp.status, resp.read()
+    finally:
+        conn.close()
+
+
+def upload_config(host, port, path, timeout):
+    boundary = "----tracereplay"
+    with open(path, "rb") as f:
+        content = f.read()
+    body = (("--%s\r\nContent-Disposition: form-data; name=\"config\"; "
+             "filename=\"config.json\"\r\nContent-Type: application/json\r\n\r\n")
+            % boundary).encode() + content + ("\r\n--%s--\r\n" % boundary).encode()
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request("POST", "/api/config/import", body=body,
+                     headers={"Content-Type": "multipart/form-data; boundary=" + boundary})
+        resp = conn.getresponse()
+        resp.read()
+        if resp.status != 200:
+            raise RuntimeError("Konfiguration nicht übernommen: HTTP %d" % resp.status)
+    finally:
+        conn.close()
+
+
+def send_request(args, ev):
+    """Aufgezeichnete Anfrage wie der ursprüngliche Client senden."""
+    port = args.control_port if ev["control"] else args.port
+    fields = ev["args"]
+    headers = {}
+    body = None
+    path = ev["path"]
+    if ev["method"] in ("POST", "PUT", "PATCH", "DELETE"):
+        if len(fields) == 1 and fields[0][0] == "plain":
+            body = fields[0][1]
+            headers["Content-Type"] = "text/plain"
+        elif fields:
+            body = urllib.parse.urlencode(fields)
+            headers["Content-Type"] = "application/x-www-form-urlencoded"
+    elif fields:
+        path += "?" + urllib.parse.urlencode(fields)
+    conn = http.client.HTTPConnection(args.host, port, timeout=args.timeout)
+    try:
+        conn.request(ev["method"], path, body=body, headers=headers)
+        resp = conn.getresponse()
+        resp.read()
+        return resp.status
+    except OSError:
+        return 0
+    finally:
+        conn.close()
+
+
+def replay(args, seg):
+    """Eingaben des Abschnitts im aufgezeichneten Takt an die Testeinheit."""
+    inputs = [ev for ev in annotate(seg) if is_input(ev)]
+    if not inputs:
+        raise RuntimeError("Abschnitt enthält keine Eingaben")
+    first = inputs[0]
+    if args.config:
+        upload_config(args.host, args.port, args.config, args.timeout)
+    post_form(args.host, args.port, "/api/trace", {"clear": 1}, args.timeout)
+    post_form(args.host, args.port, "/api/time", {"unix": first["utc"]}, args.timeout)
+    status, _ = post_form(args.host, args.port, "/api/trace", {"enabled": 1}, args.timeout)
+    if status != 200:
+        raise RuntimeError("Mitschnitt auf der Testeinheit nicht gestartet: HTTP %d" % status)
+
+    start = time.perf_counter()
+    failed = truncated = redacted = 0
+    for ev in inputs:
+        delay = start + ((ev["ms"] - first["ms"]) & 0xFFFFFFFF) / 1000.0 - time.perf_counter()
+        if delay > 0:
+            time.sleep(delay)
+        if ev["type"] == "clock":
+            post_form(args.host, args.port, "/api/time", {"unix": ev["to"]}, args.timeout)
+            continue
+        truncated += ev["truncated"]
+        redacted += ev["redacted"]
+        status = send_request(args, ev)
+        if status == 0 or status >= 500:
+            failed += 1
+    # Ergebnisse nach der letzten Eingabe (laufende Pumpen, nächste Minute)
+    time.sleep(args.settle)
+    post_form(args.host, args.port, "/api/trace", {"enabled": 0}, args.timeout)
+    data = fetch_trace(args.host, args.port, args.timeout)
+    segs = segments(parse_trace(data))
+    if not segs:
+        raise RuntimeError("Testeinheit lieferte keinen Mitschnitt")
+    if len(segs) > 1:
+        print("Achtung: Testeinheit ist während des Nachspielens neu gestartet",
+              file=sys.stderr)
+    return segs[-1], {"inputs": len(inputs), "failed": failed, "truncated": truncated,
+                      "redacted": redacted}
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    k = max(0, min(len(values) - 1, int(round(p * len(values) + 0.5)) - 1))
+    return values[k]
+
+
+def timeline(seg):
+    """Ergebnisse eines Abschnitts ab der ersten Eingabe."""
+    ev = annotate(seg)
+    inputs = [e for e in ev if is_input(e)]
+    t0 = inputs[0]["ms"] if inputs else (ev[0]["ms"] if ev else 0)
+    ev = [e for e in ev if ((e["ms"] - t0) & 0x80000000) == 0]
+    latency = defaultdict(list)
+    minutes = []
+    programs = defaultdict(int)
+    edges = defaultdict(list)
+    for e in ev:
+        kind = e["type"]
+        if kind == "request" and "us" in e:
+            latency[e["path"]].append(e["us"])
+        elif kind == "minute":
+            minutes.append((e["minute"], e["late_s"]))
+        elif kind == "program":
+            programs[(e["cause"], e["id"], e["started"])] += 1
+        elif kind == "pump":
+            edges[e["pump"]].append((e["on"], (e["ms"] - t0) & 0xFFFFFFFF))
+    return {"latency": latency, "minutes": minutes, "programs": programs, "edges": edges}
+
+
+def missed_minutes(minutes):
+    seen = sorted(set(m for m, _ in minutes))
+    missed = []
+    for a, b in zip(seen, seen[1:]):
+        missed.extend(range(a + 1, b))
+    return missed
+
+
+def compare(orig_seg, new_seg, threshold, edge_tolerance):
+    a, b = timeline(orig_seg), timeline(new_seg)
+    rep = {"routes": {}, "regressions": [], "differences": []}
+
+    for path in sorted(set(a["latency"]) | set(b["latency"])):
+        la, lb = a["latency"][path], b["latency"][path]
+        r = {"count": len(la), "replayCount": len(lb),
+             "p50_us": percentile(la, 0.5), "p99_us": percentile(la, 0.99),
+             "replay_p50_us": percentile(lb, 0.5), "replay_p99_us": percentile(lb, 0.99)}
+        rep["routes"][path] = r
+        if len(la) != len(lb):
+            rep["differences"].append("%s: %d statt %d Anfragen" % (path, len(lb), len(la)))
+        if la and lb and r["replay_p99_us"] > r["p99_us"] * (1 + threshold / 100.0):
+            rep["regressions"].append("%s: p99 %d µs statt %d µs"
+                                      % (path, r["replay_p99_us"], r["p99_us"]))
+
+    rep["minutes"] = {
+        "checked": len(a["minutes"]), "replayChecked": len(b["minutes"]),
+        "missed": missed_minutes(a["minutes"]), "replayMissed": missed_minutes(b["minutes"]),
+        "maxLate_s": max((l for _, l in a["minutes"]), default=0),
+        "replayMaxLate_s": max((l for _, l in b["minutes"]), default=0),
+    }
+    if rep["minutes"]["replayMissed"]:
+        rep["differences"].append("Minutenprüfung ausgelassen: %s"
+                                  % rep["minutes"]["replayMissed"])
+
+    for key in sorted(set(a["programs"]) | set(b["programs"]), key=str):
+        na, nb = a["programs"][key], b["programs"][key]
+        if na != nb:
+            cause, pid, started = key
+            rep["differences"].append("Programm %d %s (%s): %d statt %d"
+                                      % (pid, "gestartet" if started else "gesperrt",
+                                         cause, nb, na))
+
+    rep["pumps"] = {}
+    for pump in sorted(set(a["edges"]) | set(b["edges"])):
+        ea, eb = a["edges"][pump], b["edges"][pump]
+        dev = [abs(tb - ta) for (oa, ta), (ob, tb) in zip(ea, eb) if oa == ob]
+        same = len(ea) == len(eb) and all(oa == ob for (oa, _), (ob, _) in zip(ea, eb))
+        rep["pumps"][pump + 1] = {"edges": len(ea), "replayEdges": len(eb),
+                                  "maxDeviationMs": max(dev, default=0)}
+        if not same:
+            rep["differences"].append("Pumpe %d: %d statt %d Flanken"
+                                      % (pump + 1, len(eb), len(ea)))
+        elif dev and max(dev) > edge_tolerance:
+            rep["differences"].append("Pumpe %d: Flanke %d ms verschoben"
+                                      % (pump + 1, max(dev)))
+    return rep
+
+
+def print_compare(rep):
+    print("%-28s %7s %7s %10s %10s %10s %10s" %
+          ("Route", "Anzahl", "neu", "p50 µs", "neu", "p99 µs", "neu"))
+    for path, r in rep["routes"].items():
+        print("%-28s %7d %7d %10d %10d %10d %10d" %
+              (path, r["count"], r["replayCount"], r["p50_us"], r["replay_p50_us"],
+               r["p99_us"], r["replay_p99_us"]))
+    m = rep["minutes"]
+    print("Minutenprüfungen: %d / neu %d, ausgelassen %d / neu %d, max. Verspätung %d s / neu %d s"
+          % (m["checked"], m["replayChecked"], len(m["missed"]), len(m["replayMissed"]),
+             m["maxLate_s"], m["replayMaxLate_s"]))
+    for pump, p in rep["pumps"].items():
+        print("Pumpe %d: %d / neu %d Flanken, max. Abweichung %d ms"
+              % (pump, p["edges"], p["replayEdges"], p["maxDeviationMs"]))
+    for line in rep["regressions"]:
+        print("REGRESSION " + line)
+    for line in rep["differences"]:
+        print("ABWEICHUNG " + line)
+    if not rep["regressions"] and not rep["differences"]:
+        print("Keine Abweichungen.")
+
+
+def pick_segment(events, index):
+    segs = segments(events)
+    if not segs:
+        raise RuntimeError("Mitschnitt ist leer")
+    return segs[index]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default="192.168.1.1")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--control-port", type=int, default=8081)
+    ap.add_argument("--timeout", type=float, default=10.0)
+    ap.add_argument("--json", action="store_true", help="Ergebnis als JSON ausgeben")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("fetch", help="Mitschnitt vom Gerät holen")
+    p.add_argument("-o", "--output", required=True)
+
+    p = sub.add_parser("dump", help="Einträge als JSON-Zeilen ausgeben")
+    p.add_argument("trace")
+    p.add_argument("--loadgen", action="store_true",
+                   help="nur Anfragen, im Trace-Format von loadgen.py")
+
+    for name in ("replay", "compare"):
+        p = sub.add_parser(name)
+        p.add_argument("trace")
+        if name == "compare":
+            p.add_argument("other", help="Mitschnitt der Testeinheit")
+        else:
+            p.add_argument("--config", help="Konfiguration vorher hochladen")
+            p.add_argument("--settle", type=float, default=65.0,
+                           help="Wartezeit nach der letzten Eingabe in s")
+        p.add_argument("--segment", type=int, default=-1,
+                       help="Abschnitt (Neustart bis Neustart), Standard der letzte")
+        p.add_argument("--threshold", type=float, default=20.0,
+                       help="erlaubte Verlangsamung der p99 in Prozent")
+        p.add_argument("--edge-tolerance", type=int, default=500,
+                       help="erlaubte Verschiebung einer Pumpenflanke in ms")
+    args = ap.parse_args()
+
+    if args.cmd == "fetch":
+        data = fetch_trace(args.host, args.port, args.timeout)
+        with open(args.output, "wb") as f:
+            f.write(data)
+        print("%d Einträge" % len(parse_trace(data)))
+        return
+
+    with open(args.trace, "rb") as f:
+        events = parse_trace(f.read())
+
+    if args.cmd == "dump":
+        t0 = None
+        for ev in events:
+            if not args.loadgen:
+                print(json.dumps(ev, ensure_ascii=False))
+                continue
+            if ev["type"] == "boot":
+                t0 = None  # millis() beginnt neu
+            if ev["type"] != "request" or is_trace_route(ev["path"]):
+                continue
+            t0 = ev["ms"] if t0 is None else t0
+            line = {"at_ms": (ev["ms"] - t0) & 0xFFFFFFFF, "method": ev["method"],
+                    "path": ev["path"]}
+            if ev["args"]:
+                query = urllib.parse.urlencode(ev["args"])
+                if ev["method"] == "GET":
+                    line["path"] += "?" + query
+                else:
+                    line["body"] = query
+            print(json.dumps(line, ensure_ascii=False))
+        return
+
+    seg = pick_segment(events, args.segment)
+    if args.cmd == "replay":
+        other, info = replay(args, seg)
+    else:
+        with open(args.other, "rb") as f:
+            other = pick_segment(parse_trace(f.read()), -1)
+        info = None
+    rep = compare(seg, other, args.threshold, args.edge_tolerance)
+    rep["replay"] = info
+    if args.json:
+        json.dump(rep, sys.stdout, indent=2, ensure_ascii=False, default=str)
+        print()
+    else:
+        if info:
+            print("%d Eingaben nachgespielt, %d fehlgeschlagen, %d gekürzt, %d ohne Geheimnisse"
+                  % (info["inputs"], info["failed"], info["truncated"], info["redacted"]))
+        print_compare(rep)
+    sys.exit(1 if rep["regressions"] or rep["differences"] else 0)
+
+
+if __name__ == "__main__":
+    main()